@@ -0,0 +1,454 @@
+/*
+ *  Module "chatthrottle"   -- Throttle outgoing chat state notifications
+ *
+ *  While you type in a chat window, mcabber sends a "composing"
+ *  notification, then "paused" when you stop typing for a few seconds,
+ *  then "composing" again, and so on: in a long conversation, most of
+ *  the stanzas sent are chat state notifications.
+ *
+ *  After a composing/paused cycle has been sent to a contact, this
+ *  module suppresses the following notifications to this contact for
+ *  chatthrottle_interval seconds: the contact sees "paused" until the
+ *  message arrives (which still carries the "active" state), or until
+ *  the end of the interval.  The module does this through the chat
+ *  state support flag of the resource, which it sets back when the
+ *  interval is over.  mcabber does not tell when it drops a notification;
+ *  a message sent during an interval means that at least its "composing"
+ *  notification was suppressed, so /chatthrottle reports a lower bound of
+ *  the stanzas saved.
+ *
+ *  Notifications are only sent to resources known to support chat
+ *  states.  When a resource has not sent any chat state for
+ *  chatthrottle_stale seconds, its support is considered unknown again:
+ *  mcabber stops sending notifications to it, and probes it again with
+ *  the next message.
+ *
+ *  Options:
+ *  - chatthrottle_interval: integer (default: 30)
+ *    Seconds without notification after a composing/paused cycle; 0
+ *    disables the throttling.
+ *  - chatthrottle_stale: integer (default: 3600)
+ *    Seconds after which the chat state support of a silent resource is
+ *    reset; 0 disables the reset.
+ *
+ *  /chatthrottle       Display the statistics
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+#include <mcabber/logprint.h>
+#include <mcabber/roster.h>
+#include <mcabber/settings.h>
+#include <mcabber/utils.h>
+#include <mcabber/xmpp.h>
+#include <mcabber/xmpp_defines.h>
+
+#include "common/inittime.h"
+#include "common/lmhandler.h"
+#include "common/optcache.h"
+#include "common/requires.h"
+#include "hookstats/hookstats.h"
+
+static void chatthrottle_init(void);
+static void chatthrottle_uninit(void);
+
+MODULE_TIMED_INIT(chatthrottle_init)
+
+/* Module description */
+module_info_t info_chatthrottle = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Throttle outgoing chat state notifications\n"
+                          " Provides the command /chatthrottle",
+        .requires       = MODULE_REQUIRES,
+        .init           = chatthrottle_init_timed,
+        .uninit         = chatthrottle_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer chatthrottle_cmdid;
+#endif
+
+#define DEFAULT_INTERVAL    30
+#define DEFAULT_STALE       3600
+
+#if defined XEP0022 || defined XEP0085
+
+// Per resource ("bare jid/resource", lowercased)
+typedef struct {
+  gchar   *bjid;
+  gchar   *res;
+  guint    last_sent;           // Last state seen sent
+  time_t   rcvd;                // Last chat state received
+  time_t   until;               // End of the throttling interval
+  gboolean closed85, closed22;  // Support flags changed by the module
+} entry_t;
+
+static GHashTable *entries;
+static guint srcno, reclose_srcno;
+static guint pre_disconnect_hid, post_connect_hid;
+static lmhandler_t message_handler =
+  LMHANDLER(LM_MESSAGE_TYPE_MESSAGE, LM_HANDLER_PRIORITY_FIRST);
+static optcache_t opt_interval = OPTCACHE_INT("chatthrottle_interval",
+                                              DEFAULT_INTERVAL);
+static optcache_t opt_stale = OPTCACHE_INT("chatthrottle_stale", DEFAULT_STALE);
+
+static struct {
+  guint64 notifications;        // Composing/paused notifications seen
+  guint64 cycles;
+  guint64 intervals;
+  guint64 stale;
+  guint64 saved;                // Messages sent during the intervals
+} stats;
+
+static void entry_free(entry_t *e)
+{
+  g_free(e->bjid);
+  g_free(e->res);
+  g_free(e);
+}
+
+static entry_t *entry_get(const gchar *bjid, const gchar *res)
+{
+  gchar *key = g_strdup_printf("%s/%s", bjid, res ? res : "");
+  gchar *lkey = g_utf8_strdown(key, -1);
+  entry_t *e = g_hash_table_lookup(entries, lkey);
+
+  g_free(key);
+  if (e) {
+    g_free(lkey);
+    return e;
+  }
+  e = g_new0(entry_t, 1);
+  e->bjid = g_strdup(bjid);
+  e->res  = g_strdup(res);
+  e->rcvd = time(NULL);         // Not stale before we have seen it
+  g_hash_table_insert(entries, lkey, e);
+  return e;
+}
+
+static gpointer entry_buddy(entry_t *e)
+{
+  GSList *sl = roster_find(e->bjid, jidsearch, ROSTER_TYPE_USER);
+  return sl ? sl->data : NULL;
+}
+
+// Let mcabber send the notifications again
+static void entry_open(entry_t *e)
+{
+  gpointer buddy = entry_buddy(e);
+
+  if (buddy) {
+#ifdef XEP0085
+    struct xep0085 *xep85 = buddy_resource_xep85(buddy, e->res);
+    if (e->closed85 && xep85 &&
+        xep85->support == CHATSTATES_SUPPORT_PROBED)
+      xep85->support = CHATSTATES_SUPPORT_OK;
+#endif
+#ifdef XEP0022
+    struct xep0022 *xep22 = buddy_resource_xep22(buddy, e->res);
+    if (e->closed22 && xep22 &&
+        xep22->support == CHATSTATES_SUPPORT_PROBED)
+      xep22->support = CHATSTATES_SUPPORT_OK;
+#endif
+  }
+  e->closed85 = e->closed22 = FALSE;
+  e->until = 0;
+}
+
+// Stop the notifications: mcabber only sends them to the resources whose
+// support is known.  Incoming chat states set the support back, so this
+// is done again every second until the end of the interval.
+static void entry_close(entry_t *e, gpointer buddy)
+{
+#ifdef XEP0085
+  struct xep0085 *xep85 = buddy_resource_xep85(buddy, e->res);
+  if (xep85 && xep85->support == CHATSTATES_SUPPORT_OK) {
+    xep85->support = CHATSTATES_SUPPORT_PROBED;
+    e->closed85 = TRUE;
+  }
+#endif
+#ifdef XEP0022
+  struct xep0022 *xep22 = buddy_resource_xep22(buddy, e->res);
+  if (xep22 && xep22->support == CHATSTATES_SUPPORT_OK) {
+    xep22->support = CHATSTATES_SUPPORT_PROBED;
+    e->closed22 = TRUE;
+  }
+#endif
+}
+
+// The support of a resource which does not send chat states anymore is
+// unknown again
+static void entry_check_stale(entry_t *e, gpointer buddy, time_t now)
+{
+  gint stale = optcache_int(&opt_stale);
+  gboolean reset = FALSE;
+
+  if (stale <= 0 || now - e->rcvd < stale)
+    return;
+#ifdef XEP0085
+  struct xep0085 *xep85 = buddy_resource_xep85(buddy, e->res);
+  if (xep85 && xep85->support == CHATSTATES_SUPPORT_OK) {
+    xep85->support = CHATSTATES_SUPPORT_UNKNOWN;
+    reset = TRUE;
+  }
+#endif
+#ifdef XEP0022
+  struct xep0022 *xep22 = buddy_resource_xep22(buddy, e->res);
+  if (xep22 && xep22->support == CHATSTATES_SUPPORT_OK) {
+    xep22->support = CHATSTATES_SUPPORT_UNKNOWN;
+    reset = TRUE;
+  }
+#endif
+  if (reset)
+    stats.stale++;
+}
+
+static guint last_state_sent(gpointer buddy, const gchar *res)
+{
+#ifdef XEP0085
+  struct xep0085 *xep85 = buddy_resource_xep85(buddy, res);
+  if (xep85 && xep85->last_state_sent)
+    return xep85->last_state_sent;
+#endif
+#ifdef XEP0022
+  struct xep0022 *xep22 = buddy_resource_xep22(buddy, res);
+  if (xep22)
+    return xep22->last_state_sent;
+#endif
+  return ROSTER_EVENT_NONE;
+}
+
+// End of the intervals, or support set back by an incoming chat state
+static void check_intervals(time_t now)
+{
+  GHashTableIter iter;
+  gpointer buddy;
+  entry_t *e;
+
+  g_hash_table_iter_init(&iter, entries);
+  while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&e)) {
+    if (!e->until)
+      continue;
+    if (now >= e->until)
+      entry_open(e);
+    else if ((buddy = entry_buddy(e)) != NULL)
+      entry_close(e, buddy);
+  }
+}
+
+// Run after mcabber has handled an incoming chat state
+static gboolean reclose_cb(gpointer data)
+{
+  reclose_srcno = 0;
+  check_intervals(time(NULL));
+  return FALSE;
+}
+
+// Notifications are only sent to the current buddy, while you type; its
+// state is checked every second.
+static gboolean tick_cb(gpointer data)
+{
+  time_t now = time(NULL);
+  gpointer buddy;
+  const gchar *res;
+  entry_t *e;
+  guint state;
+
+  if (!xmpp_is_online())
+    return TRUE;
+
+  check_intervals(now);
+
+  if (!current_buddy)
+    return TRUE;
+  buddy = BUDDATA(current_buddy);
+  if (buddy_gettype(buddy) != ROSTER_TYPE_USER)
+    return TRUE;
+  res = buddy_getactiveresource(buddy);
+  e = entry_get(buddy_getjid(buddy), res);
+
+  state = last_state_sent(buddy, res);
+  // The message carries the "active" state
+  if (e->until && state != e->last_sent && state == ROSTER_EVENT_ACTIVE)
+    stats.saved++;
+  if (state != e->last_sent &&
+      (state == ROSTER_EVENT_COMPOSING || state == ROSTER_EVENT_PAUSED)) {
+    gint interval = optcache_int(&opt_interval);
+    stats.notifications++;
+    if (state == ROSTER_EVENT_PAUSED &&
+        e->last_sent == ROSTER_EVENT_COMPOSING) {
+      stats.cycles++;
+      if (interval > 0 && !e->until) {
+        e->until = now + interval;
+        entry_close(e, buddy);
+        stats.intervals++;
+      }
+    }
+  }
+  e->last_sent = state;
+  if (!e->until)
+    entry_check_stale(e, buddy, now);
+  return TRUE;
+}
+
+// Incoming messages: remember when each resource sent a chat state
+static LmHandlerResult message_cb(LmMessageHandler *h, LmConnection *c,
+                                  LmMessage *m, gpointer user_data)
+{
+  const gchar *from = lm_message_node_get_attribute(m->node, "from");
+  LmMessageNode *node;
+  const gchar *res;
+  gchar *bjid;
+  entry_t *e;
+
+  if (!from || !(res = strchr(from, JID_RESOURCE_SEPARATOR)))
+    return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+
+  for (node = m->node->children; node; node = node->next) {
+    const gchar *ns = lm_message_node_get_attribute(node, "xmlns");
+    if (!g_strcmp0(ns, NS_CHATSTATES) ||
+        (!g_strcmp0(ns, NS_EVENT) && node->children))
+      break;
+  }
+  if (!node)
+    return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+
+  bjid = jidtodisp(from);
+  e = entry_get(bjid, res + 1);
+  g_free(bjid);
+  e->rcvd = time(NULL);
+  if (e->until && !reclose_srcno)
+    reclose_srcno = g_idle_add(reclose_cb, NULL);
+  return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+// mcabber deletes the resources when the connection is closed
+static guint pre_disconnect_hh(const gchar *hookname, hk_arg_t *args,
+                               gpointer userdata)
+{
+  g_hash_table_remove_all(entries);
+  lmhandler_detach(&message_handler);
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static guint post_connect_hh(const gchar *hookname, hk_arg_t *args,
+                             gpointer userdata)
+{
+  lmhandler_attach(&message_handler);
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static void do_chatthrottle(char *args)
+{
+  GHashTableIter iter;
+  entry_t *e;
+  guint throttled = 0;
+
+  g_hash_table_iter_init(&iter, entries);
+  while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&e))
+    if (e->until)
+      throttled++;
+  scr_log_print(LPRINT_NORMAL, "chatthrottle: %" G_GUINT64_FORMAT
+                " notifications and %" G_GUINT64_FORMAT " composing/paused "
+                "cycles sent, %" G_GUINT64_FORMAT " throttling intervals "
+                "(%u now), at least %" G_GUINT64_FORMAT " stanzas saved, %"
+                G_GUINT64_FORMAT " stale supports reset, %u resources.",
+                stats.notifications, stats.cycles, stats.intervals,
+                throttled, stats.saved, stats.stale,
+                g_hash_table_size(entries));
+}
+
+#else
+
+static void do_chatthrottle(char *args)
+{
+  scr_log_print(LPRINT_NORMAL, "No Chat State support.");
+}
+
+#endif
+
+/* Initialization */
+static void chatthrottle_init(void)
+{
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  chatthrottle_cmdid = cmd_add("chatthrottle", "Chat state throttling", 0, 0,
+                               do_chatthrottle, NULL);
+#else
+  cmd_add("chatthrottle", "Chat state throttling", 0, 0, do_chatthrottle,
+          NULL);
+#endif
+
+#if defined XEP0022 || defined XEP0085
+  entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                  (GDestroyNotify)entry_free);
+  // On the current connection, if any, and the next ones
+  lmhandler_new(&message_handler, message_cb, NULL);
+  lmhandler_attach(&message_handler);
+  pre_disconnect_hid = hk_add_handler(pre_disconnect_hh, HOOK_PRE_DISCONNECT,
+                                      G_PRIORITY_DEFAULT_IDLE, NULL);
+  post_connect_hid = hk_add_handler(post_connect_hh, HOOK_POST_CONNECT,
+                                    G_PRIORITY_DEFAULT_IDLE, NULL);
+  optcache_bind(&opt_interval, NULL);
+  optcache_bind(&opt_stale, NULL);
+  srcno = g_timeout_add_seconds(1, tick_cb, NULL);
+#endif
+}
+
+/* Uninitialization */
+static void chatthrottle_uninit(void)
+{
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(chatthrottle_cmdid);
+#else
+  cmd_del("chatthrottle");
+#endif
+
+#if defined XEP0022 || defined XEP0085
+  GHashTableIter iter;
+  entry_t *e;
+
+  g_source_remove(srcno);
+  srcno = 0;
+  if (reclose_srcno) {
+    g_source_remove(reclose_srcno);
+    reclose_srcno = 0;
+  }
+  hk_del_handler(HOOK_PRE_DISCONNECT, pre_disconnect_hid);
+  hk_del_handler(HOOK_POST_CONNECT, post_connect_hid);
+  lmhandler_free(&message_handler);
+  optcache_unbind_all();
+
+  // Do not leave contacts without notifications
+  g_hash_table_iter_init(&iter, entries);
+  while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&e))
+    if (e->until)
+      entry_open(e);
+  g_hash_table_destroy(entries);
+  entries = NULL;
+  memset(&stats, 0, sizeof stats);
+#endif
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
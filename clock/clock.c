@@ -7,6 +7,20 @@
  *    if false, the clock is updated once per minute.
  *  - clock_strfmt: string (default: "%Y-%m-%d %H:%M")
  *    strftime format string.
+ *  - clock_stall_threshold: integer (default: 0)
+ *    Stall detection: when set, the clock timer ticks every
+ *    clock_stall_tick ms and measures how late each tick fires on the
+ *    monotonic clock, i.e. the main loop lag.  A lag of this number of
+ *    ms or more is logged as a stall, with the longest hook handler or
+ *    module command call since the previous tick when the modules are
+ *    built with --enable-hookstats.  The time a stall does not spend
+ *    there was spent in a redraw, in a command of mcabber or in mcabber
+ *    itself.
+ *  - clock_stall_tick: integer (default: 100)
+ *    Stall detection tick, in ms.
+ *
+ *  /clockstall [reset]
+ *    Display (or reset) the main loop lag histogram.
  *
  * Copyright (C) 2010 Mikael Berthe <mikael@lilotux.net>
  *
@@ -24,47 +38,82 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
 #include <time.h>
 
 #include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/logprint.h>
 #include <mcabber/settings.h>
 #include <mcabber/screen.h>
 
+#include "common/inittime.h"
+#include "common/logcoal.h"
+#include "common/optcache.h"
+#include "common/requires.h"
+#include "hookstats/hookstats.h"
+
 static void clock_init(void);
 static void clock_uninit(void);
 
+MODULE_TIMED_INIT(clock_init)
+
 /* Module description */
 module_info_t info_clock = {
         .branch         = MCABBER_BRANCH,
         .api            = MCABBER_API_VERSION,
         .version        = "1.00",
         .description    = "Simple clock module\n"
-                          "Uses the 'info' option to display the time.",
-        .requires       = NULL,
-        .init           = clock_init,
+                          "Uses the 'info' option to display the time.\n"
+                          " Provides the command /clockstall",
+        .requires       = MODULE_REQUIRES,
+        .init           = clock_init_timed,
         .uninit         = clock_uninit,
         .next           = NULL,
 };
 
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer clockstall_cmdid;
+#endif
+
 static guint srcno = 0;
-static gboolean precision_onesec;
 static gchar *backup_info;
-static gchar *strfmt;
-static const gchar dfltstrfmt[] = "%Y-%m-%d %H:%M"; // Default string format
+static optcache_t precision_onesec = OPTCACHE_INT("clock_precision_onesec", 0);
+static optcache_t strfmt = OPTCACHE_STRING("clock_strfmt", "%Y-%m-%d %H:%M");
+static optcache_t stall_threshold = OPTCACHE_INT("clock_stall_threshold", 0);
+static optcache_t stall_tick = OPTCACHE_INT("clock_stall_tick", 100);
 
-static gboolean clock_cb(void)
+// Lag histogram: below 1 ms, then one bucket per power of two (in ms),
+// the last one is 4 s and more
+#define STALL_BUCKETS   14
+
+static struct {
+  gint64  tick;                 // us
+  gint64  expected;             // Monotonic time the next tick is due
+  time_t  shown;                // Time displayed, in seconds or minutes
+  guint64 ticks;
+  guint64 stalls;
+  gint64  max_lag;
+  guint64 hist[STALL_BUCKETS];
+} stall;
+
+static struct tm *clock_display(time_t now_t)
 {
   char buf[256];
-  time_t now_t;
   struct tm *now;
 
-  time(&now_t);
   now = localtime(&now_t);
-  strftime(buf, sizeof(buf), strfmt, now);
+  strftime(buf, sizeof(buf), optcache_str(&strfmt), now);
   settings_set(SETTINGS_TYPE_OPTION, "info", buf);
   scr_update_chat_status(TRUE);
+  return now;
+}
+
+static gboolean clock_cb(void)
+{
+  struct tm *now = clock_display(time(NULL));
 
-  if (precision_onesec)
+  if (optcache_int(&precision_onesec))
     return TRUE;  // Let's be called again in 1 second
 
   // Set up new timeout event
@@ -73,12 +122,62 @@ static gboolean clock_cb(void)
   return FALSE;   // Destroy the old timeout
 }
 
+static void stall_record(gint64 lag)
+{
+  gint64 ms = lag / 1000;
+  gint threshold = optcache_int(&stall_threshold);
+  gchar name[128];
+  guint64 ns;
+  gboolean found;
+
+  stall.ticks++;
+  stall.hist[ms ? MIN(g_bit_nth_msf(ms, -1) + 1, STALL_BUCKETS - 1) : 0]++;
+  if (lag > stall.max_lag)
+    stall.max_lag = lag;
+
+  // Always query, so that the longest call is the one since the last tick
+  found = HOOKSTATS_LONGEST(name, sizeof name, &ns);
+  if (threshold <= 0 || ms < threshold)
+    return;
+  stall.stalls++;
+  if (found)
+    logcoal_print(LPRINT_LOGNORM, "Main loop stalled for %" G_GINT64_FORMAT
+                  " ms; longest hook handler or command call: %s, %.1f ms",
+                  ms, name, ns / 1e6);
+  else
+    logcoal_print(LPRINT_LOGNORM, "Main loop stalled for %" G_GINT64_FORMAT
+                  " ms", ms);
+}
+
+// Stall detection tick, which also updates the clock display
+static gboolean clock_stall_cb(gpointer data)
+{
+  gint64 now = g_get_monotonic_time();
+  time_t now_t = time(NULL);
+  time_t shown = optcache_int(&precision_onesec) ? now_t : now_t / 60;
+
+  // GLib schedules the next tick from the time this one is dispatched
+  stall_record(MAX(now - stall.expected, 0));
+  stall.expected = now + stall.tick;
+
+  if (shown != stall.shown) {
+    stall.shown = shown;
+    clock_display(now_t);
+  }
+  return TRUE;
+}
+
 static void clock_setup_timer(gboolean activate)
 {
   if ((activate && srcno) || (!activate && !srcno))
     return;
 
-  if (activate) {
+  if (activate && optcache_int(&stall_threshold) > 0) {
+    stall.tick = MAX(optcache_int(&stall_tick), 1) * (gint64)1000;
+    stall.expected = g_get_monotonic_time() + stall.tick;
+    stall.shown = 0;
+    srcno = g_timeout_add(stall.tick / 1000, clock_stall_cb, NULL);
+  } else if (activate) {
     srcno = g_timeout_add_seconds(1, (GSourceFunc)clock_cb, NULL);
   } else {
     g_source_remove(srcno);
@@ -86,29 +185,88 @@ static void clock_setup_timer(gboolean activate)
   }
 }
 
-//static void do_clock(char *args)
-//{
-//}
+// Apply the new options now
+static void clock_option_changed(const optcache_t *opt)
+{
+  clock_setup_timer(FALSE);
+  clock_setup_timer(TRUE);
+}
+
+static void clockstall_show(void)
+{
+  guint b;
+
+  if (!stall.ticks) {
+    scr_log_print(LPRINT_NORMAL, "clock: no lag measured (stall detection "
+                  "is enabled with the option clock_stall_threshold).");
+    return;
+  }
+  scr_log_print(LPRINT_NORMAL, "clock: %" G_GUINT64_FORMAT " ticks of %"
+                G_GINT64_FORMAT " ms, %" G_GUINT64_FORMAT " stalls, "
+                "maximum lag %.1f ms", stall.ticks, stall.tick / 1000,
+                stall.stalls, stall.max_lag / 1e3);
+  for (b = 0; b < STALL_BUCKETS; b++) {
+    if (!stall.hist[b])
+      continue;
+    if (!b)
+      scr_log_print(LPRINT_NORMAL, " %14s %10" G_GUINT64_FORMAT, "< 1 ms",
+                    stall.hist[b]);
+    else if (b == STALL_BUCKETS - 1)
+      scr_log_print(LPRINT_NORMAL, " >= %8u ms %10" G_GUINT64_FORMAT,
+                    1u << (b - 1), stall.hist[b]);
+    else
+      scr_log_print(LPRINT_NORMAL, " %5u-%5u ms %10" G_GUINT64_FORMAT,
+                    1u << (b - 1), 1u << b, stall.hist[b]);
+  }
+}
+
+static void do_clockstall(char *args)
+{
+  if (!*args) {
+    clockstall_show();
+  } else if (!strcmp(args, "reset")) {
+    stall.ticks = stall.stalls = 0;
+    stall.max_lag = 0;
+    memset(stall.hist, 0, sizeof stall.hist);
+  } else {
+    scr_log_print(LPRINT_NORMAL, "Usage: /clockstall [reset]");
+  }
+}
 
 /* Initialization */
 static void clock_init(void)
 {
   backup_info = g_strdup(settings_opt_get("info"));
-  precision_onesec = settings_opt_get_int("clock_precision_onesec");
-  strfmt = g_strdup(settings_opt_get("clock_strfmt"));
-  if (!strfmt)
-    strfmt = g_strdup(dfltstrfmt);
+  optcache_bind(&precision_onesec, clock_option_changed);
+  optcache_bind(&strfmt, clock_option_changed);
+  optcache_bind(&stall_threshold, clock_option_changed);
+  optcache_bind(&stall_tick, clock_option_changed);
+  logcoal_init();
   clock_setup_timer(TRUE);
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  clockstall_cmdid = cmd_add("clockstall", "Main loop lag histogram", 0, 0,
+                             do_clockstall, NULL);
+#else
+  cmd_add("clockstall", "Main loop lag histogram", 0, 0, do_clockstall, NULL);
+#endif
 }
 
 /* Deinitialization */
 static void clock_uninit(void)
 {
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(clockstall_cmdid);
+#else
+  cmd_del("clockstall");
+#endif
   clock_setup_timer(FALSE);
+  logcoal_flush();
+  optcache_unbind_all();
   settings_set(SETTINGS_TYPE_OPTION, "info", backup_info);
   g_free(backup_info);
-  g_free(strfmt);
-  backup_info = strfmt = NULL; // probably useless...
+  backup_info = NULL; // probably useless...
   scr_update_chat_status(TRUE);
 }
 
@@ -0,0 +1,204 @@
+/*
+ *  Module "cmdbench"   -- Command dispatch microbenchmark
+ *
+ *  /cmdbench N command [args]
+ *
+ *  Runs a command N times through mcabber's command processing, then
+ *  the no-op /# command (comment module) with the same arguments, and
+ *  displays the time per call of both and the difference, i.e. what
+ *  the command costs on top of the parsing and dispatch.  The heap
+ *  growth per call is displayed too (glibc only), and the allocations
+ *  per call when the host counts them (mockhost/alloc.c).
+ *
+ *  The command output, if any, is displayed N times, and the time spent
+ *  displaying it is counted: use a quiet command (e.g. /set with an
+ *  option nobody reads) or a small N for a command that prints.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __GLIBC__
+# include <malloc.h>
+#endif
+
+#include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/logprint.h>
+
+#define MODULE_EXTRA_REQUIRES "comment"
+#include "common/inittime.h"
+#include "common/requires.h"
+
+static void cmdbench_init(void);
+static void cmdbench_uninit(void);
+
+MODULE_TIMED_INIT(cmdbench_init)
+
+/* Module description */
+module_info_t info_cmdbench = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Command dispatch microbenchmark\n"
+                          " Provides the command /cmdbench",
+        .requires       = MODULE_REQUIRES,
+        .init           = cmdbench_init_timed,
+        .uninit         = cmdbench_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer cmdbench_cmdid;
+#endif
+
+#define MAX_RUNS    10000000
+#define WARMUP_RUNS 10
+
+// Allocation counters of the mock host (see mockhost/mockhost.h); mcabber
+// does not count the allocations.
+typedef struct {
+  guint64 allocs;
+  guint64 frees;
+  guint64 bytes;
+} host_alloc_stats_t;
+
+extern void mock_alloc_count(gboolean enable) __attribute__((weak));
+extern void mock_alloc_get(host_alloc_stats_t *stats) __attribute__((weak));
+
+typedef struct {
+  gdouble ns;
+  gdouble allocs;
+  gdouble heap;
+} run_t;
+
+static gboolean running;
+
+static inline guint64 now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (guint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Bytes in use on the heap
+static gint64 heap_used(void)
+{
+#if defined __GLIBC__ && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  return mallinfo2().uordblks;
+#elif defined __GLIBC__
+  return (guint)mallinfo().uordblks;
+#else
+  return 0;
+#endif
+}
+
+static void run(const gchar *line, guint n, run_t *r)
+{
+  host_alloc_stats_t a0 = { 0 }, a1 = { 0 };
+  gint64 h0;
+  guint64 t0;
+  guint i;
+
+  for (i = 0; i < WARMUP_RUNS; i++)
+    process_command(line, TRUE);
+
+  h0 = heap_used();
+  if (mock_alloc_get) {
+    mock_alloc_get(&a0);
+    mock_alloc_count(TRUE);
+  }
+  t0 = now_ns();
+  for (i = 0; i < n; i++)
+    process_command(line, TRUE);
+  r->ns = (gdouble)(now_ns() - t0) / n;
+  if (mock_alloc_get) {
+    mock_alloc_count(FALSE);
+    mock_alloc_get(&a1);
+  }
+  r->allocs = (gdouble)(a1.allocs - a0.allocs) / n;
+  r->heap   = (gdouble)(heap_used() - h0) / n;
+}
+
+static void do_cmdbench(char *args)
+{
+  gchar *cmd, *cmdargs, *line, *baseline, *end;
+  guint64 n;
+  run_t r, b;
+
+  n = g_ascii_strtoull(args, &end, 10);
+  cmd = end;
+  while (*cmd == ' ')
+    cmd++;
+  while (*cmd == '/')
+    cmd++;
+  if (end == args || !*cmd || n < 1 || n > MAX_RUNS) {
+    scr_log_print(LPRINT_NORMAL, "Usage: /cmdbench N command [args] "
+                  "(N <= %u)", MAX_RUNS);
+    return;
+  }
+  if (running || !strncmp(cmd, "cmdbench", 8)) {
+    scr_log_print(LPRINT_NORMAL, "cmdbench: cannot benchmark itself.");
+    return;
+  }
+
+  // The baseline has the same arguments, so that the line parsing costs
+  // the same
+  cmdargs = strchr(cmd, ' ');
+  line = g_strdup_printf("/%s", cmd);
+  baseline = g_strdup_printf("/#%s", cmdargs ? cmdargs : "");
+
+  running = TRUE;
+  run(line, n, &r);
+  run(baseline, n, &b);
+  running = FALSE;
+
+  scr_log_print(LPRINT_NORMAL, "cmdbench: %s: %" G_GUINT64_FORMAT " runs, "
+                "%.0f ns/op, /# baseline %.0f ns/op, i.e. +%.0f ns/op",
+                line, n, r.ns, b.ns, r.ns - b.ns);
+  if (mock_alloc_get)
+    scr_log_print(LPRINT_NORMAL, "cmdbench: %.2f allocs/op (baseline %.2f)",
+                  r.allocs, b.allocs);
+  scr_log_print(LPRINT_NORMAL, "cmdbench: heap growth %.1f bytes/op "
+                "(baseline %.1f)", r.heap, b.heap);
+  g_free(line);
+  g_free(baseline);
+}
+
+/* Initialization */
+static void cmdbench_init(void)
+{
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmdbench_cmdid = cmd_add("cmdbench", "Command benchmark", 0, 0,
+                           do_cmdbench, NULL);
+#else
+  cmd_add("cmdbench", "Command benchmark", 0, 0, do_cmdbench, NULL);
+#endif
+}
+
+/* Uninitialization */
+static void cmdbench_uninit(void)
+{
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(cmdbench_cmdid);
+#else
+  cmd_del("cmdbench");
+#endif
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -21,9 +21,14 @@
 #include <mcabber/modules.h>
 #include <mcabber/commands.h>
 
+#include "common/inittime.h"
+#include "common/requires.h"
+
 static void comment_init(void);
 static void comment_uninit(void);
 
+MODULE_TIMED_INIT(comment_init)
+
 /* Module description */
 module_info_t info_comment = {
         .branch         = MCABBER_BRANCH,
@@ -31,8 +36,8 @@ module_info_t info_comment = {
         .version        = "1.00",
         .description    = "Comment (no-op) pseudo-command\n"
                           "(Pretty useless!)",
-        .requires       = NULL,
-        .init           = comment_init,
+        .requires       = MODULE_REQUIRES,
+        .init           = comment_init_timed,
         .uninit         = comment_uninit,
         .next           = NULL,
 };
@@ -0,0 +1,161 @@
+/*
+ *  hkargs.h        -- Hook argument lookup
+ *
+ *  Hook handlers receive their arguments as a NULL-terminated array of
+ *  name/value pairs.  hkargs_parse() extracts all the arguments a
+ *  handler wants in a single pass: each name is mapped to a key with a
+ *  switch on its first characters (a perfect hash for the names mcabber
+ *  uses), confirmed with one strcmp(), and the scan stops as soon as all
+ *  the wanted keys have been found.  Numeric values (e.g. "unread") can
+ *  be parsed on the way.
+ *
+ *    hkargs_t a;
+ *    hkargs_parse(args, HKARG(HKARG_JID) | HKARG(HKARG_UNREAD),
+ *                 HKARG(HKARG_UNREAD), &a);
+ *    jid = hkargs_value(&a, HKARG_JID);
+ *    n   = hkargs_uint(&a, HKARG_UNREAD);
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HKARGS_H__
+#define __HKARGS_H__ 1
+
+#include <string.h>
+
+#include <mcabber/hooks.h>
+
+// Hook argument names
+enum {
+  HKARG_JID,
+  HKARG_RESOURCE,
+  HKARG_MESSAGE,
+  HKARG_GROUPCHAT,
+  HKARG_DELAYED,
+  HKARG_ERROR,
+  HKARG_ATTENTION,
+  HKARG_TYPE,
+  HKARG_OLD_STATUS,
+  HKARG_NEW_STATUS,
+  HKARG_UNREAD,
+  HKARG_MUC_UNREAD,
+  HKARG_MUC_ATTENTION,
+  HKARG_COUNT
+};
+
+#define HKARG(key)  (1U << (key))
+
+static const gchar * const hkarg_names[HKARG_COUNT] = {
+  [HKARG_JID]           = "jid",
+  [HKARG_RESOURCE]      = "resource",
+  [HKARG_MESSAGE]       = "message",
+  [HKARG_GROUPCHAT]     = "groupchat",
+  [HKARG_DELAYED]       = "delayed",
+  [HKARG_ERROR]         = "error",
+  [HKARG_ATTENTION]     = "attention",
+  [HKARG_TYPE]          = "type",
+  [HKARG_OLD_STATUS]    = "old_status",
+  [HKARG_NEW_STATUS]    = "new_status",
+  [HKARG_UNREAD]        = "unread",
+  [HKARG_MUC_UNREAD]    = "muc_unread",
+  [HKARG_MUC_ATTENTION] = "muc_attention",
+};
+
+typedef struct {
+  guint        found;                 // Keys found (HKARG() mask)
+  const gchar *value[HKARG_COUNT];    // Only valid for the keys found
+  guint        num[HKARG_COUNT];      // Parsed numeric values
+} hkargs_t;
+
+// Return the key for an argument name, or -1 if it is unknown
+static inline gint hkarg_key(const gchar *name)
+{
+  gint key;
+
+  switch (name[0]) {
+    case 'j': key = HKARG_JID;        break;
+    case 'r': key = HKARG_RESOURCE;   break;
+    case 'g': key = HKARG_GROUPCHAT;  break;
+    case 'd': key = HKARG_DELAYED;    break;
+    case 'e': key = HKARG_ERROR;      break;
+    case 'a': key = HKARG_ATTENTION;  break;
+    case 't': key = HKARG_TYPE;       break;
+    case 'o': key = HKARG_OLD_STATUS; break;
+    case 'n': key = HKARG_NEW_STATUS; break;
+    case 'u': key = HKARG_UNREAD;     break;
+    case 'm':
+        if (name[1] != 'u')
+          key = HKARG_MESSAGE;
+        else if (name[2] == 'c' && name[3] == '_' && name[4] == 'u')
+          key = HKARG_MUC_UNREAD;
+        else
+          key = HKARG_MUC_ATTENTION;
+        break;
+    default:
+        return -1;
+  }
+  return strcmp(name, hkarg_names[key]) ? -1 : key;
+}
+
+// Parse an unsigned decimal value (0 if it is NULL or not a number)
+static inline guint hkarg_uint(const gchar *value)
+{
+  guint n = 0;
+
+  if (!value)
+    return 0;
+  for ( ; *value >= '0' && *value <= '9'; value++)
+    n = n * 10 + (*value - '0');
+  return n;
+}
+
+// Extract the wanted arguments (HKARG() mask) in one pass; the values of
+// the keys in the numeric mask are also parsed.  Returns the keys found.
+static inline guint hkargs_parse(hk_arg_t *args, guint wanted, guint numeric,
+                                 hkargs_t *a)
+{
+  a->found = 0;
+  for ( ; args->name && a->found != wanted; args++) {
+    gint key = hkarg_key(args->name);
+
+    if (key < 0 || !(wanted & HKARG(key)) || (a->found & HKARG(key)))
+      continue;
+    a->found |= HKARG(key);
+    a->value[key] = args->value;
+    if (numeric & HKARG(key))
+      a->num[key] = hkarg_uint(args->value);
+  }
+  return a->found;
+}
+
+static inline const gchar *hkargs_value(const hkargs_t *a, gint key)
+{
+  return (a->found & HKARG(key)) ? a->value[key] : NULL;
+}
+
+static inline guint hkargs_uint(const hkargs_t *a, gint key)
+{
+  return (a->found & HKARG(key)) ? a->num[key] : 0;
+}
+
+// Boolean arguments ("groupchat", "attention"...) are "true" or "false"
+static inline gboolean hkargs_true(const hkargs_t *a, gint key)
+{
+  const gchar *v = hkargs_value(a, key);
+  return v && !strcmp(v, "true");
+}
+
+#endif /* __HKARGS_H__ */
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
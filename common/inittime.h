@@ -0,0 +1,59 @@
+/*
+ *  inittime.h      -- Module initialization timing
+ *
+ *  MODULE_TIMED_INIT(foo_init) defines foo_init_timed(), to be used as
+ *  the init function in the module description: it runs foo_init() and
+ *  logs how long it took, at debug level, or at normal level when it
+ *  takes more than INIT_SLOW_USEC.  With --enable-hookstats the time is
+ *  also reported to the hookstats module (see /hookstats init).
+ *
+ *  Setup that takes time (compiling regexes, reading files, warming up
+ *  caches...) should be done on first use, not in the init function.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __INITTIME_H__
+#define __INITTIME_H__ 1
+
+#include <glib.h>
+#include <mcabber/logprint.h>
+
+#include "hookstats/hookstats.h"
+
+#define INIT_SLOW_USEC  5000
+
+// The metrics and modmem modules do not require hookstats
+#if defined MODULES_HOOKSTATS && !defined METRICS_MODULE && \
+    !defined MODMEM_MODULE
+# define INITTIME_REPORT(init, usec)  hookstats_init_time(init, usec)
+#else
+# define INITTIME_REPORT(init, usec)
+#endif
+
+#define MODULE_TIMED_INIT(init)                                             \
+static void init##_timed(void)                                              \
+{                                                                           \
+  gint64 t0 = g_get_monotonic_time(), usec;                                 \
+                                                                            \
+  init();                                                                   \
+  usec = g_get_monotonic_time() - t0;                                       \
+  scr_log_print(usec > INIT_SLOW_USEC ? LPRINT_LOGNORM : LPRINT_DEBUG,      \
+                "%s() took %.3f ms", #init, usec / 1e3);                    \
+  INITTIME_REPORT(#init, usec);                                             \
+}
+
+#endif /* __INITTIME_H__ */
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
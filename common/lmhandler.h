@@ -0,0 +1,96 @@
+/*
+ *  lmhandler.h     -- Stanza handlers on the current connection
+ *
+ *  mcabber creates a new Loudmouth connection each time it connects to
+ *  the server, and lconnection is NULL until the first one (the modules
+ *  listed in the configuration file are loaded before): a handler
+ *  registered on lconnection by the init function never sees a stanza,
+ *  or stops seeing them after a reconnection.  An lmhandler is attached
+ *  to the current connection when the module is loaded and after each
+ *  connection, and detached before the disconnection:
+ *
+ *    static lmhandler_t presence =
+ *      LMHANDLER(LM_MESSAGE_TYPE_PRESENCE, LM_HANDLER_PRIORITY_FIRST);
+ *
+ *    lmhandler_new(&presence, presence_cb, NULL);   // init
+ *    lmhandler_attach(&presence);                   // init, post-connect
+ *    lmhandler_detach(&presence);                   // pre-disconnect
+ *    lmhandler_free(&presence);                     // uninit
+ *
+ *  lmhandler_attach() does nothing without a connection, or when the
+ *  handler is already registered on the current one.  The connection is
+ *  referenced while the handler is registered on it: when the link
+ *  drops, mcabber does not run HOOK_PRE_DISCONNECT, and the new
+ *  connection could otherwise get the address of the old one.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LMHANDLER_H__
+#define __LMHANDLER_H__ 1
+
+#include <glib.h>
+#include <loudmouth/loudmouth.h>
+
+#include <mcabber/xmpp.h>
+
+typedef struct {
+  LmMessageHandler  *handler;
+  LmMessageType      type;
+  LmHandlerPriority  priority;
+  LmConnection      *conn;      // Registered on this connection, if any
+} lmhandler_t;
+
+#define LMHANDLER(type, priority)  { NULL, type, priority, NULL }
+
+static inline void lmhandler_new(lmhandler_t *h,
+                                 LmHandleMessageFunction function,
+                                 gpointer user_data)
+{
+  h->handler = lm_message_handler_new(function, user_data, NULL);
+  h->conn = NULL;
+}
+
+static inline void lmhandler_detach(lmhandler_t *h)
+{
+  if (!h->conn)
+    return;
+  lm_connection_unregister_message_handler(h->conn, h->handler, h->type);
+  lm_connection_unref(h->conn);
+  h->conn = NULL;
+}
+
+static inline void lmhandler_attach(lmhandler_t *h)
+{
+  if (!h->handler || !lconnection || h->conn == lconnection)
+    return;
+  lmhandler_detach(h);          // From the previous connection
+  lm_connection_register_message_handler(lconnection, h->handler, h->type,
+                                         h->priority);
+  h->conn = lm_connection_ref(lconnection);
+}
+
+static inline void lmhandler_free(lmhandler_t *h)
+{
+  if (!h->handler)
+    return;
+  lmhandler_detach(h);
+  lm_message_handler_invalidate(h->handler);
+  lm_message_handler_unref(h->handler);
+  h->handler = NULL;
+}
+
+#endif /* __LMHANDLER_H__ */
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
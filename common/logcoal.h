@@ -0,0 +1,206 @@
+/*
+ *  logcoal.h       -- Coalesced log messages
+ *
+ *  A handler logging a line per event floods the log window under load
+ *  (an authorization request storm, receipts from a busy contact...).
+ *  The lines logged with logcoal_print() are grouped by format string:
+ *  the first line of a burst is displayed at once, the next ones during
+ *  the following LOGCOAL_WINDOW ms (option logcoal_window) are counted,
+ *  and a summary is displayed at the end of the window, all summaries in
+ *  one update:
+ *
+ *    Ignored auth request from spam1@example.net (none)
+ *    Ignored auth request from spam38@example.net (none) (x37 similar)
+ *
+ *  "(x37)" when the lines were all identical.  Besides, no more than
+ *  logcoal_max_lines lines (default LOGCOAL_MAX_LINES) are displayed per
+ *  second and module; the others are only counted.  Every line still
+ *  goes to the trace log file: as before with LPRINT_LOG, as a debug
+ *  line otherwise (tracelog_level 2).
+ *
+ *    logcoal_init();                                             // init
+ *    logcoal_print(LPRINT_NORMAL, "Received MDR from %s", jid);  // handler
+ *    logcoal_flush();                                            // uninit
+ *    optcache_unbind_all();
+ *
+ *  The options are cached with common/optcache.h.
+ *
+ *  Only the lines for the log window (LPRINT_NORMAL, in UTF-8) are
+ *  coalesced; the others are passed through.  Command output, which the
+ *  user asked for, should not go through here.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LOGCOAL_H__
+#define __LOGCOAL_H__ 1
+
+#include <stdarg.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <mcabber/logprint.h>
+
+#include "common/optcache.h"
+
+#define LOGCOAL_TEMPLATES   16      // Format strings followed per module
+#define LOGCOAL_LINE        512     // Longer lines are cut
+#define LOGCOAL_WINDOW      1000    // ms
+#define LOGCOAL_MAX_LINES   10      // Displayed per second
+
+typedef struct {
+  const gchar *fmt;
+  guint        count;               // Lines not displayed in the window
+  gboolean     same;                // ... all identical to the first one
+  gchar        last[LOGCOAL_LINE];
+} logcoal_tpl_t;
+
+static struct {
+  logcoal_tpl_t tpl[LOGCOAL_TEMPLATES];
+  guint         ntpl;
+  guint         srcno;
+  gint64        sec;
+  guint         lines;              // Displayed during this second
+  guint         suppressed;         // Over the limit, since the last flush
+  guint         max_lines;
+  gboolean      debug;              // Copy the lines to the trace log
+} logcoal;
+
+static optcache_t logcoal_opt_window = OPTCACHE_INT("logcoal_window",
+                                                    LOGCOAL_WINDOW);
+static optcache_t logcoal_opt_max_lines = OPTCACHE_INT("logcoal_max_lines",
+                                                       LOGCOAL_MAX_LINES);
+static optcache_t logcoal_opt_tracelog = OPTCACHE_INT("tracelog_level", 0);
+
+static inline void logcoal_init(void)
+{
+  optcache_bind(&logcoal_opt_window, NULL);
+  optcache_bind(&logcoal_opt_max_lines, NULL);
+  optcache_bind(&logcoal_opt_tracelog, NULL);
+}
+
+// Display a line if the rate limit allows it
+static inline void logcoal_display(guint flag, const gchar *line)
+{
+  gint64 sec = g_get_monotonic_time() / G_USEC_PER_SEC;
+
+  if (sec != logcoal.sec) {
+    logcoal.sec = sec;
+    logcoal.lines = 0;
+  }
+  if (logcoal.lines >= logcoal.max_lines) {
+    logcoal.suppressed++;
+    return;
+  }
+  logcoal.lines++;
+  scr_log_print(flag & ~LPRINT_LOG, "%s", line);
+}
+
+// Display the summaries, in one update, and close the window
+static inline void logcoal_flush(void)
+{
+  GString *batch;
+  guint i;
+
+  if (logcoal.srcno) {
+    g_source_remove(logcoal.srcno);
+    logcoal.srcno = 0;
+  }
+  batch = g_string_sized_new(256);
+  for (i = 0; i < logcoal.ntpl; i++) {
+    const logcoal_tpl_t *t = &logcoal.tpl[i];
+    if (t->count)
+      g_string_append_printf(batch, "%s%s (x%u%s)", batch->len ? "\n" : "",
+                             t->last, t->count, t->same ? "" : " similar");
+  }
+  if (logcoal.suppressed)
+    g_string_append_printf(batch, "%s(%u more log lines not displayed)",
+                           batch->len ? "\n" : "", logcoal.suppressed);
+  if (batch->len)
+    scr_log_print(LPRINT_NORMAL, "%s", batch->str);
+  g_string_free(batch, TRUE);
+  logcoal.ntpl = 0;
+  logcoal.suppressed = 0;
+}
+
+static inline gboolean logcoal_window_cb(gpointer data)
+{
+  logcoal.srcno = 0;
+  logcoal_flush();
+  return FALSE;
+}
+
+static inline void logcoal_print(guint flag, const gchar *fmt, ...)
+  G_GNUC_PRINTF(2, 3);
+
+static inline void logcoal_print(guint flag, const gchar *fmt, ...)
+{
+  gchar line[LOGCOAL_LINE];
+  logcoal_tpl_t *t = NULL;
+  va_list ap;
+  guint i;
+
+  va_start(ap, fmt);
+  g_vsnprintf(line, sizeof line, fmt, ap);
+  va_end(ap);
+
+  if (!(flag & LPRINT_NORMAL) || (flag & LPRINT_NOTUTF8)) {
+    scr_log_print(flag, "%s", line);
+    return;
+  }
+
+  // A new window: read the options
+  if (!logcoal.srcno) {
+    gint window = optcache_int(&logcoal_opt_window);
+    gint max = optcache_int(&logcoal_opt_max_lines);
+    logcoal.max_lines = max > 0 ? max : LOGCOAL_MAX_LINES;
+    logcoal.debug = optcache_int(&logcoal_opt_tracelog) >= 2;
+    logcoal.srcno = g_timeout_add(window > 0 ? window : LOGCOAL_WINDOW,
+                                  logcoal_window_cb, NULL);
+  }
+
+  // Full detail in the trace log
+  if (flag & LPRINT_LOG)
+    scr_log_print(flag & ~LPRINT_NORMAL, "%s", line);
+  else if (logcoal.debug)
+    scr_log_print(LPRINT_DEBUG, "%s", line);
+
+  for (i = 0; i < logcoal.ntpl; i++)
+    if (logcoal.tpl[i].fmt == fmt) {
+      t = &logcoal.tpl[i];
+      break;
+    }
+  if (t) {
+    // Already displayed in this window
+    if (t->same && strcmp(t->last, line))
+      t->same = FALSE;
+    strcpy(t->last, line);
+    t->count++;
+    return;
+  }
+
+  if (logcoal.ntpl < LOGCOAL_TEMPLATES) {
+    t = &logcoal.tpl[logcoal.ntpl++];
+    t->fmt   = fmt;
+    t->count = 0;
+    t->same  = TRUE;
+    strcpy(t->last, line);
+  }
+  logcoal_display(flag, line);
+}
+
+#endif /* __LOGCOAL_H__ */
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -0,0 +1,170 @@
+/*
+ *  optcache.h      -- Cached option values
+ *
+ *  Handlers called for every stanza should not look their options up in
+ *  the settings hash table, nor parse or expand them, each time.  An
+ *  option bound with optcache_bind() is read once; then a settings guard
+ *  updates the cached value whenever the option is changed (/set, the
+ *  configuration file, another module), so that the handlers only read a
+ *  variable and the changes apply without reloading the module.
+ *
+ *    static optcache_t opt_enabled = OPTCACHE_INT("ignore_auth", 1);
+ *
+ *    optcache_bind(&opt_enabled, NULL);              // init
+ *    if (optcache_int(&opt_enabled)) ...             // handler
+ *    optcache_unbind_all();                          // uninit
+ *
+ *  The optional callback is called after a change, with the new value
+ *  already cached (settings_opt_get() still returns the old one).
+ *
+ *  mcabber only accepts one guard per option: when the option is already
+ *  guarded (by mcabber or another module), the value is compared with
+ *  the settings at each read instead, which costs what the plain lookup
+ *  did.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __OPTCACHE_H__
+#define __OPTCACHE_H__ 1
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <mcabber/settings.h>
+#include <mcabber/utils.h>
+
+typedef enum {
+  OPTCACHE_TYPE_INT,            // Parsed like settings_opt_get_int()
+  OPTCACHE_TYPE_STRING,
+  OPTCACHE_TYPE_PATH,           // Expanded with expand_filename()
+} optcache_type_t;
+
+typedef struct optcache optcache_t;
+typedef void (*optcache_changed_t)(const optcache_t *opt);
+
+struct optcache {
+  const gchar        *key;
+  optcache_type_t     type;
+  gint                dflt;     // When unset (integers)
+  const gchar        *dflt_str; // When unset (strings, may be NULL)
+  optcache_changed_t  changed;
+  gboolean            guarded;
+  gchar              *raw;      // Option value (copy)
+  gint                ival;
+  gchar              *sval;
+};
+
+#define OPTCACHE_INT(key, dflt)     { key, OPTCACHE_TYPE_INT, dflt, NULL }
+#define OPTCACHE_STRING(key, dflt)  { key, OPTCACHE_TYPE_STRING, 0, dflt }
+#define OPTCACHE_PATH(key, dflt)    { key, OPTCACHE_TYPE_PATH, 0, dflt }
+
+// The options bound by this module
+static GSList *optcache_list;
+
+// As mcabber's settings_get_int(): atoi(), so "on" or "true" is 0
+static inline gint optcache_parse_int(const gchar *value)
+{
+  return atoi(value);
+}
+
+static inline void optcache_store(optcache_t *opt, const gchar *value)
+{
+  g_free(opt->raw);
+  g_free(opt->sval);
+  opt->raw  = g_strdup(value);
+  opt->sval = NULL;
+  if (!value)
+    value = opt->dflt_str;
+  switch (opt->type) {
+    case OPTCACHE_TYPE_INT:
+        opt->ival = opt->raw ? optcache_parse_int(opt->raw) : opt->dflt;
+        break;
+    case OPTCACHE_TYPE_STRING:
+        opt->sval = g_strdup(value);
+        break;
+    case OPTCACHE_TYPE_PATH:
+        opt->sval = value && *value ? expand_filename(value) : NULL;
+        break;
+  }
+}
+
+static inline gchar *optcache_guard(const gchar *key, const gchar *new_value)
+{
+  GSList *li;
+
+  for (li = optcache_list; li; li = g_slist_next(li)) {
+    optcache_t *opt = li->data;
+    if (opt->guarded && !strcmp(opt->key, key)) {
+      optcache_store(opt, new_value);
+      if (opt->changed)
+        opt->changed(opt);
+      break;
+    }
+  }
+  return g_strdup(new_value);
+}
+
+// Unguarded option: update the cached value if the option has changed
+static inline optcache_t *optcache_check(optcache_t *opt)
+{
+  const gchar *value = settings_opt_get(opt->key);
+
+  if (g_strcmp0(value, opt->raw)) {
+    optcache_store(opt, value);
+    if (opt->changed)
+      opt->changed(opt);
+  }
+  return opt;
+}
+
+static inline void optcache_bind(optcache_t *opt, optcache_changed_t changed)
+{
+  opt->changed = changed;
+  opt->guarded = settings_set_guard(opt->key, optcache_guard);
+  optcache_store(opt, settings_opt_get(opt->key));
+  optcache_list = g_slist_prepend(optcache_list, opt);
+}
+
+static inline void optcache_unbind_all(void)
+{
+  GSList *li;
+
+  for (li = optcache_list; li; li = g_slist_next(li)) {
+    optcache_t *opt = li->data;
+    if (opt->guarded)
+      settings_del_guard(opt->key);
+    opt->guarded = FALSE;
+    g_free(opt->raw);
+    g_free(opt->sval);
+    opt->raw = opt->sval = NULL;
+  }
+  g_slist_free(optcache_list);
+  optcache_list = NULL;
+}
+
+static inline gint optcache_int(optcache_t *opt)
+{
+  return G_LIKELY(opt->guarded) ? opt->ival : optcache_check(opt)->ival;
+}
+
+// NULL when unset and without default
+static inline const gchar *optcache_str(optcache_t *opt)
+{
+  return G_LIKELY(opt->guarded) ? opt->sval : optcache_check(opt)->sval;
+}
+
+#endif /* __OPTCACHE_H__ */
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
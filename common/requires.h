@@ -0,0 +1,61 @@
+/*
+ *  requires.h      -- Instrumentation modules dependencies
+ *
+ *  The modules built with --enable-hookstats, --enable-metrics,
+ *  --enable-modmem or --enable-traffic depend on the hookstats, metrics,
+ *  modmem or traffic module.  They set
+ *  ".requires = MODULE_REQUIRES" in their module description, so that
+ *  mcabber loads these modules first.  This includes every module using
+ *  common/inittime.h, which reports to hookstats.
+ *
+ *  A module which needs another module defines MODULE_EXTRA_REQUIRES
+ *  (e.g. "comment") before including this file.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REQUIRES_H__
+#define __REQUIRES_H__ 1
+
+#include <glib.h>
+
+#if defined MODULES_HOOKSTATS || defined MODULES_METRICS || \
+    defined MODULES_MODMEM || defined MODULE_EXTRA_REQUIRES || \
+    (defined MODULES_TRAFFIC && !defined TRAFFIC_MODULE)
+static const gchar * const module_requires[] = {
+# ifdef MODULE_EXTRA_REQUIRES
+  MODULE_EXTRA_REQUIRES,
+# endif
+# ifdef MODULES_HOOKSTATS
+  "hookstats",
+# endif
+# ifdef MODULES_METRICS
+  "metrics",
+# endif
+# ifdef MODULES_MODMEM
+  "modmem",
+# endif
+# if defined MODULES_TRAFFIC && !defined TRAFFIC_MODULE
+  "traffic",
+# endif
+  NULL
+};
+# define MODULE_REQUIRES module_requires
+#else
+# define MODULE_REQUIRES NULL
+#endif
+
+#endif /* __REQUIRES_H__ */
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -0,0 +1,81 @@
+/*
+ *  rostermap.h     -- Roster lookups for bulk operations
+ *
+ *  roster_find() walks the whole roster: a command resolving every
+ *  contact of a list (a snapshot, a broadcast...) costs the number of
+ *  contacts times the size of the roster.  A roster map is built with
+ *  one walk and then resolves a JID in constant time:
+ *
+ *    GHashTable *map = rostermap_new(ROSTER_TYPE_USER|ROSTER_TYPE_AGENT);
+ *
+ *    for (...)
+ *      if ((rosterdata = rostermap_find(map, bjid)) != NULL) ...
+ *    g_hash_table_destroy(map);
+ *
+ *  The map points to the roster items: it is only valid as long as no
+ *  contact is added or removed, i.e. within one command or handler,
+ *  without going back to the main loop.  As with roster_find(), the
+ *  JIDs are compared without regard to ASCII case.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ROSTERMAP_H__
+#define __ROSTERMAP_H__ 1
+
+#include <glib.h>
+
+#include <mcabber/roster.h>
+
+static inline guint rostermap_hash(gconstpointer key)
+{
+  const guchar *p = key;
+  guint h = 5381;
+
+  for ( ; *p; p++)
+    h = h * 33 + (guchar)g_ascii_tolower(*p);
+  return h;
+}
+
+static inline gboolean rostermap_equal(gconstpointer a, gconstpointer b)
+{
+  return !g_ascii_strcasecmp(a, b);
+}
+
+static inline void rostermap_add(gpointer rosterdata, void *param)
+{
+  const char *jid = buddy_getjid(rosterdata);
+
+  // The first one wins, as with roster_find()
+  if (jid && !g_hash_table_lookup(param, jid))
+    g_hash_table_insert(param, (gpointer)jid, rosterdata);
+}
+
+// JID (owned by the roster) -> roster item, for the given roster types
+static inline GHashTable *rostermap_new(guint roster_type)
+{
+  GHashTable *map = g_hash_table_new(rostermap_hash, rostermap_equal);
+
+  foreach_buddy(roster_type, rostermap_add, map);
+  return map;
+}
+
+static inline gpointer rostermap_find(GHashTable *map, const char *bjid)
+{
+  return bjid ? g_hash_table_lookup(map, bjid) : NULL;
+}
+
+#endif /* __ROSTERMAP_H__ */
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -0,0 +1,163 @@
+/*
+ *  workq.h         -- Deferred work queue
+ *
+ *  Hook handlers run while mcabber is handling a stanza; the work which
+ *  does not have to be done before the handler returns (log messages,
+ *  roster lookups, status bar updates...) can be queued and done a bit
+ *  later, from the main loop.  The queue is a fixed ring of tasks (no
+ *  allocation), drained by an idle source which stops after
+ *  WORKQ_BUDGET_USEC and lets mcabber handle its events before going on.
+ *
+ *  A task is a function and up to WORKQ_STRINGS strings and an integer,
+ *  copied into the ring:
+ *
+ *    static void log_mdr(const gchar * const *str, guint num) { ... }
+ *
+ *    workq_push(log_mdr, 0, 1, jid);             // handler
+ *    workq_flush();                              // uninit
+ *
+ *  The tasks are run in order.  When the ring is full, the oldest task
+ *  is run to make room; a task whose strings do not fit is run at once,
+ *  after the queued ones.  Code which needs the result of the queued
+ *  tasks (e.g. a command displaying what they store) calls workq_flush()
+ *  first.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WORKQ_H__
+#define __WORKQ_H__ 1
+
+#include <stdarg.h>
+#include <string.h>
+
+#include <glib.h>
+
+#define WORKQ_SLOTS         64
+#define WORKQ_STRINGS       4
+#define WORKQ_DATA          480     // String bytes per task
+#define WORKQ_BUDGET_USEC   2000
+#define WORKQ_NOSTR         0xffff
+
+typedef void (*workq_fn_t)(const gchar * const *str, guint num);
+
+typedef struct {
+  workq_fn_t fn;
+  guint      num;
+  guint16    off[WORKQ_STRINGS];  // String offsets in data, or WORKQ_NOSTR
+  gchar      data[WORKQ_DATA];
+} workq_task_t;
+
+static struct {
+  workq_task_t task[WORKQ_SLOTS];
+  guint        head, count;
+  guint        srcno;
+} workq;
+
+static inline void workq_run(workq_task_t *t)
+{
+  const gchar *str[WORKQ_STRINGS];
+  guint i;
+
+  for (i = 0; i < WORKQ_STRINGS; i++)
+    str[i] = t->off[i] == WORKQ_NOSTR ? NULL : t->data + t->off[i];
+  t->fn(str, t->num);
+}
+
+// Run the first task.  Its slot is released first, but is the last one
+// to be reused: a task must not queue a full ring of tasks.
+static inline void workq_run_first(void)
+{
+  workq_task_t *t = &workq.task[workq.head];
+
+  workq.head = (workq.head + 1) % WORKQ_SLOTS;
+  workq.count--;
+  workq_run(t);
+}
+
+static inline gboolean workq_drain_cb(gpointer data)
+{
+  gint64 deadline = g_get_monotonic_time() + WORKQ_BUDGET_USEC;
+
+  while (workq.count) {
+    workq_run_first();
+    if (g_get_monotonic_time() >= deadline)
+      break;
+  }
+  if (workq.count)
+    return TRUE;
+  workq.srcno = 0;
+  return FALSE;
+}
+
+// Run the queued tasks now
+static inline void workq_flush(void)
+{
+  if (workq.srcno) {
+    g_source_remove(workq.srcno);
+    workq.srcno = 0;
+  }
+  while (workq.count)
+    workq_run_first();
+}
+
+// Queue a task with nstr strings (which may be NULL)
+static inline void workq_push(workq_fn_t fn, guint num, guint nstr, ...)
+{
+  const gchar *str[WORKQ_STRINGS] = { NULL };
+  workq_task_t *t;
+  gsize len, used = 0;
+  va_list ap;
+  guint i;
+
+  g_return_if_fail(nstr <= WORKQ_STRINGS);
+
+  va_start(ap, nstr);
+  for (i = 0; i < nstr; i++)
+    str[i] = va_arg(ap, const gchar *);
+  va_end(ap);
+
+  // Full: make room, the oldest task first
+  while (workq.count >= WORKQ_SLOTS)
+    workq_run_first();
+
+  t = &workq.task[(workq.head + workq.count) % WORKQ_SLOTS];
+  for (i = 0; i < WORKQ_STRINGS; i++) {
+    if (!str[i]) {
+      t->off[i] = WORKQ_NOSTR;
+      continue;
+    }
+    len = strlen(str[i]) + 1;
+    if (used + len > WORKQ_DATA) {
+      // Too long to be copied: run it now, after the queued tasks
+      workq_flush();
+      fn(str, num);
+      return;
+    }
+    memcpy(t->data + used, str[i], len);
+    t->off[i] = used;
+    used += len;
+  }
+  t->fn  = fn;
+  t->num = num;
+
+  workq.count++;
+  if (!workq.srcno)
+    workq.srcno = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, workq_drain_cb,
+                                  NULL, NULL);
+}
+
+#endif /* __WORKQ_H__ */
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -3,6 +3,11 @@
  *                         Spawns an external editor, using screen
  *                         See the README file
  *
+ *  The message can also be broadcast to several recipients (JIDs, rooms
+ *  or a whole roster group): the helper script is launched only once and
+ *  the message body is read once, then sent to every recipient in small
+ *  batches.
+ *
  * Copyright (C) 2010 Mikael Berthe <mikael@lilotux.net>
  *
  * This module is free software: you can redistribute it and/or modify
@@ -29,20 +34,27 @@
 #include <mcabber/commands.h>
 #include <mcabber/settings.h>
 #include <mcabber/compl.h>
+#include <mcabber/roster.h>
 #include <mcabber/utils.h>
 #include <mcabber/logprint.h>
 
+#include "common/inittime.h"
+#include "common/optcache.h"
+#include "common/requires.h"
+
 static void extsay_init(void);
 static void extsay_uninit(void);
 
+MODULE_TIMED_INIT(extsay_init)
+
 /* Module description */
 module_info_t info_extsay = {
         .branch         = MCABBER_BRANCH,
         .api            = MCABBER_API_VERSION,
-        .version        = "0.02",
+        .version        = "0.03",
         .description    = "Use external editor to send a message",
-        .requires       = NULL,
-        .init           = extsay_init,
+        .requires       = MODULE_REQUIRES,
+        .init           = extsay_init_timed,
         .uninit         = extsay_uninit,
         .next           = NULL,
 };
@@ -51,27 +63,57 @@ module_info_t info_extsay = {
 static gpointer extsay_cmdid;
 #endif
 
+// Broadcast prefix used to tag the recipient parameter of the helper script
+#define BCAST_PREFIX  '+'
+
+// Default pacing for broadcasts: BCAST_BATCH messages every BCAST_DELAY ms
+#define BCAST_BATCH   5
+#define BCAST_DELAY   500
+
+// A broadcast still waiting for the helper script after this time (s)
+// is dropped: the script could not call back (no FIFO, no screen...)
+#define BCAST_EXPIRE  3600
+
+// A broadcast waiting for the helper script (recipients only), or
+// being sent (body set)
+struct bcast_T {
+  guint   id;
+  gchar **rcpt;       // NULL-terminated list of JIDs (local charset)
+  guint   next;       // Index of the next recipient to send to
+  gchar  *body;       // Message body, read once from the edited file
+  guint   srcno;      // Expiry, then pacing, timeout source
+};
+
+static GSList *bcast_list;
+static guint bcast_lastid;
+
+static optcache_t opt_script     = OPTCACHE_PATH("extsay_script_path", NULL);
+static optcache_t opt_split_win  = OPTCACHE_INT("extsay_split_win", 0);
+static optcache_t opt_win_height = OPTCACHE_INT("extsay_win_height", 0);
+static optcache_t opt_bc_batch   = OPTCACHE_INT("extsay_broadcast_batch",
+                                                BCAST_BATCH);
+static optcache_t opt_bc_delay   = OPTCACHE_INT("extsay_broadcast_delay",
+                                                BCAST_DELAY);
 
 // Run the external helper script with parameters
-static void screen_run_script(const gchar *args)
+static gboolean screen_run_script(const gchar *args)
 {
   GError *err = NULL;
   gchar *argv[] = { "screen", "-r", "-X", "screen", NULL,
                     NULL, NULL, NULL, NULL };
   gchar strwinheight[32];
-  gchar *fpath;
-  gboolean winsplit, ret;
+  const gchar *fpath;
+  gboolean ret;
 
   // screen -r -X screen $path/extsay.sh [jid [winsplit [height]]]
-  fpath = (gchar*)settings_opt_get("extsay_script_path");
+  fpath = optcache_str(&opt_script);
 
   // Helper script path
-  if (!fpath || !fpath[0]) {
+  if (!fpath) {
     scr_log_print(LPRINT_NORMAL, "Please set option 'extsay_script_path'.");
-    return;
+    return FALSE;
   }
-  fpath = expand_filename(fpath);
-  argv[4] = fpath;
+  argv[4] = (gchar*)fpath;
 
   // Helper script parameter #1
   if (args && *args)
@@ -80,9 +122,8 @@ static void screen_run_script(const gchar *args)
     argv[5] = ".";
 
   // Update parameters for the helper script
-  winsplit = settings_opt_get_int("extsay_split_win");
-  if (winsplit) {
-    gint winheight = settings_opt_get_int("extsay_win_height");
+  if (optcache_int(&opt_split_win)) {
+    gint winheight = optcache_int(&opt_win_height);
     argv[6] = "winsplit";       // Helper script parameter #2
     if (winheight > 0 && winheight < 256) {
       snprintf(strwinheight, sizeof strwinheight, "%d", winheight);
@@ -95,10 +136,195 @@ static void screen_run_script(const gchar *args)
                         G_SPAWN_STDOUT_TO_DEV_NULL|G_SPAWN_STDERR_TO_DEV_NULL,
                       NULL, NULL, NULL, &err);
 
-  if (!ret)
+  if (!ret) {
     scr_LogPrint(LPRINT_NORMAL, err->message);
+    g_error_free(err);
+  }
+  return ret;
+}
+
+static void bcast_free(struct bcast_T *bc)
+{
+  if (bc->srcno)
+    g_source_remove(bc->srcno);
+  g_strfreev(bc->rcpt);
+  g_free(bc->body);
+  g_free(bc);
+}
+
+static void bcast_drop(struct bcast_T *bc)
+{
+  bcast_list = g_slist_remove(bcast_list, bc);
+  bcast_free(bc);
+}
+
+static struct bcast_T *bcast_find(guint id)
+{
+  GSList *li;
+
+  for (li = bcast_list; li; li = g_slist_next(li)) {
+    struct bcast_T *bc = li->data;
+    if (bc->id == id)
+      return bc;
+  }
+  return NULL;
+}
+
+// Send the message to the next batch of recipients
+static gboolean bcast_send_cb(gpointer data)
+{
+  struct bcast_T *bc = data;
+  gint batch = optcache_int(&opt_bc_batch);
+  gint i;
+
+  if (batch <= 0)
+    batch = BCAST_BATCH;
+
+  for (i = 0; i < batch && bc->rcpt[bc->next]; i++, bc->next++) {
+    // say_to does the actual work (charset conversion, MUC detection,
+    // history, encryption...); the body is only copied into the command.
+    gchar *cmdline = g_strdup_printf("say_to -q %s %s",
+                                     bc->rcpt[bc->next], bc->body);
+    process_command(cmdline, TRUE);
+    g_free(cmdline);
+  }
+
+  if (bc->rcpt[bc->next])
+    return TRUE;  // More recipients to go
 
-  g_free(fpath);
+  scr_LogPrint(LPRINT_LOGNORM, "[extsay] Broadcast #%u sent to %u recipients.",
+               bc->id, bc->next);
+  bc->srcno = 0;
+  bcast_drop(bc);
+  return FALSE;
+}
+
+static gboolean bcast_expire_cb(gpointer data)
+{
+  struct bcast_T *bc = data;
+
+  scr_LogPrint(LPRINT_LOGNORM, "[extsay] Broadcast #%u cancelled, "
+               "no message after %u s.", bc->id, BCAST_EXPIRE);
+  bc->srcno = 0;
+  bcast_drop(bc);
+  return FALSE;
+}
+
+// Called back (through the FIFO) by the helper script once the message
+// has been written: "/extsay -s id file"; without a file, or with an
+// empty one, the broadcast is cancelled
+static void bcast_send(const gchar *args)
+{
+  struct bcast_T *bc;
+  gchar *endp, *fname, *body;
+  GError *err = NULL;
+  gint delay;
+  guint id;
+
+  id = (guint)strtoul(args, &endp, 10);
+  while (*endp == ' ')
+    endp++;
+  bc = bcast_find(id);
+  if (!bc || bc->body) {
+    scr_LogPrint(LPRINT_NORMAL, "[extsay] Unknown broadcast.");
+    return;
+  }
+  if (!*endp) {
+    scr_LogPrint(LPRINT_NORMAL, "[extsay] Broadcast #%u cancelled.", bc->id);
+    bcast_drop(bc);
+    return;
+  }
+
+  fname = expand_filename(endp);
+  if (!g_file_get_contents(fname, &body, NULL, &err)) {
+    scr_LogPrint(LPRINT_NORMAL, "[extsay] %s", err->message);
+    g_error_free(err);
+    g_free(fname);
+    bcast_drop(bc);
+    return;
+  }
+  g_free(fname);
+
+  // All the sends will share this body
+  bc->body = g_strchomp(body);
+  if (!*bc->body) {
+    scr_LogPrint(LPRINT_NORMAL, "[extsay] Empty message, broadcast cancelled.");
+    bcast_drop(bc);
+    return;
+  }
+  g_source_remove(bc->srcno);   // No expiry once the message is there
+  bc->srcno = 0;
+
+  delay = optcache_int(&opt_bc_delay);
+  if (delay <= 0)
+    delay = BCAST_DELAY;
+
+  // Send the first batch now, and pace the next ones
+  if (bcast_send_cb(bc))
+    bc->srcno = g_timeout_add(delay, bcast_send_cb, bc);
+}
+
+static void add_group_member(gpointer rosterdata, void *param)
+{
+  GPtrArray *rcpt = param;
+
+  if (buddy_gettype(rosterdata) &
+      (ROSTER_TYPE_USER|ROSTER_TYPE_AGENT|ROSTER_TYPE_ROOM))
+    g_ptr_array_add(rcpt, from_utf8(buddy_getjid(rosterdata)));
+}
+
+// "/extsay -g group" or "/extsay -m jid1 jid2..."
+static void bcast_prepare(const gchar *args)
+{
+  GPtrArray *rcpt = g_ptr_array_new();
+  struct bcast_T *bc;
+  gchar param[16];
+
+  if (!strncmp(args, "-g ", 3)) {
+    gchar *group = to_utf8(g_strstrip(g_strdup(args+3)));
+    GSList *sl_group = roster_find(group, namesearch, ROSTER_TYPE_GROUP);
+    if (sl_group)
+      foreach_group_member(sl_group->data, add_group_member, rcpt);
+    else
+      scr_LogPrint(LPRINT_NORMAL, "Group \"%s\" not found.", group);
+    g_free(group);
+  } else {
+    gchar **jids = g_strsplit_set(args+3, " ", 0);
+    gchar **p;
+    for (p = jids; *p; p++) {
+      gchar *jid_utf8;
+      if (!**p)
+        continue;
+      jid_utf8 = to_utf8(*p);
+      if (check_jid_syntax(jid_utf8))
+        scr_LogPrint(LPRINT_NORMAL, "Invalid Jabber ID: %s", *p);
+      else
+        g_ptr_array_add(rcpt, g_strdup(*p));
+      g_free(jid_utf8);
+    }
+    g_strfreev(jids);
+  }
+
+  if (!rcpt->len) {
+    scr_LogPrint(LPRINT_NORMAL, "No recipient.");
+    g_ptr_array_free(rcpt, TRUE);
+    return;
+  }
+  g_ptr_array_add(rcpt, NULL);
+
+  bc = g_new0(struct bcast_T, 1);
+  bc->id = ++bcast_lastid;
+  bc->rcpt = (gchar**)g_ptr_array_free(rcpt, FALSE);
+  bcast_list = g_slist_append(bcast_list, bc);
+
+  scr_LogPrint(LPRINT_NORMAL, "[extsay] Broadcast #%u: %u recipients.",
+               bc->id, g_strv_length(bc->rcpt));
+  snprintf(param, sizeof param, "%c%u", BCAST_PREFIX, bc->id);
+  // The script will call us back with "-s id"
+  if (screen_run_script(param))
+    bc->srcno = g_timeout_add_seconds(BCAST_EXPIRE, bcast_expire_cb, bc);
+  else
+    bcast_drop(bc);
 }
 
 static void do_extsay(gchar *args)
@@ -106,6 +332,18 @@ static void do_extsay(gchar *args)
   gboolean expandfjid = FALSE;
   gchar *fjid;
 
+  if (args && !strncmp(args, "-s ", 3)) {
+    bcast_send(args+3);
+    return;
+  }
+
+  // A roster group, or several recipients.  (Without -m, the argument
+  // is one JID, whose resource may contain spaces.)
+  if (args && (!strncmp(args, "-g ", 3) || !strncmp(args, "-m ", 3))) {
+    bcast_prepare(args);
+    return;
+  }
+
   if (args && !strncmp(args, "." JID_RESOURCE_SEPARATORSTR, 2))
     expandfjid = TRUE;
 
@@ -154,15 +392,29 @@ static void extsay_init(void)
   cmd_add("extsay", "Use external editor to write a message",
           COMPL_JID, 0, do_extsay, NULL);
 #endif
+  optcache_bind(&opt_script, NULL);
+  optcache_bind(&opt_split_win, NULL);
+  optcache_bind(&opt_win_height, NULL);
+  optcache_bind(&opt_bc_batch, NULL);
+  optcache_bind(&opt_bc_delay, NULL);
 }
 
 static void extsay_uninit(void)
 {
+  GSList *li;
+
 #ifdef MCABBER_API_HAVE_CMD_ID
   cmd_del(extsay_cmdid);
 #else
   cmd_del("extsay");
 #endif
+
+  // Drop pending broadcasts
+  for (li = bcast_list; li; li = g_slist_next(li))
+    bcast_free(li->data);
+  g_slist_free(bcast_list);
+  bcast_list = NULL;
+  optcache_unbind_all();
 }
 
 /* vim: set expandtab cindent cinoptions=>2\:2(0:  For Vim users... */
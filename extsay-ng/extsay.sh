@@ -7,6 +7,10 @@
 #
 # Usage: extsay.sh [jid [winsplit [height]]]
 #
+# If jid is "+N", the message is a broadcast prepared by the module:
+# the file is handed back to mcabber with "extsay -s N file", even if
+# it is empty, so that the module cancels the broadcast.
+#
 # This script is free software.
 # MiKael, 2010-04-03
 
@@ -26,7 +30,14 @@ jid="."
 # Leave if the FIFO is not available
 [ -p $FIFOPATH ] || exit 255
 
-tf=$(mktemp $tmpdir/extsay-${jid%%/*}-XXXXXX) || exit 255
+case $jid in
+    +*) bcast=${jid#+}; jid="broadcast" ;;
+esac
+
+if ! tf=$(mktemp $tmpdir/extsay-${jid%%/*}-XXXXXX); then
+    [ -n "$bcast" ] && echo "extsay -s $bcast" >> $FIFOPATH
+    exit 255
+fi
 
 if [ x$winsplit = x"winsplit" ]; then
     screen -r -X other
@@ -41,7 +52,9 @@ fi
 $editor $tf
 
 # Send the message using MCabber's pipe
-if [ -s $tf ]; then
+if [ -n "$bcast" ]; then
+    cmd="extsay -s $bcast $tf"
+elif [ -s $tf ]; then
     cmd="say_to -q -f $tf $jid"
 else
     cmd="echo [extsay] The file has not been modified.  Message cancelled."
@@ -0,0 +1,479 @@
+/*
+ *  Module "hookstats"  -- Hook handler call counts and latencies
+ *
+ *  The modules built with --enable-hookstats register their hook
+ *  handlers and their commands through this module (see hookstats.h),
+ *  which wraps them to count the calls and keep a latency histogram per
+ *  handler or command.  mcabber does not pass any data to a command
+ *  function, so a command is wrapped by one of HS_CMD_SLOTS functions;
+ *  the commands registered beyond that are not measured.
+ *
+ *  /hookstats [show]   Display the statistics
+ *  /hookstats reset    Reset the statistics
+ *  /hookstats on|off   Enable or disable the measurements
+ *  /hookstats init     Display the time taken by the modules init
+ *                      functions (see common/inittime.h)
+ *
+ *  When the measurements are disabled, the wrapper only costs an
+ *  indirect call.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+#include <mcabber/logprint.h>
+
+#define HOOKSTATS_MODULE
+#include "common/inittime.h"
+#include "hookstats.h"
+
+static void hookstats_init(void);
+static void hookstats_uninit(void);
+
+MODULE_TIMED_INIT(hookstats_init)
+
+/* Module description */
+module_info_t info_hookstats = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Hook handler call counts and latencies\n"
+                          " Provides the command /hookstats",
+        .requires       = NULL,
+        .init           = hookstats_init_timed,
+        .uninit         = hookstats_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer hookstats_cmdid;
+#endif
+
+// Log-linear latency histogram (in nanoseconds): each power of two is
+// split into HS_SUB buckets, i.e. the precision is about 12%.
+#define HS_SUB_BITS   3
+#define HS_SUB        (1 << HS_SUB_BITS)
+#define HS_MAX_MSB    40        // About 18 minutes
+#define HS_BUCKETS    ((HS_MAX_MSB - HS_SUB_BITS + 2) * HS_SUB)
+
+typedef struct {
+  hk_handler_t handler;
+  gpointer     userdata;
+  gchar       *name;
+  const gchar *hookname;        // "/command" for a command
+  guint        hid;
+  void       (*cmd)(char *);    // Command function, or NULL
+  guint        slot;
+  gpointer     cmdid;
+  guint64      calls;
+  guint64      total_ns;
+  guint64      max_ns;
+  guint32      hist[HS_BUCKETS];
+} hs_entry_t;
+
+static GSList *entries;
+static gboolean enabled = TRUE;
+
+// Longest call since the last hookstats_longest()
+static hs_entry_t *longest;
+static guint64 longest_ns;
+
+typedef struct {
+  gchar  *name;
+  gint64  usec;
+} hs_init_t;
+
+static GSList *init_times;
+
+static guint hs_bucket(guint64 v)
+{
+  guint msb;
+
+  if (v < HS_SUB)
+    return v;
+  msb = g_bit_nth_msf(v, -1);
+  if (msb > HS_MAX_MSB)
+    return HS_BUCKETS - 1;
+  return (msb - HS_SUB_BITS + 1) * HS_SUB +
+         ((v >> (msb - HS_SUB_BITS)) & (HS_SUB - 1));
+}
+
+// Upper bound of a bucket
+static guint64 hs_bucket_value(guint b)
+{
+  guint msb;
+
+  if (b < HS_SUB)
+    return b;
+  msb = b / HS_SUB - 1 + HS_SUB_BITS;
+  return (((guint64)(HS_SUB + b % HS_SUB) + 1) << (msb - HS_SUB_BITS)) - 1;
+}
+
+static guint64 hs_percentile(hs_entry_t *e, gdouble pct)
+{
+  guint64 rank = (guint64)(e->calls * pct / 100.), seen = 0;
+  guint b;
+
+  for (b = 0; b < HS_BUCKETS; b++) {
+    seen += e->hist[b];
+    if (seen > rank)
+      return MIN(hs_bucket_value(b), e->max_ns);
+  }
+  return e->max_ns;
+}
+
+static inline guint64 now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (guint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void hs_record(hs_entry_t *e, guint64 dt)
+{
+  e->calls++;
+  e->total_ns += dt;
+  if (dt > e->max_ns)
+    e->max_ns = dt;
+  e->hist[hs_bucket(dt)]++;
+  if (dt > longest_ns) {
+    longest = e;
+    longest_ns = dt;
+  }
+}
+
+static guint hs_wrapper(const gchar *hookname, hk_arg_t *args,
+                        gpointer userdata)
+{
+  hs_entry_t *e = userdata;
+  guint64 t0;
+  guint ret;
+
+  if (!enabled)
+    return e->handler(hookname, args, e->userdata);
+
+  t0 = now_ns();
+  ret = e->handler(hookname, args, e->userdata);
+  hs_record(e, now_ns() - t0);
+  return ret;
+}
+
+#define HS_CMD_SLOTS  64
+
+static hs_entry_t *cmd_slots[HS_CMD_SLOTS];
+
+static void hs_cmd_run(guint slot, char *args)
+{
+  hs_entry_t *e = cmd_slots[slot];
+  guint64 t0;
+
+  if (!enabled) {
+    e->cmd(args);
+    return;
+  }
+  t0 = now_ns();
+  e->cmd(args);
+  // The command may have unloaded its module
+  if (cmd_slots[slot] == e)
+    hs_record(e, now_ns() - t0);
+}
+
+#define HS_CMD(n)  static void hs_cmd_##n(char *args) { hs_cmd_run(n, args); }
+HS_CMD(0)  HS_CMD(1)  HS_CMD(2)  HS_CMD(3)  HS_CMD(4)  HS_CMD(5)  HS_CMD(6)
+HS_CMD(7)  HS_CMD(8)  HS_CMD(9)  HS_CMD(10) HS_CMD(11) HS_CMD(12) HS_CMD(13)
+HS_CMD(14) HS_CMD(15) HS_CMD(16) HS_CMD(17) HS_CMD(18) HS_CMD(19) HS_CMD(20)
+HS_CMD(21) HS_CMD(22) HS_CMD(23) HS_CMD(24) HS_CMD(25) HS_CMD(26) HS_CMD(27)
+HS_CMD(28) HS_CMD(29) HS_CMD(30) HS_CMD(31) HS_CMD(32) HS_CMD(33) HS_CMD(34)
+HS_CMD(35) HS_CMD(36) HS_CMD(37) HS_CMD(38) HS_CMD(39) HS_CMD(40) HS_CMD(41)
+HS_CMD(42) HS_CMD(43) HS_CMD(44) HS_CMD(45) HS_CMD(46) HS_CMD(47) HS_CMD(48)
+HS_CMD(49) HS_CMD(50) HS_CMD(51) HS_CMD(52) HS_CMD(53) HS_CMD(54) HS_CMD(55)
+HS_CMD(56) HS_CMD(57) HS_CMD(58) HS_CMD(59) HS_CMD(60) HS_CMD(61) HS_CMD(62)
+HS_CMD(63)
+#undef HS_CMD
+
+static void (*const hs_cmd_fn[HS_CMD_SLOTS])(char *) = {
+  hs_cmd_0,  hs_cmd_1,  hs_cmd_2,  hs_cmd_3,  hs_cmd_4,  hs_cmd_5,  hs_cmd_6,
+  hs_cmd_7,  hs_cmd_8,  hs_cmd_9,  hs_cmd_10, hs_cmd_11, hs_cmd_12, hs_cmd_13,
+  hs_cmd_14, hs_cmd_15, hs_cmd_16, hs_cmd_17, hs_cmd_18, hs_cmd_19, hs_cmd_20,
+  hs_cmd_21, hs_cmd_22, hs_cmd_23, hs_cmd_24, hs_cmd_25, hs_cmd_26, hs_cmd_27,
+  hs_cmd_28, hs_cmd_29, hs_cmd_30, hs_cmd_31, hs_cmd_32, hs_cmd_33, hs_cmd_34,
+  hs_cmd_35, hs_cmd_36, hs_cmd_37, hs_cmd_38, hs_cmd_39, hs_cmd_40, hs_cmd_41,
+  hs_cmd_42, hs_cmd_43, hs_cmd_44, hs_cmd_45, hs_cmd_46, hs_cmd_47, hs_cmd_48,
+  hs_cmd_49, hs_cmd_50, hs_cmd_51, hs_cmd_52, hs_cmd_53, hs_cmd_54, hs_cmd_55,
+  hs_cmd_56, hs_cmd_57, hs_cmd_58, hs_cmd_59, hs_cmd_60, hs_cmd_61, hs_cmd_62,
+  hs_cmd_63,
+};
+
+static void hs_entry_free(hs_entry_t *e)
+{
+  if (longest == e) {
+    longest = NULL;
+    longest_ns = 0;
+  }
+  if (e->cmd)
+    cmd_slots[e->slot] = NULL;
+  entries = g_slist_remove(entries, e);
+  g_free(e->name);
+  g_free(e);
+}
+
+gpointer hookstats_cmd_add(const char *name, const char *help, guint flags1,
+                           guint flags2, void (*f)(char*), gpointer userdata,
+                           const gchar *fname)
+{
+  gpointer id = NULL;
+  hs_entry_t *e;
+  gchar *hookname;
+  guint slot;
+
+  for (slot = 0; slot < HS_CMD_SLOTS && cmd_slots[slot]; slot++)
+    ;
+  if (slot == HS_CMD_SLOTS) {
+#ifdef MCABBER_API_HAVE_CMD_ID
+    return cmd_add(name, help, flags1, flags2, f, userdata);
+#else
+    cmd_add(name, help, flags1, flags2, f, userdata);
+    return NULL;
+#endif
+  }
+
+  e = g_new0(hs_entry_t, 1);
+  e->cmd  = f;
+  e->slot = slot;
+  e->name = g_strdup(fname);
+  hookname = g_strconcat("/", name, NULL);
+  e->hookname = g_intern_string(hookname);
+  g_free(hookname);
+  cmd_slots[slot] = e;
+  entries = g_slist_append(entries, e);
+#ifdef MCABBER_API_HAVE_CMD_ID
+  id = e->cmdid = cmd_add(name, help, flags1, flags2, hs_cmd_fn[slot],
+                          userdata);
+#else
+  cmd_add(name, help, flags1, flags2, hs_cmd_fn[slot], userdata);
+#endif
+  return id;
+}
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+gboolean hookstats_cmd_del(gpointer id)
+{
+  GSList *li;
+
+  for (li = entries; li; li = g_slist_next(li)) {
+    hs_entry_t *e = li->data;
+    if (e->cmd && e->cmdid == id) {
+      hs_entry_free(e);
+      break;
+    }
+  }
+  return cmd_del(id);
+}
+#else
+void hookstats_cmd_del(const char *name)
+{
+  GSList *li;
+
+  for (li = entries; li; li = g_slist_next(li)) {
+    hs_entry_t *e = li->data;
+    if (e->cmd && !strcmp(e->hookname + 1, name)) {
+      hs_entry_free(e);
+      break;
+    }
+  }
+  cmd_del(name);
+}
+#endif
+
+guint hookstats_add_handler(hk_handler_t handler, const gchar *hookname,
+                            gint priority, gpointer userdata,
+                            const gchar *name)
+{
+  hs_entry_t *e = g_new0(hs_entry_t, 1);
+
+  e->handler  = handler;
+  e->userdata = userdata;
+  e->name     = g_strdup(name);
+  e->hookname = g_intern_string(hookname);
+  e->hid      = hk_add_handler(hs_wrapper, hookname, priority, e);
+  entries = g_slist_append(entries, e);
+  return e->hid;
+}
+
+void hookstats_del_handler(const gchar *hookname, guint hid)
+{
+  GSList *li;
+
+  hk_del_handler(hookname, hid);
+  for (li = entries; li; li = g_slist_next(li)) {
+    hs_entry_t *e = li->data;
+    if (!e->cmd && e->hid == hid && !strcmp(e->hookname, hookname)) {
+      hs_entry_free(e);
+      return;
+    }
+  }
+}
+
+// Name and duration of the longest handler or command call since the
+// previous query, if any has been called (and measured)
+gboolean hookstats_longest(gchar *buf, gsize len, guint64 *ns)
+{
+  gboolean found = (longest != NULL);
+
+  if (found) {
+    g_snprintf(buf, len, "%s [%s]", longest->name, longest->hookname);
+    *ns = longest_ns;
+  }
+  longest = NULL;
+  longest_ns = 0;
+  return found;
+}
+
+void hookstats_init_time(const gchar *init, gint64 usec)
+{
+  GSList *li;
+  hs_init_t *it;
+
+  // A module loaded again replaces its previous time
+  for (li = init_times; li; li = g_slist_next(li)) {
+    it = li->data;
+    if (!strcmp(it->name, init)) {
+      it->usec = usec;
+      return;
+    }
+  }
+  it = g_new(hs_init_t, 1);
+  it->name = g_strdup(init);
+  it->usec = usec;
+  init_times = g_slist_append(init_times, it);
+}
+
+static void hs_show_init(void)
+{
+  GSList *li;
+  gint64 total = 0;
+
+  scr_log_print(LPRINT_NORMAL, "hookstats: module init times (ms)");
+  for (li = init_times; li; li = g_slist_next(li)) {
+    hs_init_t *it = li->data;
+    scr_log_print(LPRINT_NORMAL, " %-24s %8.3f", it->name, it->usec / 1e3);
+    total += it->usec;
+  }
+  scr_log_print(LPRINT_NORMAL, " %-24s %8.3f", "total", total / 1e3);
+}
+
+static void hs_show(void)
+{
+  GSList *li;
+
+  if (!entries) {
+    scr_log_print(LPRINT_NORMAL, "hookstats: no instrumented handler "
+                  "(modules must be built with --enable-hookstats).");
+    return;
+  }
+
+  scr_log_print(LPRINT_NORMAL, "hookstats%s: calls, average/p50/p99/max "
+                "latency (us)", enabled ? "" : " (disabled)");
+  for (li = entries; li; li = g_slist_next(li)) {
+    hs_entry_t *e = li->data;
+    if (!e->calls) {
+      scr_log_print(LPRINT_NORMAL, " %s [%s]: no call", e->name, e->hookname);
+      continue;
+    }
+    scr_log_print(LPRINT_NORMAL, " %s [%s]: %" G_GUINT64_FORMAT
+                  ", %.1f/%.1f/%.1f/%.1f", e->name, e->hookname, e->calls,
+                  e->total_ns / 1e3 / e->calls,
+                  hs_percentile(e, 50.) / 1e3, hs_percentile(e, 99.) / 1e3,
+                  e->max_ns / 1e3);
+  }
+}
+
+static void hs_reset(void)
+{
+  GSList *li;
+
+  for (li = entries; li; li = g_slist_next(li)) {
+    hs_entry_t *e = li->data;
+    e->calls = e->total_ns = e->max_ns = 0;
+    memset(e->hist, 0, sizeof e->hist);
+  }
+}
+
+static void do_hookstats(char *args)
+{
+  if (!*args || !strcmp(args, "show")) {
+    hs_show();
+  } else if (!strcmp(args, "reset")) {
+    hs_reset();
+  } else if (!strcmp(args, "on")) {
+    enabled = TRUE;
+  } else if (!strcmp(args, "off")) {
+    enabled = FALSE;
+  } else if (!strcmp(args, "init")) {
+    hs_show_init();
+  } else {
+    scr_log_print(LPRINT_NORMAL, "Usage: /hookstats [show|reset|on|off|"
+                  "init]");
+  }
+}
+
+/* Initialization */
+static void hookstats_init(void)
+{
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  hookstats_cmdid = cmd_add("hookstats", "Hook handler statistics", 0, 0,
+                            do_hookstats, NULL);
+#else
+  cmd_add("hookstats", "Hook handler statistics", 0, 0, do_hookstats, NULL);
+#endif
+}
+
+/* Uninitialization */
+static void hookstats_uninit(void)
+{
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(hookstats_cmdid);
+#else
+  cmd_del("hookstats");
+#endif
+  // The modules requiring hookstats have been unloaded, and have removed
+  // their handlers and commands; free the remaining entries anyway.
+  while (entries) {
+    hs_entry_t *e = entries->data;
+    if (!e->cmd)
+      hookstats_del_handler(e->hookname, e->hid);
+#ifdef MCABBER_API_HAVE_CMD_ID
+    else
+      hookstats_cmd_del(e->cmdid);
+#else
+    else
+      hookstats_cmd_del(e->hookname + 1);
+#endif
+  }
+  while (init_times) {
+    hs_init_t *it = init_times->data;
+    g_free(it->name);
+    g_free(it);
+    init_times = g_slist_delete_link(init_times, init_times);
+  }
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
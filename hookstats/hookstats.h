@@ -0,0 +1,64 @@
+/*
+ *  hookstats.h     -- Hook handler instrumentation
+ *
+ *  Modules include this header after <mcabber/hooks.h>.  When the
+ *  modules are built with --enable-hookstats (MODULES_HOOKSTATS), their
+ *  hook handlers and commands are registered through the hookstats
+ *  module, which counts the calls and records their latency (see
+ *  /hookstats), and HOOKSTATS_LONGEST() tells which handler or command
+ *  call was the longest since the previous query (see the clock module
+ *  stall detection).
+ *  Otherwise this header does nothing, and HOOKSTATS_LONGEST() is
+ *  FALSE.
+ *
+ *  Modules using it must set ".requires = MODULE_REQUIRES" in their
+ *  module description (see common/requires.h).
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HOOKSTATS_H__
+#define __HOOKSTATS_H__ 1
+
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+
+guint hookstats_add_handler(hk_handler_t handler, const gchar *hookname,
+                            gint priority, gpointer userdata,
+                            const gchar *name);
+void  hookstats_del_handler(const gchar *hookname, guint hid);
+gpointer hookstats_cmd_add(const char *name, const char *help, guint flags1,
+                           guint flags2, void (*f)(char*), gpointer userdata,
+                           const gchar *fname);
+#ifdef MCABBER_API_HAVE_CMD_ID
+gboolean hookstats_cmd_del(gpointer id);
+#else
+void     hookstats_cmd_del(const char *name);
+#endif
+void  hookstats_init_time(const gchar *init, gint64 usec);
+gboolean hookstats_longest(gchar *buf, gsize len, guint64 *ns);
+
+#if defined MODULES_HOOKSTATS && !defined HOOKSTATS_MODULE
+# define hk_add_handler(handler, hookname, priority, userdata) \
+         hookstats_add_handler(handler, hookname, priority, userdata, #handler)
+# define hk_del_handler hookstats_del_handler
+# define cmd_add(name, help, flags1, flags2, f, userdata) \
+         hookstats_cmd_add(name, help, flags1, flags2, f, userdata, #f)
+# define cmd_del hookstats_cmd_del
+# define HOOKSTATS_LONGEST(buf, len, ns)  hookstats_longest(buf, len, ns)
+#else
+# define HOOKSTATS_LONGEST(buf, len, ns)  ((void)(buf), (void)(ns), FALSE)
+#endif
+
+#endif /* __HOOKSTATS_H__ */
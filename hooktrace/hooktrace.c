@@ -0,0 +1,361 @@
+/*
+ *  Module "hooktrace"  -- Record hook events to a trace file
+ *
+ *  This module records the hook events (with their timestamps and
+ *  arguments) to a compact binary trace file, see hooktrace.h for the
+ *  format.  The trace can be replayed offline with the mock host
+ *  (mockhost/mcabber-replay), to reproduce and benchmark a real flood.
+ *
+ *  /hooktrace start [file]
+ *  /hooktrace stop
+ *  /hooktrace flush
+ *  /hooktrace [status]
+ *
+ *  Options:
+ *  - hooktrace_file: string
+ *    Trace file path; if set when the module is loaded, recording
+ *    starts immediately.  The trace is appended to an existing trace
+ *    file of the same version; any other existing file is left alone.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+#include <mcabber/logprint.h>
+#include <mcabber/settings.h>
+#include <mcabber/utils.h>
+
+#include "common/inittime.h"
+#include "common/requires.h"
+#include "hookstats/hookstats.h"
+#include "hooktrace.h"
+
+static void hooktrace_init(void);
+static void hooktrace_uninit(void);
+
+MODULE_TIMED_INIT(hooktrace_init)
+
+/* Module description */
+module_info_t info_hooktrace = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Record hook events to a trace file\n"
+                          " Provides the command /hooktrace",
+        .requires       = MODULE_REQUIRES,
+        .init           = hooktrace_init_timed,
+        .uninit         = hooktrace_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer hooktrace_cmdid;
+#endif
+
+#define WBUF_SIZE       65536
+#define FLUSH_INTERVAL  1       // seconds
+
+static int trace_fd = -1;
+static gchar *trace_path;
+static guint hook_hid[G_N_ELEMENTS(hooktrace_hooks)];
+static guint flush_srcno, stop_srcno;
+
+// Buffered writer
+static guchar wbuf[WBUF_SIZE];
+static gsize wlen;
+
+static guint64 nrecords, nbytes;
+static gboolean trace_failed;
+
+static void trace_stop(void);
+
+static gboolean stop_idle_cb(gpointer data)
+{
+  stop_srcno = 0;
+  trace_stop();
+  return FALSE;
+}
+
+// Write errors can happen while a hook is being dispatched, so the
+// handlers are removed later, from the main loop.
+static void trace_error(void)
+{
+  if (!trace_failed)
+    stop_srcno = g_idle_add(stop_idle_cb, NULL);
+  trace_failed = TRUE;
+}
+
+static gboolean write_all(const guchar *buf, gsize len)
+{
+  while (len) {
+    ssize_t n = write(trace_fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      scr_log_print(LPRINT_LOGNORM, "hooktrace: write error (%s), "
+                    "recording stopped.", g_strerror(errno));
+      return FALSE;
+    }
+    buf += n;
+    len -= n;
+    nbytes += n;
+  }
+  return TRUE;
+}
+
+static gboolean trace_flush(void)
+{
+  gboolean ret;
+
+  if (!wlen || trace_fd < 0 || trace_failed)
+    return TRUE;
+  ret = write_all(wbuf, wlen);
+  wlen = 0;
+  return ret;
+}
+
+static gboolean flush_cb(gpointer data)
+{
+  if (trace_flush())
+    return TRUE;
+  flush_srcno = 0;
+  trace_stop();
+  return FALSE;
+}
+
+static guchar *put_string(guchar *p, const gchar *s, gsize len, gsize lensize)
+{
+  if (lensize == 1) {
+    *p++ = len;
+  } else {
+    hooktrace_put_u16(p, s ? len : HOOKTRACE_NULL_VALUE);
+    p += 2;
+  }
+  if (s && len) {
+    memcpy(p, s, len);
+    p += len;
+  }
+  return p;
+}
+
+static guint trace_hh(const gchar *hookname, hk_arg_t *args,
+                      gpointer userdata)
+{
+  guint hookidx = GPOINTER_TO_UINT(userdata);
+  gsize hlen = 0, size, nlen[HOOKTRACE_MAX_ARGS], vlen[HOOKTRACE_MAX_ARGS];
+  guchar *rec, *p;
+  guint i, nargs;
+
+  if (trace_failed)
+    return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+
+  // Compute the record size
+  size = 8 + 1 + 1;
+  if (hookidx == HOOKTRACE_HOOK_OTHER) {
+    hlen = MIN(strlen(hookname), 255);
+    size += 1 + hlen;
+  }
+  for (nargs = 0; args[nargs].name && nargs < HOOKTRACE_MAX_ARGS; nargs++) {
+    nlen[nargs] = MIN(strlen(args[nargs].name), 255);
+    vlen[nargs] = args[nargs].value ?
+                  MIN(strlen(args[nargs].value), HOOKTRACE_NULL_VALUE-1) : 0;
+    size += 1 + nlen[nargs] + 2 + vlen[nargs];
+  }
+
+  // Make room in the buffer; huge records bypass it
+  if (wlen + 4 + size > WBUF_SIZE && !trace_flush()) {
+    trace_error();
+    return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+  }
+  rec = (4 + size > WBUF_SIZE) ? g_malloc(4 + size) : wbuf + wlen;
+
+  p = rec;
+  hooktrace_put_u32(p, size);
+  hooktrace_put_u64(p+4, g_get_real_time());
+  p += 12;
+  *p++ = hookidx;
+  if (hookidx == HOOKTRACE_HOOK_OTHER)
+    p = put_string(p, hookname, hlen, 1);
+  *p++ = nargs;
+  for (i = 0; i < nargs; i++) {
+    p = put_string(p, args[i].name, nlen[i], 1);
+    p = put_string(p, args[i].value, vlen[i], 2);
+  }
+  nrecords++;
+
+  if (rec == wbuf + wlen) {
+    wlen += 4 + size;
+  } else {
+    gboolean ok = write_all(rec, 4 + size);
+    g_free(rec);
+    if (!ok)
+      trace_error();
+  }
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static void trace_start(const gchar *path)
+{
+  guchar hdr[HOOKTRACE_HEADER_SIZE];
+  struct stat st;
+  guint i;
+
+  if (trace_fd >= 0) {
+    scr_log_print(LPRINT_NORMAL, "hooktrace: already recording to %s.",
+                  trace_path);
+    return;
+  }
+
+  trace_path = expand_filename(path);
+  trace_fd = open(trace_path, O_RDWR|O_CREAT|O_APPEND, S_IRUSR|S_IWUSR);
+  if (trace_fd < 0 || fstat(trace_fd, &st) < 0) {
+    scr_log_print(LPRINT_NORMAL, "hooktrace: cannot open %s (%s).",
+                  trace_path, g_strerror(errno));
+    goto fail;
+  }
+
+  if (st.st_size == 0) {
+    // New file: write the header
+    memcpy(hdr, HOOKTRACE_MAGIC, 4);
+    hooktrace_put_u16(hdr+4, HOOKTRACE_VERSION);
+    hooktrace_put_u16(hdr+6, 0);
+    if (!write_all(hdr, sizeof hdr))
+      goto fail;
+  } else if (pread(trace_fd, hdr, sizeof hdr, 0) != sizeof hdr ||
+             memcmp(hdr, HOOKTRACE_MAGIC, 4) ||
+             hooktrace_get_u16(hdr+4) != HOOKTRACE_VERSION) {
+    // Do not append to another file, or to a trace the replay would
+    // reject
+    scr_log_print(LPRINT_NORMAL, "hooktrace: %s is not a version %d "
+                  "trace, not recording.", trace_path, HOOKTRACE_VERSION);
+    goto fail;
+  }
+
+  trace_failed = FALSE;
+
+  // Record before the other handlers, which may drop the event
+  for (i = 0; hooktrace_hooks[i]; i++)
+    hook_hid[i] = hk_add_handler(trace_hh, hooktrace_hooks[i],
+                                 G_PRIORITY_HIGH, GUINT_TO_POINTER(i));
+  flush_srcno = g_timeout_add_seconds(FLUSH_INTERVAL, flush_cb, NULL);
+  scr_log_print(LPRINT_NORMAL, "hooktrace: recording to %s.", trace_path);
+  return;
+
+fail:
+  if (trace_fd >= 0)
+    close(trace_fd);
+  trace_fd = -1;
+  g_free(trace_path);
+  trace_path = NULL;
+}
+
+static void trace_stop(void)
+{
+  guint i;
+
+  if (trace_fd < 0)
+    return;
+
+  for (i = 0; hooktrace_hooks[i]; i++)
+    hk_del_handler(hooktrace_hooks[i], hook_hid[i]);
+  if (flush_srcno)
+    g_source_remove(flush_srcno);
+  if (stop_srcno)
+    g_source_remove(stop_srcno);
+  flush_srcno = stop_srcno = 0;
+
+  trace_flush();
+  close(trace_fd);
+  trace_fd = -1;
+  wlen = 0;
+  trace_failed = FALSE;
+  g_free(trace_path);
+  trace_path = NULL;
+}
+
+static void do_hooktrace(char *args)
+{
+  if (!strncmp(args, "start", 5) && (!args[5] || args[5] == ' ')) {
+    const gchar *path = args + 5;
+    while (*path == ' ')
+      path++;
+    if (!*path)
+      path = settings_opt_get("hooktrace_file");
+    if (!path || !*path) {
+      scr_log_print(LPRINT_NORMAL, "hooktrace: please specify a file name "
+                    "or set option 'hooktrace_file'.");
+      return;
+    }
+    trace_start(path);
+  } else if (!strcmp(args, "stop")) {
+    if (trace_fd >= 0)
+      scr_log_print(LPRINT_NORMAL, "hooktrace: recording stopped.");
+    trace_stop();
+  } else if (!strcmp(args, "flush")) {
+    if (!trace_flush())
+      trace_stop();
+  } else if (!*args || !strcmp(args, "status")) {
+    if (trace_fd >= 0)
+      scr_log_print(LPRINT_NORMAL, "hooktrace: recording to %s, "
+                    "%" G_GUINT64_FORMAT " events, %" G_GUINT64_FORMAT
+                    " bytes written, %" G_GSIZE_FORMAT " bytes buffered.",
+                    trace_path, nrecords, nbytes, wlen);
+    else
+      scr_log_print(LPRINT_NORMAL, "hooktrace: not recording "
+                    "(%" G_GUINT64_FORMAT " events recorded).", nrecords);
+  } else {
+    scr_log_print(LPRINT_NORMAL, "Usage: /hooktrace [start [file]|stop|"
+                  "flush|status]");
+  }
+}
+
+/* Initialization */
+static void hooktrace_init(void)
+{
+  const gchar *path;
+
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  hooktrace_cmdid = cmd_add("hooktrace", "Record hook events", 0, 0,
+                            do_hooktrace, NULL);
+#else
+  cmd_add("hooktrace", "Record hook events", 0, 0, do_hooktrace, NULL);
+#endif
+
+  path = settings_opt_get("hooktrace_file");
+  if (path && *path)
+    trace_start(path);
+}
+
+/* Uninitialization */
+static void hooktrace_uninit(void)
+{
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(hooktrace_cmdid);
+#else
+  cmd_del("hooktrace");
+#endif
+  trace_stop();
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
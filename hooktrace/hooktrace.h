@@ -0,0 +1,90 @@
+/*
+ *  hooktrace.h     -- Hook trace file format
+ *
+ *  Shared by the hooktrace module (writer) and the mock host replay
+ *  tool (reader).
+ *
+ *  File header: "MCHT", u16 version, u16 reserved.
+ *  Then one record per event, all integers are little endian:
+ *    u32 size        size of the rest of the record
+ *    u64 time        microseconds since the Epoch
+ *    u8  hook        index in hooktrace_hooks[], or HOOKTRACE_HOOK_OTHER
+ *    [u8 len, name]  hook name, only for HOOKTRACE_HOOK_OTHER
+ *    u8  nargs
+ *    nargs times:
+ *      u8  len, name
+ *      u16 len, value  (len HOOKTRACE_NULL_VALUE for a NULL value)
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HOOKTRACE_H__
+#define __HOOKTRACE_H__ 1
+
+#include <glib.h>
+#include <mcabber/hooks.h>
+
+#define HOOKTRACE_MAGIC         "MCHT"
+#define HOOKTRACE_VERSION       1
+#define HOOKTRACE_HEADER_SIZE   8
+
+#define HOOKTRACE_HOOK_OTHER    0xff
+#define HOOKTRACE_NULL_VALUE    0xffff
+#define HOOKTRACE_MAX_ARGS      32
+
+// Hooks recorded by the module; the index is stored in the trace, so
+// new hooks must be added at the end.
+static const gchar * const hooktrace_hooks[] = {
+  HOOK_POST_MESSAGE_IN,
+  HOOK_SUBSCRIPTION,
+  HOOK_UNREAD_LIST_CHANGE,
+  HOOK_MDR_RECEIVED,
+  HOOK_MY_STATUS_CHANGE,
+  NULL
+};
+
+static inline void hooktrace_put_u16(guchar *p, guint16 v)
+{
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static inline void hooktrace_put_u32(guchar *p, guint32 v)
+{
+  hooktrace_put_u16(p, v & 0xffff);
+  hooktrace_put_u16(p+2, v >> 16);
+}
+
+static inline void hooktrace_put_u64(guchar *p, guint64 v)
+{
+  hooktrace_put_u32(p, v & 0xffffffff);
+  hooktrace_put_u32(p+4, v >> 32);
+}
+
+static inline guint16 hooktrace_get_u16(const guchar *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline guint32 hooktrace_get_u32(const guchar *p)
+{
+  return hooktrace_get_u16(p) | ((guint32)hooktrace_get_u16(p+2) << 16);
+}
+
+static inline guint64 hooktrace_get_u64(const guchar *p)
+{
+  return hooktrace_get_u32(p) | ((guint64)hooktrace_get_u32(p+4) << 32);
+}
+
+#endif /* __HOOKTRACE_H__ */
@@ -0,0 +1,1122 @@
+/*
+ *  Module "hsearch"    -- Indexed search in the history files
+ *
+ *  This module keeps a trigram index of the messages stored in the
+ *  mcabber history files (option logging_dir), so that searching years
+ *  of history does not mean reading all of it.  The index file is
+ *  memory-mapped; the messages logged since it was written are indexed
+ *  in memory, from the end of the history files, when a message is
+ *  received or sent, and are merged into the file from time to time.
+ *
+ *  The index is built in the background, from the main loop, the first
+ *  time the module is used; it is written whenever the postings in
+ *  memory reach the size of the index file, so that each write at least
+ *  doubles it, and once more at the end (see hsearch.h for the format).
+ *  Every hit is checked against the history file, so an index that is
+ *  out of date cannot give wrong results; if a history file gets
+ *  shorter, use /hsearch rebuild.  The search is a substring search,
+ *  case-insensitive for ASCII letters.
+ *
+ *  Options:
+ *  - hsearch_index: string (default: "~/.mcabber/hsearch.idx")
+ *  - hsearch_max: integer (default: 20)
+ *    Maximum number of hits displayed, the most recent first.
+ *
+ *  /hsearch [-j jid] text      Search the history
+ *  /hsearch status             Display the index status
+ *  /hsearch rebuild            Build the index again
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+#include <mcabber/logprint.h>
+#include <mcabber/settings.h>
+#include <mcabber/utils.h>
+
+#include "common/hkargs.h"
+#include "common/inittime.h"
+#include "common/requires.h"
+#include "hookstats/hookstats.h"
+#include "hsearch.h"
+
+static void hsearch_init(void);
+static void hsearch_uninit(void);
+
+MODULE_TIMED_INIT(hsearch_init)
+
+/* Module description */
+module_info_t info_hsearch = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Indexed search in the history files\n"
+                          " Provides the command /hsearch",
+        .requires       = MODULE_REQUIRES,
+        .init           = hsearch_init_timed,
+        .uninit         = hsearch_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer hsearch_cmdid;
+#endif
+
+#define DEFAULT_INDEX       "~/.mcabber/hsearch.idx"
+#define DEFAULT_HISTODIR    "~/.mcabber/histo/"
+#define DEFAULT_MAX_HITS    20
+
+#define DELTA_MAX           (16 << 20)  // Postings kept in memory (bytes)
+#define BUILD_DELTA_MAX     (256 << 20) // Same during the build (at most)
+#define BUILD_STEP          (256 << 10) // History bytes indexed per idle call
+#define READ_CHUNK          (1 << 20)
+#define MAX_RECORD          (64 << 10)  // Longest message checked entirely
+#define MAX_LISTS           4           // Posting lists intersected
+#define MAX_CANDIDATES      100000
+
+// A history record: "MR 20200308T10:11:12Z 002 text", then the number of
+// continuation lines given by the 3 digits.
+#define HLOG_TEXT           26
+#define HLOG_TIME           3
+#define HLOG_TIME_LEN       18
+
+typedef struct {
+  gchar   *name;                // File name, i.e. the bare JID
+  guint64  indexed;             // Bytes indexed
+  gboolean queued;              // Waiting for the background build
+} hfile_t;
+
+// Postings added since the index file was written
+typedef struct {
+  guint64     first, last;
+  guint32     count;
+  GByteArray *rest;             // Deltas after the first document
+} dpost_t;
+
+static struct {
+  guchar             *map;
+  gsize               len;
+  const idx_header_t *hdr;
+  const guint64      *docs;
+  const idx_tri_t    *tri;
+  const guchar       *post;
+} base;
+
+static GPtrArray  *files;       // hfile_t, by file number
+static GHashTable *file_ids;    // name -> file number + 1
+static GHashTable *delta;       // trigram -> dpost_t
+static GArray     *delta_docs;  // guint64, after the base documents
+static gsize       delta_bytes;
+
+static gboolean started;
+static gchar *index_path, *histo_dir;
+static GQueue build_queue;      // File numbers
+static guint build_srcno;
+static gint64 build_start;
+static guint64 build_bytes;
+static gsize build_limit;       // Postings written above this, in the build
+
+static guint message_in_hid, message_out_hid;
+
+/* Helpers */
+
+static guchar fold_table[256];
+
+static void fold_table_init(void)
+{
+  guint c;
+
+  for (c = 0; c < 256; c++)
+    fold_table[c] = c == '\n' ? ' ' : g_ascii_tolower(c);
+}
+
+static inline guchar fold(guchar c)
+{
+  return fold_table[c];
+}
+
+static inline guint32 trigram(const guchar *p)
+{
+  return (guint32)fold(p[0]) << 16 | (guint32)fold(p[1]) << 8 | fold(p[2]);
+}
+
+static void put_varint(GByteArray *buf, guint64 v)
+{
+  guint8 b[10];
+  guint n = 0;
+
+  while (v >= 0x80) {
+    b[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  b[n++] = v;
+  g_byte_array_append(buf, b, n);
+}
+
+static inline guint64 ndocs_base(void)
+{
+  return base.hdr ? base.hdr->ndocs : 0;
+}
+
+static guint64 doc_get(guint64 doc)
+{
+  if (doc < ndocs_base())
+    return base.docs[doc];
+  return g_array_index(delta_docs, guint64, doc - ndocs_base());
+}
+
+static const idx_tri_t *base_find(guint32 tri)
+{
+  guint lo = 0, hi = base.hdr ? base.hdr->ntri : 0;
+
+  while (lo < hi) {
+    guint mid = (lo + hi) / 2;
+    if (base.tri[mid].tri < tri)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (base.hdr && lo < base.hdr->ntri && base.tri[lo].tri == tri)
+    return &base.tri[lo];
+  return NULL;
+}
+
+static guint32 file_id(const gchar *name, gboolean add)
+{
+  gpointer id = g_hash_table_lookup(file_ids, name);
+  hfile_t *f;
+
+  if (id || !add)
+    return GPOINTER_TO_UINT(id);
+  f = g_new0(hfile_t, 1);
+  f->name = g_strdup(name);
+  g_ptr_array_add(files, f);
+  g_hash_table_insert(file_ids, f->name, GUINT_TO_POINTER(files->len));
+  return files->len;
+}
+
+static void hfile_free(hfile_t *f)
+{
+  g_free(f->name);
+  g_free(f);
+}
+
+static gchar *file_path(const hfile_t *f)
+{
+  return g_build_filename(histo_dir, f->name, NULL);
+}
+
+/* Indexing */
+
+static void dpost_free(dpost_t *d)
+{
+  g_byte_array_free(d->rest, TRUE);
+  g_free(d);
+}
+
+static int tri_cmp(const void *a, const void *b)
+{
+  guint32 ta = *(const guint32 *)a, tb = *(const guint32 *)b;
+  return (ta > tb) - (ta < tb);
+}
+
+static void index_doc(guint32 fileno, guint64 offset, const guchar *text,
+                      gsize len)
+{
+  guint32 stack[512], *tris = stack;
+  guint64 doc = ndocs_base() + delta_docs->len, packed;
+  gsize i, n = 0;
+
+  if (len < 3)
+    return;
+  packed = DOC_PACK(fileno, offset);
+  g_array_append_val(delta_docs, packed);
+  delta_bytes += sizeof packed;
+
+  if (len - 2 > G_N_ELEMENTS(stack))
+    tris = g_new(guint32, len - 2);
+  for (i = 0; i + 2 < len; i++)
+    tris[n++] = trigram(text + i);
+  qsort(tris, n, sizeof *tris, tri_cmp);
+
+  for (i = 0; i < n; i++) {
+    dpost_t *d;
+    if (i && tris[i] == tris[i-1])
+      continue;
+    d = g_hash_table_lookup(delta, GUINT_TO_POINTER(tris[i]));
+    if (!d) {
+      d = g_new0(dpost_t, 1);
+      d->first = doc;
+      d->rest = g_byte_array_new();
+      g_hash_table_insert(delta, GUINT_TO_POINTER(tris[i]), d);
+      delta_bytes += sizeof *d + 16;
+    } else {
+      guint before = d->rest->len;
+      put_varint(d->rest, doc - d->last);
+      delta_bytes += d->rest->len - before;
+    }
+    d->last = doc;
+    d->count++;
+  }
+  if (tris != stack)
+    g_free(tris);
+}
+
+// Index the complete records of a buffer read at offset; returns the
+// number of bytes used
+static gsize index_buffer(guint32 fileno, guint64 offset, const guchar *buf,
+                          gsize len)
+{
+  gsize pos = 0;
+
+  while (pos < len) {
+    const guchar *rec = buf + pos, *end = buf + len, *p;
+    guint lines;
+
+    p = memchr(rec, '\n', end - rec);
+    if (!p)
+      break;
+    if (p - rec < HLOG_TEXT || rec[21] != ' ' || rec[25] != ' ' ||
+        !g_ascii_isdigit(rec[22]) || !g_ascii_isdigit(rec[23]) ||
+        !g_ascii_isdigit(rec[24])) {
+      pos = p + 1 - buf;        // Not a record, skip the line
+      continue;
+    }
+    // Continuation lines
+    lines = (rec[22] - '0') * 100 + (rec[23] - '0') * 10 + rec[24] - '0';
+    while (lines && p && p + 1 < end) {
+      p = memchr(p + 1, '\n', end - p - 1);
+      lines--;
+    }
+    if (lines || !p)
+      break;                    // Incomplete
+
+    if (rec[0] == 'M')
+      index_doc(fileno, offset + pos, rec + HLOG_TEXT, p - rec - HLOG_TEXT);
+    pos = p + 1 - buf;
+  }
+  return pos;
+}
+
+static void index_save(void);
+
+// Index the new records of a history file, at most max_bytes of them;
+// returns TRUE if there is more to index
+static gboolean index_file(guint32 fileno, gsize max_bytes)
+{
+  hfile_t *f = g_ptr_array_index(files, fileno - 1);
+  gchar *path = file_path(f);
+  gsize bufsize = READ_CHUNK, done = 0;
+  guchar *buf;
+  gboolean more;
+  struct stat st;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  g_free(path);
+  if (fd < 0 || fstat(fd, &st) < 0 || (guint64)st.st_size <= f->indexed) {
+    if (fd >= 0)
+      close(fd);
+    return FALSE;
+  }
+
+  buf = g_malloc(bufsize);
+  while (done < max_bytes && f->indexed < (guint64)st.st_size) {
+    ssize_t n = pread(fd, buf, bufsize, f->indexed);
+    gsize used;
+
+    if (n <= 0)
+      break;
+    used = index_buffer(fileno, f->indexed, buf, n);
+    if (!used) {
+      // A record larger than the buffer, or an incomplete one at the end
+      if ((gsize)n < bufsize || bufsize >= 64 * READ_CHUNK)
+        break;
+      bufsize *= 2;
+      buf = g_realloc(buf, bufsize);
+      continue;
+    }
+    f->indexed += used;
+    done += used;
+    build_bytes += used;
+  }
+  more = done >= max_bytes && f->indexed < (guint64)st.st_size;
+  g_free(buf);
+  close(fd);
+  return more;
+}
+
+/* Index file */
+
+static void base_unmap(void)
+{
+  if (base.map)
+    munmap(base.map, base.len);
+  memset(&base, 0, sizeof base);
+}
+
+static void index_reset(void)
+{
+  base_unmap();
+  g_hash_table_remove_all(delta);
+  g_array_set_size(delta_docs, 0);
+  delta_bytes = 0;
+  g_hash_table_remove_all(file_ids);
+  g_ptr_array_set_size(files, 0);
+}
+
+static gboolean index_load(void)
+{
+  const idx_header_t *hdr;
+  const guchar *p, *end;
+  struct stat st;
+  guint32 i;
+  int fd;
+
+  fd = open(index_path, O_RDONLY);
+  if (fd < 0)
+    return FALSE;
+  if (fstat(fd, &st) < 0 || (gsize)st.st_size < sizeof(idx_header_t)) {
+    close(fd);
+    return FALSE;
+  }
+  base.len = st.st_size;
+  base.map = mmap(NULL, base.len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base.map == MAP_FAILED) {
+    memset(&base, 0, sizeof base);
+    return FALSE;
+  }
+
+  hdr = (const idx_header_t *)base.map;
+  if (memcmp(hdr->magic, IDX_MAGIC, 4) || hdr->version != IDX_VERSION ||
+      hdr->size != base.len || hdr->files_off > hdr->docs_off ||
+      hdr->docs_off + hdr->ndocs * sizeof(guint64) > hdr->post_off ||
+      hdr->post_off > hdr->tri_off ||
+      hdr->tri_off + (guint64)hdr->ntri * sizeof(idx_tri_t) > base.len ||
+      hdr->docs_off % 8 || hdr->tri_off % 8)
+    goto invalid;
+
+  p = base.map + hdr->files_off;
+  end = base.map + hdr->docs_off;
+  for (i = 0; i < hdr->nfiles; i++) {
+    guint64 indexed;
+    guint32 len;
+    gchar *name;
+
+    if (end - p < 12)
+      goto invalid;
+    memcpy(&indexed, p, 8);
+    memcpy(&len, p + 8, 4);
+    p += 12;
+    if ((gsize)(end - p) < len || !len)
+      goto invalid;
+    name = g_strndup((const gchar *)p, len);
+    p += len;
+    p += (8 - (p - base.map) % 8) % 8;
+    if (file_id(name, TRUE) != i + 1) {
+      g_free(name);
+      goto invalid;
+    }
+    ((hfile_t *)g_ptr_array_index(files, i))->indexed = indexed;
+    g_free(name);
+  }
+
+  base.hdr  = hdr;
+  base.docs = (const guint64 *)(base.map + hdr->docs_off);
+  base.post = base.map + hdr->post_off;
+  base.tri  = (const idx_tri_t *)(base.map + hdr->tri_off);
+  return TRUE;
+
+invalid:
+  scr_log_print(LPRINT_LOGNORM, "hsearch: invalid index %s, rebuilding it.",
+                index_path);
+  index_reset();
+  return FALSE;
+}
+
+static gboolean write_pad(FILE *fp, guint64 *pos)
+{
+  static const gchar zeros[8];
+  gsize n = (8 - *pos % 8) % 8;
+
+  *pos += n;
+  return fwrite(zeros, 1, n, fp) == n;
+}
+
+#define WRITE(ptr, size) \
+  do { if (fwrite(ptr, 1, size, fp) != (gsize)(size)) goto error; \
+       pos += (size); } while (0)
+
+// Write the base index and the postings in memory to a new index file,
+// which replaces the current one
+static void index_save(void)
+{
+  idx_header_t hdr;
+  GArray *table;
+  guint32 *dtris, ndtris, i, j, k;
+  gchar *tmpname;
+  guint64 pos = 0;
+  GHashTableIter iter;
+  gpointer key;
+  FILE *fp;
+  int fd;
+
+  if (!delta_docs->len && (base.hdr || !files->len))
+    return;
+
+  tmpname = g_strdup_printf("%s.tmp", index_path);
+  fd = open(tmpname, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+  fp = fd < 0 ? NULL : fdopen(fd, "w");
+  if (!fp) {
+    if (fd >= 0)
+      close(fd);
+    scr_log_print(LPRINT_LOGNORM, "hsearch: cannot write %s (%s).", tmpname,
+                  g_strerror(errno));
+    g_free(tmpname);
+    return;
+  }
+
+  memset(&hdr, 0, sizeof hdr);
+  WRITE(&hdr, sizeof hdr);
+
+  hdr.files_off = pos;
+  for (i = 0; i < files->len; i++) {
+    hfile_t *f = g_ptr_array_index(files, i);
+    guint32 len = strlen(f->name);
+    WRITE(&f->indexed, 8);
+    WRITE(&len, 4);
+    WRITE(f->name, len);
+    if (!write_pad(fp, &pos))
+      goto error;
+  }
+
+  hdr.docs_off = pos;
+  if (base.hdr)
+    WRITE(base.docs, base.hdr->ndocs * sizeof(guint64));
+  WRITE(delta_docs->data, delta_docs->len * sizeof(guint64));
+
+  // Merge the trigrams of the base and the delta, in order
+  ndtris = g_hash_table_size(delta);
+  dtris = g_new(guint32, ndtris);
+  k = 0;
+  g_hash_table_iter_init(&iter, delta);
+  while (g_hash_table_iter_next(&iter, &key, NULL))
+    dtris[k++] = GPOINTER_TO_UINT(key);
+  qsort(dtris, ndtris, sizeof *dtris, tri_cmp);
+
+  hdr.post_off = pos;
+  table = g_array_sized_new(FALSE, FALSE, sizeof(idx_tri_t),
+                            (base.hdr ? base.hdr->ntri : 0) + ndtris);
+  for (i = j = 0; i < (base.hdr ? base.hdr->ntri : 0) || j < ndtris; ) {
+    const idx_tri_t *b = NULL;
+    dpost_t *d = NULL;
+    idx_tri_t t;
+
+    if (base.hdr && i < base.hdr->ntri &&
+        (j == ndtris || base.tri[i].tri <= dtris[j]))
+      b = &base.tri[i++];
+    if (j < ndtris && (!b || b->tri == dtris[j]))
+      d = g_hash_table_lookup(delta, GUINT_TO_POINTER(dtris[j++]));
+
+    memset(&t, 0, sizeof t);
+    t.tri = b ? b->tri : dtris[j-1];
+    t.post_off = pos - hdr.post_off;
+    if (b) {
+      if (fwrite(base.post + b->post_off, 1, b->post_len, fp) !=
+          b->post_len)
+        goto error_table;
+      pos += b->post_len;
+      t.count = b->count;
+      t.last  = b->last;
+    }
+    if (d) {
+      GByteArray *first = g_byte_array_new();
+      put_varint(first, d->first - (b ? b->last : 0));
+      if (fwrite(first->data, 1, first->len, fp) != first->len) {
+        g_byte_array_free(first, TRUE);
+        goto error_table;
+      }
+      pos += first->len;
+      g_byte_array_free(first, TRUE);
+      if (fwrite(d->rest->data, 1, d->rest->len, fp) != d->rest->len)
+        goto error_table;
+      pos += d->rest->len;
+      t.count += d->count;
+      t.last   = d->last;
+    }
+    t.post_len = pos - hdr.post_off - t.post_off;
+    g_array_append_val(table, t);
+  }
+  g_free(dtris);
+  dtris = NULL;
+
+  if (!write_pad(fp, &pos))
+    goto error_table;
+  hdr.tri_off = pos;
+  if (fwrite(table->data, sizeof(idx_tri_t), table->len, fp) != table->len)
+    goto error_table;
+  pos += (guint64)table->len * sizeof(idx_tri_t);
+
+  memcpy(hdr.magic, IDX_MAGIC, 4);
+  hdr.version = IDX_VERSION;
+  hdr.ndocs   = ndocs_base() + delta_docs->len;
+  hdr.nfiles  = files->len;
+  hdr.ntri    = table->len;
+  hdr.size    = pos;
+  g_array_free(table, TRUE);
+  if (fseek(fp, 0, SEEK_SET) || fwrite(&hdr, sizeof hdr, 1, fp) != 1)
+    goto error;
+  if (fclose(fp)) {
+    fp = NULL;
+    goto error;
+  }
+  fp = NULL;
+  if (rename(tmpname, index_path))
+    goto error;
+  g_free(tmpname);
+
+  // Switch to the new file
+  base_unmap();
+  g_hash_table_remove_all(delta);
+  g_array_set_size(delta_docs, 0);
+  delta_bytes = 0;
+  {
+    // The file table is read again from the new index
+    GPtrArray *saved = files;
+    guint32 n;
+    files = g_ptr_array_new_with_free_func((GDestroyNotify)hfile_free);
+    g_hash_table_remove_all(file_ids);
+    if (!index_load()) {
+      scr_log_print(LPRINT_LOGNORM, "hsearch: cannot read the new index.");
+      g_ptr_array_free(saved, TRUE);
+      return;
+    }
+    // Keep the build state
+    for (n = 0; n < saved->len && n < files->len; n++)
+      ((hfile_t *)g_ptr_array_index(files, n))->queued =
+        ((hfile_t *)g_ptr_array_index(saved, n))->queued;
+    g_ptr_array_free(saved, TRUE);
+  }
+  return;
+
+error_table:
+  g_free(dtris);
+  g_array_free(table, TRUE);
+error:
+  scr_log_print(LPRINT_LOGNORM, "hsearch: cannot write %s (%s).", tmpname,
+                g_strerror(errno));
+  if (fp)
+    fclose(fp);
+  unlink(tmpname);
+  g_free(tmpname);
+}
+
+#undef WRITE
+
+/* Background build */
+
+static void build_queue_file(guint32 fileno)
+{
+  hfile_t *f = g_ptr_array_index(files, fileno - 1);
+
+  if (f->queued)
+    return;
+  f->queued = TRUE;
+  g_queue_push_tail(&build_queue, GUINT_TO_POINTER(fileno));
+}
+
+static gboolean build_cb(gpointer data)
+{
+  gsize budget = BUILD_STEP;
+
+  // Rewriting the index whenever the postings exceed DELTA_MAX would
+  // copy it again and again: wait until they reach the size of the file
+  // (between DELTA_MAX and BUILD_DELTA_MAX), so that each write doubles
+  // it.  index_save() replaces the file table, hence before indexing.
+  if (delta_bytes > build_limit) {
+    index_save();
+    if (delta_bytes) {
+      build_limit = 2 * delta_bytes;  // Not written, try later
+    } else {
+      build_limit = CLAMP(base.len, DELTA_MAX, BUILD_DELTA_MAX);
+      return TRUE;
+    }
+  }
+
+  while (!g_queue_is_empty(&build_queue)) {
+    guint32 fileno = GPOINTER_TO_UINT(g_queue_peek_head(&build_queue));
+    hfile_t *f = g_ptr_array_index(files, fileno - 1);
+    guint64 before = f->indexed;
+
+    if (index_file(fileno, budget))
+      return TRUE;              // Continue with this file next time
+    f->queued = FALSE;
+    g_queue_pop_head(&build_queue);
+    if (f->indexed - before >= budget)
+      return TRUE;
+    budget -= f->indexed - before;
+  }
+
+  index_save();
+  scr_log_print(LPRINT_LOGNORM, "hsearch: %u history files indexed "
+                "(%" G_GUINT64_FORMAT " MB in %.1f s).", files->len,
+                build_bytes >> 20,
+                (g_get_monotonic_time() - build_start) / 1e6);
+  build_srcno = 0;
+  return FALSE;
+}
+
+// Queue the history files which have not been indexed entirely
+static void build_start_scan(void)
+{
+  GDir *dir = g_dir_open(histo_dir, 0, NULL);
+  const gchar *name;
+
+  if (!dir)
+    return;
+  while ((name = g_dir_read_name(dir)) != NULL) {
+    gchar *path = g_build_filename(histo_dir, name, NULL);
+    struct stat st;
+    guint32 fileno;
+
+    if (!stat(path, &st) && S_ISREG(st.st_mode) && st.st_size) {
+      fileno = file_id(name, TRUE);
+      if ((guint64)st.st_size > ((hfile_t *)g_ptr_array_index(files,
+                                                    fileno - 1))->indexed)
+        build_queue_file(fileno);
+    }
+    g_free(path);
+  }
+  g_dir_close(dir);
+
+  if (!g_queue_is_empty(&build_queue) && !build_srcno) {
+    build_start = g_get_monotonic_time();
+    build_bytes = 0;
+    build_limit = CLAMP(base.len, DELTA_MAX, BUILD_DELTA_MAX);
+    build_srcno = g_idle_add_full(G_PRIORITY_LOW, build_cb, NULL, NULL);
+  }
+}
+
+// The index is loaded, and the build started, when the module is used
+static void hsearch_start(void)
+{
+  if (started)
+    return;
+  started = TRUE;
+  index_load();
+  build_start_scan();
+}
+
+// Index what has been appended to a history file
+static void index_update(const gchar *jid)
+{
+  gchar *name;
+  guint32 fileno;
+
+  if (!jid || !*jid)
+    return;
+  hsearch_start();
+  name = g_utf8_strdown(jid, -1);
+  fileno = file_id(name, FALSE);
+  if (!fileno) {
+    gchar *path = g_build_filename(histo_dir, name, NULL);
+    if (g_file_test(path, G_FILE_TEST_IS_REGULAR))
+      fileno = file_id(name, TRUE);
+    g_free(path);
+  }
+  g_free(name);
+  if (fileno && !((hfile_t *)g_ptr_array_index(files, fileno - 1))->queued)
+    index_file(fileno, G_MAXSIZE);
+  // During the build, build_cb() writes the index
+  if (delta_bytes > DELTA_MAX && !build_srcno)
+    index_save();
+}
+
+static guint message_hh(const gchar *hookname, hk_arg_t *args,
+                        gpointer userdata)
+{
+  hkargs_t a;
+
+  hkargs_parse(args, HKARG(HKARG_JID), 0, &a);
+  index_update(hkargs_value(&a, HKARG_JID));
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+/* Search */
+
+typedef struct {
+  const guchar *p, *end;        // Base postings
+  dpost_t      *d;              // Delta postings
+  const guchar *dp, *dend;
+  gboolean      in_delta, done;
+  guint64       cur;
+  guint64       count;
+} piter_t;
+
+static void piter_next(piter_t *it)
+{
+  guint64 v;
+
+  if (!it->in_delta) {
+    if (it->p && it->p < it->end &&
+        (it->p = hsearch_get_varint(it->p, it->end, &v))) {
+      it->cur += v;
+      return;
+    }
+    it->in_delta = TRUE;
+    if (it->d) {
+      it->cur = it->d->first;
+      it->dp = it->d->rest->data;
+      it->dend = it->dp + it->d->rest->len;
+      return;
+    }
+  } else if (it->d && it->dp < it->dend &&
+             (it->dp = hsearch_get_varint(it->dp, it->dend, &v))) {
+    it->cur += v;
+    return;
+  }
+  it->done = TRUE;
+}
+
+static void piter_init(piter_t *it, guint32 tri)
+{
+  const idx_tri_t *b = base_find(tri);
+
+  memset(it, 0, sizeof *it);
+  if (b) {
+    it->p = base.post + b->post_off;
+    it->end = it->p + b->post_len;
+    it->count = b->count;
+  }
+  it->d = g_hash_table_lookup(delta, GUINT_TO_POINTER(tri));
+  if (it->d)
+    it->count += it->d->count;
+}
+
+static int piter_cmp(const void *a, const void *b)
+{
+  const piter_t *pa = a, *pb = b;
+  return (pa->count > pb->count) - (pa->count < pb->count);
+}
+
+typedef struct {
+  guint32 fileno;
+  guint64 offset;
+  gchar   when[HLOG_TIME_LEN + 1];
+} hit_t;
+
+static int hit_cmp(const void *a, const void *b)
+{
+  const hit_t *ha = a, *hb = b;
+  return -strcmp(ha->when, hb->when);
+}
+
+// Read a record in buf (MAX_RECORD + 1 bytes); returns its text, with
+// the line breaks, or NULL
+static gchar *read_record(int fd, guint64 offset, gchar *buf)
+{
+  gsize size = 1024;            // Most messages are shorter
+  guint lines;
+  ssize_t n;
+  gchar *p;
+
+  for (;;) {
+    n = pread(fd, buf, size, offset);
+    if (n < HLOG_TEXT)
+      return NULL;
+    buf[n] = '\0';
+    lines = atoi(buf + 22);
+    for (p = buf; (p = strchr(p, '\n')) != NULL && lines; p++, lines--)
+      ;
+    if (p || (gsize)n < size || size == MAX_RECORD)
+      break;
+    size = MAX_RECORD;
+  }
+  if (p)
+    *p = '\0';
+  return buf + HLOG_TEXT;
+}
+
+// Check that a record contains the folded query
+static gboolean check_doc(int fd, guint64 offset, const gchar *query,
+                          gchar *buf, hit_t *hit)
+{
+  gchar *text = read_record(fd, offset, buf), *p;
+
+  if (!text)
+    return FALSE;
+  for (p = text; *p; p++)
+    *p = fold(*p);
+  if (!strstr(text, query))
+    return FALSE;
+  hit->offset = offset;
+  g_strlcpy(hit->when, buf + HLOG_TIME, sizeof hit->when);
+  return TRUE;
+}
+
+static int file_open(GHashTable *fds, guint32 fileno)
+{
+  gpointer fdp;
+  gchar *path;
+  int fd;
+
+  if (g_hash_table_lookup_extended(fds, GUINT_TO_POINTER(fileno), NULL, &fdp))
+    return GPOINTER_TO_INT(fdp);
+  if (!fileno || fileno > files->len)
+    return -1;
+  path = file_path(g_ptr_array_index(files, fileno - 1));
+  fd = open(path, O_RDONLY);
+  g_free(path);
+  g_hash_table_insert(fds, GUINT_TO_POINTER(fileno), GINT_TO_POINTER(fd));
+  return fd;
+}
+
+static void hsearch(const gchar *jid, const gchar *text)
+{
+  piter_t its[MAX_LISTS], all[256];
+  guint32 tris[256], only = 0;
+  guint nall = 0, nits, i, j, max_hits;
+  gchar *query = g_strdup(text), *p, *buf;
+  GArray *cands = g_array_new(FALSE, FALSE, sizeof(guint64));
+  GArray *hits = g_array_new(FALSE, FALSE, sizeof(hit_t));
+  gint64 t0 = g_get_monotonic_time();
+  GHashTable *fds;
+  GHashTableIter iter;
+  gpointer fdp;
+
+  for (p = query; *p; p++)
+    *p = fold(*p);
+  if (strlen(query) < 3) {
+    scr_log_print(LPRINT_NORMAL, "hsearch: at least 3 characters please.");
+    goto out;
+  }
+  if (jid) {
+    gchar *name = g_utf8_strdown(jid, -1);
+    only = file_id(name, FALSE);
+    g_free(name);
+    if (!only) {
+      scr_log_print(LPRINT_NORMAL, "hsearch: no history for %s.", jid);
+      goto out;
+    }
+  }
+
+  // Index the messages logged since the last update (the files waiting
+  // for the background build are not searched yet)
+  for (i = 1; i <= files->len; i++)
+    if ((!only || i == only) &&
+        !((hfile_t *)g_ptr_array_index(files, i - 1))->queued)
+      index_file(i, G_MAXSIZE);
+
+  // Distinct trigrams of the query, then the rarest lists
+  for (i = 0; query[i+2] && nall < G_N_ELEMENTS(all); i++) {
+    guint32 t = trigram((const guchar *)query + i);
+    for (j = 0; j < nall && tris[j] != t; j++)
+      ;
+    if (j < nall)
+      continue;
+    tris[nall] = t;
+    piter_init(&all[nall], t);
+    if (!all[nall].count)
+      goto done;                // Some trigram is nowhere
+    nall++;
+  }
+  qsort(all, nall, sizeof *all, piter_cmp);
+  nits = MIN(nall, MAX_LISTS);
+  memcpy(its, all, nits * sizeof *its);
+
+  // Intersect the lists, driven by the shortest one
+  for (i = 0; i < nits; i++)
+    piter_next(&its[i]);
+  while (!its[0].done && cands->len < MAX_CANDIDATES) {
+    guint64 doc = its[0].cur;
+    gboolean match = TRUE;
+
+    for (i = 1; i < nits; i++) {
+      while (!its[i].done && its[i].cur < doc)
+        piter_next(&its[i]);
+      if (its[i].done)
+        goto done;
+      if (its[i].cur != doc)
+        match = FALSE;
+    }
+    if (match && (!only || DOC_FILE(doc_get(doc)) == only))
+      g_array_append_val(cands, doc);
+    piter_next(&its[0]);
+  }
+
+done:
+  // Check the candidates in the history files
+  fds = g_hash_table_new(g_direct_hash, g_direct_equal);
+  buf = g_malloc(MAX_RECORD + 1);
+  for (i = 0; i < cands->len; i++) {
+    guint64 d = doc_get(g_array_index(cands, guint64, i));
+    int fd = file_open(fds, DOC_FILE(d));
+    hit_t hit;
+
+    if (fd >= 0 && check_doc(fd, DOC_OFFSET(d), query, buf, &hit)) {
+      hit.fileno = DOC_FILE(d);
+      g_array_append_val(hits, hit);
+    }
+  }
+
+  g_array_sort(hits, hit_cmp);
+  max_hits = settings_opt_get_int("hsearch_max");
+  if (!max_hits)
+    max_hits = DEFAULT_MAX_HITS;
+  scr_log_print(LPRINT_NORMAL, "hsearch: %u hit(s)%s for \"%s\" in %.1f ms%s",
+                hits->len, cands->len == MAX_CANDIDATES ? " at least" : "",
+                text, (g_get_monotonic_time() - t0) / 1e3,
+                build_srcno ? " (the index is being built)" : "");
+  for (i = 0; i < hits->len && i < max_hits; i++) {
+    hit_t *h = &g_array_index(hits, hit_t, i);
+    hfile_t *f = g_ptr_array_index(files, h->fileno - 1);
+    gchar *msg = read_record(file_open(fds, h->fileno), h->offset, buf);
+
+    if (!msg)
+      continue;
+    for (p = msg; *p; p++)
+      if (*p == '\n')
+        *p = ' ';
+    // 20200308T10:11:12Z -> 2020-03-08 10:11
+    scr_log_print(LPRINT_NORMAL, " %.4s-%.2s-%.2s %.5s %s: %s", h->when,
+                  h->when + 4, h->when + 6, h->when + 9, f->name, msg);
+  }
+
+  g_free(buf);
+  g_hash_table_iter_init(&iter, fds);
+  while (g_hash_table_iter_next(&iter, NULL, &fdp))
+    if (GPOINTER_TO_INT(fdp) >= 0)
+      close(GPOINTER_TO_INT(fdp));
+  g_hash_table_destroy(fds);
+
+out:
+  g_array_free(hits, TRUE);
+  g_array_free(cands, TRUE);
+  g_free(query);
+}
+
+static void do_hsearch(char *args)
+{
+  gchar **argv;
+
+  hsearch_start();
+  if (!strcmp(args, "status")) {
+    scr_log_print(LPRINT_NORMAL, "hsearch: %s, %u files, %" G_GUINT64_FORMAT
+                  " messages (%u not saved yet), %u trigrams, %" G_GSIZE_FORMAT
+                  " KB mapped, %" G_GSIZE_FORMAT " KB in memory%s.",
+                  index_path, files->len, ndocs_base() + delta_docs->len,
+                  delta_docs->len, base.hdr ? base.hdr->ntri : 0,
+                  base.len >> 10, delta_bytes >> 10,
+                  build_srcno ? ", build in progress" : "");
+    return;
+  }
+  if (!strcmp(args, "rebuild")) {
+    if (build_srcno)
+      g_source_remove(build_srcno);
+    build_srcno = 0;
+    g_queue_clear(&build_queue);
+    index_reset();
+    unlink(index_path);
+    build_start_scan();
+    return;
+  }
+
+  argv = g_strsplit(args, " ", 3);
+  if (argv[0] && !strcmp(argv[0], "-j") && argv[1] && argv[2] && *argv[2]) {
+    hsearch(argv[1], argv[2]);
+  } else if (*args && *args != '-') {
+    hsearch(NULL, args);
+  } else {
+    scr_log_print(LPRINT_NORMAL, "Usage: /hsearch [-j jid] text|status|"
+                  "rebuild");
+  }
+  g_strfreev(argv);
+}
+
+/* Initialization */
+static void hsearch_init(void)
+{
+  const gchar *path = settings_opt_get("hsearch_index");
+
+  index_path = expand_filename(path && *path ? path : DEFAULT_INDEX);
+  path = settings_opt_get("logging_dir");
+  histo_dir = expand_filename(path && *path ? path : DEFAULT_HISTODIR);
+
+  fold_table_init();
+  files = g_ptr_array_new_with_free_func((GDestroyNotify)hfile_free);
+  file_ids = g_hash_table_new(g_str_hash, g_str_equal);
+  delta = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                (GDestroyNotify)dpost_free);
+  delta_docs = g_array_new(FALSE, FALSE, sizeof(guint64));
+  g_queue_init(&build_queue);
+
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  hsearch_cmdid = cmd_add("hsearch", "Search the history", 0, 0,
+                          do_hsearch, NULL);
+#else
+  cmd_add("hsearch", "Search the history", 0, 0, do_hsearch, NULL);
+#endif
+
+  /* Add hook handlers */
+  message_in_hid  = hk_add_handler(message_hh, HOOK_POST_MESSAGE_IN,
+                                   G_PRIORITY_DEFAULT_IDLE, NULL);
+  message_out_hid = hk_add_handler(message_hh, HOOK_MESSAGE_OUT,
+                                   G_PRIORITY_DEFAULT_IDLE, NULL);
+}
+
+/* Uninitialization */
+static void hsearch_uninit(void)
+{
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(hsearch_cmdid);
+#else
+  cmd_del("hsearch");
+#endif
+  hk_del_handler(HOOK_POST_MESSAGE_IN, message_in_hid);
+  hk_del_handler(HOOK_MESSAGE_OUT, message_out_hid);
+
+  if (build_srcno)
+    g_source_remove(build_srcno);
+  build_srcno = 0;
+  g_queue_clear(&build_queue);
+  // Keep what has been indexed
+  if (started)
+    index_save();
+  started = FALSE;
+
+  index_reset();
+  g_ptr_array_free(files, TRUE);
+  g_hash_table_destroy(file_ids);
+  g_hash_table_destroy(delta);
+  g_array_free(delta_docs, TRUE);
+  g_free(index_path);
+  g_free(histo_dir);
+  index_path = histo_dir = NULL;
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
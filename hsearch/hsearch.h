@@ -0,0 +1,86 @@
+/*
+ *  hsearch.h       -- History index file format
+ *
+ *  Shared by the hsearch module (writer and reader) and the mock host
+ *  check tool.
+ *
+ *  The index file is in native byte order (it is a local cache, rebuilt
+ *  if it does not look right).  Documents are the indexed messages,
+ *  numbered in the order they were indexed, so the new postings of a
+ *  trigram are always after the old ones.
+ *    header      idx_header_t
+ *    files       indexed size (64 bits), name length (32 bits), name,
+ *                padded to 8 bytes
+ *    docs        file number << 40 | record offset, 64 bits per document
+ *    postings    per trigram, the document numbers as LEB128 deltas
+ *                (the first one from 0)
+ *    trigrams    idx_tri_t array, sorted
+ *
+ *  A trigram is three bytes of the message text, ASCII letters in lower
+ *  case and newlines as spaces, first byte in the high bits.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HSEARCH_H__
+#define __HSEARCH_H__ 1
+
+#include <glib.h>
+
+#define IDX_MAGIC           "MCHS"
+#define IDX_VERSION         1
+
+typedef struct {
+  gchar   magic[4];
+  guint32 version;
+  guint64 ndocs;
+  guint32 nfiles;
+  guint32 ntri;
+  guint64 files_off, docs_off, post_off, tri_off, size;
+} idx_header_t;
+
+typedef struct {
+  guint32 tri;
+  guint32 count;
+  guint64 post_off;             // From the start of the postings
+  guint64 post_len;
+  guint64 last;                 // Last document
+} idx_tri_t;
+
+#define DOC_FILE(d)         ((guint32)((d) >> 40))
+#define DOC_OFFSET(d)       ((d) & ((G_GUINT64_CONSTANT(1) << 40) - 1))
+#define DOC_PACK(f, off)    ((guint64)(f) << 40 | (off))
+
+// Decode a posting delta; NULL if it goes past end
+static inline const guchar *hsearch_get_varint(const guchar *p,
+                                               const guchar *end,
+                                               guint64 *v)
+{
+  guint64 r = 0;
+  guint shift = 0;
+
+  while (p < end && shift < 64) {
+    r |= (guint64)(*p & 0x7f) << shift;
+    if (!(*p++ & 0x80)) {
+      *v = r;
+      return p;
+    }
+    shift += 7;
+  }
+  return NULL;
+}
+
+#endif /* __HSEARCH_H__ */
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -16,6 +16,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <stdlib.h>
 #include <string.h>
 
 #include <mcabber/commands.h>
@@ -25,17 +26,30 @@
 #include <mcabber/settings.h>
 #include <mcabber/xmpp.h>
 
+#include "common/hkargs.h"
+#include "common/inittime.h"
+#include "common/logcoal.h"
+#include "common/optcache.h"
+#include "common/requires.h"
+#include "common/workq.h"
+#include "hookstats/hookstats.h"
+#include "metrics/metrics.h"
+#include "modmem/modmem.h"
+#include "traffic/traffic.h"
+
 static void ignore_auth_init   (void);
 static void ignore_auth_uninit (void);
 
+MODULE_TIMED_INIT(ignore_auth_init)
+
 /* Module description */
 module_info_t info_ignore_auth = {
         .branch          = MCABBER_BRANCH,
         .api             = MCABBER_API_VERSION,
         .version         = MCABBER_VERSION,
         .description     = "ignore auth requests by specifying a jid regex",
-        .requires        = NULL,
-        .init            = ignore_auth_init,
+        .requires        = MODULE_REQUIRES,
+        .init            = ignore_auth_init_timed,
         .uninit          = ignore_auth_uninit,
         .next            = NULL,
 };
@@ -44,24 +58,65 @@ module_info_t info_ignore_auth = {
 static gpointer ignoreauth_cmdid;
 #endif
 
+MODMEM_DEFINE("ignore_auth");
+
+// The size of a compiled regex is not known, this is an estimate
+#define REGEX_SIZE(re)  (sizeof(GSList) + 256 + \
+                         4 * strlen(g_regex_get_pattern(re)))
+
 GSList *regexlist = NULL;
+static GSList *patterns = NULL;    /* Regexes not compiled yet */
 static guint ignore_auth_hid = 0;  /* Hook handler id */
 
+/* enabled unless ignore_auth is set to 0 */
+static optcache_t opt_enabled = OPTCACHE_INT("ignore_auth", 1);
+
+METRIC_DEFINE(m_ignored, "mcabber_ignored_subscriptions_total",
+              METRIC_COUNTER, "Subscription requests ignored by ignore_auth");
+
+/* The regexes are compiled (and optimized) when they are first needed,
+ * so that the commands in the configuration file do not slow the
+ * startup down.  An invalid pattern is reported then, and dropped. */
+static void compile_patterns(void)
+{
+  GSList *head;
+
+  for (head = patterns; head; head = g_slist_next(head)) {
+    GRegex *new_regex = g_regex_new(head->data, G_REGEX_OPTIMIZE, 0, NULL);
+    if (new_regex) {
+      regexlist = g_slist_append(regexlist, new_regex);
+      MM_TRACK(REGEX_SIZE(new_regex));
+    } else {
+      scr_log_print(LPRINT_LOGNORM, "ignore_auth: %s wasn't a glib regex, "
+                    "ignored", (gchar *)head->data);
+    }
+    MM_FREE(head->data);
+  }
+  g_slist_free(patterns);
+  patterns = NULL;
+}
+
+/* Deferred: jid, message */
+static void ignore_reply(const gchar * const *str, guint num)
+{
+  xmpp_send_s10n(str[0], LM_MESSAGE_SUB_TYPE_UNSUBSCRIBED);
+  METRIC_INC(m_ignored);
+  logcoal_print(LPRINT_NORMAL, "Ignored auth request from %s (%s)",
+                str[0], str[1]);
+}
+
 static guint ignore_hh(const gchar *hookname, hk_arg_t *args, gpointer userdata)
 {
   guint subscription;
   const char *bjid = NULL, *type = NULL, *msg = NULL;
 
-  if (settings_opt_get_int("ignore_auth")) {
-    int i;
-    for (i = 0; args[i].name; i++) {
-      if (!strcmp(args[i].name, "type"))
-        type = args[i].value;
-      if (!strcmp(args[i].name, "message"))
-        msg = args[i].value;
-      if (!strcmp(args[i].name, "jid"))
-        bjid = args[i].value;
-    }
+  if (optcache_int(&opt_enabled)) {
+    hkargs_t a;
+    hkargs_parse(args, HKARG(HKARG_TYPE) | HKARG(HKARG_MESSAGE) |
+                 HKARG(HKARG_JID), 0, &a);
+    type = hkargs_value(&a, HKARG_TYPE);
+    msg  = hkargs_value(&a, HKARG_MESSAGE);
+    bjid = hkargs_value(&a, HKARG_JID);
     /* shouldn't happen */
     if (!bjid || !type || !msg)
       return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
@@ -72,6 +127,9 @@ static guint ignore_hh(const gchar *hookname, hk_arg_t *args, gpointer userdata)
       GSList *head;
       int ignore_it = FALSE;
 
+      if (patterns)
+        compile_patterns();
+
       /* try to match against one of our regular expressions */
       for (head = regexlist; head && !ignore_it; head = g_slist_next(head)) {
         GMatchInfo *match_info;
@@ -81,9 +139,8 @@ static guint ignore_hh(const gchar *hookname, hk_arg_t *args, gpointer userdata)
         g_match_info_free (match_info);
       }
       if(ignore_it) {
-        xmpp_send_s10n(bjid, LM_MESSAGE_SUB_TYPE_UNSUBSCRIBED);
-        scr_log_print(LPRINT_NORMAL, "Ignored auth request from %s (%s)",
-                      bjid, msg);
+        /* the request is dropped now, the reply can wait */
+        workq_push(ignore_reply, 0, 2, bjid, msg);
         return HOOK_HANDLER_RESULT_NO_MORE_HANDLER_DROP_DATA;
       }
     }
@@ -95,20 +152,15 @@ static guint ignore_hh(const gchar *hookname, hk_arg_t *args, gpointer userdata)
 /* ignore command handler */
 static void do_ignore_auth(char *args)
 {
-  GRegex *new_regex;
   if (!args || !*args) {
     GSList *head;
+    compile_patterns();
     for (head = regexlist; head; head = g_slist_next(head))
       scr_log_print(LPRINT_NORMAL, "Ignoring %s",
                     g_regex_get_pattern(head->data));
     return;
   }
-  new_regex = g_regex_new(args, G_REGEX_OPTIMIZE, 0, NULL);
-  if (!new_regex) {
-    scr_log_print(LPRINT_NORMAL, "That wasn't a glib regex");
-    return;
-  }
-  regexlist = g_slist_append(regexlist, new_regex);
+  patterns = g_slist_append(patterns, MM_STRDUP(args));
 }
 
 /* Initialization */
@@ -120,10 +172,13 @@ static void ignore_auth_init(void)
 #else
   cmd_add("ignore_auth", "", 0, 0, do_ignore_auth, NULL);
 #endif
+  optcache_bind(&opt_enabled, NULL);
+  logcoal_init();
   /* Add handler */
   ignore_auth_hid = hk_add_handler(ignore_hh, HOOK_SUBSCRIPTION,
                                    G_PRIORITY_DEFAULT_IDLE, NULL);
-  settings_set(SETTINGS_TYPE_OPTION, "ignore_auth", "1");
+  METRIC_REGISTER(m_ignored);
+  MODMEM_REGISTER();
 }
 
 /* Uninitialization */
@@ -138,11 +193,22 @@ static void ignore_auth_uninit(void)
 #endif
   /* Unregister event handler */
   hk_del_handler(HOOK_SUBSCRIPTION, ignore_auth_hid);
+  workq_flush();
+  logcoal_flush();
+  optcache_unbind_all();
+  METRIC_UNREGISTER(m_ignored);
   /* unref every regex */
-  for (head = regexlist; head; head = g_slist_next(head))
+  for (head = regexlist; head; head = g_slist_next(head)) {
+    MM_UNTRACK(REGEX_SIZE(head->data));
     g_regex_unref(head->data);
+  }
   g_slist_free(regexlist);
   regexlist = NULL;
+  for (head = patterns; head; head = g_slist_next(head))
+    MM_FREE(head->data);
+  g_slist_free(patterns);
+  patterns = NULL;
+  MODMEM_UNREGISTER();
 }
 
 /* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -4,6 +4,13 @@
  *  This module relies on the "info" option to display the number of
  *  unread messages in the status bar...
  *
+ *  Options:
+ *  - info_msgcount_shm: path (default: none)
+ *    Publish the unread counts and buffers in this file, mapped in
+ *    memory, for external status bars (see msgcount_shm.h).
+ *  - info_msgcount_fifo: path (default: none)
+ *    FIFO written to after each update of the file above.
+ *
  * Copyright (C) 2010 Mikael Berthe <mikael@lilotux.net>
  *
  * This module is free software; you can redistribute it and/or modify
@@ -20,24 +27,44 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <mcabber/modules.h>
+#include <mcabber/logprint.h>
+#include <mcabber/roster.h>
 #include <mcabber/settings.h>
 #include <mcabber/screen.h>
 #include <mcabber/hooks.h>
 
+#include "common/hkargs.h"
+#include "common/inittime.h"
+#include "common/optcache.h"
+#include "common/requires.h"
+#include "common/workq.h"
+#include "hookstats/hookstats.h"
+#include "metrics/metrics.h"
+#include "msgcount_shm.h"
+
 static void info_msgcount_init(void);
 static void info_msgcount_uninit(void);
 
+MODULE_TIMED_INIT(info_msgcount_init)
+
 /* Module description */
 module_info_t info_info_msgcount = {
         .branch         = MCABBER_BRANCH,
         .api            = MCABBER_API_VERSION,
         .version        = "0.01",
         .description    = "Show unread message count in the status bar",
-        .requires       = NULL,
-        .init           = info_msgcount_init,
+        .requires       = MODULE_REQUIRES,
+        .init           = info_msgcount_init_timed,
         .uninit         = info_msgcount_uninit,
         .next           = NULL,
 };
@@ -47,36 +74,192 @@ static guint unread_list_hid;
 
 static gchar *backup_info;
 
+METRIC_DEFINE(m_unread, "mcabber_unread_buffers", METRIC_GAUGE,
+              "Buffers with unread messages");
+METRIC_DEFINE(m_unread_private, "mcabber_unread_private_buffers",
+              METRIC_GAUGE, "Unread buffers, without the MUC buffers "
+              "that have no highlighted message");
+
+// Latest counts, displayed by a deferred update
+static guint all_unread, unread; // unread: private message count
+static guint attention, muc_unread, muc_attention;
+static gboolean update_queued;
+
+static optcache_t opt_shm  = OPTCACHE_PATH("info_msgcount_shm", NULL);
+static optcache_t opt_fifo = OPTCACHE_PATH("info_msgcount_fifo", NULL);
+
+static msgcount_shm_t *shm;
+static int fifo_fd = -1;
+
+static void shm_add_buffer(gpointer rosterdata, void *param)
+{
+  const char *jid;
+  msgcount_shm_buffer_t *b;
+  guint type, uiprio;
+
+  if (!(buddy_getflags(rosterdata) & ROSTER_FLAG_MSG))
+    return;
+  if (shm->nbuffers == MSGCOUNT_SHM_BUFFERS) {
+    shm->truncated++;
+    return;
+  }
+  jid    = buddy_getjid(rosterdata);
+  type   = buddy_gettype(rosterdata);
+  uiprio = buddy_getuiprio(rosterdata);
+  b = &shm->buffers[shm->nbuffers++];
+  b->uiprio = uiprio;
+  // As mcabber counts them for HOOK_UNREAD_LIST_CHANGE
+  if (type & ROSTER_TYPE_ROOM)
+    b->flags = MSGCOUNT_SHM_ROOM |
+               (uiprio >= ROSTER_UI_PRIO_MUC_HL_MESSAGE ?
+                MSGCOUNT_SHM_ATTENTION : 0);
+  else
+    b->flags = uiprio >= ROSTER_UI_PRIO_ATTENTION_MESSAGE ?
+               MSGCOUNT_SHM_ATTENTION : 0;
+  g_strlcpy(b->jid, jid ? jid : "", sizeof b->jid);
+}
+
+// Rewrite the state, readers retry while seq is odd or has changed
+static void shm_publish(guint32 pid)
+{
+  guint32 seq = shm->seq;
+
+  __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  shm->pid            = pid;
+  shm->unread         = all_unread;
+  shm->attention      = attention;
+  shm->muc_unread     = muc_unread;
+  shm->muc_attention  = muc_attention;
+  shm->private_unread = unread;
+  shm->updated        = time(NULL);
+  shm->nbuffers = shm->truncated = 0;
+  if (pid)
+    foreach_buddy(ROSTER_TYPE_USER | ROSTER_TYPE_AGENT | ROSTER_TYPE_ROOM |
+                  ROSTER_TYPE_SPECIAL, shm_add_buffer, NULL);
+
+  __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+
+  // Wake a waiting reader up; if the FIFO is full, one is already due
+  if (fifo_fd >= 0 && write(fifo_fd, "", 1) < 0 && errno != EAGAIN)
+    scr_log_print(LPRINT_DEBUG, "info_msgcount: FIFO write error: %s",
+                  strerror(errno));
+}
+
+static void shm_close(void)
+{
+  if (fifo_fd >= 0) {
+    close(fifo_fd);
+    fifo_fd = -1;
+  }
+  if (shm) {
+    shm_publish(0);
+    munmap(shm, sizeof *shm);
+    shm = NULL;
+  }
+}
+
+static void shm_open_file(void)
+{
+  const gchar *path = optcache_str(&opt_shm);
+  const gchar *fifo = optcache_str(&opt_fifo);
+  struct stat st;
+  void *map;
+  int fd;
+
+  shm_close();
+  if (!path || !*path)
+    return;
+
+  fd = open(path, O_RDWR | O_CREAT, 0600);
+  if (fd < 0 || ftruncate(fd, sizeof *shm) < 0) {
+    scr_log_print(LPRINT_LOGNORM, "info_msgcount: cannot create %s: %s",
+                  path, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+  map = mmap(NULL, sizeof *shm, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    scr_log_print(LPRINT_LOGNORM, "info_msgcount: cannot map %s: %s",
+                  path, strerror(errno));
+    return;
+  }
+  shm = map;
+  // Readers check the magic number after the size, and the sequence
+  // number goes on from the previous instance, if any
+  if (shm->magic != MSGCOUNT_SHM_MAGIC || shm->seq & 1)
+    shm->seq = 0;
+  shm->version = MSGCOUNT_SHM_VERSION;
+  shm->size    = sizeof *shm;
+  __atomic_store_n(&shm->magic, MSGCOUNT_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  if (fifo && *fifo) {
+    if (mkfifo(fifo, 0600) < 0 && errno != EEXIST) {
+      scr_log_print(LPRINT_LOGNORM, "info_msgcount: cannot create %s: %s",
+                    fifo, strerror(errno));
+    // Read-write, so that the open does not wait for a reader
+    } else if ((fifo_fd = open(fifo, O_RDWR | O_NONBLOCK)) < 0) {
+      scr_log_print(LPRINT_LOGNORM, "info_msgcount: cannot open %s: %s",
+                    fifo, strerror(errno));
+    } else if (fstat(fifo_fd, &st) < 0 || !S_ISFIFO(st.st_mode)) {
+      scr_log_print(LPRINT_LOGNORM, "info_msgcount: %s is not a FIFO",
+                    fifo);
+      close(fifo_fd);
+      fifo_fd = -1;
+    }
+  }
+  shm_publish(getpid());
+}
+
+static void shm_option_changed(const optcache_t *opt)
+{
+  shm_open_file();
+}
+
+static void unread_list_update(const gchar * const *str, guint num)
+{
+  static gchar buf[128];
+
+  update_queued = FALSE;
+  METRIC_SET(m_unread, all_unread);
+  METRIC_SET(m_unread_private, unread);
+  if (shm)
+    shm_publish(getpid());
+
+  // Update the status bar
+  snprintf(buf, sizeof(buf), "(%d/%d) ", unread, all_unread);
+  settings_set(SETTINGS_TYPE_OPTION, "info", buf);
+  scr_update_chat_status(TRUE);
+}
+
 // Event handler for HOOK_UNREAD_LIST_CHANGE events
 static guint unread_list_hh(const gchar *hookname, hk_arg_t *args,
                             gpointer userdata)
 {
-  static gchar buf[128];
-  guint all_unread = 0;
-  guint muc_unread = 0;
-  guint muc_attention = 0;
-  guint unread; // private message count
+  const guint keys = HKARG(HKARG_UNREAD) | HKARG(HKARG_ATTENTION) |
+                     HKARG(HKARG_MUC_UNREAD) | HKARG(HKARG_MUC_ATTENTION);
+  hkargs_t a;
 
   // Note: We can add "attention" string later, but it isn't used
-  // yet in mcabber...
-  for ( ; args->name; args++) {
-    if (!g_strcmp0(args->name, "unread")) {
-      all_unread = atoi(args->value);
-    } else if (!g_strcmp0(args->name, "muc_unread")) {
-      muc_unread = atoi(args->value);
-    } else if (!g_strcmp0(args->name, "muc_attention")) {
-      muc_attention = atoi(args->value);
-    }
-  }
+  // yet in mcabber... (it is published in info_msgcount_shm, though)
+  hkargs_parse(args, keys, keys, &a);
+  all_unread    = hkargs_uint(&a, HKARG_UNREAD);
+  attention     = hkargs_uint(&a, HKARG_ATTENTION);
+  muc_unread    = hkargs_uint(&a, HKARG_MUC_UNREAD);
+  muc_attention = hkargs_uint(&a, HKARG_MUC_ATTENTION);
 
   // Let's not count the MUC unread buffers that don't have the attention
   // flag (that is, MUC buffer that have no highlighted messages).
   unread = all_unread - (muc_unread - muc_attention);
 
-  // Update the status bar
-  snprintf(buf, sizeof(buf), "(%d/%d) ", unread, all_unread);
-  settings_set(SETTINGS_TYPE_OPTION, "info", buf);
-  scr_update_chat_status(TRUE);
+  // Several changes in a row are displayed once
+  if (!update_queued) {
+    update_queued = TRUE;
+    workq_push(unread_list_update, 0, 0);
+  }
 
   return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
 }
@@ -87,7 +270,15 @@ static void info_msgcount_init(void)
   // Backup info option, set default initial string
   backup_info = g_strdup(settings_opt_get("info"));
   settings_set(SETTINGS_TYPE_OPTION, "info", "(...)");
-  scr_update_chat_status(TRUE);
+  // Displayed with the next screen update, no need to force one now
+  scr_update_chat_status(FALSE);
+
+  METRIC_REGISTER(m_unread);
+  METRIC_REGISTER(m_unread_private);
+
+  optcache_bind(&opt_shm, shm_option_changed);
+  optcache_bind(&opt_fifo, shm_option_changed);
+  shm_open_file();
 
   // Add hook handler for unread message data
   unread_list_hid = hk_add_handler(unread_list_hh, HOOK_UNREAD_LIST_CHANGE,
@@ -99,6 +290,11 @@ static void info_msgcount_uninit(void)
 {
   // Unregister handler
   hk_del_handler(HOOK_UNREAD_LIST_CHANGE, unread_list_hid);
+  workq_flush();
+  shm_close();
+  optcache_unbind_all();
+  METRIC_UNREGISTER(m_unread);
+  METRIC_UNREGISTER(m_unread_private);
 
   // Restore initial info option value
   settings_set(SETTINGS_TYPE_OPTION, "info", backup_info);
@@ -0,0 +1,110 @@
+/*
+ *  msgcount_shm.h  -- Unread state published by info_msgcount
+ *
+ *  With the option info_msgcount_shm set to a file (preferably on a
+ *  tmpfs, e.g. /dev/shm/mcabber-unread), the info_msgcount module
+ *  publishes the unread counts and the list of the unread buffers in
+ *  that file, mapped in memory, whenever they change.  A status bar maps
+ *  the file once; then each poll is a read of the memory, without any
+ *  system call:
+ *
+ *    int fd = open("/dev/shm/mcabber-unread", O_RDONLY);
+ *    const msgcount_shm_t *shm = mmap(NULL, sizeof *shm, PROT_READ,
+ *                                     MAP_SHARED, fd, 0);
+ *    msgcount_shm_t state;
+ *
+ *    if (msgcount_shm_read(shm, &state) && state.pid)
+ *      printf("(%u/%u)\n", state.private_unread, state.unread);
+ *
+ *  The module rewrites the file in place, with a sequence number which
+ *  is odd during the update (a seqlock): msgcount_shm_read() copies the
+ *  state again when it has changed meanwhile, and gives up after a while
+ *  (if mcabber died during an update, the number stays odd).  pid is the
+ *  process id of mcabber, 0 once the module is unloaded.
+ *
+ *  A status bar which would rather block until the next change sets the
+ *  option info_msgcount_fifo: a byte is written to that FIFO (created if
+ *  needed) after each update, and dropped if the FIFO is full.  Read all
+ *  the pending bytes, then the state.  Each byte goes to one reader: use
+ *  one FIFO per bar, or wait on the FIFO in one process only.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MSGCOUNT_SHM_H__
+#define __MSGCOUNT_SHM_H__ 1
+
+#include <stdint.h>
+#include <string.h>
+
+#define MSGCOUNT_SHM_MAGIC    0x6d637531      // "mcu1"
+#define MSGCOUNT_SHM_VERSION  1
+#define MSGCOUNT_SHM_BUFFERS  64              // Buffers listed
+#define MSGCOUNT_SHM_JIDLEN   248             // With the final NUL
+#define MSGCOUNT_SHM_SPIN     (1U<<20)        // Reads of seq before giving up
+
+// Buffer flags
+#define MSGCOUNT_SHM_ROOM       (1U<<0)
+#define MSGCOUNT_SHM_ATTENTION  (1U<<1)       // Counted in (muc_)attention
+
+typedef struct {
+  uint32_t flags;
+  uint32_t uiprio;                            // mcabber's UI priority
+  char     jid[MSGCOUNT_SHM_JIDLEN];          // Cut if longer
+} msgcount_shm_buffer_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;                              // sizeof(msgcount_shm_t)
+  uint32_t pid;
+  uint32_t seq;                               // Odd during an update
+  uint32_t unread;                            // Unread buffers
+  uint32_t attention;
+  uint32_t muc_unread;
+  uint32_t muc_attention;
+  uint32_t private_unread;                    // As in the status bar
+  uint32_t nbuffers;
+  uint32_t truncated;                         // Buffers not listed
+  int64_t  updated;                           // time(), last update
+  uint32_t reserved[2];
+  msgcount_shm_buffer_t buffers[MSGCOUNT_SHM_BUFFERS];
+} msgcount_shm_t;
+
+// Consistent copy of the state; 0 if the file is not a state file (yet),
+// or if the update in progress does not end
+static inline int msgcount_shm_read(const msgcount_shm_t *shm,
+                                    msgcount_shm_t *copy)
+{
+  uint32_t seq, spin = 0;
+
+  if (shm->magic != MSGCOUNT_SHM_MAGIC || shm->size != sizeof *shm)
+    return 0;
+  do {
+    while ((seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE)) & 1)
+      if (++spin >= MSGCOUNT_SHM_SPIN)
+        return 0;
+    if (++spin >= MSGCOUNT_SHM_SPIN)
+      return 0;
+    memcpy(copy, shm, sizeof *shm);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (seq != __atomic_load_n(&shm->seq, __ATOMIC_RELAXED));
+  if (copy->nbuffers > MSGCOUNT_SHM_BUFFERS)
+    copy->nbuffers = MSGCOUNT_SHM_BUFFERS;
+  return 1;
+}
+
+#endif /* __MSGCOUNT_SHM_H__ */
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
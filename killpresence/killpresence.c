@@ -43,9 +43,15 @@
 #include <mcabber/utils.h>
 #include <mcabber/xmpp.h>
 
+#include "common/inittime.h"
+#include "common/requires.h"
+#include "traffic/traffic.h"
+
 static void killpresence_init(void);
 static void killpresence_uninit(void);
 
+MODULE_TIMED_INIT(killpresence_init)
+
 /* Module description */
 module_info_t info_killpresence = {
         .branch         = MCABBER_BRANCH,
@@ -56,8 +62,8 @@ module_info_t info_killpresence = {
                           " /killpresence [-p] $fulljid\n"
                           " /killchatstates $fulljid\n"
                           " /probe $barejid",
-        .requires       = NULL,
-        .init           = killpresence_init,
+        .requires       = MODULE_REQUIRES,
+        .init           = killpresence_init_timed,
         .uninit         = killpresence_uninit,
         .next           = NULL,
 };
@@ -28,17 +28,28 @@
 #include <mcabber/hooks.h>
 #include <mcabber/screen.h>
 
+#include "common/hkargs.h"
+#include "common/inittime.h"
+#include "common/logcoal.h"
+#include "common/requires.h"
+#include "common/workq.h"
+#include "hookstats/hookstats.h"
+#include "metrics/metrics.h"
+#include "modmem/modmem.h"
+
 static void lastmsg_init(void);
 static void lastmsg_uninit(void);
 
+MODULE_TIMED_INIT(lastmsg_init)
+
 /* Module description */
 module_info_t info_lastmsg = {
         .branch         = MCABBER_BRANCH,
         .api            = MCABBER_API_VERSION,
         .version        = "0.02",
         .description    = "Add a command /lastmsg",
-        .requires       = NULL,
-        .init           = lastmsg_init,
+        .requires       = MODULE_REQUIRES,
+        .init           = lastmsg_init_timed,
         .uninit         = lastmsg_uninit,
         .next           = NULL,
 };
@@ -51,32 +62,50 @@ static GSList *lastmsg_list;
 
 static guint last_message_hid, last_status_hid;
 
+METRIC_DEFINE(m_highlights, "mcabber_highlights_captured_total",
+              METRIC_COUNTER, "MUC highlights captured by lastmsg while away");
+
+MODMEM_DEFINE("lastmsg");
+
 struct lastm_T {
     gchar *mucname;
     gchar *nickname;
     gchar *msg;
 };
 
+static void lastm_free(struct lastm_T *lastm_item)
+{
+  MM_FREE(lastm_item->mucname);
+  MM_FREE(lastm_item->nickname);
+  MM_FREE(lastm_item->msg);
+  MM_FREE(lastm_item);
+  MM_UNTRACK(sizeof(GSList));   // List link
+}
+
 static void do_lastmsg(char *args)
 {
   GSList *li;
+  GString *out;
   guint count = 0;
 
+  workq_flush();
   if (!lastmsg_list) {
     scr_log_print(LPRINT_NORMAL, "You have no new message.");
     return;
   }
 
+  // All the messages in one log window update
+  out = g_string_sized_new(1024);
   for (li = lastmsg_list; li ; li = g_slist_next(li)) {
     struct lastm_T *lastm_item = li->data;
-    scr_LogPrint(LPRINT_NORMAL, "In <#%s>, \"%s\" said:\n%s",
-                 lastm_item->mucname, lastm_item->nickname,
-                 lastm_item->msg);
-    g_free(lastm_item->mucname);
-    g_free(lastm_item->nickname);
-    g_free(lastm_item->msg);
+    g_string_append_printf(out, "%sIn <#%s>, \"%s\" said:\n%s",
+                           count ? "\n" : "", lastm_item->mucname,
+                           lastm_item->nickname, lastm_item->msg);
+    lastm_free(lastm_item);
     count++;
   }
+  scr_LogPrint(LPRINT_NORMAL, "%s", out->str);
+  g_string_free(out, TRUE);
   g_slist_free(lastmsg_list);
   lastmsg_list = NULL;
   if (count*2 > scr_getlogwinheight()) {
@@ -86,70 +115,69 @@ static void do_lastmsg(char *args)
   }
 }
 
+// Deferred: room, nickname, message
+static void last_message_store(const gchar * const *str, guint num)
+{
+  struct lastm_T *lastm_item;
+
+  lastm_item = MM_NEW(struct lastm_T, 1);
+  lastm_item->mucname  = MM_STRDUP(str[0]);
+  lastm_item->nickname = MM_STRDUP(str[1]);
+  lastm_item->msg      = MM_STRDUP(str[2]);
+  lastmsg_list = g_slist_append(lastmsg_list, lastm_item);
+  MM_TRACK(sizeof(GSList));
+  METRIC_INC(m_highlights);
+}
+
 static guint last_message_hh(const gchar *hookname, hk_arg_t *args,
                              gpointer userdata)
 {
   enum imstatus status;
   const gchar *bjid, *res, *msg;
-  gboolean muc = FALSE, urgent = FALSE;
+  hkargs_t a;
 
   status = xmpp_getstatus();
 
   if (status != notavail && status != away)
     return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
 
-  bjid = res = NULL;
-  msg = NULL;
-
-  for ( ; args->name; args++) {
-    if (!g_strcmp0(args->name, "jid"))
-      bjid = args->value;
-    else if (!g_strcmp0(args->name, "resource"))
-      res = args->value;
-    else if (!g_strcmp0(args->name, "message"))
-      msg = args->value;
-    else if (!g_strcmp0(args->name, "groupchat")) {
-      if (!g_strcmp0(args->value, "true"))
-        muc = TRUE;
-    } else if (!g_strcmp0(args->name, "attention")) {
-      if (!g_strcmp0(args->value, "true"))
-        urgent = TRUE;
-    }
-  }
-
-  if (muc && urgent && bjid && res && msg) {
-    struct lastm_T *lastm_item;
+  hkargs_parse(args, HKARG(HKARG_JID) | HKARG(HKARG_RESOURCE) |
+               HKARG(HKARG_MESSAGE) | HKARG(HKARG_GROUPCHAT) |
+               HKARG(HKARG_ATTENTION), 0, &a);
+  bjid = hkargs_value(&a, HKARG_JID);
+  res  = hkargs_value(&a, HKARG_RESOURCE);
+  msg  = hkargs_value(&a, HKARG_MESSAGE);
 
-    lastm_item = g_new(struct lastm_T, 1);
-    lastm_item->mucname  = g_strdup(bjid);
-    lastm_item->nickname = g_strdup(res);
-    lastm_item->msg      = g_strdup(msg);
-    lastmsg_list = g_slist_append(lastmsg_list, lastm_item);
-  }
+  if (hkargs_true(&a, HKARG_GROUPCHAT) && hkargs_true(&a, HKARG_ATTENTION) &&
+      bjid && res && msg)
+    workq_push(last_message_store, 0, 3, bjid, res, msg);
   return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
 }
 
+// Deferred, after the messages queued before
+static void last_status_notify(const gchar * const *str, guint num)
+{
+  if (!lastmsg_list)
+    return;
+  logcoal_print(LPRINT_NORMAL, "Looks like you're back...");
+  logcoal_print(LPRINT_NORMAL, "I've got news for you, use /lastmsg to "
+                "read your messages!");
+}
+
 static guint last_status_hh(const gchar *hookname, hk_arg_t *args,
                             gpointer userdata)
 {
-  gboolean not_away = FALSE;
-
-  for ( ; args->name; args++) {
-    if (!g_strcmp0(args->name, "new_status")) {
-      if (args->value &&
-          (args->value[0] != imstatus2char[away]) &&
-          (args->value[0] != imstatus2char[notavail])) {
-        not_away = TRUE;
-        break;
-      }
-    }
-  }
-  if (!not_away || !lastmsg_list)
+  const gchar *status;
+  hkargs_t a;
+
+  hkargs_parse(args, HKARG(HKARG_NEW_STATUS), 0, &a);
+  status = hkargs_value(&a, HKARG_NEW_STATUS);
+  if (!status || status[0] == imstatus2char[away] ||
+      status[0] == imstatus2char[notavail] ||
+      (!lastmsg_list && !workq.count))
     return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
 
-  scr_log_print(LPRINT_NORMAL, "Looks like you're back...");
-  scr_log_print(LPRINT_NORMAL, "I've got news for you, use /lastmsg to "
-                "read your messages!");
+  workq_push(last_status_notify, 0, 0);
   return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
 }
 
@@ -164,6 +192,10 @@ static void lastmsg_init(void)
   cmd_add("lastmsg", "Display last missed messages", 0, 0, do_lastmsg, NULL);
 #endif
 
+  logcoal_init();
+  METRIC_REGISTER(m_highlights);
+  MODMEM_REGISTER();
+
   /* Add hook handlers */
   last_message_hid = hk_add_handler(last_message_hh, HOOK_POST_MESSAGE_IN,
                                     G_PRIORITY_DEFAULT_IDLE, NULL);
@@ -185,16 +217,17 @@ static void lastmsg_uninit(void)
   /* Unregister handlers */
   hk_del_handler(HOOK_POST_MESSAGE_IN, last_message_hid);
   hk_del_handler(HOOK_MY_STATUS_CHANGE, last_status_hid);
+  workq_flush();
+  logcoal_flush();
+  optcache_unbind_all();
+  METRIC_UNREGISTER(m_highlights);
 
   /* Clean up data */
-  for (li = lastmsg_list; li ; li = g_slist_next(li)) {
-    struct lastm_T *lastm_item = li->data;
-    g_free(lastm_item->mucname);
-    g_free(lastm_item->nickname);
-    g_free(lastm_item->msg);
-  }
+  for (li = lastmsg_list; li ; li = g_slist_next(li))
+    lastm_free(li->data);
   g_slist_free(lastmsg_list);
   lastmsg_list = NULL;
+  MODMEM_UNREGISTER();
 }
 
 /* vim: set expandtab cindent cinoptions=>2\:2(0:  For Vim users... */
@@ -0,0 +1,374 @@
+/*
+ *  Module "metrics"    -- Export counters over a local UNIX socket
+ *
+ *  This module serves the counters and gauges registered by the other
+ *  modules (see metrics.h) in the Prometheus text format, on a local
+ *  UNIX socket.  The socket is non-blocking and handled from the main
+ *  loop.  A client either sends an HTTP request, e.g.
+ *    curl --unix-socket ~/.mcabber/metrics.sock http://localhost/metrics
+ *  or sends anything else (or nothing, and shuts down its side of the
+ *  connection) to get the bare text.
+ *
+ *  Options:
+ *  - metrics_socket: string (default: "~/.mcabber/metrics.sock")
+ *    Socket path, read when the module is loaded.
+ *
+ *  /metrics            Display the metrics
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/logprint.h>
+#include <mcabber/settings.h>
+#include <mcabber/utils.h>
+#include <mcabber/xmpp.h>
+
+#define METRICS_MODULE
+#include "common/inittime.h"
+#include "metrics.h"
+
+static void metrics_init(void);
+static void metrics_uninit(void);
+
+MODULE_TIMED_INIT(metrics_init)
+
+/* Module description */
+module_info_t info_metrics = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Export counters over a local UNIX socket\n"
+                          " Provides the command /metrics",
+        .requires       = NULL,
+        .init           = metrics_init_timed,
+        .uninit         = metrics_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer metrics_cmdid;
+#endif
+
+#define DEFAULT_SOCKET    "~/.mcabber/metrics.sock"
+#define MAX_CLIENTS       8
+#define MAX_REQUEST       4096
+#define CLIENT_TIMEOUT    5     // seconds
+
+typedef struct {
+  GIOChannel *channel;
+  guint       srcno;
+  guint       timeout_srcno;
+  GString    *request;
+  GString    *reply;
+  gsize       sent;
+} metrics_client_t;
+
+static GSList *metrics_list;
+static GSList *clients;
+static GIOChannel *listen_channel;
+static guint listen_srcno;
+static gchar *socket_path;
+
+METRIC_DEFINE(m_connected, "mcabber_connected", METRIC_GAUGE,
+              "Whether the XMPP connection is up");
+METRIC_DEFINE(m_scrapes, "mcabber_metrics_scrapes_total", METRIC_COUNTER,
+              "Number of metrics requests served");
+
+void metrics_register(metric_t *metric)
+{
+  metrics_list = g_slist_append(metrics_list, metric);
+}
+
+void metrics_unregister(metric_t *metric)
+{
+  metrics_list = g_slist_remove(metrics_list, metric);
+}
+
+static GString *metrics_text(void)
+{
+  GString *text = g_string_sized_new(1024);
+  GSList *li;
+
+  METRIC_SET(m_connected, xmpp_is_online() ? 1 : 0);
+  for (li = metrics_list; li; li = g_slist_next(li)) {
+    metric_t *m = li->data;
+    g_string_append_printf(text, "# HELP %s %s\n# TYPE %s %s\n"
+                           "%s %" G_GINT64_FORMAT "\n",
+                           m->name, m->help, m->name,
+                           m->type == METRIC_COUNTER ? "counter" : "gauge",
+                           m->name, METRIC_GET(*m));
+  }
+  return text;
+}
+
+static void client_close(metrics_client_t *client)
+{
+  clients = g_slist_remove(clients, client);
+  if (client->srcno)
+    g_source_remove(client->srcno);
+  if (client->timeout_srcno)
+    g_source_remove(client->timeout_srcno);
+  g_io_channel_shutdown(client->channel, FALSE, NULL);
+  g_io_channel_unref(client->channel);
+  g_string_free(client->request, TRUE);
+  if (client->reply)
+    g_string_free(client->reply, TRUE);
+  g_free(client);
+}
+
+static gboolean client_write_cb(GIOChannel *channel, GIOCondition cond,
+                                gpointer data)
+{
+  metrics_client_t *client = data;
+  int fd = g_io_channel_unix_get_fd(channel);
+
+  while (client->sent < client->reply->len) {
+    ssize_t n = send(fd, client->reply->str + client->sent,
+                     client->reply->len - client->sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return TRUE;
+      break;
+    }
+    client->sent += n;
+  }
+  client->srcno = 0;
+  client_close(client);
+  return FALSE;
+}
+
+// Build the reply and switch the client to writing
+static void client_reply(metrics_client_t *client)
+{
+  GString *text;
+
+  METRIC_INC(m_scrapes);
+  text = metrics_text();
+  if (g_str_has_prefix(client->request->str, "GET ")) {
+    client->reply = g_string_sized_new(text->len + 128);
+    g_string_printf(client->reply, "HTTP/1.0 200 OK\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: %" G_GSIZE_FORMAT "\r\n\r\n", text->len);
+    g_string_append_len(client->reply, text->str, text->len);
+    g_string_free(text, TRUE);
+  } else {
+    client->reply = text;
+  }
+  client->srcno = g_io_add_watch(client->channel, G_IO_OUT|G_IO_ERR|G_IO_HUP,
+                                 client_write_cb, client);
+}
+
+static gboolean client_read_cb(GIOChannel *channel, GIOCondition cond,
+                               gpointer data)
+{
+  metrics_client_t *client = data;
+  int fd = g_io_channel_unix_get_fd(channel);
+  gchar buf[512];
+  ssize_t n;
+
+  for (;;) {
+    n = recv(fd, buf, sizeof buf, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return TRUE;
+    break;
+  }
+  if (n < 0) {
+    client->srcno = 0;
+    client_close(client);
+    return FALSE;
+  }
+  g_string_append_len(client->request, buf, n);
+
+  // Wait for the end of an HTTP request header; anything else is
+  // answered with the bare text
+  if (n > 0 && client->request->len < MAX_REQUEST &&
+      (g_str_has_prefix(client->request->str, "GET ") ||
+       !strncmp(client->request->str, "GET ", client->request->len)) &&
+      !strstr(client->request->str, "\r\n\r\n") &&
+      !strstr(client->request->str, "\n\n"))
+    return TRUE;
+
+  client->srcno = 0;
+  client_reply(client);
+  return FALSE;
+}
+
+static gboolean client_timeout_cb(gpointer data)
+{
+  metrics_client_t *client = data;
+
+  client->timeout_srcno = 0;
+  client_close(client);
+  return FALSE;
+}
+
+static gboolean listen_cb(GIOChannel *channel, GIOCondition cond,
+                          gpointer data)
+{
+  int fd;
+
+  while ((fd = accept(g_io_channel_unix_get_fd(channel), NULL, NULL)) >= 0) {
+    metrics_client_t *client;
+
+    if (g_slist_length(clients) >= MAX_CLIENTS ||
+        fcntl(fd, F_SETFL, O_NONBLOCK) < 0 ||
+        fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+      close(fd);
+      continue;
+    }
+    client = g_new0(metrics_client_t, 1);
+    client->channel = g_io_channel_unix_new(fd);
+    g_io_channel_set_close_on_unref(client->channel, TRUE);
+    client->request = g_string_new(NULL);
+    client->srcno = g_io_add_watch(client->channel, G_IO_IN|G_IO_ERR|G_IO_HUP,
+                                   client_read_cb, client);
+    client->timeout_srcno = g_timeout_add_seconds(CLIENT_TIMEOUT,
+                                                  client_timeout_cb, client);
+    clients = g_slist_prepend(clients, client);
+  }
+  return TRUE;
+}
+
+static void metrics_listen(const gchar *path)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  mode_t mask;
+  int fd, ret;
+
+  socket_path = expand_filename(path);
+  if (strlen(socket_path) >= sizeof addr.sun_path) {
+    scr_log_print(LPRINT_LOGNORM, "metrics: socket path too long: %s",
+                  socket_path);
+    goto fail;
+  }
+
+  // Remove a stale socket, but nothing else
+  if (!lstat(socket_path, &st)) {
+    if (!S_ISSOCK(st.st_mode)) {
+      scr_log_print(LPRINT_LOGNORM, "metrics: %s exists and is not a socket.",
+                    socket_path);
+      goto fail;
+    }
+    unlink(socket_path);
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    goto error;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+  ret = fcntl(fd, F_SETFL, O_NONBLOCK);
+  if (ret >= 0)
+    ret = fcntl(fd, F_SETFD, FD_CLOEXEC);
+  if (ret >= 0) {
+    // The socket is created with the owner permissions only: a chmod()
+    // after bind() would leave it open to the others in between
+    mask = umask(S_IXUSR|S_IRWXG|S_IRWXO);
+    ret = bind(fd, (struct sockaddr *)&addr, sizeof addr);
+    umask(mask);
+  }
+  if (ret < 0 || listen(fd, MAX_CLIENTS) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    goto error;
+  }
+
+  listen_channel = g_io_channel_unix_new(fd);
+  g_io_channel_set_close_on_unref(listen_channel, TRUE);
+  listen_srcno = g_io_add_watch(listen_channel, G_IO_IN, listen_cb, NULL);
+  return;
+
+error:
+  scr_log_print(LPRINT_LOGNORM, "metrics: cannot listen on %s (%s).",
+                socket_path, g_strerror(errno));
+fail:
+  g_free(socket_path);
+  socket_path = NULL;
+}
+
+static void do_metrics(char *args)
+{
+  GString *text = metrics_text();
+  gchar **lines, **l;
+
+  if (socket_path)
+    scr_log_print(LPRINT_NORMAL, "metrics: listening on %s", socket_path);
+  lines = g_strsplit(text->str, "\n", 0);
+  for (l = lines; *l; l++)
+    if (**l && **l != '#')
+      scr_log_print(LPRINT_NORMAL, " %s", *l);
+  g_strfreev(lines);
+  g_string_free(text, TRUE);
+}
+
+/* Initialization */
+static void metrics_init(void)
+{
+  const gchar *path = settings_opt_get("metrics_socket");
+
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  metrics_cmdid = cmd_add("metrics", "Display the exported metrics", 0, 0,
+                          do_metrics, NULL);
+#else
+  cmd_add("metrics", "Display the exported metrics", 0, 0, do_metrics, NULL);
+#endif
+
+  METRIC_REGISTER(m_connected);
+  METRIC_REGISTER(m_scrapes);
+  metrics_listen(path && *path ? path : DEFAULT_SOCKET);
+}
+
+/* Uninitialization */
+static void metrics_uninit(void)
+{
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(metrics_cmdid);
+#else
+  cmd_del("metrics");
+#endif
+
+  while (clients)
+    client_close(clients->data);
+  if (listen_channel) {
+    g_source_remove(listen_srcno);
+    g_io_channel_unref(listen_channel);
+    listen_channel = NULL;
+    unlink(socket_path);
+  }
+  g_free(socket_path);
+  socket_path = NULL;
+  g_slist_free(metrics_list);
+  metrics_list = NULL;
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -0,0 +1,72 @@
+/*
+ *  metrics.h       -- Counters and gauges exported by the metrics module
+ *
+ *  A module defines its metrics with METRIC_DEFINE(), registers them
+ *  with METRIC_REGISTER() at initialization and unregisters them with
+ *  METRIC_UNREGISTER() when it is unloaded.  Updates (METRIC_ADD,
+ *  METRIC_INC, METRIC_SET) are relaxed atomic operations on the module's
+ *  own variable: no lock, no lookup and no function call.
+ *
+ *  When the modules are not built with --enable-metrics
+ *  (MODULES_METRICS), all these macros do nothing.  Modules using them
+ *  must set ".requires = MODULE_REQUIRES" in their module description
+ *  (see common/requires.h).
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__ 1
+
+#include <glib.h>
+
+typedef enum {
+  METRIC_COUNTER,
+  METRIC_GAUGE
+} metric_type_t;
+
+typedef struct {
+  const gchar   *name;      // Prometheus metric name
+  const gchar   *help;
+  metric_type_t  type;
+  gint64         value;
+} metric_t;
+
+void metrics_register(metric_t *metric);
+void metrics_unregister(metric_t *metric);
+
+#if defined MODULES_METRICS || defined METRICS_MODULE
+# define METRIC_DEFINE(var, name, type, help) \
+         static metric_t var = { name, help, type, 0 }
+# define METRIC_REGISTER(var)     metrics_register(&(var))
+# define METRIC_UNREGISTER(var)   metrics_unregister(&(var))
+# define METRIC_ADD(var, n) \
+         ((void)__atomic_add_fetch(&(var).value, (n), __ATOMIC_RELAXED))
+# define METRIC_SET(var, n) \
+         __atomic_store_n(&(var).value, (n), __ATOMIC_RELAXED)
+# define METRIC_GET(var) \
+         __atomic_load_n(&(var).value, __ATOMIC_RELAXED)
+#else
+# define METRIC_DEFINE(var, name, type, help) \
+         typedef int var##_unused_t
+# define METRIC_REGISTER(var)     ((void)0)
+# define METRIC_UNREGISTER(var)   ((void)0)
+# define METRIC_ADD(var, n)       ((void)0)
+# define METRIC_SET(var, n)       ((void)0)
+# define METRIC_GET(var)          ((gint64)0)
+#endif
+
+#define METRIC_INC(var)           METRIC_ADD(var, 1)
+
+#endif /* __METRICS_H__ */
@@ -0,0 +1,78 @@
+/*
+ *  Mock mcabber host -- allocation counters
+ *
+ *  The malloc family is interposed (GLib allocates through malloc), so
+ *  the allocations made by the modules can be counted.  This relies on
+ *  the glibc __libc_* entry points.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "mockhost.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void  __libc_free(void *ptr);
+
+static gboolean counting;
+static mock_alloc_stats_t stats;
+
+void mock_alloc_count(gboolean enable)
+{
+  counting = enable;
+}
+
+void mock_alloc_get(mock_alloc_stats_t *st)
+{
+  *st = stats;
+}
+
+void *malloc(size_t size)
+{
+  if (counting) {
+    stats.allocs++;
+    stats.bytes += size;
+  }
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+  if (counting) {
+    stats.allocs++;
+    stats.bytes += nmemb * size;
+  }
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  if (counting) {
+    stats.allocs++;
+    stats.bytes += size;
+  }
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+  if (counting && ptr)
+    stats.frees++;
+  __libc_free(ptr);
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
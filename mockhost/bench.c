@@ -0,0 +1,695 @@
+/*
+ *  mcabber-bench -- offline module test and benchmark runner
+ *
+ *  Loads module objects built against the mock host headers, runs
+ *  optional commands, then feeds synthetic hook events to every handler
+ *  the modules have registered and reports per-handler throughput and
+ *  allocations.
+ *
+ *  Usage: mcabber-bench [-n iterations] [-s status] [-o option=value]...
+ *                       [-c command]... [-C command]... [-H hook]
+ *                       [-L rtt[,jitter[,loss]]] [-N ms] [-P occupants]
+ *                       [-R contacts] [-T ms] [-W ms] [-v] module.so...
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+#include <mcabber/roster.h>
+#include <mcabber/settings.h>
+#include <mcabber/xmpp.h>
+#include <mcabber/xmpp_defines.h>
+
+#include "mockhost.h"
+
+#define DEFAULT_ITERATIONS  10000
+#define WARMUP_ITERATIONS   100
+// Calls between two runs of the main loop, fewer than the slots of the
+// modules' work queues (common/workq.h): a full queue runs the deferred
+// tasks in the handler itself
+#define BATCH_ITERATIONS    32
+
+// Synthetic events, one per hook
+static hk_arg_t ev_message_in[] = {
+  { "jid",        "room@conference.example.org" },
+  { "resource",   "alice" },
+  { "message",    "mcabber: the build is broken again" },
+  { "groupchat",  "true" },
+  { "delayed",    "" },
+  { "error",      "false" },
+  { "attention",  "true" },
+  { NULL, NULL },
+};
+
+static hk_arg_t ev_message_out[] = {
+  { "jid",        "alice@example.org" },
+  { "message",    "On it." },
+  { NULL, NULL },
+};
+
+static hk_arg_t ev_status_change[] = {
+  { "jid",        "alice@example.org" },
+  { "resource",   "laptop" },
+  { "old_status", "o" },
+  { "new_status", "a" },
+  { "message",    "Lunch" },
+  { NULL, NULL },
+};
+
+static hk_arg_t ev_my_status_change[] = {
+  { "new_status", "o" },
+  { "message",    "" },
+  { NULL, NULL },
+};
+
+static hk_arg_t ev_unread_list_change[] = {
+  { "unread",        "12" },
+  { "attention",     "3" },
+  { "muc_unread",    "9" },
+  { "muc_attention", "1" },
+  { NULL, NULL },
+};
+
+static hk_arg_t ev_subscription[] = {
+  { "type",    "subscribe" },
+  { "jid",     "spammer@example.net" },
+  { "message", "Please add me" },
+  { NULL, NULL },
+};
+
+static hk_arg_t ev_mdr_received[] = {
+  { "jid",     "alice@example.org/phone" },
+  { NULL, NULL },
+};
+
+static hk_arg_t ev_empty[] = {
+  { NULL, NULL },
+};
+
+static const struct {
+  const gchar *hookname;
+  hk_arg_t    *args;
+} events[] = {
+  { HOOK_PRE_MESSAGE_IN,      ev_message_in },
+  { HOOK_POST_MESSAGE_IN,     ev_message_in },
+  { HOOK_MESSAGE_OUT,         ev_message_out },
+  { HOOK_STATUS_CHANGE,       ev_status_change },
+  { HOOK_MY_STATUS_CHANGE,    ev_my_status_change },
+  { HOOK_UNREAD_LIST_CHANGE,  ev_unread_list_change },
+  { HOOK_SUBSCRIPTION,        ev_subscription },
+  { HOOK_MDR_RECEIVED,        ev_mdr_received },
+  { HOOK_POST_CONNECT,        ev_empty },
+  { HOOK_PRE_DISCONNECT,      ev_empty },
+  { NULL, NULL },
+};
+
+static hk_arg_t *event_args(const gchar *hookname)
+{
+  guint i;
+
+  for (i = 0; events[i].hookname; i++)
+    if (!strcmp(events[i].hookname, hookname))
+      return events[i].args;
+  return NULL;
+}
+
+static gdouble now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Run the sources which are ready (e.g. the work deferred by the
+// handlers); returns the time spent
+static gdouble run_pending(void)
+{
+  gdouble t0 = now_ns();
+
+  while (g_main_context_iteration(NULL, FALSE))
+    ;
+  return now_ns() - t0;
+}
+
+// The handler is called in batches; the main loop is run after each
+// batch, and the time spent there (the deferred work, mostly) is
+// reported separately.  The allocations are those of both.
+static void bench_handler(mock_hook_t *h, hk_arg_t *args, guint iterations)
+{
+  mock_alloc_stats_t a0, a1;
+  gdouble t0, t_calls = 0., t_idle = 0., ns;
+  guint i, j, n;
+
+  for (i = 0; i < WARMUP_ITERATIONS; i++) {
+    h->handler(h->hookname, args, h->userdata);
+    if (!((i + 1) % BATCH_ITERATIONS))
+      run_pending();
+  }
+  run_pending();
+
+  mock_alloc_get(&a0);
+  mock_alloc_count(TRUE);
+  for (i = 0; i < iterations; i += n) {
+    n = MIN(iterations - i, BATCH_ITERATIONS);
+    t0 = now_ns();
+    for (j = 0; j < n; j++)
+      h->handler(h->hookname, args, h->userdata);
+    t_calls += now_ns() - t0;
+    t_idle += run_pending();
+  }
+  mock_alloc_count(FALSE);
+  mock_alloc_get(&a1);
+
+  ns = t_calls / iterations;
+  printf("%-16s %-26s %12.0f %10.1f %10.1f %10.2f %10.1f\n",
+         h->module, h->hookname, ns > 0 ? 1e9 / ns : 0., ns,
+         t_idle / iterations,
+         (gdouble)(a1.allocs - a0.allocs) / iterations,
+         (gdouble)(a1.bytes - a0.bytes) / iterations);
+}
+
+#define SPLIT_ROOM  "room@conference.example.org"
+
+static LmMessage *occupant_presence(guint n, gboolean available)
+{
+  LmMessage *m;
+  LmMessageNode *x, *item;
+  gchar *from = g_strdup_printf(SPLIT_ROOM "/user%u", n);
+
+  m = lm_message_new_with_sub_type(NULL, LM_MESSAGE_TYPE_PRESENCE,
+                                   available ? LM_MESSAGE_SUB_TYPE_NOT_SET
+                                             : LM_MESSAGE_SUB_TYPE_UNAVAILABLE);
+  lm_message_node_set_attribute(m->node, "from", from);
+  x = lm_message_node_add_child(m->node, "x", NULL);
+  lm_message_node_set_attribute(x, "xmlns", NS_MUC_USER);
+  item = lm_message_node_add_child(x, "item", NULL);
+  lm_message_node_set_attribute(item, "affiliation", "none");
+  lm_message_node_set_attribute(item, "role",
+                                available ? "participant" : "none");
+  if (available) {
+    // The same client for everybody: one capabilities hash
+    x = lm_message_node_add_child(m->node, "c", NULL);
+    lm_message_node_set_attribute(x, "xmlns", NS_CAPS);
+    lm_message_node_set_attribute(x, "ver", "QgayPKawpkPSDYmwT/WM94uAlu0=");
+  }
+  g_free(from);
+  return m;
+}
+
+static gboolean quit_cb(gpointer data)
+{
+  g_main_loop_quit(data);
+  return FALSE;
+}
+
+// Run the pending timers for a while
+static void drain_main_loop(guint ms)
+{
+  GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+
+  g_timeout_add(ms, quit_cb, loop);
+  g_main_loop_run(loop);
+  g_main_loop_unref(loop);
+}
+
+// Netsplit in a room: the occupants join, leave and join again, one
+// presence stanza each, as fast as the server sends them.  The pending
+// timers (e.g. delayed presence processing) are run afterwards.
+static void bench_netsplit(guint occupants)
+{
+  GSList *sl, *res = NULL;
+  gdouble t0, t1;
+  guint i, phase, n = 0;
+
+  mock_counters_reset();
+  t0 = now_ns();
+  for (phase = 0; phase < 3; phase++) {
+    // Join, leave, join again
+    for (i = 0; i < occupants; i++, n++) {
+      LmMessage *m = occupant_presence(i, phase != 1);
+      mock_lm_receive(m);
+      lm_message_unref(m);
+    }
+  }
+  t1 = now_ns();
+
+  drain_main_loop(1500);
+
+  sl = roster_find(SPLIT_ROOM, jidsearch, ROSTER_TYPE_ROOM);
+  if (sl)
+    res = buddy_getresources(sl->data);
+  printf("\nNetsplit: %u presences, %.0f ns/presence, %" G_GUINT64_FORMAT
+         " roster redraws, %" G_GUINT64_FORMAT " room buffer lines, "
+         "%u occupants\n", n, (t1 - t0) / n, mock_counters.roster_redraws,
+         mock_counters.buffer_lines,
+         g_slist_length(res));
+  g_slist_free_full(res, g_free);
+}
+
+#define RECONNECT_DEADLINE  1000  // ms
+
+static void count_resources(gpointer rosterdata, void *param)
+{
+  GSList *res = buddy_getresources(rosterdata);
+
+  *(guint *)param += g_slist_length(res);
+  g_slist_free_full(res, g_free);
+}
+
+static guint online_resources(void)
+{
+  guint n = 0;
+
+  foreach_buddy(ROSTER_TYPE_USER, count_resources, &n);
+  return n;
+}
+
+static void drop_resources(gpointer rosterdata, void *param)
+{
+  buddy_del_all_resources(rosterdata);
+}
+
+// Reconnection with a roster of online contacts: the connection is
+// closed (the resources are dropped, as mcabber does), opened again,
+// then the server sends the presences, except for one contact in ten
+// who went offline in the meantime.
+static void bench_reconnect(guint contacts)
+{
+  guint i, restored, online;
+  gdouble t0, t1;
+
+  for (i = 0; i < contacts; i++) {
+    gchar *jid = g_strdup_printf("contact%u@example.net", i);
+    roster_add_user(jid, NULL, "Contacts", ROSTER_TYPE_USER, sub_both, 1);
+    roster_setstatus(jid, "home", 0, i % 3 ? available : away, NULL, 0L,
+                     role_none, affil_none, NULL);
+    g_free(jid);
+  }
+  buddylist_build();
+
+  mock_disconnect();
+  foreach_buddy(ROSTER_TYPE_USER, drop_resources, NULL);
+  buddylist_build();
+
+  mock_counters_reset();
+  t0 = now_ns();
+  mock_connect();
+  t1 = now_ns();
+  restored = online_resources();
+
+  for (i = 0; i < contacts; i++) {
+    gchar *from;
+    LmMessage *m;
+
+    if (i % 10 == 9)
+      continue;
+    from = g_strdup_printf("contact%u@example.net/home", i);
+    m = lm_message_new(NULL, LM_MESSAGE_TYPE_PRESENCE);
+    lm_message_node_set_attribute(m->node, "from", from);
+    if (!(i % 3))
+      lm_message_node_add_child(m->node, "show", "away");
+    mock_lm_receive(m);
+    lm_message_unref(m);
+    g_free(from);
+  }
+  online = online_resources();
+  drain_main_loop(RECONNECT_DEADLINE + 500);
+
+  printf("\nReconnect: %u contacts, %u resources restored in %.0f us, "
+         "%u online after the presences, %u after %u ms; %" G_GUINT64_FORMAT
+         " roster redraws\n", contacts, restored, (t1 - t0) / 1e3, online,
+         online_resources(), RECONNECT_DEADLINE + 500,
+         mock_counters.roster_redraws);
+}
+
+// Typing in a chat window with alice, like mcabber's screen: "composing"
+// with the first keystroke, "paused" after a while without keystroke
+// (1 s here instead of 6 s), "active" with the message.  Each round is
+// one second of typing (a keystroke every 100 ms) and 1.5 s of
+// thinking; every third round sends a message.  Alice sends a chat state
+// every 5 s.
+#define TYPING_TICK       100   // ms
+#define TYPING_ROUND      25    // ticks
+#define TYPING_KEYS       10    // ticks
+#define TYPING_PAUSE      10    // ticks without keystroke
+#define TYPING_REPLY      50    // ticks
+
+typedef struct {
+  gpointer buddy;
+  guint    tick;
+  guint    idle;
+  guint    state;
+  guint    changes;             // State changes, i.e. notifications
+  guint    messages;
+} typing_t;
+
+static void typing_set_state(typing_t *t, guint state)
+{
+  if (t->state == state)
+    return;
+  t->state = state;
+  t->changes++;
+  xmpp_send_chatstate(t->buddy, state);
+}
+
+static gboolean typing_cb(gpointer data)
+{
+  typing_t *t = data;
+  guint round = t->tick / TYPING_ROUND, pos = t->tick % TYPING_ROUND;
+
+  if (pos < TYPING_KEYS) {
+    t->idle = 0;
+    typing_set_state(t, ROSTER_EVENT_COMPOSING);
+  } else if (pos == TYPING_KEYS && round % 3 == 2) {
+    // The message carries the "active" state (no notification)
+    struct xep0085 *xep85 = buddy_resource_xep85(t->buddy, "laptop");
+    if (xep85 && xep85->support != CHATSTATES_SUPPORT_NOSUPPORT)
+      xep85->last_state_sent = ROSTER_EVENT_ACTIVE;
+    t->state = ROSTER_EVENT_ACTIVE;
+    t->messages++;
+    mock_counters.stanzas_sent++;
+  } else if (++t->idle == TYPING_PAUSE && t->state == ROSTER_EVENT_COMPOSING) {
+    typing_set_state(t, ROSTER_EVENT_PAUSED);
+  }
+
+  if (!(t->tick % TYPING_REPLY)) {
+    LmMessage *m = lm_message_new(NULL, LM_MESSAGE_TYPE_MESSAGE);
+    LmMessageNode *node;
+    lm_message_node_set_attribute(m->node, "from",
+                                  "alice@example.org/laptop");
+    node = lm_message_node_add_child(m->node,
+                                     t->tick % (2 * TYPING_REPLY) ?
+                                     "paused" : "composing", NULL);
+    lm_message_node_set_attribute(node, "xmlns", NS_CHATSTATES);
+    mock_lm_receive(m);
+    lm_message_unref(m);
+  }
+  t->tick++;
+  return TRUE;
+}
+
+static void bench_typing(guint ms)
+{
+  typing_t t = { 0 };
+  struct xep0085 *xep85;
+  GSList *sl;
+  GList *li;
+  guint srcno;
+
+  sl = roster_find("alice@example.org", jidsearch, ROSTER_TYPE_USER);
+  if (!sl)
+    return;
+  t.buddy = sl->data;
+  t.state = ROSTER_EVENT_ACTIVE;
+  for (li = buddylist; li; li = g_list_next(li))
+    if (li->data == t.buddy)
+      current_buddy = li;
+  buddy_setactiveresource(t.buddy, "laptop");
+  xep85 = buddy_resource_xep85(t.buddy, "laptop");
+  if (xep85)
+    xep85->support = CHATSTATES_SUPPORT_OK;
+
+  mock_counters_reset();
+  srcno = g_timeout_add(TYPING_TICK, typing_cb, &t);
+  drain_main_loop(ms);
+  g_source_remove(srcno);
+  current_buddy = NULL;
+
+  printf("\nTyping: %u ms, %u messages, %u chat state changes, %"
+         G_GUINT64_FORMAT " notifications sent\n", ms, t.messages,
+         t.changes, mock_counters.chatstates_sent);
+}
+
+// Burst of highlights, as in a busy room or after a netsplit: every
+// HIGHLIGHT_TICK ms, HIGHLIGHT_EVENTS messages for us from a few rooms
+// and contacts.  A notification command run for each event would start
+// as many processes.
+#define HIGHLIGHT_TICK    10    // ms
+#define HIGHLIGHT_EVENTS  5     // per tick
+
+static const struct {
+  const gchar *jid;
+  const gchar *nick;            // NULL for a private message
+} highlight_from[] = {
+  { "room@conference.example.org", "alice" },
+  { "dev@conference.example.org",  "bob" },
+  { "ops@conference.example.org",  "carol" },
+  { "alice@example.org",           NULL },
+  { "bob@example.org",             NULL },
+};
+
+static gboolean highlight_cb(gpointer data)
+{
+  guint *events = data;
+  guint i;
+
+  for (i = 0; i < HIGHLIGHT_EVENTS; i++, (*events)++) {
+    guint n = *events % G_N_ELEMENTS(highlight_from);
+    gchar msg[64];
+    hk_arg_t args[] = {
+      { "jid",       highlight_from[n].jid },
+      { "resource",  highlight_from[n].nick ? highlight_from[n].nick
+                                            : "laptop" },
+      { "message",   msg },
+      { "groupchat", highlight_from[n].nick ? "true" : "false" },
+      { "delayed",   "" },
+      { "error",     "false" },
+      { "attention", "true" },
+      { NULL, NULL },
+    };
+    snprintf(msg, sizeof msg, "mcabber: are you there? (%u)", *events);
+    hk_run_handlers(HOOK_POST_MESSAGE_IN, args);
+  }
+  return TRUE;
+}
+
+static void bench_highlights(guint ms)
+{
+  guint events = 0, srcno;
+
+  srcno = g_timeout_add(HIGHLIGHT_TICK, highlight_cb, &events);
+  drain_main_loop(ms);
+  g_source_remove(srcno);
+  drain_main_loop(500);         // Last batches
+
+  printf("\nHighlights: %u ms, %u events from %u senders\n", ms, events,
+         (guint)G_N_ELEMENTS(highlight_from));
+}
+
+// Local server stand-in: answers the pings (XEP-0199) after rtt ms, give
+// or take jitter ms, and drops loss% of them
+static struct {
+  guint rtt, jitter, loss;
+  guint pings, replies;
+} server;
+
+static gboolean server_reply_cb(gpointer data)
+{
+  LmMessage *m = data;
+
+  server.replies++;
+  mock_lm_receive(m);
+  lm_message_unref(m);
+  return FALSE;
+}
+
+static void server_send_hook(LmMessage *m)
+{
+  LmMessageNode *ping = lm_message_node_get_child(m->node, "ping");
+  const gchar *to, *id;
+  LmMessage *r;
+  gint delay;
+
+  if (lm_message_get_type(m) != LM_MESSAGE_TYPE_IQ ||
+      lm_message_get_sub_type(m) != LM_MESSAGE_SUB_TYPE_GET || !ping ||
+      g_strcmp0(lm_message_node_get_attribute(ping, "xmlns"), NS_PING))
+    return;
+  server.pings++;
+  if ((guint)g_random_int_range(0, 100) < server.loss)
+    return;
+
+  to = lm_message_node_get_attribute(m->node, "to");
+  id = lm_message_node_get_attribute(m->node, "id");
+  r = lm_message_new_with_sub_type(NULL, LM_MESSAGE_TYPE_IQ,
+                                   LM_MESSAGE_SUB_TYPE_RESULT);
+  lm_message_node_set_attribute(r->node, "from", to ? to : "example.org");
+  lm_message_node_set_attribute(r->node, "id", id);
+  delay = server.rtt;
+  if (server.jitter)
+    delay += g_random_int_range(-(gint)server.jitter, server.jitter + 1);
+  g_timeout_add(MAX(delay, 0), server_reply_cb, r);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-n iterations] [-s status] "
+          "[-o option=value]... [-c command]... [-C command]... [-H hook] "
+          "[-L rtt[,jitter[,loss]]] [-N ms] [-P occupants] [-R contacts] "
+          "[-T ms] [-W ms] [-v] module.so...\n", prog);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  GSList *cmds = NULL, *postcmds = NULL, *li, *handlers;
+  const gchar *onlyhook = NULL;
+  guint iterations = DEFAULT_ITERATIONS, occupants = 0, contacts = 0;
+  guint wait_ms = 0, typing_ms = 0, highlight_ms = 0;
+  gdouble t_load;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "n:s:o:c:C:H:L:N:P:R:T:W:v")) != -1) {
+    switch (opt) {
+      case 'n':
+          iterations = strtoul(optarg, NULL, 10);
+          break;
+      case 's':
+          {
+            const char *p = strchr(imstatus2char, optarg[0]);
+            if (!p || !optarg[0])
+              usage(argv[0]);
+            mock_set_status(p - imstatus2char);
+          }
+          break;
+      case 'o':
+          {
+            gchar **kv = g_strsplit(optarg, "=", 2);
+            if (!kv[0] || !kv[1])
+              usage(argv[0]);
+            settings_set(SETTINGS_TYPE_OPTION, kv[0], kv[1]);
+            g_strfreev(kv);
+          }
+          break;
+      case 'c':
+          cmds = g_slist_append(cmds, optarg);
+          break;
+      case 'C':
+          postcmds = g_slist_append(postcmds, optarg);
+          break;
+      case 'H':
+          onlyhook = optarg;
+          break;
+      case 'L':
+          if (sscanf(optarg, "%u,%u,%u", &server.rtt, &server.jitter,
+                     &server.loss) < 1)
+            usage(argv[0]);
+          mock_lm_set_send_hook(server_send_hook);
+          break;
+      case 'N':
+          highlight_ms = strtoul(optarg, NULL, 10);
+          break;
+      case 'P':
+          occupants = strtoul(optarg, NULL, 10);
+          break;
+      case 'R':
+          contacts = strtoul(optarg, NULL, 10);
+          break;
+      case 'T':
+          typing_ms = strtoul(optarg, NULL, 10);
+          break;
+      case 'W':
+          wait_ms = strtoul(optarg, NULL, 10);
+          break;
+      case 'v':
+          mock_verbose = TRUE;
+          break;
+      default:
+          usage(argv[0]);
+    }
+  }
+  if (optind >= argc || !iterations)
+    usage(argv[0]);
+
+  mock_roster_fixture();
+
+  // Loading time, required modules and init functions included
+  t_load = now_ns();
+  for (i = optind; i < argc; i++) {
+    gchar *name;
+    gdouble t0 = now_ns();
+    module_info_t *info = mock_module_load(argv[i], &name);
+    if (!info)
+      return 1;
+    printf("Loaded module %s (%s) in %.3f ms\n", name, info->version,
+           (now_ns() - t0) / 1e6);
+  }
+  printf("Modules loaded in %.3f ms\n", (now_ns() - t_load) / 1e6);
+
+  for (li = cmds; li; li = g_slist_next(li))
+    process_command(li->data, TRUE);
+  g_slist_free(cmds);
+  // As mcabber, the modules are loaded before the connection
+  mock_connect();
+  // Let the modules do their background work
+  if (wait_ms) {
+    gdouble t0 = now_ns();
+    drain_main_loop(wait_ms);
+    printf("Main loop run for %.0f ms\n", (now_ns() - t0) / 1e6);
+    if (server.pings)
+      printf("Server: %u pings, %u replies\n", server.pings,
+             server.replies);
+  }
+
+  printf("\n%-16s %-26s %12s %10s %10s %10s %10s\n", "module", "hook",
+         "ops/s", "ns/op", "idle ns/op", "allocs/op", "bytes/op");
+
+  // Handlers can register other handlers; work on a copy of the list
+  handlers = g_slist_copy(mock_hook_handlers());
+  mock_counters_reset();
+  for (li = handlers; li; li = g_slist_next(li)) {
+    mock_hook_t *h = li->data;
+    hk_arg_t *args = event_args(h->hookname);
+
+    if (onlyhook && strcmp(onlyhook, h->hookname))
+      continue;
+    if (!args) {
+      printf("%-16s %-26s (no synthetic event)\n", h->module, h->hookname);
+      continue;
+    }
+    bench_handler(h, args, iterations);
+  }
+  g_slist_free(handlers);
+
+  printf("\nHost: %" G_GUINT64_FORMAT " log lines, %" G_GUINT64_FORMAT
+         " s10n replies, %" G_GUINT64_FORMAT " stanzas, %" G_GUINT64_FORMAT
+         " status bar updates, %" G_GUINT64_FORMAT " roster redraws\n",
+         mock_counters.log_lines, mock_counters.s10n_sent,
+         mock_counters.stanzas_sent, mock_counters.status_updates,
+         mock_counters.roster_redraws);
+
+  if (occupants)
+    bench_netsplit(occupants);
+  if (contacts)
+    bench_reconnect(contacts);
+  if (typing_ms)
+    bench_typing(typing_ms);
+  if (highlight_ms)
+    bench_highlights(highlight_ms);
+
+  for (li = postcmds; li; li = g_slist_next(li))
+    process_command(li->data, TRUE);
+  g_slist_free(postcmds);
+
+  mock_module_unload_all();
+  return 0;
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -0,0 +1,907 @@
+/*
+ *  mcabber-check -- offline module and file format checks
+ *
+ *  Loads module objects built against the mock host headers, drives
+ *  them with known events and compares the results with the expected
+ *  ones: the hook argument parser (common/hkargs.h), the info_msgcount
+ *  shared state and its seqlock (msgcount_shm.h), the toptalkers
+ *  counts, the hsearch index file (hsearch.h) and the rostersnap
+ *  restore and expiry.  Each mismatch is reported; the exit status is 1
+ *  if there is any.
+ *
+ *  Usage: mcabber-check [-v] moddir
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+#include <mcabber/logprint.h>
+#include <mcabber/roster.h>
+#include <mcabber/settings.h>
+#include <mcabber/xmpp.h>
+
+#include "common/hkargs.h"
+#include "hsearch/hsearch.h"
+#include "info_msgcount/msgcount_shm.h"
+#include "mockhost.h"
+
+static const gchar *moddir, *tmpdir;
+static const gchar *current;            // Check running
+static guint nchecks, nfailed;
+static GPtrArray *log_lines;
+
+static void check(gboolean ok, const gchar *fmt, ...) G_GNUC_PRINTF(2, 3);
+
+static void check(gboolean ok, const gchar *fmt, ...)
+{
+  va_list ap;
+
+  nchecks++;
+  if (ok)
+    return;
+  nfailed++;
+  printf("FAIL %s: ", current);
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+  printf("\n");
+}
+
+static void log_hook(guint flag, const gchar *line)
+{
+  if (flag != LPRINT_DEBUG)
+    g_ptr_array_add(log_lines, g_strdup(line));
+}
+
+static void log_clear(void)
+{
+  g_ptr_array_set_size(log_lines, 0);
+}
+
+// Index of the first log line starting with prefix, from index start;
+// -1 if there is none
+static gint log_find(guint start, const gchar *prefix)
+{
+  guint i;
+
+  for (i = start; i < log_lines->len; i++)
+    if (g_str_has_prefix(g_ptr_array_index(log_lines, i), prefix))
+      return i;
+  return -1;
+}
+
+static const gchar *log_line(gint i)
+{
+  return i >= 0 && (guint)i < log_lines->len ?
+         g_ptr_array_index(log_lines, i) : "";
+}
+
+static void run_pending(void)
+{
+  while (g_main_context_iteration(NULL, FALSE))
+    ;
+}
+
+static gboolean quit_cb(gpointer data)
+{
+  g_main_loop_quit(data);
+  return FALSE;
+}
+
+// Run the pending timers for a while
+static void drain_main_loop(guint ms)
+{
+  GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+
+  g_timeout_add(ms, quit_cb, loop);
+  g_main_loop_run(loop);
+  g_main_loop_unref(loop);
+}
+
+static gboolean load(const gchar *name)
+{
+  gchar *path = g_strdup_printf("%s/lib%s.so", moddir, name);
+  module_info_t *info = mock_module_load(path, NULL);
+
+  check(info != NULL, "cannot load %s", path);
+  g_free(path);
+  return info != NULL;
+}
+
+static gchar *tmp_path(const gchar *name)
+{
+  return g_build_filename(tmpdir, name, NULL);
+}
+
+/* hkargs */
+
+static void check_hkargs(void)
+{
+  hk_arg_t args[] = {
+    { "mu",            "prefix of two names" },
+    { "",              "empty name" },
+    { "jid",           "alice@example.org" },
+    { "muc_unread",    "9" },
+    { "message",       "hello" },
+    { "unread",        "12 messages" },
+    { "muc_attention", NULL },
+    { "jid",           "bob@example.org" },
+    { "groupchat",     "true" },
+    { "attention",     "false" },
+    { NULL, NULL },
+  };
+  const guint numeric = HKARG(HKARG_UNREAD) | HKARG(HKARG_MUC_UNREAD) |
+                        HKARG(HKARG_MUC_ATTENTION);
+  const guint wanted = numeric | HKARG(HKARG_JID) | HKARG(HKARG_MESSAGE) |
+                       HKARG(HKARG_GROUPCHAT) | HKARG(HKARG_ATTENTION) |
+                       HKARG(HKARG_TYPE);
+  hkargs_t a;
+  guint found;
+  gint key;
+
+  current = "hkargs";
+  for (key = 0; key < HKARG_COUNT; key++)
+    check(hkarg_key(hkarg_names[key]) == key, "\"%s\" is not key %d",
+          hkarg_names[key], key);
+  check(hkarg_key("muc") < 0 && hkarg_key("jids") < 0 &&
+        hkarg_key("x") < 0 && hkarg_key("") < 0,
+        "an unknown name has a key");
+
+  found = hkargs_parse(args, wanted, numeric, &a);
+  check(found == (wanted & ~HKARG(HKARG_TYPE)), "found 0x%x, expected 0x%x",
+        found, wanted & ~HKARG(HKARG_TYPE));
+  check(!g_strcmp0(hkargs_value(&a, HKARG_JID), "alice@example.org"),
+        "jid is \"%s\", not the first one", hkargs_value(&a, HKARG_JID));
+  check(!g_strcmp0(hkargs_value(&a, HKARG_MESSAGE), "hello"),
+        "message is \"%s\"", hkargs_value(&a, HKARG_MESSAGE));
+  check(hkargs_uint(&a, HKARG_UNREAD) == 12, "unread is %u",
+        hkargs_uint(&a, HKARG_UNREAD));
+  check(hkargs_uint(&a, HKARG_MUC_UNREAD) == 9, "muc_unread is %u",
+        hkargs_uint(&a, HKARG_MUC_UNREAD));
+  check(!hkargs_value(&a, HKARG_MUC_ATTENTION) &&
+        !hkargs_uint(&a, HKARG_MUC_ATTENTION),
+        "a NULL muc_attention is not 0");
+  check(!hkargs_value(&a, HKARG_TYPE) && !hkargs_uint(&a, HKARG_TYPE),
+        "type found");
+  check(hkargs_true(&a, HKARG_GROUPCHAT) && !hkargs_true(&a, HKARG_ATTENTION),
+        "wrong booleans");
+  check(!hkargs_value(&a, HKARG_DELAYED), "delayed found, not wanted");
+
+  found = hkargs_parse(args, HKARG(HKARG_JID) | HKARG(HKARG_RESOURCE), 0,
+                       &a);
+  check(found == HKARG(HKARG_JID) && !hkargs_value(&a, HKARG_RESOURCE),
+        "found 0x%x with a missing key", found);
+}
+
+/* info_msgcount shared state */
+
+static msgcount_shm_t *shm_test;
+static volatile sig_atomic_t shm_writes;
+
+// As the module publishes: seq odd during the update.  Run from a timer
+// signal, which interrupts the reader anywhere, even on a single CPU.
+static void shm_writer(int sig)
+{
+  msgcount_shm_t *shm = shm_test;
+  guint32 seq = shm->seq, v = ++shm_writes;
+
+  __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  shm->unread = shm->attention = shm->muc_unread = v;
+  shm->muc_attention = shm->private_unread = shm->nbuffers = v;
+  memset(shm->buffers[0].jid, 'a' + v % 26, MSGCOUNT_SHM_JIDLEN - 1);
+  __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static gboolean shm_consistent(const msgcount_shm_t *s)
+{
+  guint32 v = s->unread;
+  guint i;
+
+  if (s->attention != v || s->muc_unread != v || s->muc_attention != v ||
+      s->private_unread != v ||
+      s->nbuffers != MIN(v, MSGCOUNT_SHM_BUFFERS))
+    return FALSE;
+  for (i = 0; i < MSGCOUNT_SHM_JIDLEN - 1; i++)
+    if (s->buffers[0].jid[i] != s->buffers[0].jid[0])
+      return FALSE;
+  return TRUE;
+}
+
+static void check_shm_seqlock(void)
+{
+  msgcount_shm_t *shm = g_new0(msgcount_shm_t, 1), copy;
+  struct itimerval every = { { 0, 20 }, { 0, 20 } }, never = { { 0 } };
+  guint reads = 0, ok = 0, torn = 0;
+  gint64 end;
+
+  check(!msgcount_shm_read(shm, &copy), "read without magic");
+  shm->magic = MSGCOUNT_SHM_MAGIC;
+  shm->size  = sizeof *shm - 1;
+  check(!msgcount_shm_read(shm, &copy), "read with a wrong size");
+  shm->size  = sizeof *shm;
+  shm->nbuffers = MSGCOUNT_SHM_BUFFERS + 1;
+  check(msgcount_shm_read(shm, &copy) &&
+        copy.nbuffers == MSGCOUNT_SHM_BUFFERS,
+        "nbuffers not limited to the array");
+  shm->nbuffers = 0;
+  shm->seq = 1;
+  check(!msgcount_shm_read(shm, &copy),
+        "read while an update never ends");
+  shm->seq = 0;
+
+  // Concurrent updates: every copy returned must be consistent
+  shm_test = shm;
+  shm_writes = 0;
+  signal(SIGALRM, shm_writer);
+  setitimer(ITIMER_REAL, &every, NULL);
+  end = g_get_monotonic_time() + 200000;
+  while (g_get_monotonic_time() < end) {
+    reads++;
+    if (!msgcount_shm_read(shm, &copy))
+      continue;
+    ok++;
+    if (!shm_consistent(&copy))
+      torn++;
+  }
+  setitimer(ITIMER_REAL, &never, NULL);
+  signal(SIGALRM, SIG_DFL);
+  check(!torn, "%u torn copies out of %u", torn, ok);
+  check(ok > 0 && shm_writes > 0, "%u reads, %u successful, %u writes",
+        reads, ok, (guint)shm_writes);
+  g_free(shm);
+}
+
+static void check_msgcount(void)
+{
+  hk_arg_t args[] = {
+    { "unread",        "12" },
+    { "attention",     "3" },
+    { "muc_unread",    "9" },
+    { "muc_attention", "1" },
+    { NULL, NULL },
+  };
+  gchar *path = tmp_path("unread");
+  const msgcount_shm_t *shm;
+  msgcount_shm_t s;
+  guint i, rooms = 0;
+  int fd;
+
+  current = "msgcount_shm";
+  check_shm_seqlock();
+
+  settings_set(SETTINGS_TYPE_OPTION, "info_msgcount_shm", path);
+  if (!load("info_msgcount"))
+    goto out;
+  hk_run_handlers(HOOK_UNREAD_LIST_CHANGE, args);
+  run_pending();
+
+  fd = open(path, O_RDONLY);
+  shm = fd < 0 ? MAP_FAILED : mmap(NULL, sizeof *shm, PROT_READ, MAP_SHARED,
+                                   fd, 0);
+  if (fd >= 0)
+    close(fd);
+  check(shm != MAP_FAILED, "cannot map %s", path);
+  if (shm == MAP_FAILED) {
+    mock_module_unload_all();
+    goto out;
+  }
+  check(msgcount_shm_read(shm, &s), "no state in %s", path);
+  check(s.version == MSGCOUNT_SHM_VERSION && s.pid == (guint32)getpid(),
+        "version %u, pid %u", s.version, s.pid);
+  check(s.unread == 12 && s.attention == 3 && s.muc_unread == 9 &&
+        s.muc_attention == 1 && s.private_unread == 4,
+        "counts %u %u %u %u %u, expected 12 3 9 1 4", s.unread, s.attention,
+        s.muc_unread, s.muc_attention, s.private_unread);
+  // The roster fixture has two unread buffers: alice and a room
+  check(s.nbuffers == 2 && !s.truncated, "%u buffers listed, %u truncated",
+        s.nbuffers, s.truncated);
+  for (i = 0; i < s.nbuffers && i < MSGCOUNT_SHM_BUFFERS; i++)
+    if (s.buffers[i].flags & MSGCOUNT_SHM_ROOM) {
+      rooms++;
+      check(!strcmp(s.buffers[i].jid, "room@conference.example.org"),
+            "room buffer %s", s.buffers[i].jid);
+    } else {
+      check(!strcmp(s.buffers[i].jid, "alice@example.org"),
+            "buffer %s", s.buffers[i].jid);
+    }
+  check(rooms == 1, "%u room buffers", rooms);
+
+  mock_module_unload_all();
+  check(msgcount_shm_read(shm, &s) && s.pid == 0,
+        "pid %u after the module is unloaded", s.pid);
+  munmap((gpointer)shm, sizeof *shm);
+
+out:
+  settings_set(SETTINGS_TYPE_OPTION, "info_msgcount_shm", NULL);
+  unlink(path);
+  g_free(path);
+}
+
+/* toptalkers */
+
+#define TALKERS     100     // contactN sends N+1 messages
+#define TOP_SHOWN   10
+
+static void message_in(const gchar *jid, const gchar *res, gboolean muc,
+                       gboolean delayed)
+{
+  hk_arg_t args[] = {
+    { "jid",       jid },
+    { "resource",  res },
+    { "message",   "Hi" },
+    { "groupchat", muc ? "true" : "false" },
+    { "delayed",   delayed ? "20200308T10:11:12Z" : "" },
+    { NULL, NULL },
+  };
+
+  hk_run_handlers(HOOK_POST_MESSAGE_IN, args);
+}
+
+static void check_toptalkers(void)
+{
+  static const struct {
+    const gchar *jid;
+    guint        count;
+  } rooms[] = {
+    { "room0@conference.example.org", 50 },
+    { "room1@conference.example.org", 20 },
+    { "room2@conference.example.org", 5 },
+  };
+  gchar key[256];
+  guint i, round, count;
+  gint r, c;
+  gdouble rate;
+
+  current = "toptalkers";
+  if (!load("toptalkers"))
+    return;
+
+  // Round robin: the heavy hitters only stand out at the end, after
+  // the heap has been filled with the others
+  for (round = 0; round < TALKERS; round++)
+    for (i = round; i < TALKERS; i++) {
+      gchar *jid = g_strdup_printf("contact%02u@example.net", i);
+      message_in(jid, "home", FALSE, FALSE);
+      g_free(jid);
+    }
+  for (i = 0; i < G_N_ELEMENTS(rooms); i++) {
+    for (count = 0; count < rooms[i].count; count++)
+      message_in(rooms[i].jid, "alice", TRUE, FALSE);
+    // History replayed on join
+    for (count = 0; count < 10; count++)
+      message_in(rooms[i].jid, "bob", TRUE, TRUE);
+  }
+
+  log_clear();
+  process_command("toptalkers 1m", TRUE);
+  r = log_find(0, " Rooms:");
+  c = log_find(0, " Contacts:");
+  check(log_find(0, "Top talkers, last 1m") == 0 && r == 1 && c == 5 &&
+        log_lines->len == 6 + TOP_SHOWN, "unexpected output (%u lines)",
+        log_lines->len);
+  for (i = 0; r >= 0 && i < G_N_ELEMENTS(rooms); i++) {
+    const gchar *line = log_line(r + 1 + i);
+    check(sscanf(line, "%u %lf/min %255s", &count, &rate, key) == 3 &&
+          !strcmp(key, rooms[i].jid) && count == rooms[i].count,
+          "room %u: \"%s\", expected %u for %s", i, line, rooms[i].count,
+          rooms[i].jid);
+  }
+  for (i = 0; c >= 0 && i < TOP_SHOWN; i++) {
+    const gchar *line = log_line(c + 1 + i);
+    gchar *jid = g_strdup_printf("contact%02u@example.net", TALKERS - 1 - i);
+    check(sscanf(line, "%u %lf/min %255s", &count, &rate, key) == 3 &&
+          !strcmp(key, jid) && count == TALKERS - i,
+          "contact %u: \"%s\", expected %u for %s", i, line, TALKERS - i,
+          jid);
+    g_free(jid);
+  }
+
+  log_clear();
+  process_command("toptalkers 2m", TRUE);
+  check(log_find(0, "Usage: /toptalkers") == 0, "2m window accepted");
+  mock_module_unload_all();
+}
+
+/* hsearch */
+
+typedef struct {
+  const gchar *file;
+  const gchar *record;
+  gboolean     indexed;         // A message of 3 characters or more
+  guint64      offset;          // Set when the file is written
+} hrecord_t;
+
+static hrecord_t hrecords[] = {
+  { "alice@example.org", "MR 20200308T10:11:12Z 000 Hello world\n", TRUE },
+  { "alice@example.org", "MS 20200308T10:12:00Z 000 the quick brown fox\n",
+    TRUE },
+  { "alice@example.org", "SO 20200308T10:13:00Z 000 online\n", FALSE },
+  { "alice@example.org", "MR 20200309T08:00:00Z 001 multi line\n"
+                         "hello again\n", TRUE },
+  { "bob@example.org",   "not a record\n", FALSE },
+  { "bob@example.org",   "MR 20200310T09:00:00Z 000 HELLO bob\n", TRUE },
+  { "bob@example.org",   "MR 20200310T09:01:00Z 000 hi\n", FALSE },
+  { "bob@example.org",   "MS 20200310T09:02:00Z 000 nothing here\n", TRUE },
+};
+
+#define HLOG_TEXT   26
+
+static guint32 trigram(const gchar *p)
+{
+  guint32 t = 0;
+  guint i;
+
+  for (i = 0; i < 3; i++)
+    t = t << 8 | (p[i] == '\n' ? ' ' : g_ascii_tolower(p[i]));
+  return t;
+}
+
+static void histo_write(const gchar *dir)
+{
+  guint i;
+
+  g_mkdir(dir, 0700);
+  for (i = 0; i < G_N_ELEMENTS(hrecords); i++) {
+    gchar *path = g_build_filename(dir, hrecords[i].file, NULL);
+    FILE *fp = fopen(path, "a");
+    if (fp) {
+      fseek(fp, 0, SEEK_END);
+      hrecords[i].offset = ftell(fp);
+      fputs(hrecords[i].record, fp);
+      fclose(fp);
+    }
+    g_free(path);
+  }
+}
+
+static void hsearch_check_postings(const gchar *data, const idx_header_t *hdr,
+                                   GHashTable *expected)
+{
+  const idx_tri_t *tri = (const idx_tri_t *)(data + hdr->tri_off);
+  const guchar *post = (const guchar *)data + hdr->post_off;
+  guint64 post_size = hdr->tri_off - hdr->post_off;
+  guint32 i;
+
+  check(hdr->ntri == g_hash_table_size(expected), "%u trigrams, expected %u",
+        hdr->ntri, g_hash_table_size(expected));
+  for (i = 0; i < hdr->ntri; i++) {
+    GArray *docs = g_hash_table_lookup(expected,
+                                       GUINT_TO_POINTER(tri[i].tri));
+    const guchar *p, *end;
+    guint64 doc = 0, v;
+    guint32 n = 0;
+    gboolean same = TRUE;
+
+    check(!i || tri[i].tri > tri[i-1].tri, "trigram %u not sorted", i);
+    if (!docs) {
+      check(FALSE, "unexpected trigram 0x%06x", tri[i].tri);
+      continue;
+    }
+    if (tri[i].post_off > post_size ||
+        tri[i].post_len > post_size - tri[i].post_off) {
+      check(FALSE, "trigram 0x%06x postings out of bounds", tri[i].tri);
+      continue;
+    }
+    p = post + tri[i].post_off;
+    end = p + tri[i].post_len;
+    while (p < end && (p = hsearch_get_varint(p, end, &v)) != NULL) {
+      doc += v;
+      if (n >= docs->len || g_array_index(docs, guint64, n) != doc)
+        same = FALSE;
+      n++;
+    }
+    check(p == end && same && n == docs->len && tri[i].count == n &&
+          tri[i].last == doc,
+          "trigram 0x%06x: %u postings (count %u, last %" G_GUINT64_FORMAT
+          "), expected %u", tri[i].tri, n, tri[i].count, tri[i].last,
+          docs->len);
+  }
+}
+
+// The index file, against the records written
+static void hsearch_check_index(const gchar *path, const gchar *histo)
+{
+  GHashTable *expected = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                               NULL,
+                                               (GDestroyNotify)g_array_unref);
+  const idx_header_t *hdr;
+  const guint64 *docs;
+  const guchar *p, *end;
+  gchar *data = NULL, *names[2] = { NULL, NULL };
+  gboolean matched[G_N_ELEMENTS(hrecords)] = { FALSE };
+  guint64 d;
+  guint32 i, j, nexp = 0;
+  gsize len = 0;
+
+  for (j = 0; j < G_N_ELEMENTS(hrecords); j++)
+    nexp += hrecords[j].indexed;
+
+  if (!g_file_get_contents(path, &data, &len, NULL) ||
+      len < sizeof(idx_header_t)) {
+    check(FALSE, "no index in %s", path);
+    goto out;
+  }
+  hdr = (const idx_header_t *)data;
+  check(!memcmp(hdr->magic, IDX_MAGIC, 4) && hdr->version == IDX_VERSION,
+        "magic or version");
+  check(hdr->size == len, "size %" G_GUINT64_FORMAT " for a file of %"
+        G_GSIZE_FORMAT " bytes", hdr->size, len);
+  if (hdr->size != len || hdr->files_off < sizeof *hdr ||
+      hdr->files_off > hdr->docs_off ||
+      hdr->docs_off + hdr->ndocs * sizeof(guint64) > hdr->post_off ||
+      hdr->post_off > hdr->tri_off ||
+      hdr->tri_off + (guint64)hdr->ntri * sizeof(idx_tri_t) > len ||
+      hdr->docs_off % 8 || hdr->tri_off % 8) {
+    check(FALSE, "inconsistent sections");
+    goto out;
+  }
+  check(hdr->nfiles == 2 && hdr->ndocs == nexp, "%u files and %"
+        G_GUINT64_FORMAT " messages, expected 2 and %u", hdr->nfiles,
+        hdr->ndocs, nexp);
+  if (hdr->nfiles != 2)
+    goto out;
+
+  // Files: fully indexed
+  p = (const guchar *)data + hdr->files_off;
+  end = (const guchar *)data + hdr->docs_off;
+  for (i = 0; i < hdr->nfiles; i++) {
+    guint64 indexed;
+    guint32 nlen;
+    gchar *fpath;
+    struct stat st;
+
+    if (end - p < 12)
+      break;
+    memcpy(&indexed, p, 8);
+    memcpy(&nlen, p + 8, 4);
+    p += 12;
+    if ((gsize)(end - p) < nlen)
+      break;
+    names[i] = g_strndup((const gchar *)p, nlen);
+    p += nlen;
+    p += (8 - (p - (const guchar *)data) % 8) % 8;
+    fpath = g_build_filename(histo, names[i], NULL);
+    check(!stat(fpath, &st) && (guint64)st.st_size == indexed,
+          "%s: %" G_GUINT64_FORMAT " bytes indexed", names[i], indexed);
+    g_free(fpath);
+  }
+  check(i == hdr->nfiles && p == end, "file table");
+  if (i != hdr->nfiles)
+    goto out;
+
+  // Documents: the message records, each once; the expected postings
+  // are built in the same order
+  docs = (const guint64 *)(data + hdr->docs_off);
+  for (d = 0; d < hdr->ndocs; d++) {
+    guint32 fileno = DOC_FILE(docs[d]);
+    guint64 offset = DOC_OFFSET(docs[d]);
+    const gchar *text, *textend;
+    GHashTable *seen;
+
+    for (j = 0; j < G_N_ELEMENTS(hrecords); j++)
+      if (fileno >= 1 && fileno <= hdr->nfiles &&
+          !strcmp(hrecords[j].file, names[fileno-1]) &&
+          hrecords[j].offset == offset)
+        break;
+    if (j == G_N_ELEMENTS(hrecords) || !hrecords[j].indexed || matched[j]) {
+      check(FALSE, "document %" G_GUINT64_FORMAT ": file %u, offset %"
+            G_GUINT64_FORMAT, d, fileno, offset);
+      continue;
+    }
+    matched[j] = TRUE;
+    text = hrecords[j].record + HLOG_TEXT;
+    textend = hrecords[j].record + strlen(hrecords[j].record) - 1;
+    seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for ( ; text + 3 <= textend; text++) {
+      guint32 t = trigram(text);
+      GArray *a;
+      if (g_hash_table_lookup(seen, GUINT_TO_POINTER(t)))
+        continue;
+      g_hash_table_replace(seen, GUINT_TO_POINTER(t), GUINT_TO_POINTER(1));
+      a = g_hash_table_lookup(expected, GUINT_TO_POINTER(t));
+      if (!a) {
+        a = g_array_new(FALSE, FALSE, sizeof(guint64));
+        g_hash_table_replace(expected, GUINT_TO_POINTER(t), a);
+      }
+      g_array_append_val(a, d);
+    }
+    g_hash_table_destroy(seen);
+  }
+
+  hsearch_check_postings(data, hdr, expected);
+
+out:
+  g_free(names[0]);
+  g_free(names[1]);
+  g_free(data);
+  g_hash_table_destroy(expected);
+}
+
+static void check_hsearch(void)
+{
+  static const gchar * const hits[] = {
+    " 2020-03-10 09:00 bob@example.org: HELLO bob",
+    " 2020-03-09 08:00 alice@example.org: multi line hello again",
+    " 2020-03-08 10:11 alice@example.org: Hello world",
+  };
+  static const gchar delta_record[] =
+    "MS 20200311T12:00:00Z 000 hello from the delta\n";
+  gchar *histo = tmp_path("histo"), *index = tmp_path("hsearch.idx");
+  gchar *path;
+  gint64 end;
+  FILE *fp;
+  guint i;
+  gint h;
+
+  current = "hsearch";
+  histo_write(histo);
+  settings_set(SETTINGS_TYPE_OPTION, "logging_dir", histo);
+  settings_set(SETTINGS_TYPE_OPTION, "hsearch_index", index);
+  if (!load("hsearch"))
+    goto out;
+
+  // Build the index in the background
+  log_clear();
+  process_command("hsearch status", TRUE);
+  end = g_get_monotonic_time() + 5 * G_USEC_PER_SEC;
+  while (log_find(0, "hsearch: 2 history files indexed") < 0 &&
+         g_get_monotonic_time() < end)
+    g_main_context_iteration(NULL, TRUE);
+  check(log_find(0, "hsearch: 2 history files indexed") >= 0,
+        "index not built");
+
+  hsearch_check_index(index, histo);
+
+  log_clear();
+  process_command("hsearch hello", TRUE);
+  h = log_find(0, "hsearch: 3 hit(s) for \"hello\"");
+  check(h == 0 && log_lines->len == 1 + G_N_ELEMENTS(hits),
+        "\"%s\", %u lines", log_line(0), log_lines->len);
+  for (i = 0; h == 0 && i < G_N_ELEMENTS(hits); i++)
+    check(!strcmp(log_line(1 + i), hits[i]), "hit %u: \"%s\"", i,
+          log_line(1 + i));
+
+  // A new message is indexed in memory at once
+  path = g_build_filename(histo, "alice@example.org", NULL);
+  fp = fopen(path, "a");
+  if (fp) {
+    fputs(delta_record, fp);
+    fclose(fp);
+  }
+  g_free(path);
+  message_in("alice@example.org", "laptop", FALSE, FALSE);
+  log_clear();
+  process_command("hsearch -j alice@example.org HELLO", TRUE);
+  check(log_find(0, "hsearch: 3 hit(s) for \"HELLO\"") == 0 &&
+        !strcmp(log_line(1), " 2020-03-11 12:00 alice@example.org: "
+                             "hello from the delta"),
+        "\"%s\" then \"%s\"", log_line(0), log_line(1));
+
+  log_clear();
+  process_command("hsearch hq", TRUE);
+  check(log_find(0, "hsearch: at least 3 characters") == 0,
+        "\"%s\" for a short query", log_line(0));
+  mock_module_unload_all();
+
+out:
+  settings_set(SETTINGS_TYPE_OPTION, "logging_dir", NULL);
+  settings_set(SETTINGS_TYPE_OPTION, "hsearch_index", NULL);
+  g_free(histo);
+  g_free(index);
+}
+
+/* rostersnap */
+
+#define SNAP_CONTACTS   3
+
+static void count_resources(gpointer rosterdata, void *param)
+{
+  GSList *res = buddy_getresources(rosterdata);
+
+  *(guint *)param += g_slist_length(res);
+  g_slist_free_full(res, g_free);
+}
+
+static guint online_resources(void)
+{
+  guint n = 0;
+
+  foreach_buddy(ROSTER_TYPE_USER, count_resources, &n);
+  return n;
+}
+
+static void drop_resources(gpointer rosterdata, void *param)
+{
+  buddy_del_all_resources(rosterdata);
+}
+
+static void presence_from(const gchar *from)
+{
+  LmMessage *m = lm_message_new(NULL, LM_MESSAGE_TYPE_PRESENCE);
+
+  lm_message_node_set_attribute(m->node, "from", from);
+  mock_lm_receive(m);
+  lm_message_unref(m);
+}
+
+// The resources are dropped with the connection, as mcabber does
+static void disconnect(void)
+{
+  mock_disconnect();
+  foreach_buddy(ROSTER_TYPE_USER, drop_resources, NULL);
+  buddylist_build();
+}
+
+static void check_rostersnap(void)
+{
+  gchar *snap = tmp_path("rostersnap"), *data = NULL;
+  gchar stats[128];
+  guint online, i;
+  gpointer bud;
+  GSList *sl;
+
+  current = "rostersnap";
+  settings_set(SETTINGS_TYPE_OPTION, "jid", "me@example.org");
+  settings_set(SETTINGS_TYPE_OPTION, "rostersnap_file", snap);
+  settings_set(SETTINGS_TYPE_OPTION, "rostersnap_deadline", "1");
+  if (!load("rostersnap"))
+    goto out;
+  mock_connect();
+
+  for (i = 0; i < SNAP_CONTACTS; i++) {
+    gchar *jid = g_strdup_printf("snap%u@example.net", i);
+    roster_add_user(jid, NULL, "Contacts", ROSTER_TYPE_USER, sub_both, 1);
+    roster_setstatus(jid, "home", 5, away, "brb", 0L, role_none,
+                     affil_none, NULL);
+    g_free(jid);
+  }
+  buddylist_build();
+  online = online_resources();
+
+  disconnect();
+  mock_connect();
+  check(g_file_get_contents(snap, &data, NULL, NULL) &&
+        !strncmp(data, "MCRS", 4), "no snapshot in %s", snap);
+  g_free(data);
+  check(online_resources() == online, "%u resources restored, expected %u",
+        online_resources(), online);
+  sl = roster_find("snap0@example.net", jidsearch, ROSTER_TYPE_USER);
+  bud = sl ? sl->data : NULL;
+  check(bud && buddy_getstatus(bud, "home") == away &&
+        !g_strcmp0(buddy_getstatusmsg(bud, "home"), "brb") &&
+        buddy_getresourceprio(bud, "home") == 5,
+        "snap0@example.net/home not restored as saved");
+
+  // Every resource but the last contact's is confirmed by the server,
+  // the last one expires after the deadline
+  presence_from("alice@example.org/laptop");
+  presence_from("alice@example.org/phone");
+  presence_from("bob@example.org/home");
+  for (i = 0; i < SNAP_CONTACTS - 1; i++) {
+    gchar *from = g_strdup_printf("snap%u@example.net/home", i);
+    presence_from(from);
+    g_free(from);
+  }
+  // A timer in seconds fires up to one second late
+  drain_main_loop(2500);
+  check(online_resources() == online - 1, "%u resources online after the "
+        "deadline, expected %u", online_resources(), online - 1);
+  sl = roster_find("snap2@example.net", jidsearch, ROSTER_TYPE_USER);
+  check(sl && buddy_getstatus(sl->data, "home") == offline,
+        "snap2@example.net/home not expired");
+  g_snprintf(stats, sizeof stats, "%u restored, %u confirmed, 1 expired, "
+             "0 pending.", online, online - 1);
+  log_clear();
+  process_command("rostersnap", TRUE);
+  check(strstr(log_line(0), stats) != NULL, "\"%s\", expected \"%s\"",
+        log_line(0), stats);
+
+  // Not restored for another account
+  disconnect();
+  settings_set(SETTINGS_TYPE_OPTION, "jid", "other@example.org");
+  mock_connect();
+  check(online_resources() == 0, "%u resources restored for another "
+        "account", online_resources());
+
+  mock_disconnect();
+  mock_module_unload_all();
+
+out:
+  settings_set(SETTINGS_TYPE_OPTION, "rostersnap_file", NULL);
+  settings_set(SETTINGS_TYPE_OPTION, "rostersnap_deadline", NULL);
+  settings_set(SETTINGS_TYPE_OPTION, "jid", NULL);
+  unlink(snap);
+  g_free(snap);
+}
+
+/* Main */
+
+static void remove_tree(const gchar *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+  const gchar *name;
+
+  if (dir) {
+    while ((name = g_dir_read_name(dir)) != NULL) {
+      gchar *sub = g_build_filename(path, name, NULL);
+      remove_tree(sub);
+      g_free(sub);
+    }
+    g_dir_close(dir);
+    g_rmdir(path);
+  } else {
+    g_unlink(path);
+  }
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-v] moddir\n", prog);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  gchar *dir;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "v")) != -1) {
+    switch (opt) {
+      case 'v':
+          mock_verbose = TRUE;
+          break;
+      default:
+          usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1)
+    usage(argv[0]);
+  moddir = argv[optind];
+
+  dir = g_build_filename(g_get_tmp_dir(), "mcabber-check-XXXXXX", NULL);
+  tmpdir = g_mkdtemp(dir);
+  if (!tmpdir) {
+    perror("mkdtemp");
+    return 2;
+  }
+  log_lines = g_ptr_array_new_with_free_func(g_free);
+  mock_set_log_hook(log_hook);
+  mock_roster_fixture();
+
+  check_hkargs();
+  check_msgcount();
+  check_toptalkers();
+  check_hsearch();
+  check_rostersnap();
+
+  remove_tree(tmpdir);
+  g_free(dir);
+  printf("%u checks, %u failed\n", nchecks, nfailed);
+  return nfailed ? 1 : 0;
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -0,0 +1,1195 @@
+/*
+ *  Mock mcabber host -- stub implementation of the mcabber API
+ *
+ *  Only the parts of the API used by the modules are implemented, and
+ *  the implementation is kept as simple as possible: hooks, commands,
+ *  options, a small in-memory roster, and counters instead of a screen.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/caps.h>
+#include <mcabber/commands.h>
+#include <mcabber/compl.h>
+#include <mcabber/hbuf.h>
+#include <mcabber/hooks.h>
+#include <mcabber/roster.h>
+#include <mcabber/screen.h>
+#include <mcabber/settings.h>
+#include <mcabber/utils.h>
+#include <mcabber/xmpp.h>
+#include <mcabber/xmpp_defines.h>
+#include <mcabber/xmpp_helper.h>
+
+#include "mockhost.h"
+
+mock_counters_t mock_counters;
+gboolean mock_verbose;
+
+char imstatus2char[imstatus_size+1] = {
+  '_', 'o', 'f', 'd', 'n', 'a', 'i', '\0'
+};
+
+/* Modules */
+
+typedef struct {
+  gchar         *name;
+  GModule       *module;
+  module_info_t *info;
+} mock_module_t;
+
+static GSList *modules;
+static const gchar *loading_module;   // Name of the module being initialized
+
+static mock_module_t *module_loaded(const gchar *name)
+{
+  GSList *li;
+
+  for (li = modules; li; li = g_slist_next(li))
+    if (!strcmp(((mock_module_t *)li->data)->name, name))
+      return li->data;
+  return NULL;
+}
+
+module_info_t *mock_module_load(const gchar *path, gchar **modname)
+{
+  GModule *mod;
+  mock_module_t *mm;
+  module_info_t *info;
+  const gchar * const *req;
+  gchar *base, *name, *symbol, *p;
+
+  mod = g_module_open(path, G_MODULE_BIND_LAZY);
+  if (!mod) {
+    g_printerr("%s\n", g_module_error());
+    return NULL;
+  }
+
+  // libfoo.so -> foo
+  base = g_path_get_basename(path);
+  name = g_str_has_prefix(base, "lib") ? base + 3 : base;
+  if ((p = strchr(name, '.')) != NULL)
+    *p = '\0';
+  name = g_strdup(name);
+  g_free(base);
+
+  // Already loaded, e.g. as a dependency of another module
+  if ((mm = module_loaded(name)) != NULL) {
+    g_free(name);
+    g_module_close(mod);
+    if (modname)
+      *modname = mm->name;
+    return mm->info;
+  }
+
+  symbol = g_strdup_printf("info_%s", name);
+  if (!g_module_symbol(mod, symbol, (gpointer)&info) || !info) {
+    g_printerr("%s: no symbol %s\n", path, symbol);
+    g_free(symbol);
+    g_free(name);
+    g_module_close(mod);
+    return NULL;
+  }
+  g_free(symbol);
+
+  // Load the required modules first, from the same directory
+  for (req = info->requires; req && *req; req++) {
+    gchar *dir, *reqpath;
+    module_info_t *reqinfo;
+
+    if (module_loaded(*req))
+      continue;
+    dir = g_path_get_dirname(path);
+    reqpath = g_strdup_printf("%s/lib%s.so", dir, *req);
+    reqinfo = mock_module_load(reqpath, NULL);
+    g_free(reqpath);
+    g_free(dir);
+    if (!reqinfo) {
+      g_printerr("%s: cannot load required module %s\n", path, *req);
+      g_free(name);
+      g_module_close(mod);
+      return NULL;
+    }
+  }
+
+  mm = g_new0(mock_module_t, 1);
+  mm->name   = name;
+  mm->module = mod;
+  mm->info   = info;
+  modules = g_slist_append(modules, mm);
+
+  loading_module = mm->name;
+  if (info->init)
+    info->init();
+  loading_module = NULL;
+
+  if (modname)
+    *modname = mm->name;
+  return info;
+}
+
+void mock_module_unload_all(void)
+{
+  GSList *li;
+
+  // Unload in reverse order
+  modules = g_slist_reverse(modules);
+  for (li = modules; li; li = g_slist_next(li)) {
+    mock_module_t *mm = li->data;
+    if (mm->info->uninit)
+      mm->info->uninit();
+    g_module_close(mm->module);
+    g_free(mm->name);
+    g_free(mm);
+  }
+  g_slist_free(modules);
+  modules = NULL;
+}
+
+/* Hooks */
+
+static GSList *hooks;
+static guint hook_lastid;
+
+GSList *mock_hook_handlers(void)
+{
+  return hooks;
+}
+
+static gint hook_cmp(gconstpointer a, gconstpointer b)
+{
+  const mock_hook_t *ha = a, *hb = b;
+  return ha->priority - hb->priority;
+}
+
+guint hk_add_handler(hk_handler_t handler, const gchar *hookname,
+                     gint priority, gpointer userdata)
+{
+  mock_hook_t *h = g_new0(mock_hook_t, 1);
+
+  h->hid      = ++hook_lastid;
+  h->hookname = g_strdup(hookname);
+  h->priority = priority;
+  h->handler  = handler;
+  h->userdata = userdata;
+  h->module   = loading_module ? loading_module : "(host)";
+  hooks = g_slist_insert_sorted(hooks, h, hook_cmp);
+  return h->hid;
+}
+
+void hk_del_handler(const gchar *hookname, guint hid)
+{
+  GSList *li;
+
+  for (li = hooks; li; li = g_slist_next(li)) {
+    mock_hook_t *h = li->data;
+    if (h->hid == hid && !g_strcmp0(h->hookname, hookname)) {
+      hooks = g_slist_delete_link(hooks, li);
+      g_free(h->hookname);
+      g_free(h);
+      return;
+    }
+  }
+}
+
+guint hk_run_handlers(const gchar *hookname, hk_arg_t *args)
+{
+  GSList *li, *next;
+  guint ret = HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+
+  for (li = hooks; li; li = next) {
+    mock_hook_t *h = li->data;
+    next = g_slist_next(li);  // The handler may unregister itself
+    if (g_strcmp0(h->hookname, hookname))
+      continue;
+    ret = h->handler(hookname, args, h->userdata);
+    if (ret)
+      break;
+  }
+  return ret;
+}
+
+void hk_message_out(const char *bjid, const char *nickname, time_t timestamp,
+                    const char *msg, guint encrypted, gpointer xep184)
+{
+  hk_arg_t args[] = {
+    { "jid", bjid },
+    { "message", msg },
+    { NULL, NULL },
+  };
+  hk_run_handlers(HOOK_MESSAGE_OUT, args);
+}
+
+/* Commands */
+
+typedef struct {
+  gchar *name;
+  void (*func)(char *);
+  gpointer userdata;
+} mock_cmd_t;
+
+static GSList *commands;
+
+gpointer cmd_add(const char *name, const char *help, guint flags1,
+                 guint flags2, void (*f)(char*), gpointer userdata)
+{
+  mock_cmd_t *c = g_new0(mock_cmd_t, 1);
+
+  c->name     = g_strdup(name);
+  c->func     = f;
+  c->userdata = userdata;
+  commands = g_slist_append(commands, c);
+  return c;
+}
+
+gboolean cmd_del(gpointer id)
+{
+  GSList *li;
+
+  for (li = commands; li; li = g_slist_next(li)) {
+    mock_cmd_t *c = li->data;
+    if (c == id || !g_strcmp0(c->name, (const char *)id)) {
+      commands = g_slist_delete_link(commands, li);
+      g_free(c->name);
+      g_free(c);
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+// mcabber's /set: "key = value", "key =" to unset, "key" to display
+static void do_set(gchar *args)
+{
+  gchar *eq = strchr(args, '=');
+  gchar *value = NULL;
+
+  if (eq) {
+    *eq = '\0';
+    value = g_strstrip(eq + 1);
+  }
+  g_strstrip(args);
+  if (!*args)
+    return;
+  if (!eq) {
+    if (mock_verbose)
+      printf("[host] %s = [%s]\n", args,
+             settings_opt_get(args) ? settings_opt_get(args) : "");
+    return;
+  }
+  settings_set(SETTINGS_TYPE_OPTION, args, *value ? value : NULL);
+}
+
+int process_command(const char *line, guint iscmd)
+{
+  GSList *li;
+  gchar *xline, *cmd, *args;
+
+  while (*line == '/')
+    line++;
+  xline = g_strdup(line);
+  cmd = xline;
+  args = strchr(xline, ' ');
+  if (args) {
+    *args++ = '\0';
+    while (*args == ' ')
+      args++;
+  } else {
+    args = xline + strlen(xline);
+  }
+
+  mock_counters.commands_run++;
+  for (li = commands; li; li = g_slist_next(li)) {
+    mock_cmd_t *c = li->data;
+    if (!strcmp(c->name, cmd)) {
+      c->func(args);
+      g_free(xline);
+      return 0;
+    }
+  }
+  if (!strcmp(cmd, "set")) {
+    do_set(args);
+    g_free(xline);
+    return 0;
+  }
+  if (mock_verbose)
+    printf("[host] Unrecognized command: %s\n", cmd);
+  g_free(xline);
+  return 0;
+}
+
+int process_line(const char *line)
+{
+  return process_command(line, TRUE);
+}
+
+/* Completion: categories are only counted */
+
+static guint compl_lastid = 32;
+
+guint compl_new_category(guint flags)
+{
+  return ++compl_lastid;
+}
+
+void compl_del_category(guint id)
+{
+}
+
+void compl_add_category_word(guint categ, const char *command)
+{
+}
+
+void compl_del_category_word(guint categ, const char *word)
+{
+}
+
+/* Settings */
+
+static GHashTable *options;
+static GHashTable *guards;
+
+static GHashTable *option_table(void)
+{
+  if (!options)
+    options = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  return options;
+}
+
+void settings_set(guint type, const gchar *key, const gchar *value)
+{
+  gchar *newval;
+
+  if (type != SETTINGS_TYPE_OPTION)
+    return;
+
+  if (guards) {
+    settings_guard_t guard = g_hash_table_lookup(guards, key);
+    if (guard) {
+      newval = guard(key, value);
+      if (newval)
+        g_hash_table_replace(option_table(), g_strdup(key), newval);
+      else
+        g_hash_table_remove(option_table(), key);
+      return;
+    }
+  }
+
+  if (value)
+    g_hash_table_replace(option_table(), g_strdup(key), g_strdup(value));
+  else
+    g_hash_table_remove(option_table(), key);
+}
+
+const gchar *settings_get(guint type, const gchar *key)
+{
+  if (type != SETTINGS_TYPE_OPTION)
+    return NULL;
+  return g_hash_table_lookup(option_table(), key);
+}
+
+int settings_get_int(guint type, const gchar *key)
+{
+  const gchar *value = settings_get(type, key);
+
+  // As in mcabber, "on" or "yes" is 0
+  return value ? atoi(value) : 0;
+}
+
+gboolean settings_set_guard(const gchar *key, settings_guard_t guard)
+{
+  if (!guards)
+    guards = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  if (g_hash_table_lookup(guards, key))
+    return FALSE;
+  g_hash_table_insert(guards, g_strdup(key), guard);
+  return TRUE;
+}
+
+void settings_del_guard(const gchar *key)
+{
+  if (guards)
+    g_hash_table_remove(guards, key);
+}
+
+/* Roster */
+
+typedef struct {
+  gchar *name;
+  gchar prio;
+  enum imstatus status;
+  gchar *status_msg;
+  time_t status_timestamp;
+  guint events;
+  gchar *caps;
+  struct xep0085 xep85;
+  struct xep0022 xep22;
+} mock_res_t;
+
+typedef struct {
+  gchar *jid;
+  gchar *name;
+  guint type;
+  guint flags;
+  guint uiprio;
+  enum subscr subscription;
+  gpointer group;         // Group item (NULL for groups)
+  GSList *members;        // Group members (groups only)
+  GSList *resources;      // List of mock_res_t
+  gchar *active_res;
+} mock_item_t;
+
+GList *buddylist;
+GList *current_buddy;
+
+static GSList *roster;    // Groups and buddies
+
+static void res_free(mock_res_t *r)
+{
+  g_free(r->name);
+  g_free(r->status_msg);
+  g_free(r->caps);
+  g_free(r->xep22.last_msgid_sent);
+  g_free(r->xep22.last_msgid_rcvd);
+  g_free(r);
+}
+
+static mock_res_t *res_find(mock_item_t *it, const char *resname, gboolean add)
+{
+  GSList *li;
+  mock_res_t *r;
+
+  for (li = it->resources; li; li = g_slist_next(li)) {
+    r = li->data;
+    if (!g_strcmp0(r->name, resname))
+      return r;
+  }
+  if (!add)
+    return NULL;
+  r = g_new0(mock_res_t, 1);
+  r->name = g_strdup(resname ? resname : "");
+  it->resources = g_slist_append(it->resources, r);
+  return r;
+}
+
+GSList *roster_find(const char *jidname, enum findwhat type, guint roster_type)
+{
+  GSList *li;
+
+  if (!jidname)
+    return NULL;
+  for (li = roster; li; li = g_slist_next(li)) {
+    mock_item_t *it = li->data;
+    if (!(it->type & roster_type))
+      continue;
+    if (type == jidsearch && it->jid && !g_ascii_strcasecmp(it->jid, jidname))
+      return li;
+    if (type == namesearch && !g_strcmp0(it->name, jidname))
+      return li;
+  }
+  return NULL;
+}
+
+GSList *roster_add_group(const char *name)
+{
+  GSList *sl;
+  mock_item_t *it;
+
+  if (!name || !*name)
+    name = "General";
+  sl = roster_find(name, namesearch, ROSTER_TYPE_GROUP);
+  if (sl)
+    return sl;
+
+  it = g_new0(mock_item_t, 1);
+  it->name = g_strdup(name);
+  it->type = ROSTER_TYPE_GROUP;
+  roster = g_slist_append(roster, it);
+  return g_slist_last(roster);
+}
+
+GSList *roster_add_user(const char *jid, const char *name, const char *group,
+                        guint type, enum subscr esub, gint on_server)
+{
+  GSList *sl;
+  mock_item_t *it, *grp;
+
+  sl = roster_find(jid, jidsearch, ROSTER_TYPE_USER|ROSTER_TYPE_ROOM|
+                   ROSTER_TYPE_AGENT);
+  if (sl)
+    return sl;
+
+  grp = roster_add_group(group)->data;
+  it = g_new0(mock_item_t, 1);
+  it->jid = g_strdup(jid);
+  it->name = name ? g_strdup(name) : jidtodisp(jid);
+  it->type = type;
+  it->subscription = esub;
+  it->group = grp;
+  grp->members = g_slist_append(grp->members, it);
+  roster = g_slist_append(roster, it);
+  return g_slist_last(roster);
+}
+
+void roster_del_user(const char *jid)
+{
+  GSList *sl = roster_find(jid, jidsearch, ROSTER_TYPE_USER|ROSTER_TYPE_ROOM|
+                           ROSTER_TYPE_AGENT);
+  mock_item_t *it, *grp;
+
+  if (!sl)
+    return;
+  it = sl->data;
+  grp = it->group;
+  grp->members = g_slist_remove(grp->members, it);
+  roster = g_slist_delete_link(roster, sl);
+  buddylist_build();
+  g_slist_free_full(it->resources, (GDestroyNotify)res_free);
+  g_free(it->jid);
+  g_free(it->name);
+  g_free(it->active_res);
+  g_free(it);
+}
+
+void roster_setstatus(const char *jid, const char *resname, gchar prio,
+                      enum imstatus bstat, const char *status_msg,
+                      time_t timestamp,
+                      enum imrole role, enum imaffiliation affil,
+                      const char *realjid)
+{
+  GSList *sl;
+  mock_item_t *it;
+  mock_res_t *r;
+
+  sl = roster_find(jid, jidsearch, ROSTER_TYPE_USER|ROSTER_TYPE_ROOM|
+                   ROSTER_TYPE_AGENT);
+  if (!sl) {
+    if (bstat == offline)
+      return;
+    sl = roster_add_user(jid, NULL, NULL, ROSTER_TYPE_USER, sub_none, -1);
+  }
+  it = sl->data;
+
+  if (bstat == offline) {
+    r = res_find(it, resname, FALSE);
+    if (r) {
+      it->resources = g_slist_remove(it->resources, r);
+      res_free(r);
+    }
+    return;
+  }
+
+  r = res_find(it, resname, TRUE);
+  r->prio = prio;
+  r->status = bstat;
+  g_free(r->status_msg);
+  r->status_msg = g_strdup(status_msg);
+  r->status_timestamp = timestamp ? timestamp : time(NULL);
+}
+
+guint roster_getsubscription(const char *jid)
+{
+  GSList *sl = roster_find(jid, jidsearch, ROSTER_TYPE_USER);
+  return sl ? ((mock_item_t *)sl->data)->subscription : sub_none;
+}
+
+void buddylist_build(void)
+{
+  GSList *li;
+
+  g_list_free(buddylist);
+  buddylist = NULL;
+  current_buddy = NULL;
+  for (li = roster; li; li = g_slist_next(li))
+    buddylist = g_list_append(buddylist, li->data);
+}
+
+void foreach_buddy(guint roster_type,
+                   void (*pfunc)(gpointer rosterdata, void *param),
+                   void *param)
+{
+  GSList *li;
+
+  for (li = roster; li; li = g_slist_next(li)) {
+    mock_item_t *it = li->data;
+    if (it->type & roster_type)
+      pfunc(it, param);
+  }
+}
+
+void foreach_group_member(gpointer groupdata,
+                          void (*pfunc)(gpointer rosterdata, void *param),
+                          void *param)
+{
+  mock_item_t *grp = groupdata;
+  GSList *li;
+
+  for (li = grp->members; li; li = g_slist_next(li))
+    pfunc(li->data, param);
+}
+
+const char *buddy_getjid(gpointer rosterdata)
+{
+  return ((mock_item_t *)rosterdata)->jid;
+}
+
+const char *buddy_getname(gpointer rosterdata)
+{
+  return ((mock_item_t *)rosterdata)->name;
+}
+
+gpointer buddy_getgroup(gpointer rosterdata)
+{
+  mock_item_t *it = rosterdata;
+  return it->type & ROSTER_TYPE_GROUP ? it : it->group;
+}
+
+const char *buddy_getgroupname(gpointer rosterdata)
+{
+  return buddy_getname(buddy_getgroup(rosterdata));
+}
+
+guint buddy_gettype(gpointer rosterdata)
+{
+  return ((mock_item_t *)rosterdata)->type;
+}
+
+guint buddy_getflags(gpointer rosterdata)
+{
+  return ((mock_item_t *)rosterdata)->flags;
+}
+
+guint buddy_getuiprio(gpointer rosterdata)
+{
+  return ((mock_item_t *)rosterdata)->uiprio;
+}
+
+GSList *buddy_getresources(gpointer rosterdata)
+{
+  mock_item_t *it = rosterdata;
+  GSList *li, *reslist = NULL;
+
+  for (li = it->resources; li; li = g_slist_next(li))
+    reslist = g_slist_append(reslist,
+                             g_strdup(((mock_res_t *)li->data)->name));
+  return reslist;
+}
+
+enum imstatus buddy_getstatus(gpointer rosterdata, const char *resname)
+{
+  mock_res_t *r = res_find(rosterdata, resname, FALSE);
+  return r ? r->status : offline;
+}
+
+const char *buddy_getstatusmsg(gpointer rosterdata, const char *resname)
+{
+  mock_res_t *r = res_find(rosterdata, resname, FALSE);
+  return r ? r->status_msg : NULL;
+}
+
+time_t buddy_getstatustime(gpointer rosterdata, const char *resname)
+{
+  mock_res_t *r = res_find(rosterdata, resname, FALSE);
+  return r ? r->status_timestamp : 0;
+}
+
+gchar buddy_getresourceprio(gpointer rosterdata, const char *resname)
+{
+  mock_res_t *r = res_find(rosterdata, resname, FALSE);
+  return r ? r->prio : 0;
+}
+
+void buddy_setactiveresource(gpointer rosterdata, const char *resname)
+{
+  mock_item_t *it = rosterdata;
+
+  g_free(it->active_res);
+  it->active_res = g_strdup(resname);
+}
+
+const char *buddy_getactiveresource(gpointer rosterdata)
+{
+  return ((mock_item_t *)rosterdata)->active_res;
+}
+
+void buddy_del_all_resources(gpointer rosterdata)
+{
+  mock_item_t *it = rosterdata;
+
+  g_slist_free_full(it->resources, (GDestroyNotify)res_free);
+  it->resources = NULL;
+}
+
+struct xep0085 *buddy_resource_xep85(gpointer rosterdata, const char *resname)
+{
+  mock_res_t *r = res_find(rosterdata, resname, FALSE);
+  return r ? &r->xep85 : NULL;
+}
+
+struct xep0022 *buddy_resource_xep22(gpointer rosterdata, const char *resname)
+{
+  mock_res_t *r = res_find(rosterdata, resname, FALSE);
+  return r ? &r->xep22 : NULL;
+}
+
+void buddy_resource_setevents(gpointer rosterdata, const char *resname,
+                              guint event)
+{
+  mock_res_t *r = res_find(rosterdata, resname, FALSE);
+  if (r)
+    r->events = event;
+}
+
+guint buddy_resource_getevents(gpointer rosterdata, const char *resname)
+{
+  mock_res_t *r = res_find(rosterdata, resname, FALSE);
+  return r ? r->events : ROSTER_EVENT_NONE;
+}
+
+void buddy_resource_setcaps(gpointer rosterdata, const char *resname,
+                            const char *caps)
+{
+  mock_res_t *r = res_find(rosterdata, resname, FALSE);
+  if (r) {
+    g_free(r->caps);
+    r->caps = g_strdup(caps);
+  }
+}
+
+char *buddy_resource_getcaps(gpointer rosterdata, const char *resname)
+{
+  mock_res_t *r = res_find(rosterdata, resname, FALSE);
+  return r ? r->caps : NULL;
+}
+
+/* Entity capabilities: only the known hashes */
+
+static GHashTable *caps_known;
+
+void caps_add(const char *hash)
+{
+  if (!caps_known)
+    caps_known = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  g_hash_table_replace(caps_known, g_strdup(hash), GINT_TO_POINTER(TRUE));
+}
+
+int caps_has_hash(const char *hash, const char *jid)
+{
+  return caps_known && hash && g_hash_table_lookup(caps_known, hash);
+}
+
+// A few contacts and a room, used by the runners
+void mock_roster_fixture(void)
+{
+  roster_add_user("alice@example.org", "Alice", "Friends",
+                  ROSTER_TYPE_USER, sub_both, 1);
+  roster_setstatus("alice@example.org", "laptop", 5, available, NULL,
+                   0L, role_none, affil_none, NULL);
+  roster_setstatus("alice@example.org", "phone", 1, away, "Mobile",
+                   0L, role_none, affil_none, NULL);
+  roster_add_user("bob@example.org", "Bob", "Friends",
+                  ROSTER_TYPE_USER, sub_both, 1);
+  roster_setstatus("bob@example.org", "home", 0, dontdisturb, NULL,
+                   0L, role_none, affil_none, NULL);
+  roster_add_user("room@conference.example.org", NULL, "Rooms",
+                  ROSTER_TYPE_ROOM, sub_none, 0);
+  roster_setstatus("room@conference.example.org", "alice", 0, available,
+                   NULL, 0L, role_participant, affil_member, NULL);
+  // Unread buffers: a message from alice, a highlight in the room
+  scr_setmsgflag_if_needed("alice@example.org", FALSE);
+  scr_setattentionflag_if_needed("alice@example.org", FALSE,
+                                 ROSTER_UI_PRIO_PRIVATE_MESSAGE, prio_max);
+  scr_setmsgflag_if_needed("room@conference.example.org", FALSE);
+  scr_setattentionflag_if_needed("room@conference.example.org", FALSE,
+                                 ROSTER_UI_PRIO_MUC_HL_MESSAGE, prio_max);
+  buddylist_build();
+}
+
+/* Presence handling */
+
+// Like mcabber's presence handler: one roster update, a roster rebuild
+// and redraw per stanza, and a join/leave line in the room buffer
+void mock_core_presence(LmMessage *m)
+{
+  const gchar *from = lm_message_node_get_attribute(m->node, "from");
+  LmMessageSubType subtype = lm_message_get_sub_type(m);
+  LmMessageNode *show;
+  enum imstatus st = available;
+  LmMessageNode *caps;
+  const gchar *res, *ver;
+  gchar *bjid, *line;
+  GSList *sl;
+
+  if (!from || (subtype != LM_MESSAGE_SUB_TYPE_AVAILABLE &&
+                subtype != LM_MESSAGE_SUB_TYPE_NOT_SET &&
+                subtype != LM_MESSAGE_SUB_TYPE_UNAVAILABLE))
+    return;
+
+  if (subtype == LM_MESSAGE_SUB_TYPE_UNAVAILABLE) {
+    st = offline;
+  } else if ((show = lm_message_node_get_child(m->node, "show")) != NULL &&
+             show->value) {
+    if (!strcmp(show->value, "away"))
+      st = away;
+    else if (!strcmp(show->value, "xa"))
+      st = notavail;
+    else if (!strcmp(show->value, "dnd"))
+      st = dontdisturb;
+    else if (!strcmp(show->value, "chat"))
+      st = freeforchat;
+  }
+
+  bjid = jidtodisp(from);
+  res = strchr(from, JID_RESOURCE_SEPARATOR);
+  res = res ? res + 1 : "";
+  roster_setstatus(bjid, res, 0, st, NULL,
+                   lm_message_node_get_timestamp(m->node),
+                   role_none, affil_none, NULL);
+
+  // Entity capabilities: an unknown hash would be asked for (disco#info)
+  caps = lm_message_node_find_xmlns(m->node, NS_CAPS);
+  if (caps && st != offline &&
+      (ver = lm_message_node_get_attribute(caps, "ver")) != NULL &&
+      (sl = roster_find(bjid, jidsearch, ROSTER_TYPE_USER|ROSTER_TYPE_ROOM))) {
+    if (!caps_has_hash(ver, bjid))
+      caps_add(ver);
+    buddy_resource_setcaps(sl->data, res, ver);
+  }
+
+  sl = roster_find(bjid, jidsearch, ROSTER_TYPE_ROOM);
+  if (sl) {
+    line = g_strdup_printf("%s has %s", res, st == offline ? "left"
+                                                            : "joined");
+    scr_WriteIncomingMessage(bjid, line, 0, HBB_PREFIX_INFO, 0);
+    g_free(line);
+  }
+  g_free(bjid);
+
+  buddylist_build();
+  scr_draw_roster();
+}
+
+// Like mcabber, for a chat message: the sender resource becomes the
+// active one, and its chat state support is known
+void mock_core_message(LmMessage *m)
+{
+  const gchar *from = lm_message_node_get_attribute(m->node, "from");
+  LmMessageNode *node;
+  const gchar *res;
+  gchar *bjid;
+  GSList *sl;
+
+  if (!from || !(res = strchr(from, JID_RESOURCE_SEPARATOR)))
+    return;
+  res++;
+  bjid = jidtodisp(from);
+  sl = roster_find(bjid, jidsearch, ROSTER_TYPE_USER);
+  g_free(bjid);
+  if (!sl)
+    return;
+  buddy_setactiveresource(sl->data, res);
+
+  for (node = m->node->children; node; node = node->next) {
+    const gchar *ns = lm_message_node_get_attribute(node, "xmlns");
+    struct xep0085 *xep85;
+    if (!ns || strcmp(ns, NS_CHATSTATES))
+      continue;
+    xep85 = buddy_resource_xep85(sl->data, res);
+    if (xep85) {
+      xep85->support = CHATSTATES_SUPPORT_OK;
+      if (!strcmp(node->name, "composing"))
+        xep85->last_state_rcvd = ROSTER_EVENT_COMPOSING;
+      else if (!strcmp(node->name, "paused"))
+        xep85->last_state_rcvd = ROSTER_EVENT_PAUSED;
+      else
+        xep85->last_state_rcvd = ROSTER_EVENT_ACTIVE;
+    }
+  }
+}
+
+/* Screen */
+
+static void (*log_hook)(guint flag, const gchar *line);
+
+void mock_set_log_hook(void (*hook)(guint flag, const gchar *line))
+{
+  log_hook = hook;
+}
+
+void scr_log_print(unsigned int flag, const char *fmt, ...)
+{
+  va_list ap;
+  gchar *line;
+
+  mock_counters.log_lines++;
+  if (!log_hook && (!mock_verbose || flag == LPRINT_DEBUG))
+    return;
+  va_start(ap, fmt);
+  line = g_strdup_vprintf(fmt, ap);
+  va_end(ap);
+  if (log_hook)
+    log_hook(flag, line);
+  if (mock_verbose && flag != LPRINT_DEBUG)
+    printf("[log] %s\n", line);
+  g_free(line);
+}
+
+void scr_update_chat_status(int forceupdate)
+{
+  mock_counters.status_updates++;
+}
+
+void scr_update_roster(void)
+{
+  mock_counters.roster_redraws++;
+}
+
+void scr_draw_roster(void)
+{
+  mock_counters.roster_redraws++;
+}
+
+void scr_do_update(void)
+{
+}
+
+unsigned int scr_getlogwinheight(void)
+{
+  return 5;
+}
+
+static mock_item_t *item_find(const char *jid)
+{
+  GSList *sl = roster_find(jid, jidsearch, ROSTER_TYPE_USER|ROSTER_TYPE_ROOM|
+                           ROSTER_TYPE_AGENT|ROSTER_TYPE_SPECIAL);
+  return sl ? sl->data : NULL;
+}
+
+// The buffers are never displayed: the flag is always set
+void scr_setmsgflag_if_needed(const char *jid, int special)
+{
+  mock_item_t *it = item_find(jid);
+
+  if (it)
+    it->flags |= ROSTER_FLAG_MSG;
+}
+
+void scr_WriteIncomingMessage(const char *jidfrom, const char *text,
+                              time_t timestamp, guint prefix,
+                              unsigned mucnicklen)
+{
+  mock_counters.buffer_lines++;
+  if (mock_verbose)
+    printf("[%s] %s\n", jidfrom, text);
+}
+
+void scr_setattentionflag_if_needed(const char *bare_jid, int special,
+                                    guint value, enum setuiprio_ops action)
+{
+  mock_item_t *it = item_find(bare_jid);
+
+  if (!it)
+    return;
+  if (action == prio_set)
+    it->uiprio = value;
+  else if (action == prio_max)
+    it->uiprio = MAX(it->uiprio, value);
+  else
+    it->uiprio += value;
+}
+
+/* Utilities */
+
+char *expand_filename(const char *fname)
+{
+  if (!fname)
+    return NULL;
+  if (!strncmp(fname, "~/", 2))
+    return g_strdup_printf("%s%s", g_get_home_dir(), fname+1);
+  return g_strdup(fname);
+}
+
+int check_jid_syntax(const char *fjid)
+{
+  const char *at;
+
+  if (!fjid || !*fjid)
+    return 1;
+  at = strchr(fjid, '@');
+  if (at && (at == fjid || !at[1] || at[1] == JID_RESOURCE_SEPARATOR))
+    return 1;
+  return strchr(fjid, ' ') && (!strchr(fjid, JID_RESOURCE_SEPARATOR) ||
+                               strchr(fjid, ' ') <
+                               strchr(fjid, JID_RESOURCE_SEPARATOR));
+}
+
+char *jidtodisp(const char *fjid)
+{
+  const char *p = strchr(fjid, JID_RESOURCE_SEPARATOR);
+  return p ? g_strndup(fjid, p - fjid) : g_strdup(fjid);
+}
+
+// The mock host always runs in UTF-8 mode
+char *to_utf8(const char *str)
+{
+  return g_strdup(str);
+}
+
+char *from_utf8(const char *str)
+{
+  return g_strdup(str);
+}
+
+char **split_arg(const char *arg, unsigned int n, int dontparse)
+{
+  gchar **lst = g_strsplit(arg ? arg : "", " ", n);
+  gchar **full = g_new0(gchar *, n+1);
+  guint i;
+
+  for (i = 0; i < n && lst[i]; i++)
+    full[i] = lst[i];
+  g_free(lst);
+  return full;
+}
+
+void free_arg_lst(char **arglst)
+{
+  g_strfreev(arglst);
+}
+
+/* XMPP */
+
+LmMessageNode *lm_message_node_find_xmlns(LmMessageNode *node,
+                                          const char *xmlns)
+{
+  LmMessageNode *x;
+
+  for (x = node->children; x; x = x->next)
+    if (!g_strcmp0(lm_message_node_get_attribute(x, "xmlns"), xmlns))
+      return x;
+  return NULL;
+}
+
+// XEP-0203 (2002-10-03T11:12:13Z) or XEP-0091 (20021003T11:12:13) stamp
+time_t lm_message_node_get_timestamp(LmMessageNode *node)
+{
+  LmMessageNode *x;
+  const char *p = NULL;
+  struct tm tm = { 0 };
+
+  if ((x = lm_message_node_find_xmlns(node, NS_XMPP_DELAY)) != NULL ||
+      (x = lm_message_node_find_xmlns(node, NS_DELAY)) != NULL)
+    p = lm_message_node_get_attribute(x, "stamp");
+  if (!p ||
+      (sscanf(p, "%4d-%2d-%2dT%2d:%2d:%2d", &tm.tm_year, &tm.tm_mon,
+              &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6 &&
+       sscanf(p, "%4d%2d%2dT%2d:%2d:%2d", &tm.tm_year, &tm.tm_mon,
+              &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6))
+    return 0;
+  tm.tm_year -= 1900;
+  tm.tm_mon--;
+  return timegm(&tm);
+}
+
+static enum imstatus mystatus = available;
+static gboolean online;
+
+void mock_set_status(enum imstatus st)
+{
+  mystatus = st;
+}
+
+void mock_set_online(gboolean st)
+{
+  online = st;
+}
+
+void mock_connect(void)
+{
+  hk_arg_t noargs[] = { { NULL, NULL } };
+
+  mock_lm_connect();
+  online = TRUE;
+  hk_run_handlers(HOOK_POST_CONNECT, noargs);
+}
+
+void mock_disconnect(void)
+{
+  hk_arg_t noargs[] = { { NULL, NULL } };
+
+  if (!lconnection)
+    return;
+  hk_run_handlers(HOOK_PRE_DISCONNECT, noargs);
+  online = FALSE;
+  mock_lm_disconnect();
+}
+
+void mock_drop_link(void)
+{
+  online = FALSE;
+  mock_lm_disconnect();
+}
+
+gboolean xmpp_is_online(void)
+{
+  return online;
+}
+
+enum imstatus xmpp_getstatus(void)
+{
+  return mystatus;
+}
+
+const char *xmpp_getstatusmsg(void)
+{
+  return NULL;
+}
+
+void xmpp_send_s10n(const char *bjid, LmMessageSubType type)
+{
+  mock_counters.s10n_sent++;
+}
+
+// Like mcabber: a notification is sent to the active resource when it
+// supports chat states (XEP-0085, else XEP-0022) and the state changes
+void xmpp_send_chatstate(gpointer buddy, guint chatstate)
+{
+  const char *res = buddy_getactiveresource(buddy);
+  struct xep0085 *xep85 = buddy_resource_xep85(buddy, res);
+  struct xep0022 *xep22 = buddy_resource_xep22(buddy, res);
+  guint *last_sent = NULL;
+
+  if (xep85 && xep85->support == CHATSTATES_SUPPORT_OK)
+    last_sent = &xep85->last_state_sent;
+  else if (xep22 && xep22->support == CHATSTATES_SUPPORT_OK)
+    last_sent = &xep22->last_state_sent;
+  if (!last_sent || *last_sent == chatstate || !xmpp_is_online())
+    return;
+  *last_sent = chatstate;
+  mock_counters.chatstates_sent++;
+  mock_counters.stanzas_sent++;
+}
+
+void mock_counters_reset(void)
+{
+  memset(&mock_counters, 0, sizeof mock_counters);
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
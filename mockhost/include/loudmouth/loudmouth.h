@@ -0,0 +1,130 @@
+/*
+ * Mock mcabber host -- see mockhost/README
+ *
+ * Minimal Loudmouth stand-in: messages are small node trees, and
+ * "sending" one only runs the registered handlers and the host counters.
+ */
+#ifndef __LOUDMOUTH_H__
+#define __LOUDMOUTH_H__ 1
+
+#include <glib.h>
+
+typedef struct _LmConnection     LmConnection;
+typedef struct _LmMessageHandler LmMessageHandler;
+typedef struct _LmMessageNode    LmMessageNode;
+typedef struct _LmMessage        LmMessage;
+
+typedef enum {
+  LM_MESSAGE_TYPE_MESSAGE,
+  LM_MESSAGE_TYPE_PRESENCE,
+  LM_MESSAGE_TYPE_IQ,
+  LM_MESSAGE_TYPE_STREAM,
+  LM_MESSAGE_TYPE_STREAM_ERROR,
+  LM_MESSAGE_TYPE_UNKNOWN
+} LmMessageType;
+
+typedef enum {
+  LM_MESSAGE_SUB_TYPE_NOT_SET = -10,
+  LM_MESSAGE_SUB_TYPE_AVAILABLE = -1,
+  LM_MESSAGE_SUB_TYPE_NORMAL = 0,
+  LM_MESSAGE_SUB_TYPE_CHAT,
+  LM_MESSAGE_SUB_TYPE_GROUPCHAT,
+  LM_MESSAGE_SUB_TYPE_HEADLINE,
+  LM_MESSAGE_SUB_TYPE_UNAVAILABLE,
+  LM_MESSAGE_SUB_TYPE_PROBE,
+  LM_MESSAGE_SUB_TYPE_SUBSCRIBE,
+  LM_MESSAGE_SUB_TYPE_UNSUBSCRIBE,
+  LM_MESSAGE_SUB_TYPE_SUBSCRIBED,
+  LM_MESSAGE_SUB_TYPE_UNSUBSCRIBED,
+  LM_MESSAGE_SUB_TYPE_GET,
+  LM_MESSAGE_SUB_TYPE_SET,
+  LM_MESSAGE_SUB_TYPE_RESULT,
+  LM_MESSAGE_SUB_TYPE_ERROR
+} LmMessageSubType;
+
+typedef enum {
+  LM_HANDLER_RESULT_REMOVE_MESSAGE,
+  LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS
+} LmHandlerResult;
+
+typedef enum {
+  LM_HANDLER_PRIORITY_LAST   = 1,
+  LM_HANDLER_PRIORITY_NORMAL = 2,
+  LM_HANDLER_PRIORITY_FIRST  = 3
+} LmHandlerPriority;
+
+struct _LmMessageNode {
+  gchar         *name;
+  gchar         *value;
+  gboolean       raw_mode;
+  LmMessageNode *next;
+  LmMessageNode *prev;
+  LmMessageNode *parent;
+  LmMessageNode *children;
+  GSList        *attributes;
+  gint           ref_count;
+};
+
+struct _LmMessage {
+  LmMessageNode *node;
+  gpointer       priv;
+};
+
+typedef LmHandlerResult (*LmHandleMessageFunction)(LmMessageHandler *handler,
+                                                   LmConnection *connection,
+                                                   LmMessage *message,
+                                                   gpointer user_data);
+
+LmMessage       *lm_message_new(const gchar *to, LmMessageType type);
+LmMessage       *lm_message_new_with_sub_type(const gchar *to,
+                                              LmMessageType type,
+                                              LmMessageSubType sub_type);
+LmMessage       *lm_message_ref(LmMessage *message);
+void             lm_message_unref(LmMessage *message);
+LmMessageType    lm_message_get_type(LmMessage *message);
+LmMessageSubType lm_message_get_sub_type(LmMessage *message);
+LmMessageNode   *lm_message_get_node(LmMessage *message);
+
+const gchar   *lm_message_node_get_value(LmMessageNode *node);
+void           lm_message_node_set_value(LmMessageNode *node,
+                                         const gchar *value);
+LmMessageNode *lm_message_node_add_child(LmMessageNode *node,
+                                         const gchar *name,
+                                         const gchar *value);
+void           lm_message_node_set_attribute(LmMessageNode *node,
+                                             const gchar *name,
+                                             const gchar *value);
+const gchar   *lm_message_node_get_attribute(LmMessageNode *node,
+                                             const gchar *name);
+LmMessageNode *lm_message_node_get_child(LmMessageNode *node,
+                                         const gchar *child_name);
+LmMessageNode *lm_message_node_find_child(LmMessageNode *node,
+                                          const gchar *child_name);
+gchar         *lm_message_node_to_string(LmMessageNode *node);
+
+LmMessageHandler *lm_message_handler_new(LmHandleMessageFunction function,
+                                         gpointer user_data,
+                                         GDestroyNotify notify);
+void              lm_message_handler_invalidate(LmMessageHandler *handler);
+gboolean          lm_message_handler_is_valid(LmMessageHandler *handler);
+LmMessageHandler *lm_message_handler_ref(LmMessageHandler *handler);
+void              lm_message_handler_unref(LmMessageHandler *handler);
+
+LmConnection *lm_connection_ref(LmConnection *connection);
+void          lm_connection_unref(LmConnection *connection);
+void     lm_connection_register_message_handler(LmConnection *connection,
+                                                LmMessageHandler *handler,
+                                                LmMessageType type,
+                                                LmHandlerPriority priority);
+void     lm_connection_unregister_message_handler(LmConnection *connection,
+                                                  LmMessageHandler *handler,
+                                                  LmMessageType type);
+gboolean lm_connection_is_authenticated(LmConnection *connection);
+gboolean lm_connection_send(LmConnection *connection, LmMessage *message,
+                            GError **error);
+gboolean lm_connection_send_with_reply(LmConnection *connection,
+                                       LmMessage *message,
+                                       LmMessageHandler *handler,
+                                       GError **error);
+
+#endif /* __LOUDMOUTH_H__ */
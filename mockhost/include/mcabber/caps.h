@@ -0,0 +1,10 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_CAPS_H__
+#define __MCABBER_CAPS_H__ 1
+
+#include <glib.h>
+
+void caps_add(const char *hash);
+int  caps_has_hash(const char *hash, const char *jid);
+
+#endif /* __MCABBER_CAPS_H__ */
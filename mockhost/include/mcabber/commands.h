@@ -0,0 +1,17 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_COMMANDS_H__
+#define __MCABBER_COMMANDS_H__ 1
+
+#include <glib.h>
+#include <mcabber/config.h>
+#include <mcabber/roster.h>
+#include <mcabber/screen.h>
+
+gpointer cmd_add(const char *name, const char *help, guint flags1,
+                 guint flags2, void (*f)(char*), gpointer userdata);
+gboolean cmd_del(gpointer id);
+
+int process_command(const char *line, guint iscmd);
+int process_line(const char *line);
+
+#endif /* __MCABBER_COMMANDS_H__ */
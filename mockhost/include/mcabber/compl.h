@@ -0,0 +1,36 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_COMPL_H__
+#define __MCABBER_COMPL_H__ 1
+
+#include <glib.h>
+#include <mcabber/config.h>
+
+#define COMPL_CMD       1
+#define COMPL_JID       2
+#define COMPL_URLJID    3
+#define COMPL_NAME      4
+#define COMPL_STATUS    5
+#define COMPL_FILENAME  6
+#define COMPL_ROSTER    7
+#define COMPL_BUFFER    8
+#define COMPL_GROUP     9
+#define COMPL_GROUPNAME 10
+#define COMPL_MULTILINE 11
+#define COMPL_ROOM      12
+#define COMPL_RESOURCE  13
+#define COMPL_AUTH      14
+#define COMPL_REQUEST   15
+#define COMPL_EVENTS    16
+#define COMPL_EVENTSID  17
+#define COMPL_PGP       18
+#define COMPL_COLOR     19
+#define COMPL_OTR       20
+#define COMPL_OTRPOLICY 21
+#define COMPL_MODULE    22
+
+guint compl_new_category(guint flags);
+void  compl_del_category(guint id);
+void  compl_add_category_word(guint categ, const char *command);
+void  compl_del_category_word(guint categ, const char *word);
+
+#endif /* __MCABBER_COMPL_H__ */
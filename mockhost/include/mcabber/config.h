@@ -0,0 +1,16 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_CONFIG_H__
+#define __MCABBER_CONFIG_H__ 1
+
+#define MCABBER_BRANCH "dev"
+#define MCABBER_API_VERSION 41
+#define MCABBER_API_MIN 41
+#define MCABBER_VERSION "0.10.0-mock"
+
+#define MCABBER_API_HAVE_CMD_ID 1
+#define MCABBER_API_HAVE_COMPL_FLAGS 1
+
+#define XEP0085 1
+#define XEP0022 1
+
+#endif /* __MCABBER_CONFIG_H__ */
@@ -0,0 +1,22 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_HBUF_H__
+#define __MCABBER_HBUF_H__ 1
+
+#include <glib.h>
+#include <mcabber/config.h>
+
+#define HBB_PREFIX_IN          (1U<<0)
+#define HBB_PREFIX_OUT         (1U<<1)
+#define HBB_PREFIX_STATUS      (1U<<2)
+#define HBB_PREFIX_AUTH        (1U<<3)
+#define HBB_PREFIX_INFO        (1U<<4)
+#define HBB_PREFIX_ERR         (1U<<5)
+#define HBB_PREFIX_SPECIAL     (1U<<6)
+#define HBB_PREFIX_PGPCRYPT    (1U<<7)
+#define HBB_PREFIX_OTRCRYPT    (1U<<8)
+#define HBB_PREFIX_HLIGHT_OUT  (1U<<9)
+#define HBB_PREFIX_HLIGHT      (1U<<10)
+#define HBB_PREFIX_NONE        (1U<<11)
+#define HBB_PREFIX_NOFLAG      (1U<<12)
+
+#endif /* __MCABBER_HBUF_H__ */
@@ -0,0 +1,43 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_HOOKS_H__
+#define __MCABBER_HOOKS_H__ 1
+
+#include <time.h>
+#include <glib.h>
+#include <mcabber/config.h>
+
+#define HOOK_PRE_MESSAGE_IN     "hook-pre-message-in"
+#define HOOK_POST_MESSAGE_IN    "hook-post-message-in"
+#define HOOK_MESSAGE_OUT        "hook-message-out"
+#define HOOK_STATUS_CHANGE      "hook-status-change"
+#define HOOK_MY_STATUS_CHANGE   "hook-my-status-change"
+#define HOOK_POST_CONNECT       "hook-post-connect"
+#define HOOK_PRE_DISCONNECT     "hook-pre-disconnect"
+#define HOOK_UNREAD_LIST_CHANGE "hook-unread-list-change"
+#define HOOK_SUBSCRIPTION       "hook-subscription"
+#define HOOK_MDR_RECEIVED       "hook-mdr-received"
+#define HOOK_ROSTER_PUSH        "hook-roster-push"
+
+typedef enum {
+  HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS = 0,
+  HOOK_HANDLER_RESULT_NO_MORE_HANDLER,
+  HOOK_HANDLER_RESULT_NO_MORE_HANDLER_DROP_DATA,
+} hk_handler_result;
+
+typedef struct {
+  const char *name;
+  const char *value;
+} hk_arg_t;
+
+typedef guint (*hk_handler_t)(const gchar *hookname, hk_arg_t *args,
+                              gpointer data);
+
+guint hk_add_handler(hk_handler_t handler, const gchar *hookname,
+                     gint priority, gpointer userdata);
+void  hk_del_handler(const gchar *hookname, guint hid);
+guint hk_run_handlers(const gchar *hookname, hk_arg_t *args);
+
+void hk_message_out(const char *bjid, const char *nickname, time_t timestamp,
+                    const char *msg, guint encrypted, gpointer xep184);
+
+#endif /* __MCABBER_HOOKS_H__ */
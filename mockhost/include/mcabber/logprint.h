@@ -0,0 +1,17 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_LOGPRINT_H__
+#define __MCABBER_LOGPRINT_H__ 1
+
+#include <glib.h>
+
+#define LPRINT_NORMAL   1U  // Display in log window
+#define LPRINT_LOG      2U  // Display in log file
+#define LPRINT_DEBUG    4U  // Display in log file only if option debug
+#define LPRINT_NOTUTF8  8U  // Do not convert from UTF-8 to locale
+
+#define LPRINT_LOGNORM  (LPRINT_NORMAL|LPRINT_LOG)
+
+void scr_log_print(unsigned int flag, const char *fmt, ...);
+#define scr_LogPrint scr_log_print
+
+#endif /* __MCABBER_LOGPRINT_H__ */
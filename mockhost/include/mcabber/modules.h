@@ -0,0 +1,24 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_MODULES_H__
+#define __MCABBER_MODULES_H__ 1
+
+#include <glib.h>
+#include <gmodule.h>
+#include <mcabber/config.h>
+
+typedef void (*module_init_t)(void);
+typedef void (*module_uninit_t)(void);
+
+typedef struct module_info_struct module_info_t;
+struct module_info_struct {
+  const gchar        *branch;
+  guint               api;
+  const gchar        *version;
+  const gchar        *description;
+  const gchar * const *requires;
+  module_init_t       init;
+  module_uninit_t     uninit;
+  module_info_t      *next;
+};
+
+#endif /* __MCABBER_MODULES_H__ */
@@ -0,0 +1,160 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_ROSTER_H__
+#define __MCABBER_ROSTER_H__ 1
+
+#include <time.h>
+#include <stdbool.h>
+#include <glib.h>
+#include <mcabber/config.h>
+
+#define SPECIAL_BUFFER_STATUS_ID  "[status]"
+
+#define JID_RESOURCE_SEPARATOR    '/'
+#define JID_RESOURCE_SEPARATORSTR "/"
+
+enum imstatus {
+  offline,
+  available,
+  freeforchat,
+  dontdisturb,
+  notavail,
+  away,
+  invisible,
+  imstatus_size
+};
+
+extern char imstatus2char[];
+
+enum imrole {
+  role_none,
+  role_moderator,
+  role_participant,
+  role_visitor,
+  imrole_size
+};
+
+enum imaffiliation {
+  affil_none,
+  affil_owner,
+  affil_admin,
+  affil_member,
+  affil_outcast,
+  imaffiliation_size
+};
+
+enum subscr {
+  sub_none    = 0,
+  sub_pending = 1 << 3,
+  sub_remove  = 1 << 4,
+  sub_to      = 1 << 0,
+  sub_from    = 1 << 1,
+  sub_both    = sub_to | sub_from,
+};
+
+enum findwhat {
+  jidsearch,
+  namesearch
+};
+
+#define ROSTER_TYPE_USER    (1U<<0)
+#define ROSTER_TYPE_GROUP   (1U<<1)
+#define ROSTER_TYPE_AGENT   (1U<<2)
+#define ROSTER_TYPE_ROOM    (1U<<3)
+#define ROSTER_TYPE_SPECIAL (1U<<4)
+
+#define ROSTER_FLAG_MSG     (1U<<0)
+#define ROSTER_FLAG_HIDE    (1U<<1)
+#define ROSTER_FLAG_LOCK    (1U<<2)
+#define ROSTER_FLAG_USRLOCK (1U<<3)
+
+#define ROSTER_UI_PRIO_MUC_MESSAGE        10
+#define ROSTER_UI_PRIO_MUC_HL_MESSAGE     20
+#define ROSTER_UI_PRIO_MUC_PRIV_MESSAGE   30
+#define ROSTER_UI_PRIO_PRIVATE_MESSAGE    40
+#define ROSTER_UI_PRIO_ATTENTION_MESSAGE  50
+#define ROSTER_UI_PRIO_STATUS_WIN_MESSAGE 3000
+
+enum setuiprio_ops {
+  prio_set,
+  prio_max,
+  prio_inc,
+};
+
+#define ROSTER_EVENT_NONE       0U
+#define ROSTER_EVENT_COMPOSING  (1U<<1)
+#define ROSTER_EVENT_PAUSED     (1U<<2)
+#define ROSTER_EVENT_ACTIVE     (1U<<3)
+#define ROSTER_EVENT_INACTIVE   (1U<<4)
+#define ROSTER_EVENT_GONE       (1U<<5)
+
+#define CHATSTATES_SUPPORT_UNKNOWN   0
+#define CHATSTATES_SUPPORT_PROBED    1
+#define CHATSTATES_SUPPORT_NOSUPPORT 2
+#define CHATSTATES_SUPPORT_OK        3
+
+struct xep0085 {
+  guint support;
+  guint last_state_sent;
+  guint last_state_rcvd;
+};
+
+struct xep0022 {
+  guint support;
+  guint last_state_sent;
+  gchar *last_msgid_sent;
+  guint last_state_rcvd;
+  gchar *last_msgid_rcvd;
+};
+
+extern GList *buddylist;
+extern GList *current_buddy;
+
+#define BUDDATA(glist_node) ((glist_node)->data)
+#define CURRENT_JID         buddy_getjid(BUDDATA(current_buddy))
+
+GSList *roster_add_group(const char *name);
+GSList *roster_add_user(const char *jid, const char *name, const char *group,
+                        guint type, enum subscr esub, gint on_server);
+void    roster_del_user(const char *jid);
+GSList *roster_find(const char *jidname, enum findwhat type, guint roster_type);
+void    roster_setstatus(const char *jid, const char *resname, gchar prio,
+                         enum imstatus bstat, const char *status_msg,
+                         time_t timestamp,
+                         enum imrole role, enum imaffiliation affil,
+                         const char *realjid);
+guint   roster_getsubscription(const char *jid);
+
+void    buddylist_build(void);
+void    foreach_buddy(guint roster_type,
+                      void (*pfunc)(gpointer rosterdata, void *param),
+                      void *param);
+void    foreach_group_member(gpointer groupdata,
+                             void (*pfunc)(gpointer rosterdata, void *param),
+                             void *param);
+
+const char   *buddy_getjid(gpointer rosterdata);
+const char   *buddy_getname(gpointer rosterdata);
+gpointer      buddy_getgroup(gpointer rosterdata);
+const char   *buddy_getgroupname(gpointer rosterdata);
+guint         buddy_gettype(gpointer rosterdata);
+guint         buddy_getflags(gpointer rosterdata);
+guint         buddy_getuiprio(gpointer rosterdata);
+GSList       *buddy_getresources(gpointer rosterdata);
+enum imstatus buddy_getstatus(gpointer rosterdata, const char *resname);
+const char   *buddy_getstatusmsg(gpointer rosterdata, const char *resname);
+time_t        buddy_getstatustime(gpointer rosterdata, const char *resname);
+gchar         buddy_getresourceprio(gpointer rosterdata, const char *resname);
+void          buddy_setactiveresource(gpointer rosterdata, const char *resname);
+const char   *buddy_getactiveresource(gpointer rosterdata);
+void          buddy_del_all_resources(gpointer rosterdata);
+struct xep0085 *buddy_resource_xep85(gpointer rosterdata, const char *resname);
+struct xep0022 *buddy_resource_xep22(gpointer rosterdata, const char *resname);
+void          buddy_resource_setevents(gpointer rosterdata, const char *resname,
+                                       guint event);
+guint         buddy_resource_getevents(gpointer rosterdata,
+                                       const char *resname);
+void          buddy_resource_setcaps(gpointer rosterdata, const char *resname,
+                                     const char *caps);
+char         *buddy_resource_getcaps(gpointer rosterdata, const char *resname);
+
+#endif /* __MCABBER_ROSTER_H__ */
@@ -0,0 +1,24 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_SCREEN_H__
+#define __MCABBER_SCREEN_H__ 1
+
+#include <stdio.h>
+#include <glib.h>
+#include <mcabber/config.h>
+#include <mcabber/logprint.h>
+#include <mcabber/roster.h>
+#include <mcabber/xmpp.h>
+
+void scr_update_chat_status(int forceupdate);
+void scr_update_roster(void);
+void scr_draw_roster(void);
+void scr_do_update(void);
+unsigned int scr_getlogwinheight(void);
+void scr_setmsgflag_if_needed(const char *jid, int special);
+void scr_WriteIncomingMessage(const char *jidfrom, const char *text,
+                              time_t timestamp, guint prefix,
+                              unsigned mucnicklen);
+void scr_setattentionflag_if_needed(const char *bare_jid, int special,
+                                    guint value, enum setuiprio_ops action);
+
+#endif /* __MCABBER_SCREEN_H__ */
@@ -0,0 +1,23 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_SETTINGS_H__
+#define __MCABBER_SETTINGS_H__ 1
+
+#include <glib.h>
+#include <mcabber/config.h>
+
+#define SETTINGS_TYPE_OPTION    1
+#define SETTINGS_TYPE_ALIAS     2
+#define SETTINGS_TYPE_BINDING   3
+
+typedef gchar *(*settings_guard_t)(const gchar *key, const gchar *new_value);
+
+void         settings_set(guint type, const gchar *key, const gchar *value);
+const gchar *settings_get(guint type, const gchar *key);
+int          settings_get_int(guint type, const gchar *key);
+gboolean     settings_set_guard(const gchar *key, settings_guard_t guard);
+void         settings_del_guard(const gchar *key);
+
+#define settings_opt_get(k)     settings_get(SETTINGS_TYPE_OPTION, k)
+#define settings_opt_get_int(k) settings_get_int(SETTINGS_TYPE_OPTION, k)
+
+#endif /* __MCABBER_SETTINGS_H__ */
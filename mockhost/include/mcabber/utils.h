@@ -0,0 +1,16 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_UTILS_H__
+#define __MCABBER_UTILS_H__ 1
+
+#include <glib.h>
+#include <mcabber/config.h>
+
+char  *expand_filename(const char *fname);
+int    check_jid_syntax(const char *fjid);
+char  *jidtodisp(const char *fjid);
+char  *to_utf8(const char *str);
+char  *from_utf8(const char *str);
+char **split_arg(const char *arg, unsigned int n, int dontparse);
+void   free_arg_lst(char **arglst);
+
+#endif /* __MCABBER_UTILS_H__ */
@@ -0,0 +1,17 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_XMPP_H__
+#define __MCABBER_XMPP_H__ 1
+
+#include <loudmouth/loudmouth.h>
+#include <mcabber/config.h>
+#include <mcabber/roster.h>
+
+extern LmConnection *lconnection;
+
+gboolean      xmpp_is_online(void);
+enum imstatus xmpp_getstatus(void);
+const char   *xmpp_getstatusmsg(void);
+void          xmpp_send_s10n(const char *bjid, LmMessageSubType type);
+void          xmpp_send_chatstate(gpointer buddy, guint chatstate);
+
+#endif /* __MCABBER_XMPP_H__ */
@@ -0,0 +1,14 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_XMPP_DEFINES_H__
+#define __MCABBER_XMPP_DEFINES_H__ 1
+
+#define NS_MUC            "http://jabber.org/protocol/muc"
+#define NS_MUC_USER       "http://jabber.org/protocol/muc#user"
+#define NS_PING           "urn:xmpp:ping"
+#define NS_EVENT          "jabber:x:event"
+#define NS_CHATSTATES     "http://jabber.org/protocol/chatstates"
+#define NS_CAPS           "http://jabber.org/protocol/caps"
+#define NS_DELAY          "jabber:x:delay"
+#define NS_XMPP_DELAY     "urn:xmpp:delay"
+
+#endif /* __MCABBER_XMPP_DEFINES_H__ */
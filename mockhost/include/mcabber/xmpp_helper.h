@@ -0,0 +1,12 @@
+/* Mock mcabber host -- see mockhost/README */
+#ifndef __MCABBER_XMPP_HELPER_H__
+#define __MCABBER_XMPP_HELPER_H__ 1
+
+#include <time.h>
+#include <loudmouth/loudmouth.h>
+
+LmMessageNode *lm_message_node_find_xmlns(LmMessageNode *node,
+                                          const char *xmlns);
+time_t         lm_message_node_get_timestamp(LmMessageNode *node);
+
+#endif /* __MCABBER_XMPP_HELPER_H__ */
@@ -0,0 +1,520 @@
+/*
+ *  Mock mcabber host -- minimal Loudmouth stand-in
+ *
+ *  Stanzas are kept as small node trees.  Sending one runs the send hook
+ *  set by the runner (the local "server"), which may answer with
+ *  mock_lm_receive(); incoming stanzas are dispatched to the registered
+ *  message handlers, and replies to the handler given to
+ *  lm_connection_send_with_reply().
+ *
+ *  As in mcabber, lconnection is NULL until the runner connects, and
+ *  each connection is a new one: the handlers registered on the previous
+ *  one are released with it, once its last reference is dropped.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <loudmouth/loudmouth.h>
+#include <mcabber/xmpp.h>
+
+#include "mockhost.h"
+
+struct _LmConnection {
+  GSList *handlers[LM_MESSAGE_TYPE_UNKNOWN+1];  // List of lm_reg_t
+  GHashTable *replies;          // id -> LmMessageHandler
+  gint ref_count;
+};
+
+struct _LmMessageHandler {
+  LmHandleMessageFunction function;
+  gpointer user_data;
+  GDestroyNotify notify;
+  gboolean valid;
+  gint ref_count;
+};
+
+typedef struct {
+  LmMessageHandler *handler;
+  LmHandlerPriority priority;
+} lm_reg_t;
+
+typedef struct {
+  gchar *name;
+  gchar *value;
+} lm_attr_t;
+
+LmConnection *lconnection;
+
+static guint lastid;
+
+static void (*send_hook)(LmMessage *m);
+
+static const gchar *type_names[] = {
+  "message", "presence", "iq", "stream:stream", "stream:error", NULL
+};
+
+static const gchar *subtype_names[] = {
+  "normal", "chat", "groupchat", "headline", "unavailable", "probe",
+  "subscribe", "unsubscribe", "subscribed", "unsubscribed",
+  "get", "set", "result", "error"
+};
+
+/* Nodes */
+
+static LmMessageNode *node_new(const gchar *name, const gchar *value)
+{
+  LmMessageNode *node = g_new0(LmMessageNode, 1);
+
+  node->name = g_strdup(name);
+  node->value = g_strdup(value);
+  node->ref_count = 1;
+  return node;
+}
+
+static void node_free(LmMessageNode *node)
+{
+  GSList *li;
+
+  while (node) {
+    LmMessageNode *next = node->next;
+    node_free(node->children);
+    for (li = node->attributes; li; li = g_slist_next(li)) {
+      lm_attr_t *attr = li->data;
+      g_free(attr->name);
+      g_free(attr->value);
+      g_free(attr);
+    }
+    g_slist_free(node->attributes);
+    g_free(node->name);
+    g_free(node->value);
+    g_free(node);
+    node = next;
+  }
+}
+
+const gchar *lm_message_node_get_value(LmMessageNode *node)
+{
+  return node->value;
+}
+
+void lm_message_node_set_value(LmMessageNode *node, const gchar *value)
+{
+  g_free(node->value);
+  node->value = g_strdup(value);
+}
+
+LmMessageNode *lm_message_node_add_child(LmMessageNode *node,
+                                         const gchar *name,
+                                         const gchar *value)
+{
+  LmMessageNode *child = node_new(name, value), *last;
+
+  child->parent = node;
+  if (!node->children) {
+    node->children = child;
+  } else {
+    for (last = node->children; last->next; last = last->next)
+      ;
+    last->next = child;
+    child->prev = last;
+  }
+  return child;
+}
+
+void lm_message_node_set_attribute(LmMessageNode *node, const gchar *name,
+                                   const gchar *value)
+{
+  GSList *li;
+  lm_attr_t *attr;
+
+  for (li = node->attributes; li; li = g_slist_next(li)) {
+    attr = li->data;
+    if (!strcmp(attr->name, name)) {
+      g_free(attr->value);
+      attr->value = g_strdup(value);
+      return;
+    }
+  }
+  attr = g_new(lm_attr_t, 1);
+  attr->name = g_strdup(name);
+  attr->value = g_strdup(value);
+  node->attributes = g_slist_append(node->attributes, attr);
+}
+
+const gchar *lm_message_node_get_attribute(LmMessageNode *node,
+                                           const gchar *name)
+{
+  GSList *li;
+
+  for (li = node->attributes; li; li = g_slist_next(li)) {
+    lm_attr_t *attr = li->data;
+    if (!strcmp(attr->name, name))
+      return attr->value;
+  }
+  return NULL;
+}
+
+LmMessageNode *lm_message_node_get_child(LmMessageNode *node,
+                                         const gchar *child_name)
+{
+  LmMessageNode *child;
+
+  for (child = node->children; child; child = child->next)
+    if (!g_strcmp0(child->name, child_name))
+      return child;
+  return NULL;
+}
+
+LmMessageNode *lm_message_node_find_child(LmMessageNode *node,
+                                          const gchar *child_name)
+{
+  LmMessageNode *child, *found;
+
+  for (child = node->children; child; child = child->next) {
+    if (!g_strcmp0(child->name, child_name))
+      return child;
+    if ((found = lm_message_node_find_child(child, child_name)) != NULL)
+      return found;
+  }
+  return NULL;
+}
+
+static void node_to_string(LmMessageNode *node, GString *str)
+{
+  LmMessageNode *child;
+  GSList *li;
+
+  g_string_append_printf(str, "<%s", node->name);
+  for (li = node->attributes; li; li = g_slist_next(li)) {
+    lm_attr_t *attr = li->data;
+    gchar *esc = g_markup_escape_text(attr->value, -1);
+    g_string_append_printf(str, " %s=\"%s\"", attr->name, esc);
+    g_free(esc);
+  }
+  if (!node->value && !node->children) {
+    g_string_append(str, "/>");
+    return;
+  }
+  g_string_append_c(str, '>');
+  if (node->value) {
+    gchar *esc = g_markup_escape_text(node->value, -1);
+    g_string_append(str, esc);
+    g_free(esc);
+  }
+  for (child = node->children; child; child = child->next)
+    node_to_string(child, str);
+  g_string_append_printf(str, "</%s>", node->name);
+}
+
+gchar *lm_message_node_to_string(LmMessageNode *node)
+{
+  GString *str = g_string_new(NULL);
+  node_to_string(node, str);
+  return g_string_free(str, FALSE);
+}
+
+/* Messages */
+
+LmMessage *lm_message_new_with_sub_type(const gchar *to, LmMessageType type,
+                                        LmMessageSubType sub_type)
+{
+  LmMessage *m = g_new0(LmMessage, 1);
+
+  if (type > LM_MESSAGE_TYPE_UNKNOWN || type < 0)
+    type = LM_MESSAGE_TYPE_UNKNOWN;
+  m->node = node_new(type_names[type] ? type_names[type] : "unknown", NULL);
+  if (to)
+    lm_message_node_set_attribute(m->node, "to", to);
+  if (sub_type >= LM_MESSAGE_SUB_TYPE_NORMAL &&
+      sub_type <= LM_MESSAGE_SUB_TYPE_ERROR)
+    lm_message_node_set_attribute(m->node, "type", subtype_names[sub_type]);
+  if (type == LM_MESSAGE_TYPE_IQ) {
+    gchar *id = g_strdup_printf("mock%u", ++lastid);
+    lm_message_node_set_attribute(m->node, "id", id);
+    g_free(id);
+  }
+  return m;
+}
+
+LmMessage *lm_message_new(const gchar *to, LmMessageType type)
+{
+  return lm_message_new_with_sub_type(to, type, LM_MESSAGE_SUB_TYPE_NOT_SET);
+}
+
+LmMessage *lm_message_ref(LmMessage *message)
+{
+  message->node->ref_count++;
+  return message;
+}
+
+void lm_message_unref(LmMessage *message)
+{
+  if (--message->node->ref_count > 0)
+    return;
+  node_free(message->node);
+  g_free(message);
+}
+
+LmMessageType lm_message_get_type(LmMessage *message)
+{
+  LmMessageType type;
+
+  for (type = 0; type_names[type]; type++)
+    if (!strcmp(message->node->name, type_names[type]))
+      return type;
+  return LM_MESSAGE_TYPE_UNKNOWN;
+}
+
+LmMessageSubType lm_message_get_sub_type(LmMessage *message)
+{
+  const gchar *type = lm_message_node_get_attribute(message->node, "type");
+  LmMessageSubType st;
+
+  if (!type)
+    return lm_message_get_type(message) == LM_MESSAGE_TYPE_PRESENCE ?
+           LM_MESSAGE_SUB_TYPE_AVAILABLE : LM_MESSAGE_SUB_TYPE_NORMAL;
+  for (st = LM_MESSAGE_SUB_TYPE_NORMAL; st <= LM_MESSAGE_SUB_TYPE_ERROR; st++)
+    if (!strcmp(type, subtype_names[st]))
+      return st;
+  return LM_MESSAGE_SUB_TYPE_NOT_SET;
+}
+
+LmMessageNode *lm_message_get_node(LmMessage *message)
+{
+  return message->node;
+}
+
+/* Handlers */
+
+LmMessageHandler *lm_message_handler_new(LmHandleMessageFunction function,
+                                         gpointer user_data,
+                                         GDestroyNotify notify)
+{
+  LmMessageHandler *h = g_new0(LmMessageHandler, 1);
+
+  h->function = function;
+  h->user_data = user_data;
+  h->notify = notify;
+  h->valid = TRUE;
+  h->ref_count = 1;
+  return h;
+}
+
+void lm_message_handler_invalidate(LmMessageHandler *handler)
+{
+  handler->valid = FALSE;
+}
+
+gboolean lm_message_handler_is_valid(LmMessageHandler *handler)
+{
+  return handler->valid;
+}
+
+LmMessageHandler *lm_message_handler_ref(LmMessageHandler *handler)
+{
+  handler->ref_count++;
+  return handler;
+}
+
+void lm_message_handler_unref(LmMessageHandler *handler)
+{
+  if (--handler->ref_count > 0)
+    return;
+  if (handler->notify)
+    handler->notify(handler->user_data);
+  g_free(handler);
+}
+
+// As Loudmouth: by priority; the last one registered first among equals
+static gint reg_cmp(gconstpointer a, gconstpointer b)
+{
+  return ((const lm_reg_t *)b)->priority - ((const lm_reg_t *)a)->priority;
+}
+
+void lm_connection_register_message_handler(LmConnection *connection,
+                                            LmMessageHandler *handler,
+                                            LmMessageType type,
+                                            LmHandlerPriority priority)
+{
+  lm_reg_t *reg;
+
+  g_return_if_fail(connection != NULL);
+  reg = g_new(lm_reg_t, 1);
+  reg->handler = lm_message_handler_ref(handler);
+  reg->priority = priority;
+  connection->handlers[type] = g_slist_insert_sorted(connection->handlers[type],
+                                                     reg, reg_cmp);
+}
+
+void lm_connection_unregister_message_handler(LmConnection *connection,
+                                              LmMessageHandler *handler,
+                                              LmMessageType type)
+{
+  GSList *li;
+
+  g_return_if_fail(connection != NULL);
+  for (li = connection->handlers[type]; li; li = g_slist_next(li)) {
+    lm_reg_t *reg = li->data;
+    if (reg->handler == handler) {
+      connection->handlers[type] = g_slist_delete_link(
+                                     connection->handlers[type], li);
+      lm_message_handler_unref(handler);
+      g_free(reg);
+      return;
+    }
+  }
+}
+
+gboolean lm_connection_is_authenticated(LmConnection *connection)
+{
+  return xmpp_is_online();
+}
+
+/* Connection */
+
+void mock_lm_connect(void)
+{
+  mock_lm_disconnect();
+  lconnection = g_new0(LmConnection, 1);
+  lconnection->ref_count = 1;
+}
+
+void mock_lm_disconnect(void)
+{
+  LmConnection *c = lconnection;
+
+  lconnection = NULL;
+  if (c)
+    lm_connection_unref(c);
+}
+
+LmConnection *lm_connection_ref(LmConnection *connection)
+{
+  connection->ref_count++;
+  return connection;
+}
+
+// The last reference: the handlers are released
+void lm_connection_unref(LmConnection *connection)
+{
+  LmConnection *c = connection;
+  guint type;
+
+  if (--c->ref_count > 0)
+    return;
+  for (type = 0; type <= LM_MESSAGE_TYPE_UNKNOWN; type++) {
+    while (c->handlers[type]) {
+      lm_reg_t *reg = c->handlers[type]->data;
+      c->handlers[type] = g_slist_delete_link(c->handlers[type],
+                                              c->handlers[type]);
+      lm_message_handler_unref(reg->handler);
+      g_free(reg);
+    }
+  }
+  if (c->replies) {
+    GHashTableIter iter;
+    gpointer h;
+
+    g_hash_table_iter_init(&iter, c->replies);
+    while (g_hash_table_iter_next(&iter, NULL, &h))
+      lm_message_handler_unref(h);
+    g_hash_table_destroy(c->replies);
+  }
+  g_free(c);
+}
+
+/* Sending and receiving */
+
+void mock_lm_set_send_hook(void (*hook)(LmMessage *m))
+{
+  send_hook = hook;
+}
+
+void mock_lm_receive(LmMessage *m)
+{
+  LmConnection *c = lconnection;
+  LmMessageType type = lm_message_get_type(m);
+  const gchar *id = lm_message_node_get_attribute(m->node, "id");
+  LmMessageHandler *h;
+  GSList *li, *next;
+
+  // Not connected (any more): the stanza is lost
+  if (!c)
+    return;
+
+  // Replies first
+  if (id && c->replies &&
+      (h = g_hash_table_lookup(c->replies, id)) != NULL) {
+    LmHandlerResult res = LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+    g_hash_table_steal(c->replies, id);
+    if (h->valid)
+      res = h->function(h, c, m, h->user_data);
+    lm_message_handler_unref(h);
+    if (res == LM_HANDLER_RESULT_REMOVE_MESSAGE)
+      return;
+  }
+
+  for (li = c->handlers[type]; li; li = next) {
+    next = g_slist_next(li);
+    h = ((lm_reg_t *)li->data)->handler;
+    if (h->valid &&
+        h->function(h, c, m, h->user_data) == LM_HANDLER_RESULT_REMOVE_MESSAGE)
+      return;
+  }
+
+  if (type == LM_MESSAGE_TYPE_PRESENCE)
+    mock_core_presence(m);
+  else if (type == LM_MESSAGE_TYPE_MESSAGE)
+    mock_core_message(m);
+}
+
+gboolean lm_connection_send(LmConnection *connection, LmMessage *message,
+                            GError **error)
+{
+  g_return_val_if_fail(connection != NULL, FALSE);
+  if (!xmpp_is_online())
+    return FALSE;
+  mock_counters.stanzas_sent++;
+  if (send_hook)
+    send_hook(message);
+  return TRUE;
+}
+
+gboolean lm_connection_send_with_reply(LmConnection *connection,
+                                       LmMessage *message,
+                                       LmMessageHandler *handler,
+                                       GError **error)
+{
+  const gchar *id = lm_message_node_get_attribute(message->node, "id");
+
+  g_return_val_if_fail(connection != NULL, FALSE);
+  if (!xmpp_is_online())
+    return FALSE;
+  if (!id) {
+    gchar *newid = g_strdup_printf("mock%u", ++lastid);
+    lm_message_node_set_attribute(message->node, "id", newid);
+    g_free(newid);
+    id = lm_message_node_get_attribute(message->node, "id");
+  }
+  if (!connection->replies)
+    connection->replies = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                g_free, NULL);
+  g_hash_table_insert(connection->replies, g_strdup(id),
+                      lm_message_handler_ref(handler));
+  return lm_connection_send(connection, message, error);
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -0,0 +1,107 @@
+/*
+ *  Mock mcabber host -- host side interface
+ *
+ *  These functions are not part of the mcabber API: they are used by the
+ *  bench runner to drive the stub host (see the README file).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MOCKHOST_H__
+#define __MOCKHOST_H__ 1
+
+#include <mcabber/modules.h>
+#include <mcabber/hooks.h>
+#include <mcabber/roster.h>
+#include <loudmouth/loudmouth.h>
+
+// A registered hook handler
+typedef struct {
+  guint         hid;
+  gchar        *hookname;
+  gint          priority;
+  hk_handler_t  handler;
+  gpointer      userdata;
+  const gchar  *module;   // Module which registered the handler
+} mock_hook_t;
+
+// Host counters, reset by mock_counters_reset()
+typedef struct {
+  guint64 log_lines;
+  guint64 s10n_sent;
+  guint64 stanzas_sent;
+  guint64 commands_run;
+  guint64 status_updates;
+  guint64 roster_redraws;
+  guint64 buffer_lines;
+  guint64 chatstates_sent;
+} mock_counters_t;
+
+extern mock_counters_t mock_counters;
+extern gboolean mock_verbose;
+
+// Allocation counters (alloc.c)
+typedef struct {
+  guint64 allocs;
+  guint64 frees;
+  guint64 bytes;
+} mock_alloc_stats_t;
+
+void mock_alloc_count(gboolean enable);
+void mock_alloc_get(mock_alloc_stats_t *stats);
+
+// Modules
+module_info_t *mock_module_load(const gchar *path, gchar **modname);
+void           mock_module_unload_all(void);
+
+// Hooks
+GSList *mock_hook_handlers(void);       // List of mock_hook_t
+void    mock_counters_reset(void);
+
+// Roster
+void mock_roster_fixture(void);
+
+// Screen: the log lines are passed to the hook, if any (e.g. to check
+// the output of a command)
+void mock_set_log_hook(void (*hook)(guint flag, const gchar *line));
+
+// Connection/status
+void mock_set_status(enum imstatus st);
+void mock_set_online(gboolean online);
+// As mcabber: a new connection, online, then HOOK_POST_CONNECT; and
+// HOOK_PRE_DISCONNECT, offline, then the connection is released
+void mock_connect(void);
+void mock_disconnect(void);
+// The link drops: offline and the connection is released, without
+// HOOK_PRE_DISCONNECT (mcabber does not run it then)
+void mock_drop_link(void);
+
+// Loudmouth stand-in: feed an incoming stanza to the registered handlers.
+// Outgoing stanzas are passed to the send hook, if any (it can reply by
+// calling mock_lm_receive()).
+void mock_lm_receive(LmMessage *m);
+void mock_lm_set_send_hook(void (*hook)(LmMessage *m));
+// New connection (lconnection), after releasing the previous one, if any
+// (the modules may still hold a reference to it)
+void mock_lm_connect(void);
+void mock_lm_disconnect(void);
+
+// What mcabber does with a presence no module handler has removed: update
+// the roster, then rebuild and redraw it (host.c)
+void mock_core_presence(LmMessage *m);
+// Same for a message: the sender resource becomes the active resource,
+// and a chat state marks it as supporting chat states (host.c)
+void mock_core_message(LmMessage *m);
+
+#endif /* __MOCKHOST_H__ */
@@ -0,0 +1,322 @@
+/*
+ *  mcabber-replay -- replay a hook trace into modules
+ *
+ *  Reads a trace recorded by the hooktrace module and feeds the events
+ *  to the modules loaded in the mock host, either at the recorded pace
+ *  (optionally sped up) or as fast as possible, then reports the
+ *  dispatch cost per hook.
+ *
+ *  Usage: mcabber-replay [-f | -x factor] [-s status] [-o option=value]...
+ *                        [-c command]... [-C command]... [-v]
+ *                        trace module.so...
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+#include <mcabber/settings.h>
+
+#include "hooktrace/hooktrace.h"
+#include "mockhost.h"
+
+// Per-hook replay statistics
+typedef struct {
+  const gchar *hookname;
+  guint64 events;
+  guint64 dropped;      // Events a handler has dropped
+  gdouble ns;
+  guint64 allocs;
+} replay_stats_t;
+
+static GHashTable *stats;
+
+static gdouble now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static replay_stats_t *get_stats(const gchar *hookname)
+{
+  replay_stats_t *st = g_hash_table_lookup(stats, hookname);
+
+  if (!st) {
+    st = g_new0(replay_stats_t, 1);
+    st->hookname = g_intern_string(hookname);
+    g_hash_table_insert(stats, (gpointer)st->hookname, st);
+  }
+  return st;
+}
+
+// Decode a record into args, using scratch (at least as large as the
+// record) for the strings.  Returns the hook name, or NULL if the record
+// is invalid.
+static const gchar *decode_record(const guchar *p, gsize size,
+                                  hk_arg_t *args, gchar *scratch)
+{
+  const guchar *end = p + size;
+  const gchar *hookname;
+  guint hookidx, nargs, i;
+
+#define NEED(n) do { if ((gsize)(end - p) < (gsize)(n)) return NULL; } while (0)
+  NEED(10);
+  p += 8;     // Timestamp
+  hookidx = *p++;
+  if (hookidx == HOOKTRACE_HOOK_OTHER) {
+    guint len;
+    NEED(1);
+    len = *p++;
+    NEED(len);
+    memcpy(scratch, p, len);
+    scratch[len] = '\0';
+    hookname = scratch;
+    scratch += len + 1;
+    p += len;
+  } else if (hookidx < G_N_ELEMENTS(hooktrace_hooks) - 1) {
+    hookname = hooktrace_hooks[hookidx];
+  } else {
+    return NULL;
+  }
+
+  NEED(1);
+  nargs = *p++;
+  if (nargs > HOOKTRACE_MAX_ARGS)
+    return NULL;
+  for (i = 0; i < nargs; i++) {
+    guint len;
+
+    NEED(1);
+    len = *p++;
+    NEED(len + 2);
+    memcpy(scratch, p, len);
+    scratch[len] = '\0';
+    args[i].name = scratch;
+    scratch += len + 1;
+    p += len;
+
+    len = hooktrace_get_u16(p);
+    p += 2;
+    if (len == HOOKTRACE_NULL_VALUE) {
+      args[i].value = NULL;
+      continue;
+    }
+    NEED(len);
+    memcpy(scratch, p, len);
+    scratch[len] = '\0';
+    args[i].value = scratch;
+    scratch += len + 1;
+    p += len;
+  }
+  args[i].name = args[i].value = NULL;
+#undef NEED
+  return hookname;
+}
+
+static void print_stats(gpointer key, gpointer value, gpointer data)
+{
+  replay_stats_t *st = value;
+
+  printf("%-26s %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT
+         " %10.1f %10.2f\n", st->hookname, st->events, st->dropped,
+         st->ns / st->events, (gdouble)st->allocs / st->events);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-f | -x factor] [-s status] "
+          "[-o option=value]... [-c command]... [-C command]... [-v] "
+          "trace module.so...\n", prog);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  GSList *cmds = NULL, *postcmds = NULL, *li;
+  GMappedFile *map;
+  GError *err = NULL;
+  const guchar *data, *p, *end;
+  gchar *scratch = NULL;
+  gsize scratch_size = 0;
+  hk_arg_t args[HOOKTRACE_MAX_ARGS+1];
+  gboolean fast = FALSE;
+  gdouble factor = 1.0, t_start, elapsed, dispatch_ns = 0.;
+  guint64 t0_rec = 0, nevents = 0;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "fx:s:o:c:C:v")) != -1) {
+    switch (opt) {
+      case 'f':
+          fast = TRUE;
+          break;
+      case 'x':
+          factor = g_ascii_strtod(optarg, NULL);
+          if (factor <= 0.)
+            usage(argv[0]);
+          break;
+      case 's':
+          {
+            const char *st = strchr(imstatus2char, optarg[0]);
+            if (!st || !optarg[0])
+              usage(argv[0]);
+            mock_set_status(st - imstatus2char);
+          }
+          break;
+      case 'o':
+          {
+            gchar **kv = g_strsplit(optarg, "=", 2);
+            if (!kv[0] || !kv[1])
+              usage(argv[0]);
+            settings_set(SETTINGS_TYPE_OPTION, kv[0], kv[1]);
+            g_strfreev(kv);
+          }
+          break;
+      case 'c':
+          cmds = g_slist_append(cmds, optarg);
+          break;
+      case 'C':
+          postcmds = g_slist_append(postcmds, optarg);
+          break;
+      case 'v':
+          mock_verbose = TRUE;
+          break;
+      default:
+          usage(argv[0]);
+    }
+  }
+  if (optind + 1 >= argc)
+    usage(argv[0]);
+
+  map = g_mapped_file_new(argv[optind], FALSE, &err);
+  if (!map) {
+    fprintf(stderr, "%s\n", err->message);
+    return 1;
+  }
+  data = (const guchar *)g_mapped_file_get_contents(map);
+  end = data + g_mapped_file_get_length(map);
+  if (end - data < HOOKTRACE_HEADER_SIZE ||
+      memcmp(data, HOOKTRACE_MAGIC, 4) ||
+      hooktrace_get_u16(data+4) != HOOKTRACE_VERSION) {
+    fprintf(stderr, "%s: not a hook trace (version %d)\n", argv[optind],
+            HOOKTRACE_VERSION);
+    return 1;
+  }
+
+  mock_roster_fixture();
+  for (i = optind + 1; i < argc; i++) {
+    gchar *name;
+    module_info_t *info = mock_module_load(argv[i], &name);
+    if (!info)
+      return 1;
+    printf("Loaded module %s (%s)\n", name, info->version);
+  }
+  for (li = cmds; li; li = g_slist_next(li))
+    process_command(li->data, TRUE);
+  g_slist_free(cmds);
+  mock_connect();
+
+  stats = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+  mock_counters_reset();
+  t_start = now_ns();
+
+  for (p = data + HOOKTRACE_HEADER_SIZE; end - p >= 4; ) {
+    gsize size = hooktrace_get_u32(p);
+    guint64 t_rec;
+    const gchar *hookname;
+    mock_alloc_stats_t a0, a1;
+    replay_stats_t *st;
+    gdouble t0, t1;
+    guint ret;
+
+    if ((gsize)(end - p - 4) < size) {
+      fprintf(stderr, "Truncated record at offset %ld\n", (long)(p - data));
+      break;
+    }
+    if (scratch_size < size + 1) {
+      scratch_size = size + 1;
+      scratch = g_realloc(scratch, scratch_size);
+    }
+    hookname = decode_record(p + 4, size, args, scratch);
+    if (!hookname) {
+      fprintf(stderr, "Invalid record at offset %ld\n", (long)(p - data));
+      break;
+    }
+    t_rec = hooktrace_get_u64(p + 4);
+    p += 4 + size;
+
+    // Keep the recorded pace, and let the modules' timers run
+    if (!t0_rec)
+      t0_rec = t_rec;
+    if (!fast) {
+      gdouble target = t_start + (t_rec - t0_rec) * 1e3 / factor;
+      gdouble now = now_ns();
+      if (target > now)
+        g_usleep((target - now) / 1e3);
+    }
+    if (!fast || !(nevents % 1024))
+      while (g_main_context_iteration(NULL, FALSE))
+        ;
+
+    st = get_stats(hookname);
+    mock_alloc_get(&a0);
+    mock_alloc_count(TRUE);
+    t0 = now_ns();
+    ret = hk_run_handlers(hookname, args);
+    t1 = now_ns();
+    mock_alloc_count(FALSE);
+    mock_alloc_get(&a1);
+
+    st->events++;
+    if (ret == HOOK_HANDLER_RESULT_NO_MORE_HANDLER_DROP_DATA)
+      st->dropped++;
+    st->ns += t1 - t0;
+    st->allocs += a1.allocs - a0.allocs;
+    dispatch_ns += t1 - t0;
+    nevents++;
+  }
+  elapsed = now_ns() - t_start;
+
+  printf("\n%-26s %10s %10s %10s %10s\n", "hook", "events", "dropped",
+         "ns/event", "allocs/ev");
+  g_hash_table_foreach(stats, print_stats, NULL);
+  printf("\n%" G_GUINT64_FORMAT " events replayed in %.3f s "
+         "(%.0f events/s, %.1f%% of the time in handlers)\n",
+         nevents, elapsed / 1e9, nevents ? nevents * 1e9 / elapsed : 0.,
+         elapsed > 0 ? 100. * dispatch_ns / elapsed : 0.);
+  printf("Host: %" G_GUINT64_FORMAT " log lines, %" G_GUINT64_FORMAT
+         " s10n replies, %" G_GUINT64_FORMAT " stanzas, %" G_GUINT64_FORMAT
+         " status bar updates, %" G_GUINT64_FORMAT " roster redraws\n",
+         mock_counters.log_lines, mock_counters.s10n_sent,
+         mock_counters.stanzas_sent, mock_counters.status_updates,
+         mock_counters.roster_redraws);
+
+  for (li = postcmds; li; li = g_slist_next(li))
+    process_command(li->data, TRUE);
+  g_slist_free(postcmds);
+
+  mock_module_unload_all();
+  g_hash_table_destroy(stats);
+  g_free(scratch);
+  g_mapped_file_unref(map);
+  return 0;
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -0,0 +1,144 @@
+/*
+ *  Module "modmem"     -- Per-module memory accounting
+ *
+ *  The modules built with --enable-modmem allocate their data through
+ *  the accounting macros of modmem.h; this module keeps the list of
+ *  their accounts and reports them.
+ *
+ *  /modmem [show]      Display live and peak bytes, allocation counts
+ *  /modmem reset       Reset the peaks to the current values
+ *
+ *  When a module is unloaded with memory still allocated, the leak is
+ *  logged.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/logprint.h>
+
+#define MODMEM_MODULE
+#include "common/inittime.h"
+#include "modmem.h"
+
+static void modmem_init(void);
+static void modmem_uninit(void);
+
+MODULE_TIMED_INIT(modmem_init)
+
+/* Module description */
+module_info_t info_modmem = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Per-module memory accounting\n"
+                          " Provides the command /modmem",
+        .requires       = NULL,
+        .init           = modmem_init_timed,
+        .uninit         = modmem_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer modmem_cmdid;
+#endif
+
+static GSList *accounts;
+
+void modmem_register(modmem_acct_t *acct)
+{
+  accounts = g_slist_append(accounts, acct);
+}
+
+void modmem_unregister(modmem_acct_t *acct)
+{
+  accounts = g_slist_remove(accounts, acct);
+  if (acct->allocs != acct->frees)
+    scr_log_print(LPRINT_LOGNORM, "modmem: module %s unloaded with %"
+                  G_GSIZE_FORMAT " bytes in %" G_GUINT64_FORMAT
+                  " blocks still allocated", acct->name, acct->live,
+                  acct->allocs - acct->frees);
+}
+
+static void modmem_show(void)
+{
+  GSList *li;
+  gsize live = 0, peak = 0;
+
+  if (!accounts) {
+    scr_log_print(LPRINT_NORMAL, "modmem: no module to report "
+                  "(modules must be built with --enable-modmem).");
+    return;
+  }
+
+  scr_log_print(LPRINT_NORMAL, "modmem: live bytes (blocks), peak bytes, "
+                "allocations, frees");
+  for (li = accounts; li; li = g_slist_next(li)) {
+    modmem_acct_t *acct = li->data;
+    scr_log_print(LPRINT_NORMAL, " %-16s %10" G_GSIZE_FORMAT " (%"
+                  G_GUINT64_FORMAT "), %" G_GSIZE_FORMAT ", %"
+                  G_GUINT64_FORMAT ", %" G_GUINT64_FORMAT, acct->name,
+                  acct->live, acct->allocs - acct->frees, acct->peak,
+                  acct->allocs, acct->frees);
+    live += acct->live;
+    peak += acct->peak;
+  }
+  scr_log_print(LPRINT_NORMAL, " %-16s %10" G_GSIZE_FORMAT ", peaks %"
+                G_GSIZE_FORMAT, "total", live, peak);
+}
+
+static void do_modmem(char *args)
+{
+  if (!*args || !strcmp(args, "show")) {
+    modmem_show();
+  } else if (!strcmp(args, "reset")) {
+    GSList *li;
+    for (li = accounts; li; li = g_slist_next(li)) {
+      modmem_acct_t *acct = li->data;
+      acct->peak = acct->live;
+    }
+  } else {
+    scr_log_print(LPRINT_NORMAL, "Usage: /modmem [show|reset]");
+  }
+}
+
+/* Initialization */
+static void modmem_init(void)
+{
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  modmem_cmdid = cmd_add("modmem", "Module memory usage", 0, 0,
+                         do_modmem, NULL);
+#else
+  cmd_add("modmem", "Module memory usage", 0, 0, do_modmem, NULL);
+#endif
+}
+
+/* Uninitialization */
+static void modmem_uninit(void)
+{
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(modmem_cmdid);
+#else
+  cmd_del("modmem");
+#endif
+  g_slist_free(accounts);
+  accounts = NULL;
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -0,0 +1,126 @@
+/*
+ *  modmem.h        -- Per-module memory accounting
+ *
+ *  A module declares its account with MODMEM_DEFINE(), registers it
+ *  with MODMEM_REGISTER() at initialization and unregisters it with
+ *  MODMEM_UNREGISTER() when it is unloaded (the modmem module then
+ *  reports what is still allocated).  The module allocates its own data
+ *  with MM_NEW(), MM_NEW0() and MM_STRDUP(), and frees it with MM_FREE();
+ *  these blocks carry a small header with their size.  Objects the
+ *  module cannot allocate itself (e.g. a GRegex) are counted with
+ *  MM_TRACK() and MM_UNTRACK(), with an estimated size.
+ *
+ *  When the modules are not built with --enable-modmem (MODULES_MODMEM),
+ *  the macros are the plain GLib functions.  Modules using them must set
+ *  ".requires = MODULE_REQUIRES" in their module description (see
+ *  common/requires.h).
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MODMEM_H__
+#define __MODMEM_H__ 1
+
+#include <string.h>
+#include <glib.h>
+
+typedef struct {
+  const gchar *name;
+  gsize        live;        // Bytes currently allocated
+  gsize        peak;
+  guint64      allocs;
+  guint64      frees;
+} modmem_acct_t;
+
+void modmem_register(modmem_acct_t *acct);
+void modmem_unregister(modmem_acct_t *acct);
+
+// Keep the blocks aligned for any type
+#define MODMEM_HEADER   (2 * sizeof(gsize))
+
+static inline void modmem_count(modmem_acct_t *acct, gsize size)
+{
+  acct->allocs++;
+  acct->live += size;
+  if (acct->live > acct->peak)
+    acct->peak = acct->live;
+}
+
+static inline void modmem_uncount(modmem_acct_t *acct, gsize size)
+{
+  acct->frees++;
+  acct->live -= size;
+}
+
+static inline gpointer modmem_alloc(modmem_acct_t *acct, gsize size,
+                                    gboolean zero)
+{
+  gsize *block = zero ? g_malloc0(MODMEM_HEADER + size)
+                      : g_malloc(MODMEM_HEADER + size);
+
+  *block = size;
+  modmem_count(acct, size);
+  return (gchar *)block + MODMEM_HEADER;
+}
+
+static inline gchar *modmem_strdup(modmem_acct_t *acct, const gchar *str)
+{
+  gsize len;
+  gchar *copy;
+
+  if (!str)
+    return NULL;
+  len = strlen(str) + 1;
+  copy = modmem_alloc(acct, len, FALSE);
+  memcpy(copy, str, len);
+  return copy;
+}
+
+static inline void modmem_free(modmem_acct_t *acct, gpointer mem)
+{
+  gsize *block;
+
+  if (!mem)
+    return;
+  block = (gsize *)((gchar *)mem - MODMEM_HEADER);
+  modmem_uncount(acct, *block);
+  g_free(block);
+}
+
+#if defined MODULES_MODMEM || defined MODMEM_MODULE
+# define MODMEM_DEFINE(name) \
+         static modmem_acct_t modmem_acct = { name, 0, 0, 0, 0 }
+# define MODMEM_REGISTER()        modmem_register(&modmem_acct)
+# define MODMEM_UNREGISTER()      modmem_unregister(&modmem_acct)
+# define MM_NEW(type, n) \
+         ((type *)modmem_alloc(&modmem_acct, sizeof(type) * (n), FALSE))
+# define MM_NEW0(type, n) \
+         ((type *)modmem_alloc(&modmem_acct, sizeof(type) * (n), TRUE))
+# define MM_STRDUP(str)           modmem_strdup(&modmem_acct, str)
+# define MM_FREE(mem)             modmem_free(&modmem_acct, mem)
+# define MM_TRACK(size)           modmem_count(&modmem_acct, size)
+# define MM_UNTRACK(size)         modmem_uncount(&modmem_acct, size)
+#else
+# define MODMEM_DEFINE(name)      typedef int modmem_unused_t
+# define MODMEM_REGISTER()        ((void)0)
+# define MODMEM_UNREGISTER()      ((void)0)
+# define MM_NEW(type, n)          g_new(type, n)
+# define MM_NEW0(type, n)         g_new0(type, n)
+# define MM_STRDUP(str)           g_strdup(str)
+# define MM_FREE(mem)             g_free(mem)
+# define MM_TRACK(size)           ((void)0)
+# define MM_UNTRACK(size)         ((void)0)
+#endif
+
+#endif /* __MODMEM_H__ */
@@ -0,0 +1,509 @@
+/*
+ *  Module "mucdampen"  -- Dampen MUC presence floods
+ *
+ *  Every occupant presence in a room updates the roster and triggers a
+ *  roster rebuild and redraw; a netsplit in a large room sends hundreds
+ *  of them in a row.  When a room sends more than mucdampen_threshold
+ *  presences within mucdampen_delay milliseconds, this module holds the
+ *  following ones: only the last presence of each occupant is kept, and
+ *  the batch is applied to the roster at the end of the window, with a
+ *  single roster rebuild.
+ *
+ *  The held presences do not reach mcabber (nor the Loudmouth handlers
+ *  of lower priority): the module applies the status, message, priority,
+ *  role, affiliation, real JID, delay stamp and entity capabilities
+ *  itself.  The per-occupant join and leave lines of the room buffer
+ *  are replaced by one summary line per window.
+ *
+ *  Presences with status codes (own presence, nick changes, kicks...)
+ *  are never held; the pending presences of their room are applied
+ *  first, so that the order is kept.  Neither are the presences with
+ *  capabilities mcabber does not know yet, so that it can ask for them.
+ *
+ *  Options:
+ *  - mucdampen_threshold: integer (default: 20)
+ *    Number of presences per window above which a room is dampened.
+ *  - mucdampen_delay: integer (default: 500)
+ *    Window length in milliseconds, i.e. the maximum latency added to
+ *    a presence update.  Both options are read when the module is
+ *    loaded.
+ *
+ *  /mucdampen          Display the statistics
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/caps.h>
+#include <mcabber/commands.h>
+#include <mcabber/hbuf.h>
+#include <mcabber/hooks.h>
+#include <mcabber/logprint.h>
+#include <mcabber/roster.h>
+#include <mcabber/screen.h>
+#include <mcabber/settings.h>
+#include <mcabber/xmpp.h>
+#include <mcabber/xmpp_defines.h>
+#include <mcabber/xmpp_helper.h>
+
+#include "common/inittime.h"
+#include "common/lmhandler.h"
+#include "common/requires.h"
+#include "hookstats/hookstats.h"
+
+static void mucdampen_init(void);
+static void mucdampen_uninit(void);
+
+MODULE_TIMED_INIT(mucdampen_init)
+
+/* Module description */
+module_info_t info_mucdampen = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Dampen MUC presence floods\n"
+                          " Provides the command /mucdampen",
+        .requires       = MODULE_REQUIRES,
+        .init           = mucdampen_init_timed,
+        .uninit         = mucdampen_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer mucdampen_cmdid;
+#endif
+
+#define DEFAULT_THRESHOLD   20
+#define DEFAULT_DELAY       500     // ms
+
+// Last held presence of an occupant
+typedef struct {
+  enum imstatus      status;
+  gchar             *msg;
+  gchar              prio;
+  enum imrole        role;
+  enum imaffiliation affil;
+  gchar             *realjid;
+  gchar             *caps;      // Entity capabilities hash (ver)
+  time_t             timestamp;
+} held_presence_t;
+
+typedef struct {
+  gchar      *jid;
+  gint64      window_start;     // us
+  guint       count;            // Presences in the current window
+  gboolean    dampened;
+  GHashTable *held;             // nick -> held_presence_t
+  guint64     held_total;       // During the current flood
+} room_t;
+
+// Runs before mcabber's presence handler
+static lmhandler_t presence_handler =
+  LMHANDLER(LM_MESSAGE_TYPE_PRESENCE, LM_HANDLER_PRIORITY_FIRST);
+static guint pre_disconnect_hid, post_connect_hid;
+static GHashTable *rooms;       // jid -> room_t
+static GHashTable *known;       // Bare jid -> is a room, for this connection
+static guint flush_srcno;
+static guint threshold, delay;
+
+static guint64 stat_floods, stat_held, stat_applied, stat_rebuilds;
+
+static void held_free(held_presence_t *p)
+{
+  g_free(p->msg);
+  g_free(p->realjid);
+  g_free(p->caps);
+  g_free(p);
+}
+
+static void room_free(room_t *room)
+{
+  g_hash_table_destroy(room->held);
+  g_free(room->jid);
+  g_free(room);
+}
+
+static room_t *room_get(const gchar *jid)
+{
+  room_t *room = g_hash_table_lookup(rooms, jid);
+
+  if (!room) {
+    room = g_new0(room_t, 1);
+    room->jid  = g_strdup(jid);
+    room->held = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                       (GDestroyNotify)held_free);
+    g_hash_table_insert(rooms, room->jid, room);
+  }
+  return room;
+}
+
+// Apply the held presences of a room; returns TRUE if the roster changed
+static gboolean room_apply(room_t *room)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  guint joins = 0, leaves = 0;
+  GSList *sl;
+
+  if (!g_hash_table_size(room->held))
+    return FALSE;
+
+  sl = roster_find(room->jid, jidsearch, ROSTER_TYPE_ROOM);
+  g_hash_table_iter_init(&iter, room->held);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    held_presence_t *p = value;
+    roster_setstatus(room->jid, key, p->prio, p->status, p->msg,
+                     p->timestamp, p->role, p->affil, p->realjid);
+    if (p->caps && sl)
+      buddy_resource_setcaps(sl->data, key, p->caps);
+    if (p->status == offline)
+      leaves++;
+    else
+      joins++;
+    stat_applied++;
+  }
+  g_hash_table_remove_all(room->held);
+
+  if (joins || leaves) {
+    gchar *info = g_strdup_printf("Presence flood: %u occupant(s) joined or "
+                                  "changed status, %u left", joins, leaves);
+    scr_WriteIncomingMessage(room->jid, info, 0,
+                             HBB_PREFIX_INFO|HBB_PREFIX_NOFLAG, 0);
+    g_free(info);
+  }
+  return TRUE;
+}
+
+static void roster_rebuild(void)
+{
+  buddylist_build();
+  scr_update_roster();
+  stat_rebuilds++;
+}
+
+static gboolean flush_cb(gpointer data)
+{
+  GHashTableIter iter;
+  gpointer value;
+  gboolean changed = FALSE, dampening = FALSE;
+  gint64 now = g_get_monotonic_time();
+
+  g_hash_table_iter_init(&iter, rooms);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    room_t *room = value;
+
+    if (room_apply(room))
+      changed = TRUE;
+    // The flood is over once a whole window is below the threshold
+    if (now - room->window_start >= delay * 1000) {
+      if (room->dampened && room->count <= threshold) {
+        room->dampened = FALSE;
+        scr_log_print(LPRINT_LOGNORM, "mucdampen: end of the presence flood "
+                      "in %s (%" G_GUINT64_FORMAT " presences coalesced).",
+                      room->jid, room->held_total);
+      }
+      room->window_start = now;
+      room->count = 0;
+    }
+    if (room->dampened)
+      dampening = TRUE;
+    else
+      g_hash_table_iter_remove(&iter);
+  }
+  if (changed)
+    roster_rebuild();
+
+  if (dampening)
+    return TRUE;
+  flush_srcno = 0;
+  return FALSE;
+}
+
+static enum imstatus presence_status(LmMessage *m)
+{
+  LmMessageNode *show;
+  const gchar *s;
+
+  if (lm_message_get_sub_type(m) == LM_MESSAGE_SUB_TYPE_UNAVAILABLE)
+    return offline;
+  show = lm_message_node_get_child(m->node, "show");
+  s = show ? lm_message_node_get_value(show) : NULL;
+  if (!s)
+    return available;
+  if (!strcmp(s, "away"))
+    return away;
+  if (!strcmp(s, "xa"))
+    return notavail;
+  if (!strcmp(s, "dnd"))
+    return dontdisturb;
+  if (!strcmp(s, "chat"))
+    return freeforchat;
+  return available;
+}
+
+static held_presence_t *presence_parse(LmMessage *m, LmMessageNode *x)
+{
+  held_presence_t *p = g_new0(held_presence_t, 1);
+  LmMessageNode *node, *item;
+  const gchar *s;
+
+  p->status = presence_status(m);
+  // As mcabber: the delay stamp, if any, or the reception time
+  p->timestamp = lm_message_node_get_timestamp(m->node);
+  if (!p->timestamp)
+    p->timestamp = time(NULL);
+  if ((node = lm_message_node_get_child(m->node, "status")) != NULL)
+    p->msg = g_strdup(lm_message_node_get_value(node));
+  if ((node = lm_message_node_get_child(m->node, "priority")) != NULL &&
+      (s = lm_message_node_get_value(node)) != NULL)
+    p->prio = (gchar)atoi(s);
+
+  item = x ? lm_message_node_get_child(x, "item") : NULL;
+  if (item) {
+    s = lm_message_node_get_attribute(item, "role");
+    if (!g_strcmp0(s, "moderator"))
+      p->role = role_moderator;
+    else if (!g_strcmp0(s, "participant"))
+      p->role = role_participant;
+    else if (!g_strcmp0(s, "visitor"))
+      p->role = role_visitor;
+    s = lm_message_node_get_attribute(item, "affiliation");
+    if (!g_strcmp0(s, "owner"))
+      p->affil = affil_owner;
+    else if (!g_strcmp0(s, "admin"))
+      p->affil = affil_admin;
+    else if (!g_strcmp0(s, "member"))
+      p->affil = affil_member;
+    else if (!g_strcmp0(s, "outcast"))
+      p->affil = affil_outcast;
+    p->realjid = g_strdup(lm_message_node_get_attribute(item, "jid"));
+  }
+  return p;
+}
+
+// Whether a bare jid is a room; the roster is only searched for the first
+// presence from that jid, and our own presence in a room (status code
+// 110) refreshes the answer when we join or leave
+static gboolean is_room(const gchar *jid)
+{
+  gpointer value;
+
+  if (!g_hash_table_lookup_extended(known, jid, NULL, &value)) {
+    value = GINT_TO_POINTER(roster_find(jid, jidsearch, ROSTER_TYPE_ROOM)
+                            != NULL);
+    g_hash_table_insert(known, g_strdup(jid), value);
+  }
+  return GPOINTER_TO_INT(value);
+}
+
+static gboolean has_status_code(LmMessageNode *x, const gchar *code)
+{
+  LmMessageNode *node;
+
+  for (node = x->children; node; node = node->next)
+    if (!strcmp(node->name, "status") &&
+        !g_strcmp0(lm_message_node_get_attribute(node, "code"), code))
+      return TRUE;
+  return FALSE;
+}
+
+static LmMessageNode *muc_user_node(LmMessage *m)
+{
+  LmMessageNode *x;
+
+  for (x = m->node->children; x; x = x->next)
+    if (!strcmp(x->name, "x") &&
+        !g_strcmp0(lm_message_node_get_attribute(x, "xmlns"), NS_MUC_USER))
+      return x;
+  return NULL;
+}
+
+static LmHandlerResult presence_cb(LmMessageHandler *handler,
+                                   LmConnection *connection,
+                                   LmMessage *m, gpointer user_data)
+{
+  const gchar *from = lm_message_node_get_attribute(m->node, "from");
+  const gchar *nick;
+  LmMessageSubType subtype = lm_message_get_sub_type(m);
+  LmMessageNode *x, *caps;
+  const gchar *ver;
+  held_presence_t *held;
+  room_t *room;
+  gchar *roomjid;
+  gint64 now;
+
+  if (!from || !(nick = strchr(from, JID_RESOURCE_SEPARATOR)) || !*++nick ||
+      (subtype != LM_MESSAGE_SUB_TYPE_AVAILABLE &&
+       subtype != LM_MESSAGE_SUB_TYPE_NOT_SET &&
+       subtype != LM_MESSAGE_SUB_TYPE_UNAVAILABLE))
+    return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+
+  roomjid = g_strndup(from, nick - 1 - from);
+  x = muc_user_node(m);
+  // Our own presence: we join or leave the room
+  if (x && has_status_code(x, "110")) {
+    if (subtype == LM_MESSAGE_SUB_TYPE_UNAVAILABLE)
+      g_hash_table_remove(known, roomjid);
+    else
+      g_hash_table_replace(known, g_strdup(roomjid), GINT_TO_POINTER(TRUE));
+  }
+  if (!is_room(roomjid)) {
+    g_free(roomjid);
+    return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+  }
+  room = room_get(roomjid);
+  g_free(roomjid);
+
+  // Presences with status codes are handled by mcabber right away
+  if (x && lm_message_node_get_child(x, "status")) {
+    if (room_apply(room))
+      roster_rebuild();
+    return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+  }
+
+  now = g_get_monotonic_time();
+  if (now - room->window_start >= delay * 1000) {
+    room->window_start = now;
+    room->count = 0;
+  }
+  room->count++;
+
+  if (!room->dampened) {
+    if (room->count <= threshold)
+      return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+    room->dampened = TRUE;
+    room->held_total = 0;
+    stat_floods++;
+    scr_log_print(LPRINT_LOGNORM, "mucdampen: presence flood in %s, "
+                  "dampening.", room->jid);
+  }
+
+  // Unknown capabilities are left to mcabber, which asks for them; a
+  // presence held before this one for the same occupant would be older
+  caps = lm_message_node_find_xmlns(m->node, NS_CAPS);
+  if (caps && subtype != LM_MESSAGE_SUB_TYPE_UNAVAILABLE &&
+      (ver = lm_message_node_get_attribute(caps, "ver")) != NULL &&
+      !caps_has_hash(ver, from)) {
+    g_hash_table_remove(room->held, nick);
+    return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+  }
+
+  held = presence_parse(m, x);
+  if (caps && held->status != offline)
+    held->caps = g_strdup(lm_message_node_get_attribute(caps, "ver"));
+  g_hash_table_replace(room->held, g_strdup(nick), held);
+  room->held_total++;
+  stat_held++;
+  if (!flush_srcno)
+    flush_srcno = g_timeout_add(delay, flush_cb, NULL);
+  return LM_HANDLER_RESULT_REMOVE_MESSAGE;
+}
+
+// The held presences are stale once the connection is closed
+static guint pre_disconnect_hh(const gchar *hookname, hk_arg_t *args,
+                               gpointer userdata)
+{
+  g_hash_table_remove_all(rooms);
+  g_hash_table_remove_all(known);
+  lmhandler_detach(&presence_handler);
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static guint post_connect_hh(const gchar *hookname, hk_arg_t *args,
+                             gpointer userdata)
+{
+  lmhandler_attach(&presence_handler);
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static void do_mucdampen(char *args)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  scr_log_print(LPRINT_NORMAL, "mucdampen: threshold %u presences per %u ms; "
+                "%" G_GUINT64_FORMAT " flood(s), %" G_GUINT64_FORMAT
+                " presences held, %" G_GUINT64_FORMAT " applied, %"
+                G_GUINT64_FORMAT " roster rebuilds.", threshold, delay,
+                stat_floods, stat_held, stat_applied, stat_rebuilds);
+  g_hash_table_iter_init(&iter, rooms);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    room_t *room = value;
+    if (room->dampened)
+      scr_log_print(LPRINT_NORMAL, " Dampening %s (%u pending)", room->jid,
+                    g_hash_table_size(room->held));
+  }
+}
+
+/* Initialization */
+static void mucdampen_init(void)
+{
+  threshold = settings_opt_get_int("mucdampen_threshold");
+  if (!threshold)
+    threshold = DEFAULT_THRESHOLD;
+  delay = settings_opt_get_int("mucdampen_delay");
+  if (!delay)
+    delay = DEFAULT_DELAY;
+
+  rooms = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                (GDestroyNotify)room_free);
+  known = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  mucdampen_cmdid = cmd_add("mucdampen", "MUC presence flood dampening", 0, 0,
+                            do_mucdampen, NULL);
+#else
+  cmd_add("mucdampen", "MUC presence flood dampening", 0, 0, do_mucdampen,
+          NULL);
+#endif
+
+  /* On the current connection, if any, and the next ones */
+  lmhandler_new(&presence_handler, presence_cb, NULL);
+  lmhandler_attach(&presence_handler);
+  pre_disconnect_hid = hk_add_handler(pre_disconnect_hh, HOOK_PRE_DISCONNECT,
+                                      G_PRIORITY_DEFAULT_IDLE, NULL);
+  post_connect_hid = hk_add_handler(post_connect_hh, HOOK_POST_CONNECT,
+                                    G_PRIORITY_DEFAULT_IDLE, NULL);
+}
+
+/* Uninitialization */
+static void mucdampen_uninit(void)
+{
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(mucdampen_cmdid);
+#else
+  cmd_del("mucdampen");
+#endif
+
+  hk_del_handler(HOOK_PRE_DISCONNECT, pre_disconnect_hid);
+  hk_del_handler(HOOK_POST_CONNECT, post_connect_hid);
+  lmhandler_free(&presence_handler);
+
+  // Do not lose the held presences
+  if (flush_srcno) {
+    g_source_remove(flush_srcno);
+    flush_srcno = 0;
+    flush_cb(NULL);
+  }
+  g_hash_table_destroy(rooms);
+  g_hash_table_destroy(known);
+  rooms = known = NULL;
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -0,0 +1,529 @@
+/*
+ *  Module "notifier"   -- Notifications through a persistent helper
+ *
+ *  Sends the private messages and the room highlights to a helper
+ *  program (desktop notifications, pager...) started once and fed
+ *  through its standard input, instead of spawning a command for each
+ *  event.  The events are sent in batches, one line each:
+ *
+ *    TYPE <tab> COUNT <tab> JID <tab> TEXT
+ *
+ *  TYPE is MSG (private message) or HIGHLIGHT (room message for us);
+ *  COUNT is the number of events of this type from this JID merged into
+ *  the line, TEXT the last one ("nick: message" in rooms), without tabs
+ *  and newlines.  "DROPPED <tab> N" reports events lost since the last
+ *  batch.  The helper must exit when its standard input is closed.
+ *
+ *  The helper is started at the first event and restarted when it exits,
+ *  after a delay doubling up to a minute while it keeps failing.  While it
+ *  is down or does not read fast enough, the events wait and are merged;
+ *  beyond notifier_max_pending distinct events, the new ones are dropped.
+ *
+ *  Options:
+ *  - notifier_command: string
+ *    Helper command line, e.g. "~/bin/notify-helper --urgent".
+ *  - notifier_delay: integer (default: 100)
+ *    Milliseconds during which the events are collected into a batch.
+ *  - notifier_max_pending: integer (default: 64)
+ *  - notifier_text_max: integer (default: 200)
+ *    Bytes of message text sent to the helper.
+ *
+ *  /notifier           Display the statistics
+ *  /notifier restart   Restart the helper
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+#include <mcabber/logprint.h>
+
+#include "common/hkargs.h"
+#include "common/inittime.h"
+#include "common/optcache.h"
+#include "common/requires.h"
+#include "hookstats/hookstats.h"
+
+static void notifier_init(void);
+static void notifier_uninit(void);
+
+MODULE_TIMED_INIT(notifier_init)
+
+/* Module description */
+module_info_t info_notifier = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Notifications through a persistent helper\n"
+                          " Provides the command /notifier",
+        .requires       = MODULE_REQUIRES,
+        .init           = notifier_init_timed,
+        .uninit         = notifier_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer notifier_cmdid;
+#endif
+
+#define RETRY_MIN     1     // Seconds before restarting a failed helper
+#define RETRY_MAX     60    // A helper running that long is fine
+
+static optcache_t opt_command     = OPTCACHE_PATH("notifier_command", NULL);
+static optcache_t opt_delay       = OPTCACHE_INT("notifier_delay", 100);
+static optcache_t opt_max_pending = OPTCACHE_INT("notifier_max_pending", 64);
+static optcache_t opt_text_max    = OPTCACHE_INT("notifier_text_max", 200);
+
+enum { EV_MSG, EV_HIGHLIGHT, EV_TYPES };
+
+static const gchar * const event_names[EV_TYPES] = { "MSG", "HIGHLIGHT" };
+
+// Events waiting for the next batch, merged by type and JID
+typedef struct {
+  guint    type;
+  gchar   *jid;
+  GString *text;      // Last one
+  guint    count;
+} event_t;
+
+static GQueue      pending = G_QUEUE_INIT;
+static GHashTable *pending_hash[EV_TYPES];   // By JID
+static guint       dropped;         // Events dropped since the last batch
+
+// Helper process (our end of its standard input)
+static gint        helper_fd = -1;
+static GIOChannel *helper_chan;
+static guint       helper_in_srcno, helper_out_srcno;
+static gint64      helper_started;
+static gint64      retry_at;
+static guint       retry_delay = RETRY_MIN;
+static GString    *outbuf;          // Batch not entirely written yet
+static guint       batch_srcno;
+
+static guint       message_hid;
+
+static struct {
+  guint events, merged, dropped, lines, batches, starts, failures;
+} stats;
+
+static void batch_schedule(guint delay);
+
+/* Helper process */
+
+// Child side, before exec: the socket becomes the standard input
+static void helper_setup(gpointer data)
+{
+  dup2(GPOINTER_TO_INT(data), 0);
+}
+
+static void helper_close(void)
+{
+  if (helper_in_srcno)
+    g_source_remove(helper_in_srcno);
+  if (helper_out_srcno)
+    g_source_remove(helper_out_srcno);
+  helper_in_srcno = helper_out_srcno = 0;
+  if (helper_chan)
+    g_io_channel_unref(helper_chan);
+  helper_chan = NULL;
+  if (helper_fd >= 0)
+    close(helper_fd);
+  helper_fd = -1;
+}
+
+// Delay the next start, longer each time while the helper keeps failing
+static void retry_later(const gchar *reason, gboolean was_running)
+{
+  gint64 now = g_get_monotonic_time();
+
+  stats.failures++;
+  if (was_running && now - helper_started >= RETRY_MAX * G_USEC_PER_SEC)
+    retry_delay = RETRY_MIN;
+  retry_at = now + retry_delay * G_USEC_PER_SEC;
+  scr_log_print(LPRINT_LOGNORM, "notifier: %s, restart in %us.",
+                reason, retry_delay);
+  retry_delay = MIN(retry_delay * 2, RETRY_MAX);
+}
+
+// The helper has exited or cannot be written to: the lines not written
+// are lost, the pending events wait for the next helper.
+static void helper_fail(const gchar *reason)
+{
+  const gchar *p;
+
+  for (p = outbuf->str; (p = strchr(p, '\n')); p++)
+    stats.dropped++;
+  g_string_truncate(outbuf, 0);
+  helper_close();
+  retry_later(reason, TRUE);
+  if (pending.length || dropped)
+    batch_schedule(0);
+}
+
+static gboolean helper_in_cb(GIOChannel *source, GIOCondition condition,
+                             gpointer data)
+{
+  gchar buf[256];
+  gssize n = 0;
+
+  // Whatever the helper writes back is ignored
+  if (condition & G_IO_IN)
+    n = read(helper_fd, buf, sizeof buf);
+  if (n > 0 || (n < 0 && errno == EAGAIN))
+    return TRUE;
+  helper_in_srcno = 0;
+  helper_fail("helper exited");
+  return FALSE;
+}
+
+static gboolean helper_start(void)
+{
+  GError *err = NULL;
+  const gchar *command = optcache_str(&opt_command);
+  gchar **argv;
+  gint sv[2];
+  gboolean ret;
+
+  if (!command) {
+    scr_log_print(LPRINT_NORMAL, "Please set option 'notifier_command'.");
+    retry_at = g_get_monotonic_time() + RETRY_MAX * G_USEC_PER_SEC;
+    return FALSE;
+  }
+  if (!g_shell_parse_argv(command, NULL, &argv, &err)) {
+    scr_log_print(LPRINT_NORMAL, "notifier: %s", err->message);
+    g_error_free(err);
+    retry_at = g_get_monotonic_time() + RETRY_MAX * G_USEC_PER_SEC;
+    return FALSE;
+  }
+  // A socket rather than a pipe: send() can be told not to raise SIGPIPE
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+    g_strfreev(argv);
+    retry_later(g_strerror(errno), FALSE);
+    return FALSE;
+  }
+
+  ret = g_spawn_async(NULL, argv, NULL,
+                      G_SPAWN_SEARCH_PATH |
+                        G_SPAWN_STDOUT_TO_DEV_NULL|G_SPAWN_STDERR_TO_DEV_NULL,
+                      helper_setup, GINT_TO_POINTER(sv[1]), NULL, &err);
+  g_strfreev(argv);
+  close(sv[1]);
+  if (!ret) {
+    close(sv[0]);
+    retry_later(err->message, FALSE);
+    g_error_free(err);
+    return FALSE;
+  }
+
+  helper_fd = sv[0];
+  helper_chan = g_io_channel_unix_new(helper_fd);
+  helper_in_srcno = g_io_add_watch(helper_chan,
+                                   G_IO_IN | G_IO_HUP | G_IO_ERR, helper_in_cb,
+                                   NULL);
+  helper_started = g_get_monotonic_time();
+  stats.starts++;
+  return TRUE;
+}
+
+/* Batches */
+
+static void helper_write(void);
+
+static gboolean helper_out_cb(GIOChannel *source, GIOCondition condition,
+                              gpointer data)
+{
+  helper_out_srcno = 0;
+  helper_write();
+  return FALSE;
+}
+
+// Write what can be written without blocking
+static void helper_write(void)
+{
+  gssize n = send(helper_fd, outbuf->str, outbuf->len,
+                  MSG_DONTWAIT | MSG_NOSIGNAL);
+
+  if (n < 0 && errno != EAGAIN && errno != EINTR) {
+    helper_fail("cannot write to the helper");
+    return;
+  }
+  if (n > 0)
+    g_string_erase(outbuf, 0, n);
+  if (outbuf->len) {
+    // The helper is busy: the events wait and are merged meanwhile
+    helper_out_srcno = g_io_add_watch(helper_chan, G_IO_OUT, helper_out_cb,
+                                      NULL);
+    return;
+  }
+  if (pending.length)
+    batch_schedule(optcache_int(&opt_delay));
+}
+
+static void batch_fill(void)
+{
+  event_t *ev;
+
+  if (dropped) {
+    g_string_append_printf(outbuf, "DROPPED\t%u\n", dropped);
+    stats.lines++;
+    dropped = 0;
+  }
+  while ((ev = g_queue_pop_head(&pending))) {
+    g_string_append_printf(outbuf, "%s\t%u\t%s\t%s\n",
+                           event_names[ev->type], ev->count, ev->jid,
+                           ev->text->str);
+    g_hash_table_remove(pending_hash[ev->type], ev->jid);
+    stats.lines++;
+  }
+  stats.batches++;
+}
+
+static gboolean batch_cb(gpointer data)
+{
+  gint64 now = g_get_monotonic_time();
+
+  batch_srcno = 0;
+  if (outbuf->len)
+    return FALSE;         // Waiting for the helper (helper_out_cb)
+  if (helper_fd < 0) {
+    if (now < retry_at) {
+      batch_schedule((retry_at - now) / 1000 + 1);
+      return FALSE;
+    }
+    if (!helper_start()) {
+      batch_schedule((retry_at - now) / 1000 + 1);
+      return FALSE;
+    }
+  }
+  batch_fill();
+  helper_write();
+  return FALSE;
+}
+
+static void batch_schedule(guint delay)
+{
+  if (batch_srcno)
+    return;
+  batch_srcno = g_timeout_add(delay, batch_cb, NULL);
+}
+
+/* Events */
+
+static void event_free(gpointer data)
+{
+  event_t *ev = data;
+
+  g_free(ev->jid);
+  g_string_free(ev->text, TRUE);
+  g_free(ev);
+}
+
+// Text of the event, without tabs and newlines, cut on a character
+static void event_text(GString *text, const gchar *nick, const gchar *msg)
+{
+  gint max = optcache_int(&opt_text_max);
+  gchar *p;
+
+  g_string_truncate(text, 0);
+  if (nick) {
+    g_string_append(text, nick);
+    g_string_append(text, ": ");
+  }
+  g_string_append(text, msg);
+  if (max >= 0 && text->len > (gsize)max) {
+    gsize len = max;
+    while (len && (text->str[len] & 0xc0) == 0x80)
+      len--;
+    g_string_truncate(text, len);
+  }
+  for (p = text->str; *p; p++)
+    if (*p == '\t' || *p == '\n' || *p == '\r')
+      *p = ' ';
+}
+
+static void event_add(guint type, const gchar *jid, const gchar *nick,
+                      const gchar *msg)
+{
+  event_t *ev = g_hash_table_lookup(pending_hash[type], jid);
+
+  stats.events++;
+  if (ev) {
+    // Merged, no allocation while the text fits
+    event_text(ev->text, nick, msg);
+    ev->count++;
+    stats.merged++;
+    return;
+  }
+  if (pending.length >= (guint)MAX(optcache_int(&opt_max_pending), 1)) {
+    dropped++;
+    stats.dropped++;
+    return;
+  }
+  ev = g_new(event_t, 1);
+  ev->type  = type;
+  ev->jid   = g_strdup(jid);
+  ev->text  = g_string_sized_new(64);
+  ev->count = 1;
+  event_text(ev->text, nick, msg);
+  g_queue_push_tail(&pending, ev);
+  g_hash_table_insert(pending_hash[type], ev->jid, ev);
+
+  if (!outbuf->len)
+    batch_schedule(optcache_int(&opt_delay));
+}
+
+static guint message_in_hh(const gchar *hookname, hk_arg_t *args,
+                           gpointer userdata)
+{
+  const gchar *jid, *msg;
+  gboolean muc;
+  hkargs_t a;
+
+  hkargs_parse(args, HKARG(HKARG_JID) | HKARG(HKARG_RESOURCE) |
+               HKARG(HKARG_MESSAGE) | HKARG(HKARG_GROUPCHAT) |
+               HKARG(HKARG_DELAYED) | HKARG(HKARG_ERROR) |
+               HKARG(HKARG_ATTENTION), 0, &a);
+  jid = hkargs_value(&a, HKARG_JID);
+  msg = hkargs_value(&a, HKARG_MESSAGE);
+  if (!jid || !msg)
+    return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+
+  // Neither history nor errors
+  if (hkargs_value(&a, HKARG_DELAYED) && *hkargs_value(&a, HKARG_DELAYED))
+    return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+  if (!g_strcmp0(hkargs_value(&a, HKARG_ERROR), "true"))
+    return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+
+  muc = !g_strcmp0(hkargs_value(&a, HKARG_GROUPCHAT), "true");
+  if (!muc)
+    event_add(EV_MSG, jid, NULL, msg);
+  else if (!g_strcmp0(hkargs_value(&a, HKARG_ATTENTION), "true"))
+    event_add(EV_HIGHLIGHT, jid, hkargs_value(&a, HKARG_RESOURCE), msg);
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+/* Command */
+
+static void command_changed(const optcache_t *opt)
+{
+  // The next batch starts the new helper
+  if (helper_fd >= 0) {
+    g_string_truncate(outbuf, 0);
+    helper_close();
+  }
+  retry_at = 0;
+  retry_delay = RETRY_MIN;
+}
+
+static void do_notifier(char *args)
+{
+  if (args && !strcmp(args, "restart")) {
+    command_changed(&opt_command);
+    if (pending.length)
+      batch_schedule(0);
+    scr_log_print(LPRINT_NORMAL, "notifier: the helper will be restarted "
+                  "at the next event.");
+    return;
+  }
+  if (args && *args) {
+    scr_log_print(LPRINT_NORMAL, "Usage: /notifier [restart]");
+    return;
+  }
+
+  if (helper_fd >= 0)
+    scr_log_print(LPRINT_NORMAL, "notifier: helper running for %"
+                  G_GINT64_FORMAT "s, started %u times, %u failures.",
+                  (g_get_monotonic_time() - helper_started) / G_USEC_PER_SEC,
+                  stats.starts, stats.failures);
+  else
+    scr_log_print(LPRINT_NORMAL, "notifier: helper not running, "
+                  "started %u times, %u failures.",
+                  stats.starts, stats.failures);
+  scr_log_print(LPRINT_NORMAL, "notifier: %u events, %u merged, %u dropped; "
+                "%u lines in %u batches; %u pending, %u bytes unwritten.",
+                stats.events, stats.merged, stats.dropped, stats.lines,
+                stats.batches, pending.length, (guint)outbuf->len);
+}
+
+/* Initialization */
+static void notifier_init(void)
+{
+  guint type;
+
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  notifier_cmdid = cmd_add("notifier", "Notification helper", 0, 0,
+                           do_notifier, NULL);
+#else
+  cmd_add("notifier", "Notification helper", 0, 0, do_notifier, NULL);
+#endif
+
+  optcache_bind(&opt_command, command_changed);
+  optcache_bind(&opt_delay, NULL);
+  optcache_bind(&opt_max_pending, NULL);
+  optcache_bind(&opt_text_max, NULL);
+
+  for (type = 0; type < EV_TYPES; type++)
+    pending_hash[type] = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                               event_free);
+  outbuf = g_string_sized_new(1024);
+  message_hid = hk_add_handler(message_in_hh, HOOK_POST_MESSAGE_IN,
+                               G_PRIORITY_DEFAULT_IDLE, NULL);
+}
+
+/* Uninitialization */
+static void notifier_uninit(void)
+{
+  guint type;
+
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(notifier_cmdid);
+#else
+  cmd_del("notifier");
+#endif
+
+  hk_del_handler(HOOK_POST_MESSAGE_IN, message_hid);
+  if (batch_srcno)
+    g_source_remove(batch_srcno);
+  batch_srcno = 0;
+
+  // Last try, without waiting; closing the socket stops the helper
+  if (helper_fd >= 0 && !outbuf->len && (pending.length || dropped))
+    batch_fill();
+  if (helper_fd >= 0 && outbuf->len)
+    send(helper_fd, outbuf->str, outbuf->len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  helper_close();
+
+  g_queue_clear(&pending);
+  for (type = 0; type < EV_TYPES; type++) {
+    g_hash_table_destroy(pending_hash[type]);
+    pending_hash[type] = NULL;
+  }
+  g_string_free(outbuf, TRUE);
+  outbuf = NULL;
+  dropped = 0;
+  retry_at = 0;
+  retry_delay = RETRY_MIN;
+  memset(&stats, 0, sizeof stats);
+  optcache_unbind_all();
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
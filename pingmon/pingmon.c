@@ -0,0 +1,418 @@
+/*
+ *  Module "pingmon"    -- Server round-trip time in the status bar
+ *
+ *  Sends XMPP pings (XEP-0199) to the server and displays the median
+ *  and 99th percentile of the round-trip times of the last pings in the
+ *  status bar ("info" option), e.g. "rtt 42/180ms"; "--" means that the
+ *  percentile is a ping which got no reply within pingmon_timeout.
+ *
+ *  While the round-trip times are steady, the interval between pings
+ *  doubles, up to pingmon_max_interval; it goes back to pingmon_interval
+ *  after a lost ping or a round-trip time over twice the median.
+ *
+ *  Options:
+ *  - pingmon_interval: integer (default: 30)
+ *    Seconds between pings, at first and when the link is unsteady.
+ *  - pingmon_max_interval: integer (default: 300)
+ *  - pingmon_timeout: integer (default: 20)
+ *    Seconds after which a ping is considered lost.
+ *
+ *  /pingmon            Display the statistics
+ *  /pingmon now        Send a ping now
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+#include <mcabber/logprint.h>
+#include <mcabber/screen.h>
+#include <mcabber/settings.h>
+#include <mcabber/xmpp.h>
+#include <mcabber/xmpp_defines.h>
+
+#include "common/inittime.h"
+#include "common/optcache.h"
+#include "common/requires.h"
+#include "hookstats/hookstats.h"
+#include "traffic/traffic.h"
+
+static void pingmon_init(void);
+static void pingmon_uninit(void);
+
+MODULE_TIMED_INIT(pingmon_init)
+
+/* Module description */
+module_info_t info_pingmon = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Server round-trip time in the status bar\n"
+                          " Provides the command /pingmon",
+        .requires       = MODULE_REQUIRES,
+        .init           = pingmon_init_timed,
+        .uninit         = pingmon_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer pingmon_cmdid;
+#endif
+
+// Round-trip times histogram: 4 buckets per power of 2 microseconds
+#define NBUCKETS    128
+#define LOST        NBUCKETS    // Pseudo-bucket for the lost pings
+#define WINDOW      128         // Pings in the rolling percentiles
+#define MIN_SAMPLES 8           // Before the interval grows
+
+static optcache_t opt_interval     = OPTCACHE_INT("pingmon_interval", 30);
+static optcache_t opt_max_interval = OPTCACHE_INT("pingmon_max_interval",
+                                                  300);
+static optcache_t opt_timeout      = OPTCACHE_INT("pingmon_timeout", 20);
+
+static guint connect_hid, disconnect_hid;
+static gchar *backup_info;
+
+// Ping in flight
+static LmMessageHandler *ping_handler;
+static gint64 ping_sent;
+static guint timeout_srcno, ping_srcno;
+static guint interval;          // Seconds until the next ping
+
+static struct {
+  guint64 total[NBUCKETS+1];    // Since the module was loaded
+  guint   rolling[NBUCKETS+1];  // Last WINDOW pings
+  guint8  window[WINDOW];       // Bucket of the last pings
+  guint   next, count;          // In window
+  guint64 sent, replies, lost, errors;
+  gint64  max_usec;
+  gint64  last_usec;
+} st;
+
+static guint bucket_of(gint64 usec)
+{
+  guint msb;
+
+  if (usec < 4)
+    return usec < 1 ? 0 : usec;
+  msb = g_bit_storage(usec) - 1;
+  return MIN(msb * 4 + ((usec >> (msb - 2)) & 3), NBUCKETS - 1);
+}
+
+// Upper bound of a bucket
+static gint64 bucket_usec(guint b)
+{
+  guint msb = b / 4;
+
+  if (b < 8)
+    return b + 1;
+  return (gint64)(4 + (b & 3) + 1) << (msb - 2);
+}
+
+static void record(guint b)
+{
+  if (st.count == WINDOW)
+    st.rolling[st.window[st.next]]--;
+  else
+    st.count++;
+  st.window[st.next] = b;
+  st.next = (st.next + 1) % WINDOW;
+  st.rolling[b]++;
+  st.total[b]++;
+}
+
+// Percentile of a histogram, LOST if it falls on the lost pings
+static guint percentile(const void *hist, gboolean wide, guint64 n, gdouble p)
+{
+  guint64 rank = (guint64)(p * n + 0.999999), cum = 0;
+  guint b;
+
+  if (!rank)
+    rank = 1;
+  for (b = 0; b <= LOST; b++) {
+    cum += wide ? ((const guint64 *)hist)[b] : ((const guint *)hist)[b];
+    if (cum >= rank)
+      return b;
+  }
+  return LOST;
+}
+
+static void format_bucket(gchar *buf, gsize size, guint b, const gchar *unit)
+{
+  gdouble ms = bucket_usec(b) / 1000.;
+
+  if (b == LOST)
+    g_strlcpy(buf, "--", size);
+  else if (ms < 10)
+    snprintf(buf, size, "%.1f%s", ms, unit);
+  else
+    snprintf(buf, size, "%.0f%s", ms, unit);
+}
+
+static void status_update(void)
+{
+  gchar buf[64], p50[16], p99[16];
+
+  if (!st.count) {
+    settings_set(SETTINGS_TYPE_OPTION, "info", "rtt ... ");
+  } else {
+    format_bucket(p50, sizeof p50,
+                  percentile(st.rolling, FALSE, st.count, .5), "");
+    format_bucket(p99, sizeof p99,
+                  percentile(st.rolling, FALSE, st.count, .99), "ms");
+    snprintf(buf, sizeof buf, "rtt %s/%s ", p50, p99);
+    settings_set(SETTINGS_TYPE_OPTION, "info", buf);
+  }
+  scr_update_chat_status(TRUE);
+}
+
+static gboolean ping_cb(gpointer data);
+
+static void schedule(guint seconds)
+{
+  if (ping_srcno)
+    g_source_remove(ping_srcno);
+  ping_srcno = g_timeout_add_seconds(seconds, ping_cb, NULL);
+}
+
+static void ping_done(void)
+{
+  if (timeout_srcno)
+    g_source_remove(timeout_srcno);
+  timeout_srcno = 0;
+  lm_message_handler_invalidate(ping_handler);
+  lm_message_handler_unref(ping_handler);
+  ping_handler = NULL;
+}
+
+static LmHandlerResult pong_cb(LmMessageHandler *h, LmConnection *c,
+                               LmMessage *m, gpointer user_data)
+{
+  gint64 usec = g_get_monotonic_time() - ping_sent;
+  gint min = MAX(optcache_int(&opt_interval), 1);
+  gint max = MAX(optcache_int(&opt_max_interval), min);
+  guint b = bucket_of(usec), median;
+
+  if (h != ping_handler)
+    return LM_HANDLER_RESULT_REMOVE_MESSAGE;
+  ping_done();
+
+  // An error reply (e.g. no XEP-0199 support) is a round trip as well
+  if (lm_message_get_sub_type(m) == LM_MESSAGE_SUB_TYPE_ERROR)
+    st.errors++;
+  st.replies++;
+  st.last_usec = usec;
+  st.max_usec = MAX(st.max_usec, usec);
+
+  // Steady: wait longer; spike, or not enough pings yet: back to the
+  // shortest interval
+  median = percentile(st.rolling, FALSE, st.count, .5);
+  if (st.count < MIN_SAMPLES || median == LOST ||
+      usec > 2 * bucket_usec(median))
+    interval = min;
+  else
+    interval = MIN(interval * 2, (guint)max);
+  record(b);
+  status_update();
+  schedule(interval);
+  return LM_HANDLER_RESULT_REMOVE_MESSAGE;
+}
+
+static gboolean timeout_cb(gpointer data)
+{
+  timeout_srcno = 0;
+  ping_done();
+  st.lost++;
+  record(LOST);
+  status_update();
+  interval = MAX(optcache_int(&opt_interval), 1);
+  schedule(interval);
+  return FALSE;
+}
+
+// The server, or the domain of our JID
+static gchar *ping_target(void)
+{
+  const gchar *server = settings_opt_get("server");
+  const gchar *jid, *domain;
+
+  if (server && *server)
+    return g_strdup(server);
+  jid = settings_opt_get("jid");
+  if (!jid || !(domain = strchr(jid, '@')))
+    return NULL;
+  return g_strndup(domain + 1, strcspn(domain + 1, "/"));
+}
+
+static void ping_send(void)
+{
+  LmMessage *m;
+  LmMessageNode *node;
+  gchar *to;
+
+  if (ping_handler || !xmpp_is_online())
+    return;
+
+  to = ping_target();
+  m = lm_message_new_with_sub_type(to, LM_MESSAGE_TYPE_IQ,
+                                   LM_MESSAGE_SUB_TYPE_GET);
+  node = lm_message_node_add_child(m->node, "ping", NULL);
+  lm_message_node_set_attribute(node, "xmlns", NS_PING);
+  g_free(to);
+
+  ping_handler = lm_message_handler_new(pong_cb, NULL, NULL);
+  ping_sent = g_get_monotonic_time();
+  if (!lm_connection_send_with_reply(lconnection, m, ping_handler, NULL)) {
+    lm_message_handler_unref(ping_handler);
+    ping_handler = NULL;
+  } else {
+    st.sent++;
+    timeout_srcno = g_timeout_add_seconds(MAX(optcache_int(&opt_timeout), 1),
+                                          timeout_cb, NULL);
+  }
+  lm_message_unref(m);
+}
+
+static gboolean ping_cb(gpointer data)
+{
+  ping_srcno = 0;
+  ping_send();
+  return FALSE;
+}
+
+static void pingmon_start(void)
+{
+  interval = MAX(optcache_int(&opt_interval), 1);
+  status_update();
+  ping_send();
+}
+
+static void pingmon_stop(void)
+{
+  if (ping_srcno)
+    g_source_remove(ping_srcno);
+  ping_srcno = 0;
+  if (ping_handler)
+    ping_done();
+}
+
+static guint connect_hh(const gchar *hookname, hk_arg_t *args,
+                        gpointer userdata)
+{
+  pingmon_start();
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static guint disconnect_hh(const gchar *hookname, hk_arg_t *args,
+                           gpointer userdata)
+{
+  pingmon_stop();
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static void do_pingmon(char *args)
+{
+  gchar p50[16], p90[16], p99[16], r50[16], r99[16];
+  guint64 n = st.replies + st.lost;
+
+  if (args && !strcmp(args, "now")) {
+    if (ping_handler) {
+      scr_log_print(LPRINT_NORMAL, "pingmon: a ping is in flight.");
+    } else if (!xmpp_is_online()) {
+      scr_log_print(LPRINT_NORMAL, "pingmon: not connected.");
+    } else {
+      if (ping_srcno)
+        g_source_remove(ping_srcno);
+      ping_srcno = 0;
+      ping_send();
+    }
+    return;
+  }
+  if (args && *args) {
+    scr_log_print(LPRINT_NORMAL, "Usage: /pingmon [now]");
+    return;
+  }
+  if (!n) {
+    scr_log_print(LPRINT_NORMAL, "pingmon: %" G_GUINT64_FORMAT " pings sent, "
+                  "no reply yet.", st.sent);
+    return;
+  }
+  format_bucket(p50, sizeof p50, percentile(st.total, TRUE, n, .5), "ms");
+  format_bucket(p90, sizeof p90, percentile(st.total, TRUE, n, .9), "ms");
+  format_bucket(p99, sizeof p99, percentile(st.total, TRUE, n, .99), "ms");
+  format_bucket(r50, sizeof r50,
+                percentile(st.rolling, FALSE, st.count, .5), "ms");
+  format_bucket(r99, sizeof r99,
+                percentile(st.rolling, FALSE, st.count, .99), "ms");
+  scr_log_print(LPRINT_NORMAL, "pingmon: %" G_GUINT64_FORMAT " pings, %"
+                G_GUINT64_FORMAT " replies (%" G_GUINT64_FORMAT " errors), %"
+                G_GUINT64_FORMAT " lost; next in %us.", st.sent, st.replies,
+                st.errors, st.lost, interval);
+  scr_log_print(LPRINT_NORMAL, "pingmon: p50 %s, p90 %s, p99 %s, max %.1fms, "
+                "last %.1fms; last %u pings: p50 %s, p99 %s.", p50, p90, p99,
+                st.max_usec / 1000., st.last_usec / 1000., st.count, r50, r99);
+}
+
+/* Initialization */
+static void pingmon_init(void)
+{
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  pingmon_cmdid = cmd_add("pingmon", "Server round-trip time", 0, 0,
+                          do_pingmon, NULL);
+#else
+  cmd_add("pingmon", "Server round-trip time", 0, 0, do_pingmon, NULL);
+#endif
+
+  optcache_bind(&opt_interval, NULL);
+  optcache_bind(&opt_max_interval, NULL);
+  optcache_bind(&opt_timeout, NULL);
+  backup_info = g_strdup(settings_opt_get("info"));
+
+  connect_hid = hk_add_handler(connect_hh, HOOK_POST_CONNECT,
+                               G_PRIORITY_DEFAULT_IDLE, NULL);
+  disconnect_hid = hk_add_handler(disconnect_hh, HOOK_PRE_DISCONNECT,
+                                  G_PRIORITY_DEFAULT_IDLE, NULL);
+  if (xmpp_is_online())
+    pingmon_start();
+}
+
+/* Uninitialization */
+static void pingmon_uninit(void)
+{
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(pingmon_cmdid);
+#else
+  cmd_del("pingmon");
+#endif
+
+  pingmon_stop();
+  hk_del_handler(HOOK_POST_CONNECT, connect_hid);
+  hk_del_handler(HOOK_PRE_DISCONNECT, disconnect_hid);
+  optcache_unbind_all();
+  memset(&st, 0, sizeof st);
+
+  // Restore initial info option value
+  settings_set(SETTINGS_TYPE_OPTION, "info", backup_info);
+  g_free(backup_info);
+  backup_info = NULL;
+  scr_update_chat_status(TRUE);
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
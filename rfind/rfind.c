@@ -0,0 +1,532 @@
+/*
+ *  Module "rfind"      -- Indexed roster search
+ *
+ *  Keeps a trigram index of the JIDs, names and groups of the roster
+ *  items (contacts, rooms, agents), so that finding a contact in a
+ *  roster of thousands does not mean walking all of it.  The index is
+ *  built when the module is loaded and after each connection, and is
+ *  updated from the roster pushes and the presences of contacts it does
+ *  not know yet.  Every hit is checked against the roster before it is
+ *  displayed, so an index that is out of date cannot give wrong results;
+ *  if the roster has changed without notice, use /rfind rebuild.
+ *
+ *  The search is a substring search, case-insensitive for ASCII letters;
+ *  the JIDs starting with the text come first, then the names.
+ *
+ *  Options:
+ *  - rfind_max: integer (default: 20)
+ *    Maximum number of hits displayed.
+ *
+ *  /rfind text         Search the roster
+ *  /rfind              Display the index status
+ *  /rfind rebuild      Build the index again
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+#include <mcabber/logprint.h>
+#include <mcabber/roster.h>
+
+#include "common/hkargs.h"
+#include "common/inittime.h"
+#include "common/optcache.h"
+#include "common/requires.h"
+#include "common/rostermap.h"
+#include "hookstats/hookstats.h"
+
+static void rfind_init(void);
+static void rfind_uninit(void);
+
+MODULE_TIMED_INIT(rfind_init)
+
+/* Module description */
+module_info_t info_rfind = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Indexed roster search\n"
+                          " Provides the command /rfind",
+        .requires       = MODULE_REQUIRES,
+        .init           = rfind_init_timed,
+        .uninit         = rfind_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer rfind_cmdid;
+#endif
+
+#define ROSTER_TYPES  (ROSTER_TYPE_USER|ROSTER_TYPE_ROOM|ROSTER_TYPE_AGENT)
+
+// An indexed roster item; jid is NULL when the slot is free
+typedef struct {
+  gchar *jid, *name, *group;
+  gchar *text;          // Folded "jid\nname\ngroup"
+  guint  type;
+  guint  ntri;          // Trigrams in the postings
+  guint  mark;          // Last search which has seen it
+} entry_t;
+
+static GArray     *entries;     // entry_t, by id
+static GArray     *free_ids;    // guint32
+static GHashTable *by_jid;      // jid -> id + 1
+static GHashTable *postings;    // trigram -> GArray of guint32 ids
+static GHashTable *absent;      // JIDs not in the roster (presences)
+static guint       nlive;
+static gsize       nposts, nposts_live;
+static gboolean    stale;
+static guint       search_serial;
+static guint       rebuild_srcno;
+static gint64      rebuild_usec;
+
+static optcache_t opt_max = OPTCACHE_INT("rfind_max", 20);
+
+static guint connect_hid, push_hid, status_hid;
+
+/* Index */
+
+static inline entry_t *entry_get(guint32 id)
+{
+  return &g_array_index(entries, entry_t, id);
+}
+
+static inline guint32 trigram(const gchar *p)
+{
+  return (guint32)(guchar)p[0] << 16 | (guint32)(guchar)p[1] << 8 |
+         (guchar)p[2];
+}
+
+static void fold(gchar *p)
+{
+  for ( ; *p; p++)
+    *p = g_ascii_tolower(*p);
+}
+
+static int u32_cmp(const void *a, const void *b)
+{
+  guint32 x = *(const guint32 *)a, y = *(const guint32 *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void posting_free(gpointer data)
+{
+  g_array_free(data, TRUE);
+}
+
+static void entry_post(guint32 id)
+{
+  entry_t *e = entry_get(id);
+  gsize len = strlen(e->text), i, n = 0;
+  guint32 *tri;
+
+  if (len < 3)
+    return;
+  // Each trigram once
+  tri = g_new(guint32, len - 2);
+  for (i = 0; i + 3 <= len; i++)
+    tri[i] = trigram(e->text + i);
+  qsort(tri, len - 2, sizeof *tri, u32_cmp);
+  for (i = 0; i < len - 2; i++) {
+    GArray *post;
+    if (i && tri[i] == tri[i-1])
+      continue;
+    post = g_hash_table_lookup(postings, GUINT_TO_POINTER(tri[i]));
+    if (!post) {
+      post = g_array_new(FALSE, FALSE, sizeof(guint32));
+      g_hash_table_insert(postings, GUINT_TO_POINTER(tri[i]), post);
+    }
+    g_array_append_val(post, id);
+    n++;
+  }
+  g_free(tri);
+  e->ntri = n;
+  nposts += n;
+  nposts_live += n;
+}
+
+// The postings of the removed entries are only dropped from time to
+// time: the hits are checked against the entries anyway.
+static void postings_compact(void)
+{
+  guint32 id;
+
+  g_hash_table_remove_all(postings);
+  nposts = nposts_live = 0;
+  for (id = 0; id < entries->len; id++)
+    if (entry_get(id)->jid)
+      entry_post(id);
+}
+
+static void entry_remove(guint32 id)
+{
+  entry_t *e = entry_get(id);
+
+  g_hash_table_remove(by_jid, e->jid);
+  g_free(e->jid);
+  g_free(e->name);
+  g_free(e->group);
+  g_free(e->text);
+  e->jid = e->name = e->group = e->text = NULL;
+  nposts_live -= e->ntri;
+  e->ntri = 0;
+  g_array_append_val(free_ids, id);
+  nlive--;
+
+  if (nposts > 2 * nposts_live + 1024)
+    postings_compact();
+}
+
+static gboolean entry_find(const gchar *jid, guint32 *id)
+{
+  gpointer p = g_hash_table_lookup(by_jid, jid);
+
+  if (!p)
+    return FALSE;
+  *id = GPOINTER_TO_UINT(p) - 1;
+  return TRUE;
+}
+
+// Add or update the entry of a roster item
+static void entry_set(gpointer rosterdata, void *param)
+{
+  const gchar *jid = buddy_getjid(rosterdata);
+  const gchar *name = buddy_getname(rosterdata);
+  const gchar *group = buddy_getgroupname(rosterdata);
+  guint type = buddy_gettype(rosterdata);
+  entry_t *e;
+  guint32 id;
+
+  if (!jid)
+    return;
+  if (entry_find(jid, &id)) {
+    e = entry_get(id);
+    if (!strcmp(e->jid, jid) && !g_strcmp0(e->name, name) &&
+        !g_strcmp0(e->group, group) && e->type == type)
+      return;
+    entry_remove(id);
+  }
+
+  if (free_ids->len) {
+    id = g_array_index(free_ids, guint32, free_ids->len - 1);
+    g_array_set_size(free_ids, free_ids->len - 1);
+  } else {
+    entry_t empty = { NULL };
+    id = entries->len;
+    g_array_append_val(entries, empty);
+  }
+  e = entry_get(id);
+  e->jid   = g_strdup(jid);
+  e->name  = g_strdup(name);
+  e->group = g_strdup(group);
+  e->type  = type;
+  e->mark  = 0;
+  e->text  = g_strdup_printf("%s\n%s\n%s", jid, name ? name : "",
+                             group ? group : "");
+  fold(e->text);
+  g_hash_table_insert(by_jid, e->jid, GUINT_TO_POINTER(id + 1));
+  nlive++;
+  entry_post(id);
+}
+
+static void index_clear(void)
+{
+  guint32 id;
+
+  g_hash_table_remove_all(by_jid);
+  for (id = 0; id < entries->len; id++) {
+    entry_t *e = entry_get(id);
+    g_free(e->jid);
+    g_free(e->name);
+    g_free(e->group);
+    g_free(e->text);
+  }
+  nlive = 0;
+  g_array_set_size(entries, 0);
+  g_array_set_size(free_ids, 0);
+  g_hash_table_remove_all(postings);
+  g_hash_table_remove_all(absent);
+  nposts = nposts_live = 0;
+}
+
+static void index_rebuild(void)
+{
+  gint64 t0 = g_get_monotonic_time();
+
+  index_clear();
+  foreach_buddy(ROSTER_TYPES, entry_set, NULL);
+  stale = FALSE;
+  rebuild_usec = g_get_monotonic_time() - t0;
+}
+
+// One roster item has changed (or may have been removed)
+static void index_refresh(const gchar *jid)
+{
+  GSList *sl = roster_find(jid, jidsearch, ROSTER_TYPES);
+  guint32 id;
+
+  if (sl)
+    entry_set(sl->data, NULL);
+  else if (entry_find(jid, &id))
+    entry_remove(id);
+}
+
+static gboolean rebuild_cb(gpointer data)
+{
+  rebuild_srcno = 0;
+  index_rebuild();
+  return FALSE;
+}
+
+/* Handlers */
+
+static guint connect_hh(const gchar *hookname, hk_arg_t *args,
+                        gpointer userdata)
+{
+  // The roster has just been received
+  stale = TRUE;
+  if (!rebuild_srcno)
+    rebuild_srcno = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, rebuild_cb,
+                                    NULL, NULL);
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static guint push_hh(const gchar *hookname, hk_arg_t *args,
+                     gpointer userdata)
+{
+  const gchar *jid;
+  hkargs_t a;
+
+  hkargs_parse(args, HKARG(HKARG_JID), 0, &a);
+  jid = hkargs_value(&a, HKARG_JID);
+  g_hash_table_remove_all(absent);
+  if (jid)
+    index_refresh(jid);
+  else
+    stale = TRUE;
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static guint status_hh(const gchar *hookname, hk_arg_t *args,
+                       gpointer userdata)
+{
+  const gchar *jid;
+  guint32 id;
+  hkargs_t a;
+
+  // Only the contacts the index does not know: one roster walk each
+  hkargs_parse(args, HKARG(HKARG_JID), 0, &a);
+  jid = hkargs_value(&a, HKARG_JID);
+  if (!jid || stale || entry_find(jid, &id) ||
+      g_hash_table_contains(absent, jid))
+    return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+  index_refresh(jid);
+  if (!entry_find(jid, &id))
+    g_hash_table_insert(absent, g_strdup(jid), GINT_TO_POINTER(1));
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+/* Search */
+
+static const gchar *query_text;
+
+// JIDs starting with the text first, then names, then the others
+static gint hit_rank(const entry_t *e)
+{
+  gsize len = strlen(query_text);
+
+  if (!strncmp(e->text, query_text, len))
+    return 0;
+  if (!strncmp(strchr(e->text, '\n') + 1, query_text, len))
+    return 1;
+  return 2;
+}
+
+static int hit_cmp(const void *a, const void *b)
+{
+  const entry_t *x = entry_get(*(const guint32 *)a);
+  const entry_t *y = entry_get(*(const guint32 *)b);
+  gint rx = hit_rank(x), ry = hit_rank(y);
+
+  if (rx != ry)
+    return rx - ry;
+  return strcmp(x->text, y->text);
+}
+
+static void hit_add(GArray *hits, guint32 id, const gchar *query)
+{
+  entry_t *e = entry_get(id);
+
+  if (!e->jid || e->mark == search_serial || !strstr(e->text, query))
+    return;
+  e->mark = search_serial;
+  g_array_append_val(hits, id);
+}
+
+static void rfind(const gchar *text)
+{
+  gint64 t0 = g_get_monotonic_time();
+  gchar *query = g_strdup(text);
+  gsize len = strlen(query), i;
+  GArray *hits = g_array_new(FALSE, FALSE, sizeof(guint32));
+  GArray *best = NULL;
+  GHashTable *map = NULL;
+  guint max = MAX(optcache_int(&opt_max), 1), shown = 0;
+  guint32 id;
+
+  fold(query);
+  if (stale)
+    index_rebuild();
+  if (!++search_serial)
+    search_serial = 1;
+
+  if (len < 3) {
+    for (id = 0; id < entries->len; id++)
+      hit_add(hits, id, query);
+  } else {
+    // The shortest posting list of the trigrams of the text
+    for (i = 0; i + 3 <= len; i++) {
+      GArray *post = g_hash_table_lookup(postings,
+                                         GUINT_TO_POINTER(trigram(query + i)));
+      if (!post) {
+        best = NULL;
+        break;
+      }
+      if (!best || post->len < best->len)
+        best = post;
+    }
+    for (i = 0; best && i < best->len; i++)
+      hit_add(hits, g_array_index(best, guint32, i), query);
+  }
+
+  query_text = query;
+  g_array_sort(hits, hit_cmp);
+
+  // The hits are checked against the roster with one walk of it
+  if (hits->len)
+    map = rostermap_new(ROSTER_TYPES);
+  for (i = 0; i < hits->len && shown < max; i++) {
+    entry_t *e;
+    id = g_array_index(hits, guint32, i);
+    e = entry_get(id);
+    // Out of date entry: the roster has changed without notice
+    if (!rostermap_find(map, e->jid)) {
+      entry_remove(id);
+      continue;
+    }
+    scr_log_print(LPRINT_NORMAL, "  %s%s \"%s\" [%s]", e->jid,
+                  e->type & ROSTER_TYPE_ROOM ? " (room)" :
+                  e->type & ROSTER_TYPE_AGENT ? " (agent)" : "",
+                  e->name ? e->name : "", e->group ? e->group : "");
+    shown++;
+  }
+  if (hits->len > shown && shown == max)
+    scr_log_print(LPRINT_NORMAL, "  ... (rfind_max: %u)", max);
+  if (map)
+    g_hash_table_destroy(map);
+
+  // The time the user waits, display included
+  scr_log_print(LPRINT_NORMAL, "rfind: %u match(es) for \"%s\" in %"
+                G_GINT64_FORMAT " us.", hits->len, text,
+                g_get_monotonic_time() - t0);
+  g_array_free(hits, TRUE);
+  g_free(query);
+}
+
+/* Command */
+
+static void do_rfind(char *args)
+{
+  if (args && !strcmp(args, "rebuild")) {
+    index_rebuild();
+    scr_log_print(LPRINT_NORMAL, "rfind: %u roster items indexed in %"
+                  G_GINT64_FORMAT " us.", nlive, rebuild_usec);
+    return;
+  }
+  if (args && *args) {
+    rfind(args);
+    return;
+  }
+  scr_log_print(LPRINT_NORMAL, "rfind: %u roster items%s, %u trigrams, "
+                "%" G_GSIZE_FORMAT " postings (%" G_GSIZE_FORMAT " live); "
+                "last build %" G_GINT64_FORMAT " us.", nlive,
+                stale ? " (out of date)" : "", g_hash_table_size(postings),
+                nposts, nposts_live, rebuild_usec);
+}
+
+/* Initialization */
+static void rfind_init(void)
+{
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  rfind_cmdid = cmd_add("rfind", "Indexed roster search", 0, 0, do_rfind,
+                        NULL);
+#else
+  cmd_add("rfind", "Indexed roster search", 0, 0, do_rfind, NULL);
+#endif
+
+  optcache_bind(&opt_max, NULL);
+
+  entries  = g_array_new(FALSE, FALSE, sizeof(entry_t));
+  free_ids = g_array_new(FALSE, FALSE, sizeof(guint32));
+  by_jid   = g_hash_table_new(rostermap_hash, rostermap_equal);
+  postings = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                   posting_free);
+  absent   = g_hash_table_new_full(rostermap_hash, rostermap_equal, g_free,
+                                   NULL);
+  index_rebuild();
+
+  connect_hid = hk_add_handler(connect_hh, HOOK_POST_CONNECT,
+                               G_PRIORITY_DEFAULT_IDLE, NULL);
+  push_hid = hk_add_handler(push_hh, HOOK_ROSTER_PUSH,
+                            G_PRIORITY_DEFAULT_IDLE, NULL);
+  status_hid = hk_add_handler(status_hh, HOOK_STATUS_CHANGE,
+                              G_PRIORITY_DEFAULT_IDLE, NULL);
+}
+
+/* Uninitialization */
+static void rfind_uninit(void)
+{
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(rfind_cmdid);
+#else
+  cmd_del("rfind");
+#endif
+
+  hk_del_handler(HOOK_POST_CONNECT, connect_hid);
+  hk_del_handler(HOOK_ROSTER_PUSH, push_hid);
+  hk_del_handler(HOOK_STATUS_CHANGE, status_hid);
+  if (rebuild_srcno)
+    g_source_remove(rebuild_srcno);
+  rebuild_srcno = 0;
+
+  index_clear();
+  g_array_free(entries, TRUE);
+  g_array_free(free_ids, TRUE);
+  g_hash_table_destroy(by_jid);
+  g_hash_table_destroy(postings);
+  g_hash_table_destroy(absent);
+  nlive = 0;
+  stale = FALSE;
+  optcache_unbind_all();
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -0,0 +1,529 @@
+/*
+ *  Module "rostersnap" -- Roster presence snapshot and restore
+ *
+ *  After a reconnection, the presence of every contact resource arrives
+ *  again in its own stanza, and the roster is rebuilt for each of them.
+ *  This module saves the resources of the roster contacts (status,
+ *  message, priority and chat states support) in a small binary file
+ *  before disconnecting.  Once connected again, the saved resources are
+ *  restored at once, with a single roster rebuild; the ones that are not
+ *  confirmed by a presence from the server within rostersnap_deadline
+ *  seconds are removed, so that no ghost resource is left.
+ *
+ *  The snapshot is saved when mcabber disconnects (or with /rostersnap
+ *  save); it is only restored for the same account, and when it is less
+ *  than rostersnap_maxage seconds old.  Room occupants are not saved.
+ *
+ *  Options:
+ *  - rostersnap_file: string (default: "~/.mcabber/rostersnap")
+ *  - rostersnap_deadline: integer (default: 30)
+ *  - rostersnap_maxage: integer (default: 3600)
+ *
+ *  /rostersnap [show]  Display the statistics
+ *  /rostersnap save    Save a snapshot now
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+#include <mcabber/logprint.h>
+#include <mcabber/roster.h>
+#include <mcabber/screen.h>
+#include <mcabber/settings.h>
+#include <mcabber/utils.h>
+#include <mcabber/xmpp.h>
+
+#include "common/inittime.h"
+#include "common/lmhandler.h"
+#include "common/requires.h"
+#include "common/rostermap.h"
+#include "hookstats/hookstats.h"
+
+static void rostersnap_init(void);
+static void rostersnap_uninit(void);
+
+MODULE_TIMED_INIT(rostersnap_init)
+
+/* Module description */
+module_info_t info_rostersnap = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Roster presence snapshot and restore\n"
+                          " Provides the command /rostersnap",
+        .requires       = MODULE_REQUIRES,
+        .init           = rostersnap_init_timed,
+        .uninit         = rostersnap_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer rostersnap_cmdid;
+#endif
+
+#define DEFAULT_FILE        "~/.mcabber/rostersnap"
+#define DEFAULT_DEADLINE    30          // seconds
+#define DEFAULT_MAXAGE      3600        // seconds
+
+// File layout, little-endian; strings are a 16-bit length and the bytes:
+//  header: "MCRS", version, 3 reserved bytes, saved time (64 bits),
+//          account JID, number of records (32 bits)
+//  record: bare JID, resource, status, priority, XEP-0085 support,
+//          1 reserved byte, status time (64 bits), status message
+#define SNAP_MAGIC          "MCRS"
+#define SNAP_VERSION        1
+
+static guint pre_disconnect_hid, post_connect_hid;
+static lmhandler_t presence_handler =
+  LMHANDLER(LM_MESSAGE_TYPE_PRESENCE, LM_HANDLER_PRIORITY_FIRST);
+static gchar *snap_file;
+static guint deadline, maxage;
+
+static GHashTable *pending;     // "jid/resource" not confirmed yet
+static guint expire_srcno;
+
+static guint stat_saved, stat_restored, stat_confirmed, stat_expired;
+
+/* Encoding */
+
+static void put_u8(GString *buf, guint8 v)
+{
+  g_string_append_c(buf, (gchar)v);
+}
+
+static void put_u16(GString *buf, guint16 v)
+{
+  put_u8(buf, v & 0xff);
+  put_u8(buf, v >> 8);
+}
+
+static void put_u32(GString *buf, guint32 v)
+{
+  put_u16(buf, v & 0xffff);
+  put_u16(buf, v >> 16);
+}
+
+static void put_i64(GString *buf, gint64 v)
+{
+  put_u32(buf, (guint64)v & 0xffffffff);
+  put_u32(buf, (guint64)v >> 32);
+}
+
+static void put_str(GString *buf, const gchar *s)
+{
+  gsize len = s ? strlen(s) : 0;
+
+  if (len > G_MAXUINT16)
+    len = G_MAXUINT16;
+  put_u16(buf, len);
+  g_string_append_len(buf, s, len);
+}
+
+typedef struct {
+  const guchar *p, *end;
+  gboolean      error;
+} reader_t;
+
+static const guchar *get_bytes(reader_t *r, gsize n)
+{
+  const guchar *p = r->p;
+
+  if (r->error || (gsize)(r->end - r->p) < n) {
+    r->error = TRUE;
+    return NULL;
+  }
+  r->p += n;
+  return p;
+}
+
+static guint8 get_u8(reader_t *r)
+{
+  const guchar *p = get_bytes(r, 1);
+  return p ? p[0] : 0;
+}
+
+static guint16 get_u16(reader_t *r)
+{
+  const guchar *p = get_bytes(r, 2);
+  return p ? p[0] | p[1] << 8 : 0;
+}
+
+static guint32 get_u32(reader_t *r)
+{
+  guint32 lo = get_u16(r);
+  return lo | (guint32)get_u16(r) << 16;
+}
+
+static gint64 get_i64(reader_t *r)
+{
+  guint64 lo = get_u32(r);
+  return (gint64)(lo | (guint64)get_u32(r) << 32);
+}
+
+// Returns a newly allocated string, NULL if it is empty
+static gchar *get_str(reader_t *r)
+{
+  guint16 len = get_u16(r);
+  const guchar *p = get_bytes(r, len);
+  return p && len ? g_strndup((const gchar *)p, len) : NULL;
+}
+
+/* Snapshot */
+
+static const gchar *account_jid(void)
+{
+  const gchar *jid = settings_opt_get("jid");
+  return jid ? jid : "";
+}
+
+typedef struct {
+  GString *buf;
+  guint32  count;
+} save_state_t;
+
+static void save_buddy(gpointer rosterdata, void *param)
+{
+  save_state_t *st = param;
+  GSList *resources, *li;
+
+  resources = buddy_getresources(rosterdata);
+  for (li = resources; li; li = g_slist_next(li)) {
+    const gchar *res = li->data;
+    enum imstatus status = buddy_getstatus(rosterdata, res);
+    guint8 support = CHATSTATES_SUPPORT_UNKNOWN;
+#ifdef XEP0085
+    struct xep0085 *xep85 = buddy_resource_xep85(rosterdata, res);
+    // A probe in progress will not be answered on the new connection
+    if (xep85 && xep85->support != CHATSTATES_SUPPORT_PROBED)
+      support = xep85->support;
+#endif
+
+    if (status == offline)
+      continue;
+    put_str(st->buf, buddy_getjid(rosterdata));
+    put_str(st->buf, res);
+    put_u8(st->buf, status);
+    put_u8(st->buf, (guint8)buddy_getresourceprio(rosterdata, res));
+    put_u8(st->buf, support);
+    put_u8(st->buf, 0);
+    put_i64(st->buf, buddy_getstatustime(rosterdata, res));
+    put_str(st->buf, buddy_getstatusmsg(rosterdata, res));
+    st->count++;
+  }
+  g_slist_free_full(resources, g_free);
+}
+
+// Written to a temporary file and renamed; not synced, as the snapshot
+// is only a hint (g_file_set_contents() would wait for the disk)
+static gboolean snapshot_write(const GString *buf)
+{
+  gchar *tmpname = g_strdup_printf("%s.tmp", snap_file);
+  int fd = open(tmpname, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+  FILE *fp = fd < 0 ? NULL : fdopen(fd, "w");
+  gboolean ok = fp != NULL;
+
+  if (fp) {
+    ok = fwrite(buf->str, 1, buf->len, fp) == buf->len;
+    ok = !fclose(fp) && ok;
+    ok = ok && !rename(tmpname, snap_file);
+    if (!ok)
+      unlink(tmpname);
+  } else if (fd >= 0) {
+    close(fd);
+  }
+  if (!ok)
+    scr_log_print(LPRINT_LOGNORM, "rostersnap: cannot save the snapshot to "
+                  "%s: %s", snap_file, g_strerror(errno));
+  g_free(tmpname);
+  return ok;
+}
+
+static gboolean snapshot_save(void)
+{
+  save_state_t st;
+  gsize count_pos;
+  gboolean ok;
+
+  st.buf = g_string_sized_new(4096);
+  st.count = 0;
+  g_string_append(st.buf, SNAP_MAGIC);
+  put_u8(st.buf, SNAP_VERSION);
+  put_u8(st.buf, 0);
+  put_u16(st.buf, 0);
+  put_i64(st.buf, time(NULL));
+  put_str(st.buf, account_jid());
+  count_pos = st.buf->len;
+  put_u32(st.buf, 0);
+
+  foreach_buddy(ROSTER_TYPE_USER|ROSTER_TYPE_AGENT, save_buddy, &st);
+
+  // Now that the number of records is known
+  st.buf->str[count_pos]   = st.count & 0xff;
+  st.buf->str[count_pos+1] = (st.count >> 8) & 0xff;
+  st.buf->str[count_pos+2] = (st.count >> 16) & 0xff;
+  st.buf->str[count_pos+3] = st.count >> 24;
+
+  ok = snapshot_write(st.buf);
+  g_string_free(st.buf, TRUE);
+  if (ok)
+    stat_saved = st.count;
+  return ok;
+}
+
+static gchar *pending_key(const gchar *bjid, const gchar *res)
+{
+  gchar *lbjid = g_ascii_strdown(bjid, -1);
+  gchar *key = g_strdup_printf("%s" JID_RESOURCE_SEPARATORSTR "%s", lbjid,
+                               res);
+  g_free(lbjid);
+  return key;
+}
+
+static gboolean expire_cb(gpointer data)
+{
+  GHashTableIter iter;
+  gpointer key;
+  guint n = 0;
+
+  g_hash_table_iter_init(&iter, pending);
+  while (g_hash_table_iter_next(&iter, &key, NULL)) {
+    gchar *bjid = g_strdup(key);
+    gchar *res = strchr(bjid, JID_RESOURCE_SEPARATOR);
+    *res++ = '\0';
+    roster_setstatus(bjid, res, 0, offline, NULL, 0L,
+                     role_none, affil_none, NULL);
+    g_free(bjid);
+    n++;
+  }
+  g_hash_table_remove_all(pending);
+  if (n) {
+    buddylist_build();
+    scr_update_roster();
+    scr_log_print(LPRINT_LOGNORM, "rostersnap: %u restored resource(s) "
+                  "not confirmed by the server, removed.", n);
+  }
+  stat_expired += n;
+  expire_srcno = 0;
+  return FALSE;
+}
+
+static void pending_reset(void)
+{
+  if (expire_srcno) {
+    g_source_remove(expire_srcno);
+    expire_srcno = 0;
+  }
+  g_hash_table_remove_all(pending);
+}
+
+static void snapshot_restore(void)
+{
+  gchar *data = NULL, *account = NULL;
+  GHashTable *map = NULL;
+  gsize len;
+  reader_t r;
+  guint32 count, i;
+  gint64 saved;
+  guint restored = 0;
+
+  pending_reset();
+  if (!g_file_get_contents(snap_file, &data, &len, NULL))
+    return;
+
+  r.p = (const guchar *)data;
+  r.end = r.p + len;
+  r.error = FALSE;
+  if (len < 8 || memcmp(data, SNAP_MAGIC, 4) || data[4] != SNAP_VERSION)
+    goto out;
+  get_bytes(&r, 8);
+  saved = get_i64(&r);
+  account = get_str(&r);
+  count = get_u32(&r);
+  if (r.error || g_strcmp0(account ? account : "", account_jid()) ||
+      time(NULL) - saved > maxage)
+    goto out;
+
+  // The contacts are only looked up: the roster does not change below
+  map = rostermap_new(ROSTER_TYPE_USER|ROSTER_TYPE_AGENT);
+  for (i = 0; i < count && !r.error; i++) {
+    gchar *bjid = get_str(&r), *res = get_str(&r), *msg;
+    enum imstatus status = get_u8(&r);
+    gchar prio = (gchar)get_u8(&r);
+    guint8 support = get_u8(&r);
+    time_t timestamp;
+    gpointer bud;
+
+    get_u8(&r);
+    timestamp = get_i64(&r);
+    msg = get_str(&r);
+
+    // Contacts removed from the roster and resources already online are
+    // left alone
+    if (!r.error && bjid && res && status > offline &&
+        status < imstatus_size &&
+        (bud = rostermap_find(map, bjid)) != NULL &&
+        buddy_getstatus(bud, res) == offline) {
+#ifdef XEP0085
+      struct xep0085 *xep85;
+#endif
+      roster_setstatus(bjid, res, prio, status, msg, timestamp,
+                       role_none, affil_none, NULL);
+#ifdef XEP0085
+      xep85 = buddy_resource_xep85(bud, res);
+      if (xep85)
+        xep85->support = support;
+#endif
+      g_hash_table_insert(pending, pending_key(bjid, res), NULL);
+      restored++;
+    }
+    g_free(bjid);
+    g_free(res);
+    g_free(msg);
+  }
+
+  if (restored) {
+    buddylist_build();
+    scr_update_roster();
+    expire_srcno = g_timeout_add_seconds(deadline, expire_cb, NULL);
+  }
+  stat_restored += restored;
+
+out:
+  if (map)
+    g_hash_table_destroy(map);
+  g_free(account);
+  g_free(data);
+}
+
+/* Handlers */
+
+// A presence from the server confirms (or replaces) a restored resource
+static LmHandlerResult presence_cb(LmMessageHandler *handler,
+                                   LmConnection *connection,
+                                   LmMessage *m, gpointer user_data)
+{
+  const gchar *from, *res;
+  gchar *bjid, *key;
+
+  if (!g_hash_table_size(pending))
+    return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+  from = lm_message_node_get_attribute(m->node, "from");
+  if (!from || !(res = strchr(from, JID_RESOURCE_SEPARATOR)))
+    return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+
+  bjid = jidtodisp(from);
+  key = pending_key(bjid, res + 1);
+  if (g_hash_table_remove(pending, key))
+    stat_confirmed++;
+  g_free(key);
+  g_free(bjid);
+  return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static guint pre_disconnect_hh(const gchar *hookname, hk_arg_t *args,
+                               gpointer userdata)
+{
+  lmhandler_detach(&presence_handler);
+  pending_reset();
+  snapshot_save();
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static guint post_connect_hh(const gchar *hookname, hk_arg_t *args,
+                             gpointer userdata)
+{
+  // Each connection is a new one: confirm the restored resources on it
+  lmhandler_attach(&presence_handler);
+  snapshot_restore();
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static void do_rostersnap(char *args)
+{
+  if (!*args || !strcmp(args, "show")) {
+    scr_log_print(LPRINT_NORMAL, "rostersnap: %s; %u resource(s) saved, "
+                  "%u restored, %u confirmed, %u expired, %u pending.",
+                  snap_file, stat_saved, stat_restored, stat_confirmed,
+                  stat_expired, g_hash_table_size(pending));
+  } else if (!strcmp(args, "save")) {
+    if (snapshot_save())
+      scr_log_print(LPRINT_NORMAL, "rostersnap: %u resource(s) saved.",
+                    stat_saved);
+  } else {
+    scr_log_print(LPRINT_NORMAL, "Usage: /rostersnap [show|save]");
+  }
+}
+
+/* Initialization */
+static void rostersnap_init(void)
+{
+  const gchar *path = settings_opt_get("rostersnap_file");
+
+  snap_file = expand_filename(path && *path ? path : DEFAULT_FILE);
+  deadline = settings_opt_get_int("rostersnap_deadline");
+  if (!deadline)
+    deadline = DEFAULT_DEADLINE;
+  maxage = settings_opt_get_int("rostersnap_maxage");
+  if (!maxage)
+    maxage = DEFAULT_MAXAGE;
+  pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  rostersnap_cmdid = cmd_add("rostersnap", "Roster presence snapshot", 0, 0,
+                             do_rostersnap, NULL);
+#else
+  cmd_add("rostersnap", "Roster presence snapshot", 0, 0, do_rostersnap,
+          NULL);
+#endif
+
+  /* Add handlers */
+  lmhandler_new(&presence_handler, presence_cb, NULL);
+  pre_disconnect_hid = hk_add_handler(pre_disconnect_hh, HOOK_PRE_DISCONNECT,
+                                      G_PRIORITY_DEFAULT_IDLE, NULL);
+  post_connect_hid = hk_add_handler(post_connect_hh, HOOK_POST_CONNECT,
+                                    G_PRIORITY_DEFAULT_IDLE, NULL);
+}
+
+/* Uninitialization */
+static void rostersnap_uninit(void)
+{
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(rostersnap_cmdid);
+#else
+  cmd_del("rostersnap");
+#endif
+
+  hk_del_handler(HOOK_PRE_DISCONNECT, pre_disconnect_hid);
+  hk_del_handler(HOOK_POST_CONNECT, post_connect_hid);
+  lmhandler_free(&presence_handler);
+
+  pending_reset();
+  g_hash_table_destroy(pending);
+  pending = NULL;
+  g_free(snap_file);
+  snap_file = NULL;
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -28,9 +28,19 @@
 #include <mcabber/roster.h>
 #include <mcabber/utils.h>
 
+#include "common/hkargs.h"
+#include "common/inittime.h"
+#include "common/logcoal.h"
+#include "common/requires.h"
+#include "common/workq.h"
+#include "hookstats/hookstats.h"
+#include "metrics/metrics.h"
+
 static void show_mdr_init(void);
 static void show_mdr_uninit(void);
 
+MODULE_TIMED_INIT(show_mdr_init)
+
 /* Module description */
 module_info_t info_show_mdr = {
   /*
@@ -41,8 +51,8 @@ module_info_t info_show_mdr = {
         .api            = 41,     // HOOK_MDR_RECEIVED was included in dev-33
         .version        = "0.01",
         .description    = "Show delivery receipts in the log window.",
-        .requires       = NULL,
-        .init           = show_mdr_init,
+        .requires       = MODULE_REQUIRES,
+        .init           = show_mdr_init_timed,
         .uninit         = show_mdr_uninit,
         .next           = NULL,
 };
@@ -50,6 +60,9 @@ module_info_t info_show_mdr = {
 // Hook handler id
 static guint mdr_hid;
 
+METRIC_DEFINE(m_receipts, "mcabber_receipts_received_total", METRIC_COUNTER,
+              "Message delivery receipts received");
+
 static int number_of_resources(const char *fjid)
 {
   GSList *sl_user;
@@ -78,25 +91,34 @@ static int number_of_resources(const char *fjid)
   return n;
 }
 
+// Deferred: jid
+static void mdr_show(const gchar * const *str, guint num)
+{
+  int nres;
+  // Note: we could use a whitelist...
+
+  scr_log_print(LPRINT_DEBUG, "Received MDR from %s", str[0]);
+
+  /* What we do: we check the number N of resources from the contact and
+     display the MDR sender only if N > 1
+   */
+  nres = number_of_resources(str[0]);
+  if (nres > 1)
+    logcoal_print(LPRINT_NORMAL, "Received MDR from %s", str[0]);
+}
+
 // Event handler for delivery receipts events
 static guint mdr_hh(const gchar *hookname, hk_arg_t *args,
                     gpointer userdata)
 {
-  for ( ; args->name; args++) {
-    if (!g_strcmp0(args->name, "jid")) {
-      int nres;
-      // Note: we could use a whitelist...
-
-      scr_log_print(LPRINT_DEBUG, "Received MDR from %s", args->value);
-
-      /* What we do: we check the number N of resources from the contact and
-         display the MDR sender only if N > 1
-       */
-      nres = number_of_resources(args->value);
-      if (nres > 1)
-        scr_log_print(LPRINT_NORMAL, "Received MDR from %s", args->value);
-    }
-  }
+  const gchar *jid;
+  hkargs_t a;
+
+  hkargs_parse(args, HKARG(HKARG_JID), 0, &a);
+  jid = hkargs_value(&a, HKARG_JID);
+  METRIC_INC(m_receipts);
+  if (jid)
+    workq_push(mdr_show, 0, 1, jid);
 
   return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
 }
@@ -104,6 +126,8 @@ static guint mdr_hh(const gchar *hookname, hk_arg_t *args,
 // Initialization
 static void show_mdr_init(void)
 {
+  logcoal_init();
+  METRIC_REGISTER(m_receipts);
   // Add hook handler for delivery receipts
   mdr_hid = hk_add_handler(mdr_hh, HOOK_MDR_RECEIVED,
                            G_PRIORITY_DEFAULT_IDLE, NULL);
@@ -114,6 +138,10 @@ static void show_mdr_uninit(void)
 {
   // Unregister handler
   hk_del_handler(HOOK_MDR_RECEIVED, mdr_hid);
+  workq_flush();
+  logcoal_flush();
+  optcache_unbind_all();
+  METRIC_UNREGISTER(m_receipts);
 }
 
 /* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
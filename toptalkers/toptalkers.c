@@ -0,0 +1,376 @@
+/*
+ *  Module "toptalkers" -- Show the noisiest rooms and contacts
+ *
+ *  This module counts the incoming messages per room and per contact
+ *  (room occupants included) over sliding windows of about 1 minute,
+ *  10 minutes and 1 hour.  The counts are kept in count-min sketches,
+ *  with a small heap of heavy hitters per window, so the memory used is
+ *  constant whatever the number of rooms and occupants.  The counts are
+ *  estimates: they can only be too high, and only by a small fraction
+ *  of the total number of messages.
+ *
+ *  /toptalkers [1m|10m|1h]     (default: 10m)
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+#include <mcabber/logprint.h>
+
+#include "common/hkargs.h"
+#include "common/inittime.h"
+#include "common/requires.h"
+#include "hookstats/hookstats.h"
+
+static void toptalkers_init(void);
+static void toptalkers_uninit(void);
+
+MODULE_TIMED_INIT(toptalkers_init)
+
+/* Module description */
+module_info_t info_toptalkers = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Show the noisiest rooms and contacts\n"
+                          " Provides the command /toptalkers",
+        .requires       = MODULE_REQUIRES,
+        .init           = toptalkers_init_timed,
+        .uninit         = toptalkers_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer toptalkers_cmdid;
+#endif
+
+static guint message_in_hid;
+
+// Count-min sketch: CM_DEPTH rows of CM_WIDTH counters, with
+// conservative updates
+#define CM_DEPTH    4
+#define CM_WIDTH    512                 // Power of two, at most 65536
+
+// Each window is a ring of CM_SLOTS sketches: CM_SLOTS-1 complete time
+// slots plus the current one.
+#define CM_SLOTS    7
+
+#define TOP_SIZE    32                  // Heavy hitters kept per window
+#define TOP_SHOW    10
+#define KEY_MAX     96
+
+typedef struct {
+  guint32 c[CM_DEPTH][CM_WIDTH];
+} sketch_t;
+
+typedef struct {
+  guint64 hash;
+  guint   count;                        // Estimate
+  gchar   key[KEY_MAX];
+} talker_t;
+
+// Min-heap on the estimates
+typedef struct {
+  talker_t e[TOP_SIZE];
+  guint    n;
+} top_t;
+
+enum { TOP_ROOMS, TOP_CONTACTS, TOP_KINDS };
+
+typedef struct {
+  const gchar *name;
+  guint        slot_len;                // seconds
+  gint64       slot;                    // Current slot number
+  sketch_t     sk[CM_SLOTS];
+  top_t        top[TOP_KINDS];
+} window_t;
+
+static window_t windows[] = {
+  { "1m",   60 / (CM_SLOTS-1) },
+  { "10m", 600 / (CM_SLOTS-1) },
+  { "1h", 3600 / (CM_SLOTS-1) },
+};
+
+static inline gint64 now_sec(void)
+{
+  return g_get_monotonic_time() / G_USEC_PER_SEC;
+}
+
+// FNV-1a, then a final mix so that both halves are usable
+static guint64 key_hash(const gchar *key, guint kind)
+{
+  guint64 h = 0xcbf29ce484222325ULL ^ kind;
+
+  for ( ; *key; key++) {
+    h ^= (guchar)*key;
+    h *= 0x100000001b3ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Column of the key in each row: one 16-bit slice of the hash per row
+static inline guint cm_index(guint64 hash, guint row)
+{
+  return (hash >> (16 * row)) & (CM_WIDTH - 1);
+}
+
+// Estimate the count of a key over the window; the sum for each row is
+// stored in sums if it is not NULL
+static guint cm_estimate(const window_t *w, guint64 hash, guint *sums)
+{
+  guint row, slot, est = G_MAXUINT;
+
+  for (row = 0; row < CM_DEPTH; row++) {
+    guint idx = cm_index(hash, row), sum = 0;
+    for (slot = 0; slot < CM_SLOTS; slot++)
+      sum += w->sk[slot].c[row][idx];
+    if (sums)
+      sums[row] = sum;
+    est = MIN(est, sum);
+  }
+  return est;
+}
+
+static void heap_swap(top_t *top, guint a, guint b)
+{
+  talker_t tmp = top->e[a];
+  top->e[a] = top->e[b];
+  top->e[b] = tmp;
+}
+
+static void heap_down(top_t *top, guint i)
+{
+  for (;;) {
+    guint l = 2*i + 1, r = l + 1, min = i;
+    if (l < top->n && top->e[l].count < top->e[min].count)
+      min = l;
+    if (r < top->n && top->e[r].count < top->e[min].count)
+      min = r;
+    if (min == i)
+      return;
+    heap_swap(top, i, min);
+    i = min;
+  }
+}
+
+static void heap_up(top_t *top, guint i)
+{
+  while (i && top->e[i].count < top->e[(i-1)/2].count) {
+    heap_swap(top, i, (i-1)/2);
+    i = (i-1) / 2;
+  }
+}
+
+static void top_update(top_t *top, guint64 hash, const gchar *key, guint est)
+{
+  guint i;
+
+  for (i = 0; i < top->n; i++) {
+    if (top->e[i].hash == hash && !strcmp(top->e[i].key, key)) {
+      top->e[i].count = est;    // Estimates only grow between refreshes
+      heap_down(top, i);
+      return;
+    }
+  }
+
+  if (top->n < TOP_SIZE) {
+    i = top->n++;
+  } else if (est > top->e[0].count) {
+    i = 0;
+  } else {
+    return;
+  }
+  top->e[i].hash  = hash;
+  top->e[i].count = est;
+  g_strlcpy(top->e[i].key, key, KEY_MAX);
+  if (i)
+    heap_up(top, i);
+  else
+    heap_down(top, 0);
+}
+
+// Re-estimate the heavy hitters after slots have expired
+static void top_refresh(window_t *w, top_t *top)
+{
+  guint i, n = 0;
+
+  for (i = 0; i < top->n; i++) {
+    top->e[i].count = cm_estimate(w, top->e[i].hash, NULL);
+    if (top->e[i].count)
+      top->e[n++] = top->e[i];
+  }
+  top->n = n;
+  for (i = n / 2; i-- > 0; )
+    heap_down(top, i);
+}
+
+// Move the window to the current time slot, clearing the expired slots
+static void window_advance(window_t *w, gint64 now)
+{
+  gint64 slot = now / w->slot_len, s;
+  guint k;
+
+  if (slot == w->slot)
+    return;
+  for (s = w->slot + 1, k = 0; s <= slot && k < CM_SLOTS; s++, k++)
+    memset(&w->sk[s % CM_SLOTS], 0, sizeof(sketch_t));
+  w->slot = slot;
+  for (k = 0; k < TOP_KINDS; k++)
+    top_refresh(w, &w->top[k]);
+}
+
+static void window_add(window_t *w, guint kind, const gchar *key,
+                       guint64 hash)
+{
+  sketch_t *sk = &w->sk[w->slot % CM_SLOTS];
+  guint sums[CM_DEPTH], est, row;
+
+  // Conservative update: only raise the rows that give the estimate,
+  // the other ones are already above the new count.
+  est = cm_estimate(w, hash, sums);
+  for (row = 0; row < CM_DEPTH; row++)
+    if (sums[row] == est)
+      sk->c[row][cm_index(hash, row)]++;
+  top_update(&w->top[kind], hash, key, est + 1);
+}
+
+static void count_message(guint kind, const gchar *key, gint64 now)
+{
+  guint64 hash = key_hash(key, kind);
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS(windows); i++) {
+    window_advance(&windows[i], now);
+    window_add(&windows[i], kind, key, hash);
+  }
+}
+
+static guint message_in_hh(const gchar *hookname, hk_arg_t *args,
+                           gpointer userdata)
+{
+  const gchar *jid, *res, *delayed;
+  gint64 now = now_sec();
+  hkargs_t a;
+
+  hkargs_parse(args, HKARG(HKARG_JID) | HKARG(HKARG_RESOURCE) |
+               HKARG(HKARG_GROUPCHAT) | HKARG(HKARG_DELAYED), 0, &a);
+  jid     = hkargs_value(&a, HKARG_JID);
+  res     = hkargs_value(&a, HKARG_RESOURCE);
+  delayed = hkargs_value(&a, HKARG_DELAYED);
+
+  // Room history replayed on join is not traffic
+  if (!jid || (delayed && *delayed))
+    return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+
+  if (hkargs_true(&a, HKARG_GROUPCHAT)) {
+    count_message(TOP_ROOMS, jid, now);
+    if (res && *res) {
+      gchar occupant[KEY_MAX];
+      g_snprintf(occupant, sizeof occupant, "%s/%s", jid, res);
+      count_message(TOP_CONTACTS, occupant, now);
+    }
+  } else {
+    count_message(TOP_CONTACTS, jid, now);
+  }
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static int talker_cmp(const void *a, const void *b)
+{
+  const talker_t *ta = a, *tb = b;
+  return (tb->count > ta->count) - (tb->count < ta->count);
+}
+
+static void show_top(window_t *w, guint kind, gdouble minutes)
+{
+  talker_t sorted[TOP_SIZE];
+  guint i, n = w->top[kind].n;
+
+  scr_log_print(LPRINT_NORMAL, " %s:", kind == TOP_ROOMS ? "Rooms"
+                                                         : "Contacts");
+  if (!n) {
+    scr_log_print(LPRINT_NORMAL, "   (no message)");
+    return;
+  }
+  memcpy(sorted, w->top[kind].e, n * sizeof(talker_t));
+  qsort(sorted, n, sizeof(talker_t), talker_cmp);
+  for (i = 0; i < n && i < TOP_SHOW; i++)
+    scr_log_print(LPRINT_NORMAL, "  %6u  %6.1f/min  %s", sorted[i].count,
+                  sorted[i].count / minutes, sorted[i].key);
+}
+
+static void do_toptalkers(char *args)
+{
+  window_t *w = NULL;
+  gint64 now = now_sec();
+  gdouble minutes;
+  guint i;
+
+  if (!*args)
+    args = "10m";
+  for (i = 0; i < G_N_ELEMENTS(windows); i++)
+    if (!strcmp(args, windows[i].name))
+      w = &windows[i];
+  if (!w) {
+    scr_log_print(LPRINT_NORMAL, "Usage: /toptalkers [1m|10m|1h]");
+    return;
+  }
+
+  window_advance(w, now);
+  // The window spans the complete slots and the current one
+  minutes = ((CM_SLOTS-1) * w->slot_len + now % w->slot_len + 1) / 60.;
+  scr_log_print(LPRINT_NORMAL, "Top talkers, last %s (messages, rate):",
+                w->name);
+  show_top(w, TOP_ROOMS, minutes);
+  show_top(w, TOP_CONTACTS, minutes);
+}
+
+/* Initialization */
+static void toptalkers_init(void)
+{
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  toptalkers_cmdid = cmd_add("toptalkers", "Show the noisiest rooms and "
+                             "contacts", 0, 0, do_toptalkers, NULL);
+#else
+  cmd_add("toptalkers", "Show the noisiest rooms and contacts", 0, 0,
+          do_toptalkers, NULL);
+#endif
+
+  /* Add hook handler */
+  message_in_hid = hk_add_handler(message_in_hh, HOOK_POST_MESSAGE_IN,
+                                  G_PRIORITY_DEFAULT_IDLE, NULL);
+}
+
+/* Uninitialization */
+static void toptalkers_uninit(void)
+{
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(toptalkers_cmdid);
+#else
+  cmd_del("toptalkers");
+#endif
+  hk_del_handler(HOOK_POST_MESSAGE_IN, message_in_hid);
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -0,0 +1,414 @@
+/*
+ *  Module "traffic"    -- Stanza and bandwidth traffic meter
+ *
+ *  Counts the stanzas and bytes by type (message, presence, iq) and
+ *  direction, in one slot per second for the last RING_SECONDS seconds,
+ *  and displays the rates and the busiest seconds with /traffic.
+ *
+ *  The incoming stanzas are counted by Loudmouth handlers, except the
+ *  replies taken by the reply handlers of lm_connection_send_with_reply()
+ *  (which Loudmouth calls first).  Loudmouth does not tell about the
+ *  outgoing stanzas: the messages and presences sent by mcabber are
+ *  counted with the message-out and my-status-change hooks, and the
+ *  stanzas sent by the modules built with --enable-traffic through
+ *  traffic.h (probes, subscription replies, pings...).  Other stanzas
+ *  sent by mcabber (iq replies, room presences...) are not counted.
+ *
+ *  The sizes are computed from the stanza trees, without serializing
+ *  them: the usual attributes and the text are counted, not the
+ *  escaping.
+ *
+ *  /traffic            Display the statistics
+ *  /traffic reset      Reset the counters
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <mcabber/modules.h>
+#include <mcabber/commands.h>
+#include <mcabber/hooks.h>
+#include <mcabber/logprint.h>
+#include <mcabber/xmpp.h>
+
+#define TRAFFIC_MODULE
+#include "common/hkargs.h"
+#include "common/inittime.h"
+#include "common/lmhandler.h"
+#include "common/requires.h"
+#include "hookstats/hookstats.h"
+#include "traffic.h"
+
+static void traffic_init(void);
+static void traffic_uninit(void);
+
+MODULE_TIMED_INIT(traffic_init)
+
+/* Module description */
+module_info_t info_traffic = {
+        .branch         = MCABBER_BRANCH,
+        .api            = MCABBER_API_VERSION,
+        .version        = "0.01",
+        .description    = "Stanza and bandwidth traffic meter\n"
+                          " Provides the command /traffic",
+        .requires       = MODULE_REQUIRES,
+        .init           = traffic_init_timed,
+        .uninit         = traffic_uninit,
+        .next           = NULL,
+};
+
+#ifdef MCABBER_API_HAVE_CMD_ID
+static gpointer traffic_cmdid;
+#endif
+
+#define RING_SECONDS  300
+#define SPIKE_FACTOR  4     // Busiest second vs. average, to be reported
+#define SPIKE_MIN     10    // stanzas
+
+// Approximate size of the XML around a stanza sent by mcabber
+#define MESSAGE_OVERHEAD  60
+#define PRESENCE_OVERHEAD 40
+
+enum { DIR_IN, DIR_OUT, NDIRS };
+enum { T_MESSAGE, T_PRESENCE, T_IQ, T_OTHER, NTYPES };
+
+static const gchar * const dir_names[NDIRS] = { "in", "out" };
+static const gchar * const type_names[NTYPES] = {
+  "message", "presence", "iq", "other"
+};
+
+typedef struct {
+  guint32 stanzas;
+  guint32 bytes;
+} count_t;
+
+typedef struct {
+  gint64  sec;
+  count_t c[NDIRS][NTYPES];
+} slot_t;
+
+static slot_t ring[RING_SECONDS];
+static struct {
+  guint64 stanzas;
+  guint64 bytes;
+} total[NDIRS][NTYPES];
+static gint64 start_sec;
+
+// First, so that the stanzas dropped by other handlers are counted
+static lmhandler_t handlers[T_OTHER] = {
+  LMHANDLER(LM_MESSAGE_TYPE_MESSAGE,  LM_HANDLER_PRIORITY_FIRST),
+  LMHANDLER(LM_MESSAGE_TYPE_PRESENCE, LM_HANDLER_PRIORITY_FIRST),
+  LMHANDLER(LM_MESSAGE_TYPE_IQ,       LM_HANDLER_PRIORITY_FIRST),
+};
+static guint message_out_hid, my_status_hid;
+static guint post_connect_hid, pre_disconnect_hid;
+
+static inline gint64 now_sec(void)
+{
+  return g_get_monotonic_time() / G_USEC_PER_SEC;
+}
+
+static inline void count(guint dir, guint type, gsize bytes)
+{
+  gint64 sec = now_sec();
+  slot_t *s = &ring[sec % RING_SECONDS];
+
+  if (s->sec != sec) {
+    memset(s->c, 0, sizeof s->c);
+    s->sec = sec;
+  }
+  s->c[dir][type].stanzas++;
+  s->c[dir][type].bytes += bytes;
+  total[dir][type].stanzas++;
+  total[dir][type].bytes += bytes;
+}
+
+static gsize attr_size(LmMessageNode *node, const gchar *name)
+{
+  const gchar *value = lm_message_node_get_attribute(node, name);
+
+  return value ? strlen(name) + strlen(value) + 4 : 0;
+}
+
+// <name attr="value"...>value children</name>
+static gsize node_size(LmMessageNode *node, gboolean top)
+{
+  gsize len = strlen(node->name), size;
+  LmMessageNode *child;
+
+  size = attr_size(node, "xmlns");
+  if (top)
+    size += attr_size(node, "to") + attr_size(node, "from") +
+            attr_size(node, "id") + attr_size(node, "type");
+  if (!node->value && !node->children)
+    return size + len + 3;
+  size += 2 * len + 5;
+  if (node->value)
+    size += strlen(node->value);
+  for (child = node->children; child; child = child->next)
+    size += node_size(child, FALSE);
+  return size;
+}
+
+static void count_message(guint dir, LmMessage *m)
+{
+  guint type;
+
+  switch (lm_message_get_type(m)) {
+    case LM_MESSAGE_TYPE_MESSAGE:
+        type = T_MESSAGE;
+        break;
+    case LM_MESSAGE_TYPE_PRESENCE:
+        type = T_PRESENCE;
+        break;
+    case LM_MESSAGE_TYPE_IQ:
+        type = T_IQ;
+        break;
+    default:
+        type = T_OTHER;
+  }
+  count(dir, type, node_size(m->node, TRUE));
+}
+
+/* Outgoing stanzas of the modules (traffic.h) */
+
+gboolean traffic_send(LmConnection *connection, LmMessage *message,
+                      GError **error)
+{
+  gboolean ret = lm_connection_send(connection, message, error);
+
+  if (ret)
+    count_message(DIR_OUT, message);
+  return ret;
+}
+
+gboolean traffic_send_with_reply(LmConnection *connection,
+                                 LmMessage *message,
+                                 LmMessageHandler *handler, GError **error)
+{
+  gboolean ret = lm_connection_send_with_reply(connection, message, handler,
+                                               error);
+
+  if (ret)
+    count_message(DIR_OUT, message);
+  return ret;
+}
+
+void traffic_send_s10n(const char *bjid, LmMessageSubType type)
+{
+  xmpp_send_s10n(bjid, type);
+  if (xmpp_is_online())
+    count(DIR_OUT, T_PRESENCE, PRESENCE_OVERHEAD + strlen(bjid));
+}
+
+/* Handlers */
+
+static LmHandlerResult stanza_cb(LmMessageHandler *h, LmConnection *c,
+                                 LmMessage *m, gpointer user_data)
+{
+  count_message(DIR_IN, m);
+  return LM_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static guint message_out_hh(const gchar *hookname, hk_arg_t *args,
+                            gpointer userdata)
+{
+  const gchar *jid, *msg;
+  hkargs_t a;
+
+  hkargs_parse(args, HKARG(HKARG_JID) | HKARG(HKARG_MESSAGE), 0, &a);
+  jid = hkargs_value(&a, HKARG_JID);
+  msg = hkargs_value(&a, HKARG_MESSAGE);
+  count(DIR_OUT, T_MESSAGE, MESSAGE_OVERHEAD + (jid ? strlen(jid) : 0) +
+                            (msg ? strlen(msg) : 0));
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static guint my_status_hh(const gchar *hookname, hk_arg_t *args,
+                          gpointer userdata)
+{
+  const gchar *msg;
+  hkargs_t a;
+
+  hkargs_parse(args, HKARG(HKARG_MESSAGE), 0, &a);
+  msg = hkargs_value(&a, HKARG_MESSAGE);
+  count(DIR_OUT, T_PRESENCE, PRESENCE_OVERHEAD + (msg ? strlen(msg) : 0));
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+// A new connection each time
+static guint post_connect_hh(const gchar *hookname, hk_arg_t *args,
+                             gpointer userdata)
+{
+  guint type;
+
+  for (type = 0; type < T_OTHER; type++)
+    lmhandler_attach(&handlers[type]);
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+static guint pre_disconnect_hh(const gchar *hookname, hk_arg_t *args,
+                               gpointer userdata)
+{
+  guint type;
+
+  for (type = 0; type < T_OTHER; type++)
+    lmhandler_detach(&handlers[type]);
+  return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS;
+}
+
+/* Command */
+
+static void format_bytes(gchar *buf, gsize size, gdouble bytes)
+{
+  if (bytes < 10000)
+    snprintf(buf, size, "%.0fB", bytes);
+  else if (bytes < 10000 * 1024.)
+    snprintf(buf, size, "%.0fKB", bytes / 1024);
+  else
+    snprintf(buf, size, "%.0fMB", bytes / (1024 * 1024.));
+}
+
+// Stanzas and bytes per second over the last seconds
+static void rate(guint dir, guint type, gint64 now, gint64 seconds,
+                 gdouble *stanzas, gdouble *bytes)
+{
+  guint64 n = 0, b = 0;
+  gint64 sec;
+
+  seconds = MIN(seconds, now - start_sec + 1);
+  for (sec = now - seconds + 1; sec <= now; sec++) {
+    const slot_t *s = &ring[sec % RING_SECONDS];
+    if (s->sec == sec) {
+      n += s->c[dir][type].stanzas;
+      b += s->c[dir][type].bytes;
+    }
+  }
+  *stanzas = (gdouble)n / seconds;
+  *bytes   = (gdouble)b / seconds;
+}
+
+static void do_traffic(char *args)
+{
+  gint64 now = now_sec();
+  guint dir, type;
+  gboolean any = FALSE;
+
+  if (args && !strcmp(args, "reset")) {
+    memset(ring, 0, sizeof ring);
+    memset(total, 0, sizeof total);
+    start_sec = now;
+    scr_log_print(LPRINT_NORMAL, "traffic: counters reset.");
+    return;
+  }
+  if (args && *args) {
+    scr_log_print(LPRINT_NORMAL, "Usage: /traffic [reset]");
+    return;
+  }
+
+  for (dir = 0; dir < NDIRS; dir++) {
+    for (type = 0; type < NTYPES; type++) {
+      gchar tb[16], b10[16], b300[16], spike[64] = "";
+      gdouble n10, by10, n300, by300;
+      guint32 peak = 0;
+      gint64 sec, peak_sec = 0;
+
+      if (!total[dir][type].stanzas)
+        continue;
+      any = TRUE;
+      rate(dir, type, now, 10, &n10, &by10);
+      rate(dir, type, now, RING_SECONDS, &n300, &by300);
+
+      // Busiest second
+      for (sec = now - RING_SECONDS + 1; sec <= now; sec++) {
+        const slot_t *s = &ring[sec % RING_SECONDS];
+        if (s->sec == sec && s->c[dir][type].stanzas > peak) {
+          peak = s->c[dir][type].stanzas;
+          peak_sec = sec;
+        }
+      }
+      if (peak >= SPIKE_MIN && peak > SPIKE_FACTOR * n300)
+        snprintf(spike, sizeof spike, ", spike %u/s %" G_GINT64_FORMAT
+                 "s ago", peak, now - peak_sec);
+
+      format_bytes(tb, sizeof tb, total[dir][type].bytes);
+      format_bytes(b10, sizeof b10, by10);
+      format_bytes(b300, sizeof b300, by300);
+      scr_log_print(LPRINT_NORMAL, "traffic: %-3s %-8s %" G_GUINT64_FORMAT
+                    " (%s); 10s: %.1f/s %s/s; %us: %.1f/s %s/s%s",
+                    dir_names[dir], type_names[type],
+                    total[dir][type].stanzas, tb, n10, b10, RING_SECONDS,
+                    n300, b300, spike);
+    }
+  }
+  if (!any)
+    scr_log_print(LPRINT_NORMAL, "traffic: no stanza yet.");
+}
+
+/* Initialization */
+static void traffic_init(void)
+{
+  guint type;
+
+  /* Add command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  traffic_cmdid = cmd_add("traffic", "Stanza traffic meter", 0, 0,
+                          do_traffic, NULL);
+#else
+  cmd_add("traffic", "Stanza traffic meter", 0, 0, do_traffic, NULL);
+#endif
+
+  start_sec = now_sec();
+  // On the current connection, if any, and on the next ones.  Loudmouth
+  // runs the last handler registered first: attach after the other
+  // modules (G_PRIORITY_LOW).
+  for (type = 0; type < T_OTHER; type++) {
+    lmhandler_new(&handlers[type], stanza_cb, NULL);
+    lmhandler_attach(&handlers[type]);
+  }
+  post_connect_hid = hk_add_handler(post_connect_hh, HOOK_POST_CONNECT,
+                                    G_PRIORITY_LOW, NULL);
+  pre_disconnect_hid = hk_add_handler(pre_disconnect_hh, HOOK_PRE_DISCONNECT,
+                                      G_PRIORITY_DEFAULT_IDLE, NULL);
+  message_out_hid = hk_add_handler(message_out_hh, HOOK_MESSAGE_OUT,
+                                   G_PRIORITY_DEFAULT_IDLE, NULL);
+  my_status_hid = hk_add_handler(my_status_hh, HOOK_MY_STATUS_CHANGE,
+                                 G_PRIORITY_DEFAULT_IDLE, NULL);
+}
+
+/* Uninitialization */
+static void traffic_uninit(void)
+{
+  guint type;
+
+  /* Unregister command */
+#ifdef MCABBER_API_HAVE_CMD_ID
+  cmd_del(traffic_cmdid);
+#else
+  cmd_del("traffic");
+#endif
+
+  hk_del_handler(HOOK_POST_CONNECT, post_connect_hid);
+  hk_del_handler(HOOK_PRE_DISCONNECT, pre_disconnect_hid);
+  for (type = 0; type < T_OTHER; type++)
+    lmhandler_free(&handlers[type]);
+  hk_del_handler(HOOK_MESSAGE_OUT, message_out_hid);
+  hk_del_handler(HOOK_MY_STATUS_CHANGE, my_status_hid);
+  memset(ring, 0, sizeof ring);
+  memset(total, 0, sizeof total);
+}
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -0,0 +1,46 @@
+/*
+ *  traffic.h       -- Stanzas sent by the modules, for the traffic module
+ *
+ *  Loudmouth has no handler for the outgoing stanzas.  When the modules
+ *  are built with --enable-traffic (MODULES_TRAFFIC), this header
+ *  replaces the sending functions of the modules which include it with
+ *  wrappers which count the stanzas sent, in the traffic module.
+ *  Modules including it must set ".requires = MODULE_REQUIRES" in their
+ *  module description (see common/requires.h), and include it after the
+ *  mcabber and Loudmouth headers.
+ *
+ * This module is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRAFFIC_H__
+#define __TRAFFIC_H__ 1
+
+#include <mcabber/xmpp.h>
+
+gboolean traffic_send(LmConnection *connection, LmMessage *message,
+                      GError **error);
+gboolean traffic_send_with_reply(LmConnection *connection,
+                                 LmMessage *message,
+                                 LmMessageHandler *handler, GError **error);
+void     traffic_send_s10n(const char *bjid, LmMessageSubType type);
+
+#if defined MODULES_TRAFFIC && !defined TRAFFIC_MODULE
+# define lm_connection_send             traffic_send
+# define lm_connection_send_with_reply  traffic_send_with_reply
+# define xmpp_send_s10n                 traffic_send_s10n
+#endif
+
+#endif /* __TRAFFIC_H__ */
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */